@@ -0,0 +1,142 @@
+#include "acquire.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+/**
+
+	Acquisition thread for Music Bottles
+
+	The ring is single-producer/single-consumer: only the acquisition thread
+	writes head, only the detection loop writes tail. Indices run freely and are
+	masked on access, so head - tail is always the fill level.
+
+*/
+
+static SampleRing ring;
+static pthread_t acquireThread;
+static int finished = 0;  // set once the source has no more samples
+
+void ringInit(SampleRing *r) {
+	r->head = 0;
+	r->tail = 0;
+	r->dropped = 0;
+}
+
+/**
+ ringPush(r, s)
+
+ producer side: returns 1 if the sample was queued, 0 if the ring was full (sample dropped)
+*/
+int ringPush(SampleRing *r, const Sample *s) {
+	uint32_t head = r->head;
+	uint32_t tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+
+	if (head - tail >= SAMPLE_RING_SIZE) {
+		__atomic_add_fetch(&r->dropped, 1, __ATOMIC_RELAXED);
+		return 0;
+	}
+
+	r->buf[head & (SAMPLE_RING_SIZE - 1)] = *s;
+	__atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+	return 1;
+}
+
+/**
+ ringPop(r, s)
+
+ consumer side: returns 1 and fills s if a sample was available, 0 if the ring was empty
+*/
+int ringPop(SampleRing *r, Sample *s) {
+	uint32_t tail = r->tail;
+	uint32_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+
+	if (head == tail) return 0;
+
+	*s = r->buf[tail & (SAMPLE_RING_SIZE - 1)];
+	__atomic_store_n(&r->tail, tail + 1, __ATOMIC_RELEASE);
+	return 1;
+}
+
+static int ringFull(SampleRing *r) {
+	return r->head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) >= SAMPLE_RING_SIZE;
+}
+
+static void *acquireLoop(void *arg) {
+	Sample s;
+	int paced = sourceIsPaced();
+	int result;
+
+	(void) arg;
+
+	// Failed reads have already backed off inside the source, keep trying until it ends
+	while ((result = sourceRead(&s)) != SOURCE_END) {
+		if (result != SOURCE_OK) continue;
+
+		// Real-time sources drop on overflow, unpaced replays wait for the consumer
+		while (!paced && ringFull(&ring)) {
+			usleep(ACQUIRE_FULL_WAIT_US);
+		}
+		ringPush(&ring, &s);
+	}
+
+	__atomic_store_n(&finished, 1, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+/**
+ startAcquisition(int priority)
+
+ start the acquisition thread at the given SCHED_FIFO priority (0 for normal scheduling),
+ falling back to normal scheduling if that is not permitted. sourceOpen() must have been called first.
+*/
+int startAcquisition(int priority) {
+	pthread_attr_t attr;
+	struct sched_param sched;
+
+	ringInit(&ring);
+
+	if (priority <= 0) {
+		if (pthread_create(&acquireThread, NULL, acquireLoop, NULL) != 0) {
+			printf("Error starting acquisition thread\n");
+			return -1;
+		}
+		return 0;
+	}
+
+	pthread_attr_init(&attr);
+	pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+	pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+	memset(&sched, 0, sizeof(sched));
+	sched.sched_priority = priority;
+	pthread_attr_setschedparam(&attr, &sched);
+
+	if (pthread_create(&acquireThread, &attr, acquireLoop, NULL) != 0) {
+		printf("Warning: Unable to start real-time acquisition thread, using normal priority\n");
+		if (pthread_create(&acquireThread, NULL, acquireLoop, NULL) != 0) {
+			printf("Error starting acquisition thread\n");
+			pthread_attr_destroy(&attr);
+			return -1;
+		}
+	}
+
+	pthread_attr_destroy(&attr);
+	return 0;
+}
+
+// Non-blocking: returns 1 and fills s if a sample is waiting
+int acquireSample(Sample *s) {
+	return ringPop(&ring, s);
+}
+
+uint32_t acquireDropped(void) {
+	return __atomic_load_n(&ring.dropped, __ATOMIC_RELAXED);
+}
+
+// True once the source is exhausted and every queued sample has been drained
+int acquireFinished(void) {
+	return __atomic_load_n(&finished, __ATOMIC_ACQUIRE) &&
+	       __atomic_load_n(&ring.head, __ATOMIC_ACQUIRE) == ring.tail;
+}
@@ -0,0 +1,43 @@
+/**
+
+	Acquisition thread for Music Bottles
+
+	Conversions from the active sample source (see source.h) are read on their
+	own SCHED_FIFO thread and handed to
+	the detection loop through a single-producer/single-consumer lock-free
+	ring, so no conversion is missed while the main loop is busy or sleeping.
+
+*/
+
+#ifndef ACQUIRE_H
+#define ACQUIRE_H
+
+#include <stdint.h>
+#include "source.h"
+
+// Ring capacity in samples, must be a power of two
+#define SAMPLE_RING_SIZE 256
+
+// Priority of the acquisition thread (main process runs at 10, see setHighPri())
+#define ACQUIRE_PRIORITY 20
+
+// How long the acquisition thread waits for the consumer when an unpaced source fills the ring
+#define ACQUIRE_FULL_WAIT_US 200
+
+typedef struct {
+	Sample   buf[SAMPLE_RING_SIZE];
+	uint32_t head;     // next slot to write, owned by the producer
+	uint32_t tail;     // next slot to read, owned by the consumer
+	uint32_t dropped;  // samples lost because the ring was full
+} SampleRing;
+
+void     ringInit(SampleRing *r);
+int      ringPush(SampleRing *r, const Sample *s);
+int      ringPop(SampleRing *r, Sample *s);
+
+int      startAcquisition(int priority);
+int      acquireSample(Sample *s);
+uint32_t acquireDropped(void);
+int      acquireFinished(void);
+
+#endif
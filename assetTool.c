@@ -0,0 +1,86 @@
+/**
+
+Music Bottles v4 by Tal Achituv
+
+Asset compiler, converts the WAV files musicBottles plays into its asset cache (see assets.h)
+
+Usage: assetTool [-r rate] [-d dir] [-o cache] [build|check]
+
+  -r rate   output rate to convert to (default OUTPUT_RATE, what every output opens at)
+  -d dir    where the WAV files are (default ASSETS_DIR)
+  -o cache  cache file (default ASSETS_PATH)
+
+  build     convert every WAV file in dir into the cache, then list it (default)
+  check     check the cache against dir the way musicBottles does, then hash every source
+            to find files replaced with the same size and time, and list it
+
+musicBottles rebuilds a stale cache by itself in the background; this builds it ahead of time,
+e.g. right after copying new tracks, so the next start is instant.
+
+*/
+
+#include "assets.h"
+#include "output.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static double dbfs(double level) {
+	return (level > 0) ? 20 * log10(level) : -INFINITY;
+}
+
+static void list(const Assets *a) {
+	const AssetHeader *h = a->header;
+
+	printf("%u stems, %u Hz 16-bit stereo, %.1f MB, build %016llx\n",
+	       h->count, h->rate, a->size / 1048576.0, (unsigned long long) h->hash);
+	printf("%-24s %9s %9s %8s %8s  %s\n", "source", "length", "loop", "peak", "rms", "source hash");
+	for (int i = 0; i < h->count; i++) {
+		const AssetEntry *e = &a->entry[i];
+		if (e->frames == 0) {
+			printf("%-24s %9s  not converted, loaded from the file\n", e->name, "-");
+			continue;
+		}
+		printf("%-24s %8.1fs %8.1fs %5.1fdB %5.1fdB  %016llx\n", e->name, (double) e->frames / h->rate,
+		       (double) e->loopStart / h->rate, dbfs(e->peak / 32768.0), dbfs(e->rms), (unsigned long long) e->hash);
+	}
+}
+
+int main(int argc, char **argv) {
+	const char *dir = ASSETS_DIR, *path = ASSETS_PATH, *mode = "build";
+	int rate = OUTPUT_RATE, opt;
+	Assets assets;
+
+	while ((opt = getopt(argc, argv, "r:d:o:")) != -1) {
+		if (opt == 'r') rate = atoi(optarg);
+		else if (opt == 'd') dir = optarg;
+		else if (opt == 'o') path = optarg;
+		else argc = 0;
+	}
+	if (optind < argc) mode = argv[optind];
+
+	if (argc == 0 || rate <= 0 || (strcmp(mode, "build") != 0 && strcmp(mode, "check") != 0)) {
+		printf("Usage: assetTool [-r rate] [-d dir] [-o cache] [build|check]\n");
+		return -1;
+	}
+
+	if (strcmp(mode, "build") == 0) {
+		printf("Converting %s/*.wav to %d Hz...\n", dir, rate);
+		if (assetsBuild(dir, path, rate) < 0) {
+			printf("Error: %s\n", assetsError());
+			return 1;
+		}
+	}
+
+	if (assetsOpen(&assets, dir, path, rate) < 0 || (strcmp(mode, "check") == 0 && assetsVerify(&assets, dir) < 0)) {
+		printf("Stale: %s\n", assetsError());
+		assetsClose(&assets);
+		return 1;
+	}
+	printf("%s: ", path);
+	list(&assets);
+	assetsClose(&assets);
+	return 0;
+}
@@ -0,0 +1,370 @@
+#define _GNU_SOURCE  // SCHED_IDLE
+#include "assets.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+
+	Asset cache for Music Bottles
+
+	Layout: the header, the table of ASSETS_MAX entries at most, then every
+	stem's interleaved samples at an ASSETS_ALIGN boundary. The cache is
+	written to a temporary file and renamed over the old one, so a reader
+	sees either cache whole, and a build that is cut short leaves nothing.
+
+*/
+
+#define FNV_OFFSET 1469598103934665603ULL
+#define FNV_PRIME  1099511628211ULL
+
+static __thread char errorMessage[200];
+
+static int fail(const char *format, ...) {
+	va_list args;
+	va_start(args, format);
+	vsnprintf(errorMessage, sizeof(errorMessage), format, args);
+	va_end(args);
+	return -1;
+}
+
+// Why the last build or open failed
+const char *assetsError(void) {
+	return errorMessage;
+}
+
+static uint64_t fnv(const void *data, size_t n, uint64_t hash) {
+	const uint8_t *p = (const uint8_t *) data;
+	for (size_t i = 0; i < n; i++) hash = (hash ^ p[i]) * FNV_PRIME;
+	return hash;
+}
+
+static int isWav(const struct dirent *d) {
+	size_t n = strlen(d->d_name);
+	return n > 4 && strcmp(d->d_name + n - 4, ".wav") == 0 && n < ASSETS_NAME;
+}
+
+// The WAV files in dir, sorted, -1 on error
+static int listSources(const char *dir, struct dirent ***list) {
+	int n = scandir(dir, list, isWav, alphasort);
+	if (n < 0) return fail("cannot list %s: %s", dir, strerror(errno));
+	return n;
+}
+
+static void freeSources(struct dirent **list, int n) {
+	for (int i = 0; i < n; i++) free(list[i]);
+	free(list);
+}
+
+static uint64_t align(uint64_t offset) {
+	return (offset + ASSETS_ALIGN - 1) & ~(uint64_t) (ASSETS_ALIGN - 1);
+}
+
+// Hash of every stem's content hash in order, identifies the build
+static uint64_t buildHash(const AssetEntry *entry, int n) {
+	uint64_t hash = FNV_OFFSET;
+
+	for (int i = 0; i < n; i++) hash = fnv(&entry[i].hash, sizeof(entry[i].hash), hash);
+	return hash;
+}
+
+// Convert one source and append it at e->offset, an unconvertible source is listed with no frames
+static int addStem(FILE *f, const char *dir, const char *name, int rate, AssetEntry *e) {
+	char path[512];
+	struct stat st;
+	uint8_t *file;
+	size_t size;
+	Pcm pcm;
+	double sum = 0;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	snprintf(e->name, sizeof(e->name), "%s", name);
+	if (stat(path, &st) < 0 || (file = wavRead(path, &size)) == NULL) return fail("cannot read %s", path);
+	e->sourceSize = st.st_size;
+	e->sourceTime = st.st_mtime;
+	e->hash = fnv(file, size, FNV_OFFSET);
+
+	if (wavDecode(path, file, size, rate, &pcm) < 0) {
+		printf("Asset cache: %s, loaded from the file instead\n", wavError());
+		free(file);
+		return 0;
+	}
+	free(file);
+
+	for (uint32_t i = 0; i < 2 * pcm.frames; i++) {
+		uint32_t magnitude = (uint32_t) abs(pcm.data[i]);
+		if (magnitude > e->peak) e->peak = magnitude;
+		sum += (double) pcm.data[i] * pcm.data[i];
+	}
+	e->frames = pcm.frames;
+	e->loopStart = pcm.loopStart;
+	e->rms = pcm.frames ? (float) (sqrt(sum / (2.0 * pcm.frames)) / 32768.0) : 0;
+
+	if (fseek(f, (long) e->offset, SEEK_SET) < 0 ||
+	    fwrite(pcm.data, 2 * sizeof(int16_t), pcm.frames, f) != pcm.frames) {
+		wavFree(&pcm);
+		return fail("cannot write the stem of %s", name);
+	}
+	wavFree(&pcm);
+	return 0;
+}
+
+/**
+ assetsBuild(const char *dir, const char *path, int rate)
+
+ convert every WAV file in dir to stereo at rate into the cache at path, replacing it once it is
+ complete. Returns -1 on error, assetsError() says why
+*/
+int assetsBuild(const char *dir, const char *path, int rate) {
+	AssetHeader header;
+	AssetEntry entry[ASSETS_MAX];
+	struct dirent **list;
+	char temp[512];
+	uint64_t offset;
+	FILE *f;
+	int n, i, result = 0;
+
+	if ((n = listSources(dir, &list)) < 0) return -1;
+	if (n > ASSETS_MAX) {
+		freeSources(list, n);
+		return fail("more than %d WAV files in %s", ASSETS_MAX, dir);
+	}
+
+	snprintf(temp, sizeof(temp), "%s.tmp", path);
+	f = fopen(temp, "wb");
+	if (f == NULL) {
+		freeSources(list, n);
+		return fail("cannot create %s: %s", temp, strerror(errno));
+	}
+
+	memset(&header, 0, sizeof(header));
+	memset(entry, 0, sizeof(entry));
+	offset = align(sizeof(header) + n * sizeof(AssetEntry));
+	for (i = 0; i < n && result == 0; i++) {
+		entry[i].offset = offset;
+		result = addStem(f, dir, list[i]->d_name, rate, &entry[i]);
+		offset = align(offset + (uint64_t) entry[i].frames * 2 * sizeof(int16_t));
+	}
+	freeSources(list, n);
+
+	memcpy(header.magic, ASSETS_MAGIC, sizeof(header.magic));
+	header.version = ASSETS_VERSION;
+	header.byteOrder = ASSETS_NATIVE;
+	header.count = (uint16_t) n;
+	header.rate = (uint32_t) rate;
+	header.channels = 2;
+	header.bits = 16;
+	header.hash = buildHash(entry, n);
+	header.tableHash = fnv(entry, n * sizeof(AssetEntry), FNV_OFFSET);
+
+	// The last stem is padded to a whole page too, so every one can be mapped in whole pages
+	if (result == 0 && (fseek(f, 0, SEEK_SET) < 0 || fwrite(&header, sizeof(header), 1, f) != 1 ||
+	                    fwrite(entry, sizeof(AssetEntry), n, f) != (size_t) n || ftruncate(fileno(f), (off_t) offset) < 0 ||
+	                    fflush(f) != 0 || fsync(fileno(f)) < 0)) {
+		result = fail("cannot write %s: %s", temp, strerror(errno));
+	}
+	if (fclose(f) != 0 && result == 0) result = fail("cannot write %s: %s", temp, strerror(errno));
+
+	if (result == 0 && rename(temp, path) < 0) result = fail("cannot replace %s: %s", path, strerror(errno));
+	if (result < 0) remove(temp);
+	return result;
+}
+
+// Content hash of a source file, -1 if it cannot be read
+static int hashSource(const char *path, uint64_t *hash) {
+	size_t size;
+	uint8_t *file = wavRead(path, &size);
+
+	if (file == NULL) return -1;
+	*hash = fnv(file, size, FNV_OFFSET);
+	free(file);
+	return 0;
+}
+
+/**
+ checkSources(const Assets *a, const char *dir, int deep)
+
+ the cache against its sources: same files, none changed since it was built. A source with another
+ size has changed; one with another modification time, or every one if deep, is hashed and has
+ changed if its content hash differs
+*/
+static int checkSources(const Assets *a, const char *dir, int deep) {
+	struct dirent **list;
+	int n, i, result = 0;
+
+	if ((n = listSources(dir, &list)) < 0) return -1;
+	if (n != a->header->count) result = fail("%d WAV files in %s, the cache has %d", n, dir, a->header->count);
+
+	for (i = 0; i < n && result == 0; i++) {
+		const AssetEntry *e = &a->entry[i];
+		char path[512];
+		struct stat st;
+
+		snprintf(path, sizeof(path), "%s/%s", dir, list[i]->d_name);
+		if (strncmp(e->name, list[i]->d_name, ASSETS_NAME) != 0) {
+			result = fail("%s is not in the cache", list[i]->d_name);
+		} else if (stat(path, &st) < 0 || st.st_size != e->sourceSize) {
+			result = fail("%s changed", e->name);
+		} else if (deep || st.st_mtime != e->sourceTime) {
+			uint64_t hash;
+			if (hashSource(path, &hash) < 0 || hash != e->hash) result = fail("%s changed", e->name);
+		}
+	}
+	freeSources(list, n);
+	return result;
+}
+
+/**
+ assetsOpen(Assets *a, const char *dir, const char *path, int rate)
+
+ map the cache at path and check it against the WAV files in dir and the output rate. Returns -1 if
+ it is missing, malformed or stale, assetsError() says why
+*/
+int assetsOpen(Assets *a, const char *dir, const char *path, int rate) {
+	const AssetHeader *h;
+	struct stat st;
+	int fd, i;
+
+	memset(a, 0, sizeof(*a));
+	fd = open(path, O_RDONLY);
+	if (fd < 0) return fail("no cache at %s", path);
+	if (fstat(fd, &st) < 0 || (size_t) st.st_size < sizeof(AssetHeader)) {
+		close(fd);
+		return fail("%s is truncated", path);
+	}
+	a->size = (size_t) st.st_size;
+	a->map = mmap(NULL, a->size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (a->map == MAP_FAILED) {
+		a->map = NULL;
+		return fail("cannot map %s: %s", path, strerror(errno));
+	}
+
+	h = a->header = (const AssetHeader *) a->map;
+	a->entry = (const AssetEntry *) (a->map + sizeof(AssetHeader));
+	if (memcmp(h->magic, ASSETS_MAGIC, sizeof(h->magic)) != 0 || h->version != ASSETS_VERSION ||
+	    h->byteOrder != ASSETS_NATIVE || h->channels != 2 || h->bits != 16 || h->count > ASSETS_MAX ||
+	    a->size < sizeof(AssetHeader) + h->count * sizeof(AssetEntry) ||
+	    fnv(a->entry, h->count * sizeof(AssetEntry), FNV_OFFSET) != h->tableHash ||
+	    buildHash(a->entry, h->count) != h->hash) {
+		assetsClose(a);
+		return fail("%s is not a cache this build can read", path);
+	}
+	if (h->rate != (uint32_t) rate) {
+		fail("%s was made for %u Hz", path, h->rate);
+		assetsClose(a);
+		return -1;
+	}
+	for (i = 0; i < h->count; i++) {
+		const AssetEntry *e = &a->entry[i];
+		if (e->offset % ASSETS_ALIGN || e->offset + (uint64_t) e->frames * 2 * sizeof(int16_t) > a->size ||
+		    (e->frames && e->loopStart >= e->frames)) {
+			assetsClose(a);
+			return fail("%s is corrupt", path);
+		}
+	}
+
+	if (checkSources(a, dir, 0) < 0) {
+		assetsClose(a);
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ assetsVerify(const Assets *a, const char *dir)
+
+ hash every source of an open cache against the hash it was built from, which finds a file replaced
+ with one of the same size and time (cp -p, rsync -t). Returns -1 if one differs, assetsError() says which
+*/
+int assetsVerify(const Assets *a, const char *dir) {
+	return checkSources(a, dir, 1);
+}
+
+// The samples of a source in the cache, by file name. Returns its index, -1 if it is not there
+int assetsFind(const Assets *a, const char *name, Pcm *pcm) {
+	if (a->map == NULL) return -1;
+	for (int i = 0; i < a->header->count; i++) {
+		const AssetEntry *e = &a->entry[i];
+		if (e->frames == 0 || strncmp(e->name, name, ASSETS_NAME) != 0) continue;
+
+		memset(pcm, 0, sizeof(*pcm));
+		pcm->data = (int16_t *) (a->map + e->offset);
+		pcm->frames = e->frames;
+		pcm->rate = (int) a->header->rate;
+		pcm->loopStart = e->loopStart;
+		pcm->mapped = 1;
+		return i;
+	}
+	return -1;
+}
+
+void assetsClose(Assets *a) {
+	if (a->map) munmap(a->map, a->size);
+	memset(a, 0, sizeof(*a));
+}
+
+// Background rebuild, at most one per run
+typedef struct {
+	char dir[256], path[256];
+	int  rate;
+} Rebuild;
+
+static Rebuild rebuild;
+static int rebuildStarted = 0;
+
+static void *rebuildLoop(void *arg) {
+	const Rebuild *r = (const Rebuild *) arg;
+
+	if (assetsBuild(r->dir, r->path, r->rate) == 0) {
+		printf("\nAsset cache %s rebuilt, used from the next start\n", r->path);
+	} else {
+		printf("\nAsset cache not rebuilt: %s\n", assetsError());
+	}
+	return NULL;
+}
+
+/**
+ assetsRebuild(const char *dir, const char *path, int rate)
+
+ build the cache on a detached thread at idle priority, the first time only. Returns -1 if the
+ thread could not be started
+*/
+int assetsRebuild(const char *dir, const char *path, int rate) {
+	pthread_t thread;
+	pthread_attr_t attr;
+	struct sched_param sched;
+	int result;
+
+	if (rebuildStarted) return 0;
+	rebuildStarted = 1;
+	snprintf(rebuild.dir, sizeof(rebuild.dir), "%s", dir);
+	snprintf(rebuild.path, sizeof(rebuild.path), "%s", path);
+	rebuild.rate = rate;
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+	pthread_attr_setschedpolicy(&attr, SCHED_IDLE);
+	memset(&sched, 0, sizeof(sched));
+	pthread_attr_setschedparam(&attr, &sched);
+
+	result = pthread_create(&thread, &attr, rebuildLoop, &rebuild);
+	if (result != 0) {
+		pthread_attr_setinheritsched(&attr, PTHREAD_INHERIT_SCHED);
+		result = pthread_create(&thread, &attr, rebuildLoop, &rebuild);
+	}
+	pthread_attr_destroy(&attr);
+	if (result != 0) return fail("cannot start the rebuild thread");
+	return 0;
+}
@@ -0,0 +1,84 @@
+/**
+
+	Asset cache for Music Bottles
+
+	Every WAV file in ASSETS_DIR is converted once into a single cache file
+	in the device's own format: 16-bit stereo at the output rate in native
+	byte order, each stem starting on a page so it can be played in place
+	from the mapping (see stream.h). With it, startup reads a header and a
+	table, stats the sources and maps the file, in milliseconds, whatever
+	the size or format of the sources.
+
+	The cache records for every stem the source's name, size, modification
+	time and FNV-1a content hash, the loop start (from a smpl chunk, see
+	wav.h), and the converted stem's peak and RMS. It is stale if the output
+	rate differs, if a WAV file was added or removed, or if the table does
+	not match its own hash. A source has changed if its size differs, or if
+	its modification time differs and so does its content hash; startup
+	hashes nothing else, so a file replaced with one of the same size and
+	time (cp -p, rsync -t) is only found by assetsVerify(), which hashes
+	every source (assetTool check). A stale or missing cache is rebuilt
+	once in the background, at idle priority, while the WAV files are used
+	directly; the new cache replaces the old one atomically and is used from
+	the next start. assetTool builds and checks it by hand.
+
+	Sources that cannot be converted are still listed, with no frames, so
+	they do not make the cache stale: they are loaded as before.
+
+*/
+
+#ifndef ASSETS_H
+#define ASSETS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "wav.h"
+
+#define ASSETS_DIR     "music-files"
+#define ASSETS_PATH    "music-files/assets.cache"
+#define ASSETS_MAGIC   "MBASSETS"
+#define ASSETS_VERSION 1
+#define ASSETS_ALIGN   4096   // every stem starts on a page
+#define ASSETS_NAME    48
+#define ASSETS_MAX     64     // stems in one cache
+#define ASSETS_NATIVE  0x0102 // byte order marker, written as a native uint16_t
+
+typedef struct {
+	char     magic[8];
+	uint32_t version;
+	uint16_t byteOrder;
+	uint16_t count;
+	uint32_t rate;
+	uint16_t channels, bits;
+	uint64_t hash;       // of every stem's content hash in order, identifies the build
+	uint64_t tableHash;  // of the entries
+} AssetHeader;
+
+typedef struct {
+	char     name[ASSETS_NAME];  // source file in the asset directory
+	int64_t  sourceSize;
+	int64_t  sourceTime;         // modification time, seconds
+	uint64_t hash;               // of the source file's content
+	uint64_t offset;             // of the stem from the start of the cache
+	uint32_t frames;             // 0 if the source could not be converted
+	uint32_t loopStart;          // a looped stem carries on from here
+	uint32_t peak;               // largest sample magnitude
+	float    rms;                // over both channels, 1.0 is full scale
+} AssetEntry;
+
+typedef struct {
+	uint8_t *map;  // NULL while closed
+	size_t   size;
+	const AssetHeader *header;
+	const AssetEntry  *entry;
+} Assets;
+
+int  assetsBuild(const char *dir, const char *path, int rate);
+int  assetsRebuild(const char *dir, const char *path, int rate);
+int  assetsOpen(Assets *a, const char *dir, const char *path, int rate);
+int  assetsVerify(const Assets *a, const char *dir);
+int  assetsFind(const Assets *a, const char *name, Pcm *pcm);
+void assetsClose(Assets *a);
+const char *assetsError(void);
+
+#endif
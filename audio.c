@@ -1,4 +1,10 @@
 #include "audio.h"
+#include "stream.h"
+#include "assets.h"
+#include "timing.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
 
 // File paths - classic tracks and birthday only
 const char *CLAS1_PATH = "music-files/classic1.wav";
@@ -6,66 +12,195 @@ const char *CLAS2_PATH = "music-files/classic2.wav";
 const char *CLAS3_PATH = "music-files/classic3.wav";
 const char *BIRTHDAY_PATH = "music-files/birthday.wav";
 
-// Wave chunks
-Mix_Chunk *CLAS1 = NULL;
-Mix_Chunk *CLAS2 = NULL;
-Mix_Chunk *CLAS3 = NULL;
-Mix_Chunk *BIRTHDAY = NULL;
+// Sounds, as loaded or wrapped by the output
+void *CLAS1 = NULL;
+void *CLAS2 = NULL;
+void *CLAS3 = NULL;
+void *BIRTHDAY = NULL;
 int birthdayPlaying = 0;
 
-Mix_Chunk *chanA = NULL;
-Mix_Chunk *chanB = NULL;
-Mix_Chunk *chanC = NULL;
+void *chanA = NULL;
+void *chanB = NULL;
+void *chanC = NULL;
 
-void initSound() {
+// Tracks in the output format play from their files (see stream.h), one per channel they always play on
+Stream streams[FADE_CHANNELS];
 
-	printf("Initializing Audio\n");
+// Pre-converted tracks (see assets.h), mapped when the cache is up to date
+Assets assets;
 
-	// Initialize SDL.
-	if (SDL_Init(SDL_INIT_AUDIO) < 0) {
-		printf("Error initializing SDL\n");
-		return;
+// Every channel plays through the fade engine (see fade.h) on the selected output (see output.h)
+AudioOutput output;
+FadeEngine fader;
+uint32_t birthdaySilenced = 0;  // fadeSilenced() of the birthday channel when it was last checked
+int rewindPending = 0;          // rewind once every track has faded out
+
+// Output buffer, probed in low-latency mode (see latency.h)
+LatencyConfig latencyConfig = {0, LATENCY_MAX_BUFFER, LATENCY_BUDGET};
+LatencyMonitor monitor;
+int pendingBuffer = 0;          // step up to this size once nothing plays
+LatencyStats windowStart;
+uint32_t windowTick;
+
+/**
+ openOutput(int frames)
+
+ start the output with a buffer of frames, every channel silent, and restart the xrun window
+*/
+static int openOutput(int frames) {
+	if (output.start(&output, frames) < 0) return -1;
+
+	fadeSetRate(&fader, output.rate);
+	for (int i = 0; i < FADE_CHANNELS; i++) {
+		fadeSet(&fader, i, 0);
 	}
+	latencyInit(&monitor, output.frames, output.rate);
+	latencySnapshot(&monitor, &windowStart);
+	windowTick = timingMicros();
+	return 0;
+}
 
-	Mix_AllocateChannels(4);  // 3 for music tracks + 1 for birthday
+// Stop and start the output again with another buffer size, the loaded sounds stay valid at the same rate
+static int reopenOutput(int frames) {
+	int rate = output.rate;
 
-	//Initialize SDL_mixer 
-	if( Mix_OpenAudio( 22050, MIX_DEFAULT_FORMAT, 2, 4096 ) == -1 ) {
-		printf("Error initializing MIXER: %s\n",Mix_GetError());
-		return;
+	output.stop(&output);
+	if (openOutput(frames) < 0) return -1;
+	if (output.rate != rate) printf("Warning: output reopened at %d Hz instead of %d Hz\n", output.rate, rate);
+	return 0;
+}
+
+/**
+ probeLatency()
+
+ from the smallest buffer up, play every sound silently for LATENCY_PROBE_MS and keep the first size
+ that had no xruns and kept the callback within the budget
+*/
+static void probeLatency() {
+	void *sounds[FADE_CHANNELS] = {CLAS1, CLAS2, CLAS3, BIRTHDAY};
+	int frames = output.frames;
+
+	printf("Probing audio latency, callback budget %.0f%%...\n", latencyConfig.budget * 100);
+	for (;;) {
+		LatencyStats before, after, delta;
+
+		for (int i = 0; i < FADE_CHANNELS; i++) {
+			if (sounds[i]) output.play(&output, i, sounds[i], 1);
+		}
+		usleep(LATENCY_SETTLE_MS * 1000);
+		latencySnapshot(&monitor, &before);
+		usleep(LATENCY_PROBE_MS * 1000);
+		latencySnapshot(&monitor, &after);
+		output.halt(&output, -1);
+
+		latencyDelta(&after, &before, &delta);
+		printf("  %4d frames (%5.1f ms): %u underruns, %u overruns, callback busy %.0f%%, longest %.1f ms\n",
+		       frames, monitor.periodUs / 1000.0, delta.underruns, delta.overruns,
+		       latencyLoad(&monitor, &delta) * 100, delta.maxBusyUs / 1000.0);
+		if (latencyAcceptable(&monitor, &delta, latencyConfig.budget)) return;
+
+		frames = latencyNextBuffer(frames);
+		if (frames < 0) {
+			printf("Warning: no buffer size kept up, staying at %d frames\n", output.frames);
+			return;
+		}
+		if (reopenOutput(frames) < 0) return;
 	}
+}
 
-	volume(0,0);
-	volume(1,0);
-	volume(2,0);
-	Mix_Volume(3, 0);  // Birthday channel
+/**
+ loadTrack(const char *path, Stream *stream)
 
-	printf("Loading sounds to memory...\n");
+ a sound streamed from the asset cache, or from its file if it is already in the output format,
+ otherwise decoded by the output
+*/
+static void *loadTrack(const char *path, Stream *stream) {
+	const char *name = strrchr(path, '/');
+	Pcm pcm;
+	int result;
+
+	if (assetsFind(&assets, name ? name + 1 : path, &pcm) >= 0) {
+		streamView(stream, assets.map, assets.size, &pcm);
+		return output.wrap(&output, &stream->pcm);
+	}
+
+	result = streamOpen(stream, path, output.rate);
+
+	if (result == 0) return output.wrap(&output, &stream->pcm);
+	if (result == 1) printf("%s is not %d Hz 16-bit stereo, decoding it into memory instead of streaming it\n", path, output.rate);
+	return output.load(&output, path);
+}
+
+static void unloadTrack(void *sound, Stream *stream) {
+	if (sound) output.unload(&output, sound);
+	streamClose(stream);
+}
+
+// Returns -1 if the output could not be opened or a classic track could not be loaded
+int initSound() {
+
+	printf("Initializing Audio\n");
+
+	if (openOutput(latencyConfig.buffer) < 0) return -1;
+
+	printf("Loading sounds...\n");
+
+	// A stale or missing cache is rebuilt for the next start, this one plays from the WAV files
+	uint32_t start = timingMicros();
+	if (assetsOpen(&assets, ASSETS_DIR, ASSETS_PATH, output.rate) == 0) {
+		printf("Asset cache: %d tracks at %u Hz, checked and mapped in %.1f ms\n",
+		       assets.header->count, assets.header->rate, (timingMicros() - start) / 1000.0);
+	} else {
+		printf("Asset cache: %s, rebuilding it in the background\n", assetsError());
+		if (assetsRebuild(ASSETS_DIR, ASSETS_PATH, output.rate) < 0) printf("Warning: %s\n", assetsError());
+	}
 	
-	CLAS1 = Mix_LoadWAV(CLAS1_PATH);
-	if (CLAS1 == NULL) { printf("Error loading classic1.wav: %s\n",Mix_GetError());	return; }
-	CLAS2 = Mix_LoadWAV(CLAS2_PATH);
-	if (CLAS2 == NULL) { printf("Error loading classic2.wav: %s\n",Mix_GetError());	return; }
-	CLAS3 = Mix_LoadWAV(CLAS3_PATH);
-	if (CLAS3 == NULL) { printf("Error loading classic3.wav: %s\n",Mix_GetError());	return; }
+	CLAS1 = loadTrack(CLAS1_PATH, &streams[0]);
+	if (CLAS1 == NULL) { printf("Error loading classic1.wav: %s\n",output.error(&output));	return -1; }
+	CLAS2 = loadTrack(CLAS2_PATH, &streams[1]);
+	if (CLAS2 == NULL) { printf("Error loading classic2.wav: %s\n",output.error(&output));	return -1; }
+	CLAS3 = loadTrack(CLAS3_PATH, &streams[2]);
+	if (CLAS3 == NULL) { printf("Error loading classic3.wav: %s\n",output.error(&output));	return -1; }
 	printf("Loaded 'Classic' tracks.\n");
 
-	BIRTHDAY = Mix_LoadWAV(BIRTHDAY_PATH);
-	if (BIRTHDAY == NULL) { printf("Warning: Could not load birthday.wav: %s\n",Mix_GetError()); }
+	BIRTHDAY = loadTrack(BIRTHDAY_PATH, &streams[3]);
+	if (BIRTHDAY == NULL) { printf("Warning: Could not load birthday.wav: %s\n",output.error(&output)); }
 	else { printf("Loaded 'Birthday'.\n"); }
 
+	if (latencyConfig.low) probeLatency();
+	printf("Audio output: %s, %d frames at %d Hz, %.1f ms\n", output.name, output.frames, output.rate, monitor.periodUs / 1000.0);
+
 	setFiles(); // Initialize classic tracks
+	return 0;
 }
 
 int isPlaying = 0;
 
+// Stop the output and free the sounds, setOutput() and initSound() may then start another
+void closeSound() {
+	void **sounds[] = {&CLAS1, &CLAS2, &CLAS3, &BIRTHDAY};
+
+	output.halt(&output, -1);
+	output.stop(&output);
+	for (int i = 0; i < 4; i++) {
+		unloadTrack(*sounds[i], &streams[i]);
+		*sounds[i] = NULL;
+	}
+	assetsClose(&assets);
+	isPlaying = 0;
+	birthdayPlaying = 0;
+	rewindPending = 0;
+	pendingBuffer = 0;
+}
+
+// Rewind the tracks to the start once they have all faded out (see handleFade())
 void rewindFiles() {
-	setFiles();
+	rewindPending = 1;
 }
 
 // Set files to classic tracks (only supported sound set)
 void setFiles() {
-	Mix_HaltChannel(-1);
+	output.halt(&output, -1);
 	isPlaying = 0;
 	chanA = CLAS1;
 	chanB = CLAS2;
@@ -73,41 +208,143 @@ void setFiles() {
 }
 
 
-clock_t fadeClock;	
-// Fade state for all 4 channels: 0=track1, 1=track2, 2=track3, 3=birthday
-int toFade[4] = {0,0,0,0};
+/**
+ setOutput(const char *spec)
+
+ select the output (see output.h), before initSound(). Returns -1 if the spec is malformed or names an
+ output this build does not have
+*/
+int setOutput(const char *spec) {
+	char buf[256];
+	char *opts;
+	int result = -1;
+
+	snprintf(buf, sizeof(buf), "%s", spec);
+	opts = strchr(buf, ':');
+	if (opts) *opts++ = 0;
+
+	memset(&output, 0, sizeof(output));
+	output.fader = &fader;
+	output.monitor = &monitor;
+	if (strcmp(buf, "sdl") == 0) {
+		output.name = "sdl";
+		result = sdlOutput(&output, opts);
+	} else if (strcmp(buf, "alsa") == 0) {
+		output.name = "alsa";
+#ifdef AUDIO_ALSA
+		result = alsaOutput(&output, opts);
+#else
+		printf("This build has no ALSA output, rebuild with make ALSA=1\n");
+#endif
+	}
+	return result;
+}
+
+// Parse the fade spec (see fade.h), before initSound(). Returns -1 if it is malformed
+int setFades(const char *spec) {
+	return fadeInit(&fader, spec);
+}
+
+// Parse the output mode spec (see latency.h), before initSound(). Returns -1 if it is malformed
+int setLatency(const char *spec) {
+	return latencyParse(&latencyConfig, spec);
+}
+
+/**
+ handleLatency()
+
+ once per LATENCY_WINDOW_US, log xruns; in low-latency mode LATENCY_STEP_XRUNS of them step the
+ buffer up. Reopening the mixer restarts every channel, so the new size waits until nothing plays
+*/
+void handleLatency() {
+	if (timingMicros() - windowTick >= LATENCY_WINDOW_US) {
+		LatencyStats now, delta;
+
+		windowTick += LATENCY_WINDOW_US;
+		latencySnapshot(&monitor, &now);
+		latencyDelta(&now, &windowStart, &delta);
+		windowStart = now;
+
+		if (delta.underruns || delta.overruns) {
+			printf("\nAudio: %u underruns, %u overruns in %d s at %d frames, longest callback %.1f ms\n",
+			       delta.underruns, delta.overruns, LATENCY_WINDOW_US / 1000000, output.frames, delta.maxBusyUs / 1000.0);
+		}
+		if (latencyConfig.low && pendingBuffer == 0 && delta.underruns + delta.overruns >= LATENCY_STEP_XRUNS &&
+		    latencyNextBuffer(output.frames) > 0) {
+			pendingBuffer = latencyNextBuffer(output.frames);
+			printf("Audio: stepping the buffer up to %d frames once the tracks are silent\n", pendingBuffer);
+		}
+	}
+
+	if (pendingBuffer && !isPlaying && !birthdayPlaying) {
+		int frames = pendingBuffer;
+		pendingBuffer = 0;
+		if (reopenOutput(frames) == 0) {
+			printf("\nAudio output: %d frames, %.1f ms\n", output.frames, monitor.periodUs / 1000.0);
+		}
+	}
+}
+
+// Log how the audio callback has kept up since the mixer was opened
+void printAudioStats() {
+	LatencyStats total;
 
+	latencySnapshot(&monitor, &total);
+	printf("Audio: %s, %d frames (%.1f ms, %.1f ms to the DAC), %u callbacks, %u underruns, %u overruns, callback busy %.1f%%, longest %.1f ms\n",
+	       output.name, output.frames, monitor.periodUs / 1000.0, outputDelayMs(), total.callbacks, total.underruns, total.overruns,
+	       latencyLoad(&monitor, &total) * 100, total.maxBusyUs / 1000.0);
+}
+
+// The counters since the output was opened and the share of the time the callback was busy
+void getAudioStats(LatencyStats *total, double *load) {
+	latencySnapshot(&monitor, total);
+	*load = latencyLoad(&monitor, total);
+}
+
+// How far the mixer renders ahead of what is heard
+double outputDelayMs() {
+	return output.rate ? output.delay(&output) * 1000.0 / output.rate : 0;
+}
+
+// Read ahead of every streamed track where it plays, or at its start while it is stopped
+void handleStreams() {
+	for (int c = 0; c < FADE_CHANNELS; c++) {
+		int playing = (c < 3) ? isPlaying : birthdayPlaying;
+		streamPrefetch(&streams[c], playing ? output.position(&output, c) : 0);
+	}
+}
+
+/**
+ handleFade()
+
+ finish what the mixer has faded out: halt the birthday track once it is silent and rewind the
+ tracks once they all are. The fades themselves run in the mixer, this only polls
+*/
 void handleFade() {
-	int i;
-	// Handle fade for all 4 channels (tracks 0-2 and birthday on channel 3)
-	for (i = 0; i < 4; i++) {
-		if (toFade[i] != 0) {
-			int currentVol = getVolume(i);
-			if (currentVol < 5) {
-				// Fade complete - set volume to 0 and clear fade flag
-				Mix_Volume(i, 0);
-				toFade[i] = 0;
-				// Stop birthday channel when fade completes
-				if (i == 3 && birthdayPlaying) {
-					birthdayPlaying = 0;
-					Mix_HaltChannel(3);
-				}
-			} else {
-				// Continue fading
-				Mix_Volume(i, currentVol * 0.96);
-			}
+	uint32_t silenced = fadeSilenced(&fader, 3);
+
+	if (silenced != birthdaySilenced) {
+		birthdaySilenced = silenced;
+		if (birthdayPlaying && fader.target[3] == 0) {
+			birthdayPlaying = 0;
+			output.halt(&output, 3);
 		}
 	}
+
+	if (rewindPending && fadeGain(&fader, 0) == 0 && fadeGain(&fader, 1) == 0 && fadeGain(&fader, 2) == 0) {
+		rewindPending = 0;
+		setFiles();
+	}
 }
 
 void fadeOut(int chan) {
-	toFade[chan] = 1;
+	fadeTo(&fader, chan, 0);
 }
 
 void volume(int chan, int vol) {
-	// Cancel any pending fade when setting volume high
+	// Fading a track in cancels a rewind that has not happened yet, the tracks carry on
 	if (vol >= 100) {
-		toFade[chan] = 0;
+		rewindPending = 0;
 	}
 	
 	// Start playback if not already playing
@@ -115,34 +352,36 @@ void volume(int chan, int vol) {
 		play();
 	}
 
-	// Clamp volume to SDL_mixer max (128)
-	if (vol > 128) vol = 128;
-	Mix_Volume(chan, vol);
+	// Clamp volume to the SDL_mixer range (0-128), it is turned into a gain
+	if (vol > AUDIO_MAX_VOLUME) vol = AUDIO_MAX_VOLUME;
+	fadeTo(&fader, chan, vol * FADE_UNITY / AUDIO_MAX_VOLUME);
 }
 
 int getVolume(int chan) {
-	return Mix_Volume(chan,-1);
+	return fadeGain(&fader, chan) * AUDIO_MAX_VOLUME / FADE_UNITY;
 }
 
 // Debug functions
 void playDebugSound() {
 	const char *DEBUG_PATH = "music-files/songbird.wav";
-	Mix_Chunk *debugChunk = Mix_LoadWAV(DEBUG_PATH);
+	Stream stream;
+	void *debugChunk = loadTrack(DEBUG_PATH, &stream);
 	if (debugChunk == NULL) {
-		printf("Error loading debug sound %s: %s\n", DEBUG_PATH, Mix_GetError());
+		printf("Error loading debug sound %s: %s\n", DEBUG_PATH, output.error(&output));
+		streamClose(&stream);
 		return;
 	}
 	
 	printf("DEBUG: Playing %s for 10 seconds...\n", DEBUG_PATH);
-	Mix_Volume(0, 105);
-	if (Mix_PlayChannel(0, debugChunk, 0) == -1) {
-		printf("Error playing debug sound: %s\n", Mix_GetError());
+	fadeSet(&fader, 0, 105 * FADE_UNITY / AUDIO_MAX_VOLUME);
+	if (output.play(&output, 0, debugChunk, 0) == -1) {
+		printf("Error playing debug sound: %s\n", output.error(&output));
 	} else {
-		SDL_Delay(10000);
-		Mix_HaltChannel(0);
+		usleep(10000000);
+		output.halt(&output, 0);
 	}
-	Mix_Volume(0, 0);
-	Mix_FreeChunk(debugChunk);
+	fadeSet(&fader, 0, 0);
+	unloadTrack(debugChunk, &stream);
 	printf("DEBUG: Done.\n");
 }
 
@@ -150,34 +389,30 @@ void playDebugSound() {
 void playBirthday() {
 	if (BIRTHDAY == NULL) return;
 	
-	// Cancel any pending fade on birthday channel
-	toFade[3] = 0;
-	
 	if (!birthdayPlaying) {
 		birthdayPlaying = 1;
-		Mix_Volume(3, 105);
-		if (Mix_PlayChannel(3, BIRTHDAY, -1) == -1) {
-			printf("Error playing BIRTHDAY: %s\n", Mix_GetError());
+		if (output.play(&output, 3, BIRTHDAY, 1) == -1) {
+			printf("Error playing BIRTHDAY: %s\n", output.error(&output));
 			birthdayPlaying = 0;
+			return;
 		}
-	} else {
-		// Already playing, just restore volume
-		Mix_Volume(3, 105);
 	}
+	
+	// Fade in, or back up if it was fading out
+	fadeTo(&fader, 3, 105 * FADE_UNITY / AUDIO_MAX_VOLUME);
 }
 
 void fadeOutBirthday() {
 	if (birthdayPlaying) {
-		toFade[3] = 1;
+		fadeOut(3);
 	}
 }
 
 void stopBirthday() {
 	if (birthdayPlaying) {
 		birthdayPlaying = 0;
-		toFade[3] = 0;
-		Mix_HaltChannel(3);
-		Mix_Volume(3, 0);
+		output.halt(&output, 3);
+		fadeSet(&fader, 3, 0);
 	}
 }
 
@@ -186,22 +421,23 @@ int isBirthdayPlaying() {
 }
 
 void play() {
+	if (chanA == NULL || chanB == NULL || chanC == NULL) return;
 
 	if (isPlaying == 0) {
 		isPlaying = 1;
 
-		if ( Mix_PlayChannel(0, chanA, -1) == -1 ) {
-			printf("Error playing CHAN_A: %s\n",Mix_GetError());
+		if ( output.play(&output, 0, chanA, 1) == -1 ) {
+			printf("Error playing CHAN_A: %s\n",output.error(&output));
 			return;
 		}
 		
-		if ( Mix_PlayChannel(1, chanB, -1) == -1 ) {
-			printf("Error playing CHAN_B: %s\n",Mix_GetError());
+		if ( output.play(&output, 1, chanB, 1) == -1 ) {
+			printf("Error playing CHAN_B: %s\n",output.error(&output));
 			return;
 		}
 
-		if ( Mix_PlayChannel(2, chanC, -1) == -1 ) {
-			printf("Error playing CHAN_C: %s\n",Mix_GetError());
+		if ( output.play(&output, 2, chanC, 1) == -1 ) {
+			printf("Error playing CHAN_C: %s\n",output.error(&output));
 			return;
 		}
 
@@ -1,13 +1,23 @@
 
-#include <SDL2/SDL.h>
-#include <SDL2/SDL_mixer.h>
-#include <time.h>
+#include "output.h"
 
-void initSound();
+// volume() takes the SDL_mixer range, whichever output plays it
+#define AUDIO_MAX_VOLUME 128
+
+int setOutput(const char *spec);
+int setFades(const char *spec);
+int setLatency(const char *spec);
+int initSound();
+void closeSound();
 void setFiles();
 void rewindFiles();
 void fadeOut(int chan);
 void handleFade();
+void handleLatency();
+void handleStreams();
+void printAudioStats();
+double outputDelayMs();
+void getAudioStats(LatencyStats *total, double *load);
 void play();
 void volume(int c, int v);
 int getVolume(int chan);
@@ -0,0 +1,171 @@
+/**
+
+Music Bottles v4 by Tal Achituv
+
+Audio benchmark, plays the classic tracks through each output and compares what they cost
+
+Usage: audioBench [-d seconds] [-l latency] [output ...]
+
+  -d seconds  how long each output plays (default BENCH_SECONDS)
+  -l latency  buffer spec every output opens with, see latency.h (default LATENCY_DEFAULT)
+  output      outputs to compare, see output.h (default sdl, and alsa when built with ALSA=1)
+
+Every second the three tracks are faded in or out the way musicBottles does it, through
+volume() and fadeOut(), with fades of 0 ms so the gain jumps as soon as the mixer takes the
+command. Per output it reports:
+
+  cpu         process CPU time over wall time, everything the output's threads do plus this
+              loop's polling, which is the same for every output
+  callback    share of the time the mixer was busy rendering, and xruns (see latency.h)
+  command     from volume() or fadeOut() to the mixer applying the gain, polled every
+              BENCH_POLL_US
+  queued      what the output had rendered ahead of the DAC, averaged over the run; SDL does
+              not report it, so for sdl it is an estimate of two buffers
+  end-to-end  command plus queued, from a bottle being detected to it being heard
+
+Run it from the repository so music-files/ is found, with musicBottles stopped.
+
+*/
+
+#include "audio.h"
+#include "timing.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_SECONDS  20
+#define BENCH_TOGGLE_US 1000000  // tracks faded in or out this often
+#define BENCH_POLL_US  200
+#define BENCH_FADES    "in=0,out=0,curve=linear"
+#define BENCH_VOLUME   105       // what musicBottles fades a track in to
+#define BENCH_MAX_OUTPUTS 8
+
+extern AudioOutput output;  // audio.c
+
+typedef struct {
+	const char *spec;
+	int      frames, rate;
+	double   cpu;          // share of one core
+	double   load;         // share of the time the callback was busy
+	uint32_t underruns, overruns;
+	double   commandMs, maxCommandMs;
+	double   queuedMs;
+	int      commands;
+} Result;
+
+static double seconds(clockid_t clock) {
+	struct timespec t;
+	clock_gettime(clock, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+// Fade the tracks in or out and wait for the mixer to take it, returns the microseconds it took or -1 on timeout
+static long toggle(int on) {
+	uint32_t start = timingMicros();
+
+	for (int c = 0; c < 3; c++) {
+		if (on) volume(c, BENCH_VOLUME);
+		else fadeOut(c);
+	}
+	while (timingMicros() - start < BENCH_TOGGLE_US) {
+		if ((getVolume(0) > 0) == on && (getVolume(1) > 0) == on && (getVolume(2) > 0) == on) {
+			return timingMicros() - start;
+		}
+		usleep(BENCH_POLL_US);
+	}
+	return -1;
+}
+
+static int run(const char *spec, int duration, Result *r) {
+	LatencyStats total;
+	double wall, cpu, queued = 0;
+	uint32_t start, lastToggle;
+	int on = 0, polls = 0;
+
+	printf("\n%s:\n", spec);
+	r->spec = spec;
+	if (setOutput(spec) < 0 || initSound() < 0) return -1;
+	r->frames = output.frames;
+	r->rate = output.rate;
+
+	wall = seconds(CLOCK_MONOTONIC);
+	cpu = seconds(CLOCK_PROCESS_CPUTIME_ID);
+	start = lastToggle = timingMicros() - BENCH_TOGGLE_US;
+	while (timingMicros() - start < (uint32_t) duration * 1000000 + BENCH_TOGGLE_US) {
+		if (timingMicros() - lastToggle >= BENCH_TOGGLE_US) {
+			long us;
+
+			lastToggle += BENCH_TOGGLE_US;
+			on = !on;
+			us = toggle(on);
+			if (us < 0) {
+				printf("  the mixer did not take a fade %s within %d ms\n", on ? "in" : "out", BENCH_TOGGLE_US / 1000);
+				continue;
+			}
+			r->commandMs += us / 1000.0;
+			if (us / 1000.0 > r->maxCommandMs) r->maxCommandMs = us / 1000.0;
+			r->commands++;
+		}
+		handleFade();
+		handleStreams();
+		queued += outputDelayMs();
+		polls++;
+		usleep(BENCH_POLL_US);
+	}
+	r->cpu = (seconds(CLOCK_PROCESS_CPUTIME_ID) - cpu) / (seconds(CLOCK_MONOTONIC) - wall);
+
+	printAudioStats();
+	getAudioStats(&total, &r->load);
+	r->underruns = total.underruns;
+	r->overruns = total.overruns;
+	r->queuedMs = queued / polls;
+	if (r->commands) r->commandMs /= r->commands;
+	closeSound();
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	const char *latencySpec = LATENCY_DEFAULT;
+	const char *outputs[BENCH_MAX_OUTPUTS];
+	Result results[BENCH_MAX_OUTPUTS] = {{0}};
+	int numOutputs = 0, duration = BENCH_SECONDS, opt;
+
+	while ((opt = getopt(argc, argv, "d:l:")) != -1) {
+		if (opt == 'd') duration = atoi(optarg);
+		else if (opt == 'l') latencySpec = optarg;
+		else argc = 0;
+	}
+	for (int i = optind; i < argc && numOutputs < BENCH_MAX_OUTPUTS; i++) {
+		outputs[numOutputs++] = argv[i];
+	}
+	if (numOutputs == 0) {
+		outputs[numOutputs++] = "sdl";
+#ifdef AUDIO_ALSA
+		outputs[numOutputs++] = "alsa";
+#endif
+	}
+
+	if (argc == 0 || duration < 1 || setFades(BENCH_FADES) < 0 || setLatency(latencySpec) < 0) {
+		printf("Usage: audioBench [-d seconds] [-l latency] [output ...]\n");
+		return -1;
+	}
+
+	for (int i = 0; i < numOutputs; i++) {
+		if (run(outputs[i], duration, &results[i]) < 0) printf("  %s could not be started, skipped\n", outputs[i]);
+	}
+
+	printf("\n%-20s %6s %6s %6s %9s %6s %6s %15s %9s %11s\n",
+	       "output", "frames", "rate", "cpu", "callback", "under", "over", "command ms", "queued", "end-to-end");
+	for (int i = 0; i < numOutputs; i++) {
+		Result *r = &results[i];
+		if (r->commands == 0) {
+			printf("%-20s %6s\n", r->spec, "-");
+			continue;
+		}
+		printf("%-20s %6d %6d %5.1f%% %8.1f%% %6u %6u %7.1f / %5.1f %6.1f ms %8.1f ms\n",
+		       r->spec, r->frames, r->rate, r->cpu * 100, r->load * 100, r->underruns, r->overruns,
+		       r->commandMs, r->maxCommandMs, r->queuedMs, r->commandMs + r->queuedMs);
+	}
+	return 0;
+}
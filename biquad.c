@@ -0,0 +1,107 @@
+#include "biquad.h"
+#include <math.h>
+
+/**
+
+	Fixed-point biquad filters for Music Bottles
+
+	Inputs are tared counts, well inside 2^24 for the HX711, so a product
+	with a Q3.28 coefficient stays below 2^54 and the sum of five below 2^57:
+	no saturation logic is needed in the 64-bit accumulator.
+
+*/
+
+#define ONE ((int64_t) 1 << BIQUAD_FRACTION_BITS)
+
+static int32_t quantise(double c) {
+	return (int32_t) llround(c * ONE);
+}
+
+// Normalise by a0, quantise, and start from rest. b1 absorbs the rounding, so the gain at DC is exactly 1
+static int design(Biquad *q, double b0, double b2, double a0, double a1, double a2) {
+	q->b0 = quantise(b0 / a0);
+	q->b2 = quantise(b2 / a0);
+	q->a1 = quantise(a1 / a0);
+	q->a2 = quantise(a2 / a0);
+	q->b1 = (int32_t) (ONE + q->a1 + q->a2 - q->b0 - q->b2);
+	biquadReset(q, 0);
+	return 0;
+}
+
+/**
+ biquadLowPass(Biquad *q, double rate, double hz, double qFactor)
+
+ second-order low-pass at hz for conversions at rate per second (BIQUAD_BUTTERWORTH_Q for a
+ maximally flat passband). Returns -1 unless 0 < hz < rate / 2
+*/
+int biquadLowPass(Biquad *q, double rate, double hz, double qFactor) {
+	double w, alpha;
+
+	if (rate <= 0 || hz <= 0 || hz >= rate / 2 || qFactor <= 0) return -1;
+	w = 2 * M_PI * hz / rate;
+	alpha = sin(w) / (2 * qFactor);
+	return design(q, (1 - cos(w)) / 2, (1 - cos(w)) / 2, 1 + alpha, -2 * cos(w), 1 - alpha);
+}
+
+/**
+ biquadNotch(Biquad *q, double rate, double hz, double qFactor)
+
+ notch at hz, bandwidth hz / qFactor. Returns -1 unless 0 < hz < rate / 2
+*/
+int biquadNotch(Biquad *q, double rate, double hz, double qFactor) {
+	double w, alpha;
+
+	if (rate <= 0 || hz <= 0 || hz >= rate / 2 || qFactor <= 0) return -1;
+	w = 2 * M_PI * hz / rate;
+	alpha = sin(w) / (2 * qFactor);
+	return design(q, 1, 1, 1 + alpha, -2 * cos(w), 1 - alpha);
+}
+
+// Settle the section at a constant input, the output then holds it
+void biquadReset(Biquad *q, int32_t level) {
+	q->x1 = q->x2 = level;
+	q->y1 = q->y2 = level;
+	q->error = 0;
+}
+
+// One conversion through the section
+int32_t biquadPush(Biquad *q, int32_t x) {
+	int64_t acc = q->error;
+	int32_t y;
+
+	acc += (int64_t) q->b0 * x + (int64_t) q->b1 * q->x1 + (int64_t) q->b2 * q->x2;
+	acc -= (int64_t) q->a1 * q->y1 + (int64_t) q->a2 * q->y2;
+
+	// Arithmetic shift floors, the remainder goes into the next output
+	y = (int32_t) (acc >> BIQUAD_FRACTION_BITS);
+	q->error = acc - ((int64_t) y << BIQUAD_FRACTION_BITS);
+
+	q->x2 = q->x1;
+	q->x1 = x;
+	q->y2 = q->y1;
+	q->y1 = y;
+	return y;
+}
+
+void cascadeInit(BiquadCascade *c) {
+	c->sections = 0;
+}
+
+// Append a designed section, returns -1 if the cascade is full
+int cascadeAdd(BiquadCascade *c, const Biquad *q) {
+	if (c->sections == BIQUAD_MAX_SECTIONS) return -1;
+	c->section[c->sections++] = *q;
+	return 0;
+}
+
+void cascadeReset(BiquadCascade *c, int32_t level) {
+	int i;
+	for (i = 0; i < c->sections; i++) biquadReset(&c->section[i], level);
+}
+
+// One conversion through every section in turn, an empty cascade passes it through
+int32_t cascadePush(BiquadCascade *c, int32_t x) {
+	int i;
+	for (i = 0; i < c->sections; i++) x = biquadPush(&c->section[i], x);
+	return x;
+}
@@ -0,0 +1,48 @@
+/**
+
+	Fixed-point biquad filters for Music Bottles
+
+	Second-order IIR sections (RBJ audio cookbook low-pass and notch) in
+	direct form I on integer counts. Coefficients are designed in double once
+	and stored as Q3.28 integers; every conversion then costs five 32x32->64
+	multiply-adds per section and no floating point, which the Pi Zero's
+	ARM1176 does in a few dozen cycles. The rounding error of each output is
+	fed back into the next (first-order error feedback), so low cut-offs do
+	not leave a dead band or a DC offset of a few counts.
+
+	A cascade chains up to BIQUAD_MAX_SECTIONS sections. Both section types
+	have unity gain at DC, so a cascade reset to a level holds it exactly.
+
+*/
+
+#ifndef BIQUAD_H
+#define BIQUAD_H
+
+#include <stdint.h>
+
+#define BIQUAD_FRACTION_BITS 28    // coefficients in Q3.28: |a1| < 2 fits with room to spare
+#define BIQUAD_MAX_SECTIONS  4
+#define BIQUAD_BUTTERWORTH_Q 0.7071
+
+typedef struct {
+	int32_t b0, b1, b2, a1, a2;  // Q3.28, a0 normalised to 1
+	int32_t x1, x2, y1, y2;      // previous inputs and outputs, counts
+	int64_t error;               // fraction dropped from the last output, Q28
+} Biquad;
+
+typedef struct {
+	int    sections;
+	Biquad section[BIQUAD_MAX_SECTIONS];
+} BiquadCascade;
+
+int     biquadLowPass(Biquad *q, double rate, double hz, double qFactor);
+int     biquadNotch(Biquad *q, double rate, double hz, double qFactor);
+void    biquadReset(Biquad *q, int32_t level);
+int32_t biquadPush(Biquad *q, int32_t x);
+
+void    cascadeInit(BiquadCascade *c);
+int     cascadeAdd(BiquadCascade *c, const Biquad *q);
+void    cascadeReset(BiquadCascade *c, int32_t level);
+int32_t cascadePush(BiquadCascade *c, int32_t x);
+
+#endif
@@ -0,0 +1,109 @@
+#include "calib.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/**
+
+	Persisted calibration for Music Bottles
+
+	One "key value" pair per line, # starts a comment. Unknown keys are
+	skipped so later versions can add fields without breaking older files.
+
+*/
+
+// Fingerprint of the current setup: the source spec, the cap weights and any bottle weights (may be NULL)
+void calibFingerprint(char *buf, size_t len, const char *spec, const long *caps, const long *bottles, int n) {
+	size_t used;
+	int i, haveBottles = 0;
+
+	used = snprintf(buf, len, "%s caps", spec);
+	for (i = 0; i < n && used < len; i++) {
+		used += snprintf(buf + used, len - used, "%c%ld", i ? ',' : '=', caps[i]);
+		if (bottles && bottles[i]) haveBottles = 1;
+	}
+	if (!haveBottles) return;
+
+	if (used < len) used += snprintf(buf + used, len - used, " bottles");
+	for (i = 0; i < n && used < len; i++) {
+		used += snprintf(buf + used, len - used, "%c%ld", i ? ',' : '=', bottles[i]);
+	}
+}
+
+/**
+ calibLoad(const char *path, Calibration *c)
+
+ returns 0 if the file exists, has the current version and every field, -1 otherwise
+*/
+int calibLoad(const char *path, Calibration *c) {
+	char line[256];
+	char *value;
+	int version = 0, fields = 0;
+	FILE *f = fopen(path, "r");
+
+	if (f == NULL) return -1;
+
+	memset(c, 0, sizeof(*c));
+	while (fgets(line, sizeof(line), f)) {
+		line[strcspn(line, "\r\n")] = 0;
+		if (line[0] == '#' || line[0] == 0) continue;
+
+		value = strchr(line, ' ');
+		if (value == NULL) continue;
+		*value++ = 0;
+
+		if (strcmp(line, "version") == 0) version = atoi(value);
+		else if (strcmp(line, "fingerprint") == 0) {
+			snprintf(c->fingerprint, sizeof(c->fingerprint), "%s", value);
+			fields |= 1;
+		}
+		else if (strcmp(line, "tare") == 0)   { c->tare = atol(value);   fields |= 2; }
+		else if (strcmp(line, "weight") == 0) { c->weight = atol(value); fields |= 4; }
+		else if (strcmp(line, "state") == 0)  { c->state = atoi(value);  fields |= 8; }
+		else if (strcmp(line, "margin") == 0 && c->margins < CALIB_MAX_MARGINS) {
+			CalibMargin *m = &c->margin[c->margins];
+			if (sscanf(value, "%d %lf %lf %lf", &m->state, &m->count, &m->mean, &m->var) == 4 && m->state >= 0) {
+				c->margins++;
+			}
+		}
+	}
+	fclose(f);
+
+	return (version == CALIB_VERSION && fields == 15) ? 0 : -1;
+}
+
+/**
+ calibSave(const char *path, const Calibration *c)
+
+ atomically replace the file, returns 0 on success, -1 (file untouched) on any error
+*/
+int calibSave(const char *path, const Calibration *c) {
+	char tmp[512];
+	FILE *f;
+	int i, ok;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	f = fopen(tmp, "w");
+	if (f == NULL) return -1;
+
+	fprintf(f, "# music bottles calibration, rewritten while running\n");
+	fprintf(f, "version %d\n", CALIB_VERSION);
+	fprintf(f, "fingerprint %s\n", c->fingerprint);
+	fprintf(f, "tare %ld\n", c->tare);
+	fprintf(f, "weight %ld\n", c->weight);
+	fprintf(f, "state %d\n", c->state);
+	for (i = 0; i < c->margins && i < CALIB_MAX_MARGINS; i++) {
+		fprintf(f, "margin %d %.0f %.3f %.4f\n", c->margin[i].state, c->margin[i].count, c->margin[i].mean, c->margin[i].var);
+	}
+
+	// Data on disk before the rename makes it visible, or a power cut can leave an empty file
+	ok = fflush(f) == 0 && fsync(fileno(f)) == 0;
+	ok = (fclose(f) == 0) && ok;
+
+	if (!ok || rename(tmp, path) != 0) {
+		unlink(tmp);
+		return -1;
+	}
+	return 0;
+}
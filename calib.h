@@ -0,0 +1,57 @@
+/**
+
+	Persisted calibration for Music Bottles
+
+	The tare, the latest smoothed weight and the detected state are kept in a
+	small text file so a restart (crash, Restart=always, power blip) can resume
+	without a full tare, and without re-taring against a table whose caps are
+	off. The file is replaced atomically: written to FILE.tmp, synced, then
+	renamed over FILE, so a reader only ever sees the old or the new version.
+
+	The fingerprint ties the file to one setup (source spec, cap and bottle weights);
+	a file written for a different setup is ignored.
+
+	The margins learned for each state (see margins.h) ride along as optional
+	"margin" lines, up to CALIB_MAX_MARGINS of them.
+
+*/
+
+#ifndef CALIB_H
+#define CALIB_H
+
+#include <stddef.h>
+
+#define CALIB_PATH    "musicBottles.calib"
+#define CALIB_VERSION 1
+
+#define CALIB_FINGERPRINT_LEN 200
+
+#define CALIB_MAX_MARGINS 64
+
+// Conversions read at startup to check the file against the scale
+#define CALIB_CHECK_SAMPLES 5
+
+// The smoothed weight is rewritten at most this often, state changes are written immediately
+#define CALIB_SAVE_INTERVAL_US 30000000
+
+typedef struct {
+	int    state;
+	double count;  // observations behind the statistics
+	double mean;   // display units
+	double var;
+} CalibMargin;
+
+typedef struct {
+	char fingerprint[CALIB_FINGERPRINT_LEN];
+	long tare;    // raw counts
+	long weight;  // smoothed weight relative to tare, counts
+	int  state;   // detected state index
+	int  margins;
+	CalibMargin margin[CALIB_MAX_MARGINS];
+} Calibration;
+
+void calibFingerprint(char *buf, size_t len, const char *spec, const long *caps, const long *bottles, int n);
+int  calibLoad(const char *path, Calibration *c);
+int  calibSave(const char *path, const Calibration *c);
+
+#endif
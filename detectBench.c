@@ -0,0 +1,507 @@
+/**
+
+Music Bottles v4 by Tal Achituv
+
+Detector benchmark, runs a recorded trace (or synthetic data) through the detection stages offline
+
+Usage: detectBench [-s source] [-m counts] [-n samples] [-o model] [step|filter|train BOTTLES]
+
+  -s source   sample source, usually trace:FILE,speed=0 or synth:speed=0,... (see source.h)
+  -m counts   smallest step to detect, raw counts (default: a 415 cap, 41500)
+  -n samples  stop after this many samples (required with the hx711 source)
+  -o model    transient model written by train (default transient.model)
+
+  step        CUSUM step detector: detection latency, step size error and false triggers,
+              next to the time the old EMA matcher took to settle on the same steps
+  filter      adaptive Kalman filter against the fixed 0.15 EMA: settling time after each
+              step and output noise at rest, both fed by the streaming estimator
+  train       fit the transient classifier (see transient.h) to the trace, on the windows the
+              step detector triggers just as in musicBottles. BOTTLES lists the bottle
+              (1-based) behind every step in order, e.g. 1,1,3,3,2,2; reports the
+              leave-one-out accuracy and writes the model
+
+Ground truth comes from the whole trace at once: a change is where the medians of the
+BENCH_REF_WINDOW samples before and after differ by more than half the smallest step,
+placed at the first sample past the midpoint between the two medians.
+
+*/
+
+#include "hx711.h"
+#include "source.h"
+#include "estimator.h"
+#include "step.h"
+#include "kalman.h"
+#include "transient.h"
+#include <unistd.h>
+
+#define BENCH_MIN_STEP    41500
+#define BENCH_HX711_LIMIT 6000   // samples read from the live scale unless -n says otherwise
+
+// Reference segmentation: median windows either side of a candidate change
+#define BENCH_REF_WINDOW 10
+
+// An alarm this many samples before or 2 * BENCH_REF_WINDOW after a change detects it
+#define BENCH_EARLY 2
+
+// The EMA matcher counted as settled within the musicBottles match margin (20 units of 100 counts)
+#define BENCH_MARGIN   2000
+#define ESTIMATE_WINDOW 8
+
+// Settled means inside the margin for this many samples in a row
+#define BENCH_SETTLE_HOLD 5
+
+// Noise at rest is measured from this many samples after a change, once even the EMA has settled
+#define BENCH_REST_AFTER 50
+
+typedef struct {
+	int  index;   // first sample of the new plateau
+	long before;  // plateau medians
+	long after;
+} Change;
+
+static Sample *samples = NULL;
+static int numSamples = 0;
+
+static int readAll(int limit) {
+	int capacity = 0, result;
+	Sample s;
+
+	while ((limit == 0 || numSamples < limit) && (result = sourceRead(&s)) != SOURCE_END) {
+		if (result != SOURCE_OK) continue;
+		if (numSamples == capacity) {
+			capacity = capacity ? capacity * 2 : 4096;
+			samples = realloc(samples, capacity * sizeof(Sample));
+		}
+		samples[numSamples++] = s;
+	}
+	return numSamples;
+}
+
+static int compareLong(const void *a, const void *b) {
+	long x = *(const long *) a, y = *(const long *) b;
+	return (x > y) - (x < y);
+}
+
+static long windowMedian(int start, int n) {
+	long tmp[BENCH_REF_WINDOW];
+	int i;
+
+	for (i = 0; i < n; i++) tmp[i] = samples[start + i].value;
+	qsort(tmp, n, sizeof(long), compareLong);
+	return tmp[n / 2];
+}
+
+/**
+ refineEdge(Change *c)
+
+ the largest median jump can be anywhere within half a window of the edge, so move the change
+ to the first sample within that distance that is past the midpoint of the two plateaus, and
+ stays past it for the next sample so a single spike does not count
+*/
+static void refineEdge(Change *c) {
+	long mid = (c->before + c->after) / 2;
+	int dir = (c->after > c->before) ? 1 : -1;
+	int i = c->index - BENCH_REF_WINDOW / 2, end = c->index + BENCH_REF_WINDOW / 2;
+
+	if (i < 1) i = 1;
+	if (end > numSamples - 2) end = numSamples - 2;
+	for (; i <= end; i++) {
+		if ((samples[i].value - mid) * dir > 0 && (samples[i + 1].value - mid) * dir > 0 &&
+		    (samples[i - 1].value - mid) * dir <= 0) {
+			c->index = i;
+			return;
+		}
+	}
+}
+
+// Offline changes: runs of samples where the median jumps, each reduced to its largest jump and refined to its edge
+static int findChanges(Change *changes, int max, long minStep) {
+	int i, n = 0, inRun = 0;
+	long best = 0;
+
+	for (i = BENCH_REF_WINDOW; i + BENCH_REF_WINDOW <= numSamples; i++) {
+		long before = windowMedian(i - BENCH_REF_WINDOW, BENCH_REF_WINDOW);
+		long after = windowMedian(i, BENCH_REF_WINDOW);
+		long jump = labs(after - before);
+
+		if (jump <= minStep / 2) {
+			inRun = 0;
+			continue;
+		}
+		if (!inRun) {
+			if (n == max) break;
+			inRun = 1;
+			best = 0;
+			n++;
+		}
+		if (jump > best) {
+			best = jump;
+			changes[n - 1].index = i;
+			changes[n - 1].before = before;
+			changes[n - 1].after = after;
+		}
+	}
+	for (i = 0; i < n; i++) refineEdge(&changes[i]);
+	return n;
+}
+
+/**
+ matchAlarms(changes, numChanges, alarmIndex, numAlarms, match)
+
+ pair every reference change with the first unpaired alarm from BENCH_EARLY samples before it
+ to 2 * BENCH_REF_WINDOW after, match[c] is the alarm or -1. Returns the number paired
+*/
+static int matchAlarms(const Change *changes, int numChanges, const int *alarmIndex, int numAlarms, int *match) {
+	int *used = calloc(numAlarms + 1, sizeof(int));
+	int c, a, paired = 0;
+
+	for (c = 0; c < numChanges; c++) {
+		match[c] = -1;
+		for (a = 0; a < numAlarms; a++) {
+			int lag = alarmIndex[a] - changes[c].index;
+			if (used[a] || lag < -BENCH_EARLY || lag > 2 * BENCH_REF_WINDOW) continue;
+
+			used[a] = 1;
+			match[c] = a;
+			paired++;
+			break;
+		}
+	}
+	free(used);
+	return paired;
+}
+
+static double msBetween(int from, int to) {
+	return (uint32_t) (samples[to].tick - samples[from].tick) / 1000.0;
+}
+
+void runStep(long minStep) {
+	int maxChanges = numSamples / BENCH_REF_WINDOW + 1;
+	Change *changes = malloc(maxChanges * sizeof(Change));
+	int *alarmIndex = malloc(numSamples * sizeof(int));
+	double *alarmStep = malloc(numSamples * sizeof(double));
+	int *match = malloc(maxChanges * sizeof(int));
+	int numChanges = findChanges(changes, maxChanges, minStep);
+	int numAlarms = 0, detected = 0, falseTriggers = 0, settled = 0;
+	double latencySum = 0, latencyMax = 0, errorSum = 0, emaSum = 0, emaMax = 0;
+	double hours = msBetween(0, numSamples - 1) / 3600000.0;
+	StepDetector d;
+	Estimator e;
+	double ema = 0;
+	int i, c, a;
+
+	stepInit(&d, minStep);
+	for (i = 0; i < numSamples; i++) {
+		if (stepPush(&d, samples[i].value)) {
+			alarmIndex[numAlarms] = i;
+			alarmStep[numAlarms++] = d.step;
+		}
+	}
+
+	detected = matchAlarms(changes, numChanges, alarmIndex, numAlarms, match);
+	falseTriggers = numAlarms - detected;
+	for (c = 0; c < numChanges; c++) {
+		if ((a = match[c]) < 0) continue;
+
+		double ms = (alarmIndex[a] > changes[c].index) ? msBetween(changes[c].index, alarmIndex[a]) : 0;
+		latencySum += ms;
+		if (ms > latencyMax) latencyMax = ms;
+		errorSum += fabs(alarmStep[a] - (changes[c].after - changes[c].before));
+	}
+
+	// Same steps through the previous pipeline: estimator window, then 0.85/0.15 EMA
+	estimatorInit(&e, ESTIMATE_WINDOW, ESTIMATOR_K, ESTIMATOR_MIN_BAND);
+	ema = samples[0].value;
+	for (i = 0, c = 0; i < numSamples && c < numChanges; i++) {
+		ema = ema * 0.85 + estimatorPush(&e, samples[i].value) * 0.15;
+		if (i < changes[c].index) continue;
+
+		if (fabs(ema - changes[c].after) <= BENCH_MARGIN) {
+			double ms = msBetween(changes[c].index, i);
+			settled++;
+			emaSum += ms;
+			if (ms > emaMax) emaMax = ms;
+			c++;
+		} else if (c + 1 < numChanges && i >= changes[c + 1].index) {
+			c++;  // never settled before the next change
+		}
+	}
+
+	printf("Samples:         %d (%.1f s)\n", numSamples, hours * 3600);
+	printf("Reference steps: %d (|step| > %ld counts)\n", numChanges, minStep / 2);
+	printf("CUSUM detected:  %d of %d", detected, numChanges);
+	if (detected) printf(", latency %.0f ms mean, %.0f ms max, step error %.0f counts mean",
+	                     latencySum / detected, latencyMax, errorSum / detected);
+	printf("\n");
+	printf("False triggers:  %d", falseTriggers);
+	if (hours > 0) printf(" (%.2f per hour)", falseTriggers / hours);
+	printf("\n");
+	printf("EMA settled:     %d of %d", settled, numChanges);
+	if (settled) printf(", latency %.0f ms mean, %.0f ms max (within %d counts)", emaSum / settled, emaMax, BENCH_MARGIN);
+	printf("\n");
+
+	free(changes);
+	free(alarmIndex);
+	free(alarmStep);
+	free(match);
+}
+
+/**
+ settleStats(out, changes, numChanges, settled, meanMs, maxMs)
+
+ time from each reference change until the filter output is within BENCH_MARGIN of the new
+ plateau for BENCH_SETTLE_HOLD samples, changes not settled before the next one are skipped
+*/
+static void settleStats(const double *out, const Change *changes, int numChanges, int *settled, double *meanMs, double *maxMs) {
+	int c, i, hold;
+
+	*settled = 0;
+	*meanMs = *maxMs = 0;
+	for (c = 0; c < numChanges; c++) {
+		int end = (c + 1 < numChanges) ? changes[c + 1].index : numSamples;
+		for (i = changes[c].index, hold = 0; i < end; i++) {
+			hold = (fabs(out[i] - changes[c].after) <= BENCH_MARGIN) ? hold + 1 : 0;
+			if (hold < BENCH_SETTLE_HOLD) continue;
+
+			double ms = msBetween(changes[c].index, i - BENCH_SETTLE_HOLD + 1);
+			(*settled)++;
+			*meanMs += ms;
+			if (ms > *maxMs) *maxMs = ms;
+			break;
+		}
+	}
+	if (*settled) *meanMs /= *settled;
+}
+
+/**
+ restNoise(out, changes, numChanges)
+
+ pooled standard deviation of the output around a straight line fitted to each plateau,
+ from BENCH_REST_AFTER samples after a change to BENCH_REF_WINDOW before the next, so
+ neither settling nor slow drift counts as noise
+*/
+static double restNoise(const double *out, const Change *changes, int numChanges) {
+	double sumSq = 0;
+	int c, i, n = 0, fitted = 0;
+
+	for (c = -1; c < numChanges; c++) {
+		int start = ((c < 0) ? 0 : changes[c].index) + BENCH_REST_AFTER;
+		int end = ((c + 1 < numChanges) ? changes[c + 1].index : numSamples) - BENCH_REF_WINDOW;
+		double mt = (start + end - 1) / 2.0, my = 0, sty = 0, stt = 0, slope;
+
+		if (end - start < 3) continue;
+		for (i = start; i < end; i++) my += out[i];
+		my /= end - start;
+		for (i = start; i < end; i++) {
+			sty += (i - mt) * (out[i] - my);
+			stt += (i - mt) * (i - mt);
+		}
+		slope = sty / stt;
+		for (i = start; i < end; i++) {
+			double d = out[i] - my - slope * (i - mt);
+			sumSq += d * d;
+		}
+		n += end - start;
+		fitted += 2;
+	}
+	return (n > fitted) ? sqrt(sumSq / (n - fitted)) : 0;
+}
+
+void runFilter(long minStep) {
+	int maxChanges = numSamples / BENCH_REF_WINDOW + 1;
+	Change *changes = malloc(maxChanges * sizeof(Change));
+	double *clean = malloc(numSamples * sizeof(double));
+	double *ema = malloc(numSamples * sizeof(double));
+	double *kalman = malloc(numSamples * sizeof(double));
+	int numChanges = findChanges(changes, maxChanges, minStep);
+	int settled;
+	double meanMs, maxMs;
+	Estimator e;
+	Kalman k;
+	int i;
+
+	estimatorInit(&e, ESTIMATE_WINDOW, ESTIMATOR_K, ESTIMATOR_MIN_BAND);
+	kalmanInit(&k, KALMAN_R_INIT);
+	for (i = 0; i < numSamples; i++) {
+		clean[i] = estimatorPush(&e, samples[i].value);
+		ema[i] = i ? ema[i - 1] * 0.85 + clean[i] * 0.15 : clean[i];
+		kalman[i] = kalmanUpdate(&k, clean[i]);
+	}
+
+	printf("Samples:         %d (%.1f s)\n", numSamples, msBetween(0, numSamples - 1) / 1000);
+	printf("Reference steps: %d (|step| > %ld counts), settled = within %d counts for %d samples\n",
+	       numChanges, minStep / 2, BENCH_MARGIN, BENCH_SETTLE_HOLD);
+	printf("\n%-10s %-14s %-24s %s\n", "Filter", "Settled", "Settling (mean / max)", "Noise at rest (SD)");
+
+	settleStats(clean, changes, numChanges, &settled, &meanMs, &maxMs);
+	printf("%-10s %3d of %-7d %7.0f / %-6.0f ms %8.0f counts\n", "estimator", settled, numChanges, meanMs, maxMs,
+	       restNoise(clean, changes, numChanges));
+	settleStats(ema, changes, numChanges, &settled, &meanMs, &maxMs);
+	printf("%-10s %3d of %-7d %7.0f / %-6.0f ms %8.0f counts\n", "EMA 0.15", settled, numChanges, meanMs, maxMs,
+	       restNoise(ema, changes, numChanges));
+	settleStats(kalman, changes, numChanges, &settled, &meanMs, &maxMs);
+	printf("%-10s %3d of %-7d %7.0f / %-6.0f ms %8.0f counts\n", "Kalman", settled, numChanges, meanMs, maxMs,
+	       restNoise(kalman, changes, numChanges));
+	printf("\nKalman learned measurement noise: %.0f counts SD\n", sqrt(k.r));
+
+	free(changes);
+	free(clean);
+	free(ema);
+	free(kalman);
+}
+
+// Bottle numbers from a comma separated list, 0-based, -1 if malformed
+static int parseBottles(const char *list, int *bottles, int max) {
+	char *end = (char *) list;
+	int n = 0;
+
+	while (*end && n < max) {
+		bottles[n] = strtol(end, &end, 10) - 1;
+		if (bottles[n] < 0 || bottles[n] >= TRANSIENT_MAX_CLASSES / 2) return -1;
+		n++;
+		if (*end == ',') end++;
+		else if (*end) return -1;
+	}
+	return n;
+}
+
+void runTrain(long minStep, const char *list, const char *modelPath) {
+	int maxChanges = numSamples / BENCH_REF_WINDOW + 1;
+	Change *changes = malloc(maxChanges * sizeof(Change));
+	int *labels = malloc(maxChanges * sizeof(int));
+	double (*features)[TRANSIENT_FEATURES] = malloc(maxChanges * sizeof(*features));
+	int *used = malloc(maxChanges * sizeof(int));
+	int *match = malloc(maxChanges * sizeof(int));
+	int *alarmIndex = malloc(numSamples * sizeof(int));
+	int *captured = malloc(numSamples * sizeof(int));
+	double (*alarmFeatures)[TRANSIENT_FEATURES] = malloc(numSamples * sizeof(*alarmFeatures));
+	int numChanges = findChanges(changes, maxChanges, minStep);
+	int numLabels = parseBottles(list, labels, maxChanges);
+	int i, c, j, n = 0, numAlarms = 0, correct = 0, confident = 0, confidentCorrect = 0;
+	TransientModel model;
+	TransientCapture capture;
+	StepDetector d;
+
+	printf("Reference steps: %d (|step| > %ld counts), labels: %d\n", numChanges, minStep / 2, numLabels);
+	if (numLabels != numChanges) {
+		printf("Need one bottle number per step\n");
+		numChanges = 0;
+	}
+
+	// The windows musicBottles classifies: captured around the detector's change point estimate, so the
+	// features are aligned the same way. The reference changes only say which label goes with which alarm
+	stepInit(&d, minStep);
+	transientInit(&capture);
+	for (i = 0; i < numSamples; i++) {
+		if (stepPush(&d, samples[i].value)) {
+			transientTrigger(&capture, d.latency);
+			captured[numAlarms] = 0;
+			alarmIndex[numAlarms++] = i;
+		}
+		if (transientPush(&capture, samples[i].value)) {
+			transientFeatures(&capture, alarmFeatures[numAlarms - 1]);
+			captured[numAlarms - 1] = 1;
+		}
+	}
+
+	matchAlarms(changes, numChanges, alarmIndex, numAlarms, match);
+	for (c = 0; c < numChanges; c++) {
+		used[c] = (match[c] >= 0 && captured[match[c]]);
+		if (!used[c]) continue;
+
+		memcpy(features[c], alarmFeatures[match[c]], sizeof(features[c]));
+		n++;
+	}
+	if (n < numChanges) printf("%d steps not detected or without a full window, left out\n", numChanges - n);
+
+	// Leave-one-out: classify each step with a model fitted to all the others
+	for (c = 0; c < numChanges; c++) {
+		double posterior = 0;
+		int bottle;
+
+		if (!used[c]) continue;
+		transientModelInit(&model);
+		for (j = 0; j < numChanges; j++) {
+			if (j != c && used[j]) transientTrainAdd(&model, labels[j], features[j][TRANSIENT_STEP] >= 0, features[j]);
+		}
+		transientTrainFinish(&model);
+
+		bottle = transientClassify(&model, features[c], ~0u, &posterior);
+		if (bottle == labels[c]) correct++;
+		if (posterior >= TRANSIENT_CONFIDENCE) {
+			confident++;
+			if (bottle == labels[c]) confidentCorrect++;
+		}
+	}
+
+	transientModelInit(&model);
+	for (c = 0; c < numChanges; c++) {
+		if (used[c]) transientTrainAdd(&model, labels[c], features[c][TRANSIENT_STEP] >= 0, features[c]);
+	}
+	transientTrainFinish(&model);
+
+	printf("\n%-8s %-7s %5s %9s %9s %9s %7s %9s\n", "Bottle", "", "Steps", "Step", "Press", "Release", "Ring", "Energy");
+	for (c = 0; c < model.count; c++) {
+		const TransientClass *k = &model.classes[c];
+		printf("%-8d %-7s %5d %9.0f %9.0f %9.0f %7.3f %9.0f\n", k->bottle + 1, k->direction == TRANSIENT_LIFT ? "lift" : "return",
+		       k->count, k->mean[TRANSIENT_STEP], k->mean[TRANSIENT_PRESS], k->mean[TRANSIENT_RELEASE],
+		       k->mean[TRANSIENT_RING], k->mean[TRANSIENT_ENERGY]);
+	}
+
+	if (n) {
+		printf("\nLeave-one-out: %d of %d correct (%.0f%%), %d confident (p >= %.2f) of which %d correct\n",
+		       correct, n, 100.0 * correct / n, confident, TRANSIENT_CONFIDENCE, confidentCorrect);
+		if (transientSave(modelPath, &model) == 0) printf("Model written to %s\n", modelPath);
+		else printf("Could not write %s\n", modelPath);
+	}
+
+	free(changes);
+	free(labels);
+	free(features);
+	free(used);
+	free(match);
+	free(alarmIndex);
+	free(captured);
+	free(alarmFeatures);
+}
+
+int main(int argc, char **argv) {
+	const char *sourceSpec = SOURCE_DEFAULT;
+	const char *modelPath = TRANSIENT_MODEL_PATH;
+	long minStep = BENCH_MIN_STEP;
+	int limit = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "s:m:n:o:")) != -1) {
+		if (opt == 's') sourceSpec = optarg;
+		else if (opt == 'm') minStep = atol(optarg);
+		else if (opt == 'n') limit = atoi(optarg);
+		else if (opt == 'o') modelPath = optarg;
+		else return -1;
+	}
+
+	if (sourceOpen(sourceSpec) < 0) return -1;
+	if (limit == 0 && sourceIsHardware()) limit = BENCH_HX711_LIMIT;
+
+	printf("Reading %s ...\n", sourceSpec);
+	if (readAll(limit) < 2 * BENCH_REF_WINDOW) {
+		printf("Not enough samples (%d)\n", numSamples);
+		sourceClose();
+		return -1;
+	}
+	sourceClose();
+
+	if (optind == argc || strcmp(argv[optind], "step") == 0) {
+		runStep(minStep);
+	} else if (strcmp(argv[optind], "filter") == 0) {
+		runFilter(minStep);
+	} else if (strcmp(argv[optind], "train") == 0 && optind + 1 < argc) {
+		runTrain(minStep, argv[optind + 1], modelPath);
+	} else {
+		printf("Unknown mode '%s'\n", argv[optind]);
+		return -1;
+	}
+
+	free(samples);
+	return 0;
+}
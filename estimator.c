@@ -0,0 +1,199 @@
+#include "estimator.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+
+	Streaming robust estimator for Music Bottles
+
+	The fifo always wraps at ESTIMATOR_MAX_WINDOW, whatever the current
+	window, so the adaptive window can grow without reordering anything and
+	shrinks by retiring the oldest samples one at a time.
+
+	Locating a sample, the median and the MAD are binary searches over the sorted
+	window. Inserting and retiring a sample shift part of the sorted array, which
+	for windows of a few dozen samples is cheaper than maintaining a tree.
+
+*/
+
+#define MAD_TO_SIGMA 1.4826
+
+void estimatorInit(Estimator *e, int size, double k, long minBand) {
+	if (size < 1) size = 1;
+	if (size > ESTIMATOR_MAX_WINDOW) size = ESTIMATOR_MAX_WINDOW;
+
+	e->size = size;
+	e->maxSize = size;
+	e->minSize = 0;
+	e->k = k;
+	e->minBand = minBand;
+	e->shrinks = 0;
+	estimatorReset(e);
+}
+
+/**
+ estimatorAdapt(Estimator *e, int minSize)
+
+ let the window shrink to minSize samples while the weight moves and grow back to the size given
+ to estimatorInit() at rest
+*/
+void estimatorAdapt(Estimator *e, int minSize) {
+	if (minSize < 1) minSize = 1;
+	if (minSize > e->maxSize) minSize = e->maxSize;
+	e->minSize = minSize;
+	e->size = minSize;
+}
+
+// Forget all samples, keeping the configuration. An adaptive window starts short, a reset means a step
+void estimatorReset(Estimator *e) {
+	if (e->minSize) e->size = e->minSize;
+	e->outlierRun = 0;
+	e->count = 0;
+	e->oldest = 0;
+	e->median = 0;
+	e->mad = 0;
+	e->band = e->minBand;
+	e->value = 0;
+	e->kept = 0;
+	e->rejected = 0;
+}
+
+// First index in sorted[0..n) whose value is >= x
+static int lowerBound(const long *sorted, int n, long x) {
+	int lo = 0, hi = n;
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if (sorted[mid] < x) lo = mid + 1;
+		else hi = mid;
+	}
+	return lo;
+}
+
+// First index in sorted[0..n) whose value is > x
+static int upperBound(const long *sorted, int n, long x) {
+	int lo = 0, hi = n;
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if (sorted[mid] <= x) lo = mid + 1;
+		else hi = mid;
+	}
+	return lo;
+}
+
+/**
+ kthDeviation(sorted, n, med, k)
+
+ k-th smallest |x - med| over the window without building the deviation array:
+ below the split the deviations ascend walking down, above it they ascend walking up,
+ so this is a k-th-of-two-sorted-arrays search in O(log n)
+*/
+static long kthDeviation(const long *sorted, int n, long med, int k) {
+	int split = lowerBound(sorted, n, med);
+	int nLow = split, nHigh = n - split;
+	int lo, hi;
+
+	// i = how many deviations come from the low side among the k+1 smallest
+	lo = (k + 1 - nHigh > 0) ? k + 1 - nHigh : 0;
+	hi = (k + 1 < nLow) ? k + 1 : nLow;
+
+	while (lo <= hi) {
+		int i = (lo + hi) / 2;
+		int j = k + 1 - i;
+		long lowPrev  = (i > 0)     ? med - sorted[split - i]     : -1;
+		long lowNext  = (i < nLow)  ? med - sorted[split - i - 1] : -1;
+		long highPrev = (j > 0)     ? sorted[split + j - 1] - med : -1;
+		long highNext = (j < nHigh) ? sorted[split + j] - med     : -1;
+
+		if (i > 0 && j < nHigh && lowPrev > highNext) {
+			hi = i - 1;
+		} else if (j > 0 && i < nLow && highPrev > lowNext) {
+			lo = i + 1;
+		} else {
+			return (lowPrev > highPrev) ? lowPrev : highPrev;
+		}
+	}
+	return 0;
+}
+
+// Remove the oldest sample from both orders
+static void retireOldest(Estimator *e) {
+	int pos = lowerBound(e->sorted, e->count, e->fifo[e->oldest]);
+	memmove(&e->sorted[pos], &e->sorted[pos + 1], (e->count - pos - 1) * sizeof(long));
+	e->count--;
+	e->oldest = (e->oldest + 1) % ESTIMATOR_MAX_WINDOW;
+}
+
+// Adaptive window: cut it on motion, grow it by one per in-band sample
+static void adaptWindow(Estimator *e, long x) {
+	int side = (x > e->median + e->band) - (x < e->median - e->band);
+
+	if (e->count == 0 || side == 0) {
+		e->outlierRun = 0;
+		if (e->size < e->maxSize) e->size++;
+		return;
+	}
+
+	e->outlierRun = (e->outlierRun * side > 0) ? e->outlierRun + side : side;
+	if (abs(e->outlierRun) >= ESTIMATOR_MOTION_RUN && e->size > e->minSize) {
+		e->size = e->minSize;
+		e->shrinks++;
+	}
+}
+
+/**
+ estimatorStdErr(const Estimator *e)
+
+ standard error of the current value in counts: the spread of the window (from the MAD, at least
+ what the minimum band allows for) over the root of the samples averaged
+*/
+double estimatorStdErr(const Estimator *e) {
+	double sigma = MAD_TO_SIGMA * e->mad;
+
+	if (sigma < e->minBand / e->k) sigma = e->minBand / e->k;
+	return (e->kept > 0) ? sigma / sqrt(e->kept) : sigma;
+}
+
+/**
+ estimatorPush(Estimator *e, long x)
+
+ add a conversion, retiring the oldest once the window is full, and return the updated clean value
+*/
+long estimatorPush(Estimator *e, long x) {
+	int pos, n, lo, hi, i;
+	long sum = 0;
+
+	if (e->minSize) adaptWindow(e, x);
+
+	// Retire the oldest samples until the new one fits the window
+	while (e->count >= e->size) retireOldest(e);
+	e->fifo[(e->oldest + e->count) % ESTIMATOR_MAX_WINDOW] = x;
+
+	// Insert the new one in order
+	pos = upperBound(e->sorted, e->count, x);
+	memmove(&e->sorted[pos + 1], &e->sorted[pos], (e->count - pos) * sizeof(long));
+	e->sorted[pos] = x;
+	n = ++e->count;
+
+	if (n % 2) {
+		e->median = e->sorted[n / 2];
+	} else {
+		e->median = (e->sorted[n / 2 - 1] + e->sorted[n / 2]) / 2;
+	}
+	e->mad = kthDeviation(e->sorted, n, e->median, (n - 1) / 2);
+
+	e->band = (long) (e->k * MAD_TO_SIGMA * e->mad);
+	if (e->band < e->minBand) e->band = e->minBand;
+
+	// Mean of the samples inside the band, never empty since the median is inside
+	lo = lowerBound(e->sorted, n, e->median - e->band);
+	hi = upperBound(e->sorted, n, e->median + e->band);
+	for (i = lo; i < hi; i++) {
+		sum += e->sorted[i];
+	}
+	e->kept = hi - lo;
+	e->value = (e->kept > 0) ? sum / e->kept : e->median;
+	e->rejected = (x < e->median - e->band || x > e->median + e->band);
+
+	return e->value;
+}
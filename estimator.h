@@ -0,0 +1,60 @@
+/**
+
+	Streaming robust estimator for Music Bottles
+
+	Keeps the last N conversions both in arrival order and sorted, so every new
+	sample yields a fresh clean value: the mean of the window samples within a
+	MAD-based band around the rolling median. The band is absolute (counts), so
+	unlike a percentage of the mean it does not collapse near zero after tare.
+
+	With estimatorAdapt() the window length follows the signal: three
+	conversions in a row outside the band on the same side mean the weight is
+	moving (two happen by chance a few times a minute at 80 SPS), and the
+	window drops to the newest few samples so the value follows at once.
+	Every in-band conversion then grows it by one, back up to the configured
+	length, which pushes the noise down again at rest. count is the window
+	the current value was taken over, and estimatorStdErr() its standard
+	error, for consumers that weight their confidence by it.
+
+*/
+
+#ifndef ESTIMATOR_H
+#define ESTIMATOR_H
+
+#define ESTIMATOR_MAX_WINDOW 64
+
+// Rejection band: ESTIMATOR_K robust standard deviations (1.4826 * MAD), at least ESTIMATOR_MIN_BAND counts
+#define ESTIMATOR_K        3.0
+#define ESTIMATOR_MIN_BAND 200
+
+// Adaptive window: out-of-band conversions in a row, on the same side, that count as motion
+#define ESTIMATOR_MOTION_RUN 3
+
+typedef struct {
+	int    size;      // window length, varies between minSize and maxSize when adaptive
+	int    maxSize;
+	int    minSize;   // 0: fixed window
+	int    count;     // samples currently held (< size while filling)
+	int    oldest;    // fifo index of the oldest sample, the fifo wraps at ESTIMATOR_MAX_WINDOW
+	long   fifo[ESTIMATOR_MAX_WINDOW];    // arrival order
+	long   sorted[ESTIMATOR_MAX_WINDOW];  // same samples, ascending
+	double k;
+	long   minBand;
+
+	long   median;    // rolling median
+	long   mad;       // median absolute deviation from the median
+	long   band;      // current rejection half-width in counts
+	long   value;     // clean value: mean of the in-band samples
+	int    kept;      // samples that contributed to value
+	int    rejected;  // 1 if the latest sample fell outside the band
+	int    outlierRun;   // consecutive out-of-band samples, signed by side
+	unsigned long shrinks;  // times motion cut the window
+} Estimator;
+
+void estimatorInit(Estimator *e, int size, double k, long minBand);
+void estimatorReset(Estimator *e);
+void estimatorAdapt(Estimator *e, int minSize);
+double estimatorStdErr(const Estimator *e);
+long estimatorPush(Estimator *e, long x);
+
+#endif
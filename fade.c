@@ -0,0 +1,235 @@
+#include "fade.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+
+	Fade engine for Music Bottles
+
+	Per frame a ramp costs one table interpolation and a multiply per
+	sample, all in integers; a channel at rest at full scale costs nothing
+	and a silent one a memset. The ramp position advances in Q16 table
+	entries, and the last frame of a ramp is set to the target outright, so
+	the length is exact and rounding never leaves a residue.
+
+	Rising ramps read the curve backwards and upside down, so a fade in is
+	the time-reverse of a fade out with the same curve.
+
+*/
+
+#define TABLE_END ((uint32_t) FADE_TABLE_SIZE << 16)
+
+static const char *CURVE_NAMES[FADE_CURVES] = {"linear", "cosine", "exp"};
+
+// The share of the way from the start to the target at progress p in [0, 1]
+static double curveAt(int curve, double p) {
+	double floor = pow(10, -FADE_EXPONENTIAL_DB / 20);
+
+	if (curve == FADE_COSINE) return (1 - cos(M_PI * p)) / 2;
+	if (curve == FADE_EXPONENTIAL) return (1 - pow(floor, p)) / (1 - floor);
+	return p;
+}
+
+/**
+ fadeInit(FadeEngine *f, const char *spec)
+
+ parse a fade spec (see fade.h) and build the curve table, every channel silent. Returns -1 if
+ the spec is malformed or a duration is outside 0 to FADE_MAX_MS
+*/
+int fadeInit(FadeEngine *f, const char *spec) {
+	char buf[256];
+	char *opt, *save;
+	int i;
+
+	memset(f, 0, sizeof(*f));
+	f->curve = FADE_EXPONENTIAL;
+	f->inMs = FADE_IN_MS;
+	f->outMs = FADE_OUT_MS;
+
+	snprintf(buf, sizeof(buf), "%s", spec ? spec : FADE_DEFAULT);
+	for (opt = strtok_r(buf, ",", &save); opt; opt = strtok_r(NULL, ",", &save)) {
+		char *value = strchr(opt, '='), *end;
+		long ms;
+
+		if (value == NULL) return -1;
+		*value++ = 0;
+
+		if (strcmp(opt, "curve") == 0) {
+			for (i = 0; i < FADE_CURVES && strcmp(value, CURVE_NAMES[i]) != 0; i++);
+			if (i == FADE_CURVES) return -1;
+			f->curve = i;
+			continue;
+		}
+
+		ms = strtol(value, &end, 10);
+		if (*end || *value == 0 || ms < 0 || ms > FADE_MAX_MS) return -1;
+		if (strcmp(opt, "in") == 0) f->inMs = ms;
+		else if (strcmp(opt, "out") == 0) f->outMs = ms;
+		else return -1;
+	}
+
+	for (i = 0; i <= FADE_TABLE_SIZE; i++) {
+		f->table[i] = lround(curveAt(f->curve, (double) i / FADE_TABLE_SIZE) * FADE_UNITY);
+	}
+	f->table[FADE_TABLE_SIZE + 1] = f->table[FADE_TABLE_SIZE];
+	return 0;
+}
+
+// Output rate of the mixer, ramp lengths in milliseconds are converted to frames with it
+void fadeSetRate(FadeEngine *f, int rate) {
+	f->rate = rate;
+}
+
+// Control thread side of the queue: returns 1 if the command was queued, 0 if the queue was full
+static int queuePush(FadeQueue *q, const FadeCommand *c) {
+	uint32_t head = q->head;
+	uint32_t tail = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+
+	if (head - tail >= FADE_QUEUE_SIZE) {
+		__atomic_add_fetch(&q->dropped, 1, __ATOMIC_RELAXED);
+		return 0;
+	}
+
+	q->buf[head & (FADE_QUEUE_SIZE - 1)] = *c;
+	__atomic_store_n(&q->head, head + 1, __ATOMIC_RELEASE);
+	return 1;
+}
+
+// Mixer thread side: returns 1 and fills c if a command was waiting
+static int queuePop(FadeQueue *q, FadeCommand *c) {
+	uint32_t tail = q->tail;
+	uint32_t head = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+
+	if (head == tail) return 0;
+
+	*c = q->buf[tail & (FADE_QUEUE_SIZE - 1)];
+	__atomic_store_n(&q->tail, tail + 1, __ATOMIC_RELEASE);
+	return 1;
+}
+
+static int command(FadeEngine *f, int channel, int32_t gain, int ms) {
+	FadeCommand c;
+
+	if (channel < 0 || channel >= FADE_CHANNELS) return 0;
+	if (gain < 0) gain = 0;
+	if (gain > FADE_UNITY) gain = FADE_UNITY;
+
+	c.channel = channel;
+	c.gain = gain;
+	c.frames = (uint32_t) ((uint64_t) ms * f->rate / 1000);
+	if (!queuePush(&f->queue, &c)) return 0;
+	f->target[channel] = gain;
+	return 1;
+}
+
+/**
+ fadeTo(FadeEngine *f, int channel, int32_t gain)
+
+ control thread: ramp a channel to gain (Q15) over the configured fade in or fade out time. A
+ channel already heading for that gain carries on undisturbed. Returns 0 if the queue was full
+*/
+int fadeTo(FadeEngine *f, int channel, int32_t gain) {
+	if (channel < 0 || channel >= FADE_CHANNELS) return 0;
+	if (gain == f->target[channel]) return 1;
+	return command(f, channel, gain, (gain > f->target[channel]) ? f->inMs : f->outMs);
+}
+
+// Control thread: jump a channel to gain at the start of the next buffer
+int fadeSet(FadeEngine *f, int channel, int32_t gain) {
+	return command(f, channel, gain, 0);
+}
+
+// Gain the mixer last applied to a channel, Q15
+int32_t fadeGain(const FadeEngine *f, int channel) {
+	return __atomic_load_n(&f->env[channel].gain, __ATOMIC_RELAXED);
+}
+
+// How many times a channel has gone silent, a change tells the control thread a fade out has finished
+uint32_t fadeSilenced(const FadeEngine *f, int channel) {
+	return __atomic_load_n(&f->env[channel].silenced, __ATOMIC_ACQUIRE);
+}
+
+uint32_t fadeDropped(const FadeEngine *f) {
+	return __atomic_load_n(&f->queue.dropped, __ATOMIC_RELAXED);
+}
+
+static void setGain(Envelope *e, int32_t gain) {
+	if (gain == 0 && e->gain != 0) __atomic_add_fetch(&e->silenced, 1, __ATOMIC_RELEASE);
+	__atomic_store_n(&e->gain, gain, __ATOMIC_RELAXED);
+}
+
+static void start(FadeEngine *f, const FadeCommand *c) {
+	Envelope *e = &f->env[c->channel];
+
+	e->from = e->gain;
+	e->to = c->gain;
+	e->pos = 0;
+	e->frames = c->frames;
+	e->phase = 0;
+	e->carry = 0;
+	if (c->frames == 0) {
+		setGain(e, c->gain);
+	} else {
+		e->step = TABLE_END / c->frames;
+		e->remainder = TABLE_END % c->frames;
+	}
+}
+
+// Advance a ramp by one frame
+static void rampFrame(const FadeEngine *f, Envelope *e) {
+	uint32_t phase;
+	int32_t share, a, b;
+
+	if (++e->pos == e->frames) {
+		setGain(e, e->to);
+		return;
+	}
+
+	// Whole table steps plus the remainder carried Bresenham-style, so the phase is exactly pos / frames of the table
+	e->phase += e->step;
+	e->carry += e->remainder;
+	if (e->carry >= e->frames) {
+		e->carry -= e->frames;
+		e->phase++;
+	}
+	phase = (e->to > e->from) ? TABLE_END - e->phase : e->phase;
+	a = f->table[phase >> 16];
+	b = f->table[(phase >> 16) + 1];
+	share = a + (int32_t) (((int64_t) (b - a) * (phase & 0xffff)) >> 16);
+	if (e->to > e->from) share = FADE_UNITY - share;
+
+	setGain(e, e->from + (int32_t) (((int64_t) (e->to - e->from) * share) >> 15));
+}
+
+static void scale(int16_t *samples, int count, int32_t gain) {
+	int i;
+	for (i = 0; i < count; i++) samples[i] = (int16_t) ((samples[i] * gain) >> 15);
+}
+
+/**
+ fadeProcess(FadeEngine *f, int channel, int16_t *samples, int frames, int channels)
+
+ mixer thread: take any queued commands, then apply a channel's envelope to a buffer of
+ interleaved signed 16-bit frames in place
+*/
+void fadeProcess(FadeEngine *f, int channel, int16_t *samples, int frames, int channels) {
+	FadeCommand c;
+	Envelope *e;
+
+	while (queuePop(&f->queue, &c)) start(f, &c);
+	if (channel < 0 || channel >= FADE_CHANNELS) return;
+	e = &f->env[channel];
+
+	// Frame by frame through a ramp, then the rest of the buffer at one gain
+	while (frames > 0 && e->pos < e->frames) {
+		rampFrame(f, e);
+		scale(samples, channels, e->gain);
+		samples += channels;
+		frames--;
+	}
+	if (frames == 0 || e->gain == FADE_UNITY) return;
+	if (e->gain == 0) memset(samples, 0, (size_t) frames * channels * sizeof(*samples));
+	else scale(samples, frames * channels, e->gain);
+}
@@ -0,0 +1,100 @@
+/**
+
+	Fade engine for Music Bottles
+
+	Gain envelopes applied to every output frame inside the mixer, so a fade
+	lasts exactly as long as configured whatever the detection loop is doing,
+	and the gain moves a little on every frame instead of in 0-128 volume
+	steps once per main loop pass.
+
+	The control thread queues commands (a target gain and a ramp length in
+	frames) through a single-producer/single-consumer lock-free queue, the
+	same scheme as the sample ring in acquire.h; the mixer thread drains it at
+	the start of every buffer it processes. The control thread never takes
+	SDL's audio lock to change a gain.
+
+	Fades are configured with a spec:
+
+	  in=MS,out=MS,curve=linear|cosine|exp   (default FADE_DEFAULT)
+
+	exp falls by close to a constant number of decibels per frame, across
+	FADE_EXPONENTIAL_DB, and rises as its mirror image, which sounds even to
+	the ear; cosine is an S-curve with no corner at either end. Every curve
+	starts exactly at the current gain and ends exactly at the target, so a
+	fade never steps.
+
+*/
+
+#ifndef FADE_H
+#define FADE_H
+
+#include <stdint.h>
+
+#define FADE_DEFAULT "in=300,out=3000,curve=exp"
+#define FADE_IN_MS   300
+#define FADE_OUT_MS  3000
+#define FADE_MAX_MS  60000
+
+#define FADE_CHANNELS       4       // mixer channels 0 to 3: three tracks and the birthday track
+#define FADE_UNITY          32768   // gains are Q15, full scale
+#define FADE_QUEUE_SIZE     64      // commands, must be a power of two
+#define FADE_TABLE_BITS     8       // curve tables of 2^bits segments, interpolated per frame
+#define FADE_TABLE_SIZE     (1 << FADE_TABLE_BITS)
+#define FADE_EXPONENTIAL_DB 40.0    // range of the exp curve, scaled to end exactly in silence
+
+#define FADE_LINEAR      0
+#define FADE_COSINE      1
+#define FADE_EXPONENTIAL 2
+#define FADE_CURVES      3
+
+typedef struct {
+	int      channel;
+	int32_t  gain;    // target, Q15
+	uint32_t frames;  // ramp length, 0 to jump
+} FadeCommand;
+
+typedef struct {
+	FadeCommand buf[FADE_QUEUE_SIZE];
+	uint32_t head;     // next slot to write, owned by the control thread
+	uint32_t tail;     // next slot to read, owned by the mixer thread
+	uint32_t dropped;  // commands lost because the queue was full
+} FadeQueue;
+
+// One channel's envelope, only the mixer thread writes it
+typedef struct {
+	int32_t  gain;              // current, Q15
+	int32_t  from, to;
+	uint32_t pos, frames;       // progress through the ramp, done at pos == frames
+	uint32_t phase, step;       // position in the curve table, Q16 table entries
+	uint32_t remainder, carry;  // step's fraction of a Q16 entry, in 1/frames
+	uint32_t silenced;          // times the gain has reached 0, read by the control thread
+} Envelope;
+
+typedef struct {
+	// Configuration
+	int      curve;
+	int      inMs, outMs;
+	int      rate;      // output frames per second, 0 until the mixer is open
+	int32_t  table[FADE_TABLE_SIZE + 2];  // the curve from 0 to FADE_UNITY, one spare entry for interpolation
+
+	// Control thread side
+	int32_t  target[FADE_CHANNELS];  // last gain requested per channel
+
+	FadeQueue queue;
+	Envelope  env[FADE_CHANNELS];
+} FadeEngine;
+
+int      fadeInit(FadeEngine *f, const char *spec);
+void     fadeSetRate(FadeEngine *f, int rate);
+
+// Control thread
+int      fadeTo(FadeEngine *f, int channel, int32_t gain);
+int      fadeSet(FadeEngine *f, int channel, int32_t gain);
+int32_t  fadeGain(const FadeEngine *f, int channel);
+uint32_t fadeSilenced(const FadeEngine *f, int channel);
+uint32_t fadeDropped(const FadeEngine *f);
+
+// Mixer thread
+void     fadeProcess(FadeEngine *f, int channel, int16_t *samples, int frames, int channels);
+
+#endif
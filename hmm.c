@@ -0,0 +1,147 @@
+#include "hmm.h"
+#include <math.h>
+
+/**
+
+	State tracker for Music Bottles
+
+	The posterior lives in entry order of the sorted index, so the emission
+	step only evaluates the entries within HMM_EMISSION_RANGE sigmas of the
+	measurement (found by binary search). Neighbours are generated from the
+	base-3 digits on the fly instead of being stored: O(states x bottles)
+	per conversion, no allocation.
+
+*/
+
+void hmmInit(HmmTracker *h, const StateIndex *idx, double sigma) {
+	int i;
+
+	h->idx = idx;
+	h->baseSigma = sigma;
+	h->sigma = sigma;
+	h->noise = 0;
+	h->reach = 0;
+	h->maxScale = 1;
+	for (i = 0; i < STATE_MAX_STATES; i++) h->posOf[i] = -1;
+	for (i = 0; i < idx->count; i++) {
+		h->posOf[idx->entries[i].state] = i;
+		h->mean[i] = idx->entries[i].weight;
+		h->scale[i] = 1;
+	}
+	hmmReset(h, -1);
+}
+
+// Put all probability on one state (after a tare or a warm start), -1 for no idea at all
+void hmmReset(HmmTracker *h, int state) {
+	int i, n = h->idx->count;
+	int pos = (state >= 0 && state < STATE_MAX_STATES) ? h->posOf[state] : -1;
+
+	for (i = 0; i < n; i++) {
+		h->p[i] = (pos < 0) ? 1.0 / n : (i == pos);
+	}
+	h->map = (pos < 0) ? h->idx->entries[0].state : state;
+	h->confidence = (pos < 0) ? 1.0 / n : 1.0;
+}
+
+// Standard error of the next measurements in display units, added in quadrature to the base sigma
+void hmmSetNoise(HmmTracker *h, double noise) {
+	h->noise = noise;
+	h->sigma = sqrt(h->baseSigma * h->baseSigma + noise * noise);
+}
+
+// Centre a state's emission on mean (display units) with baseSigma * scale, ignored for states not modelled
+void hmmSetState(HmmTracker *h, int state, double mean, double scale) {
+	int pos = (state >= 0 && state < STATE_MAX_STATES) ? h->posOf[state] : -1;
+
+	if (pos < 0) return;
+	h->mean[pos] = mean;
+	h->scale[pos] = scale;
+	if (fabs(mean - h->idx->entries[pos].weight) > h->reach) h->reach = fabs(mean - h->idx->entries[pos].weight);
+	if (scale > h->maxScale) h->maxScale = scale;
+}
+
+// First entry position whose weight is >= w
+static int lowerBound(const StateIndex *idx, double w) {
+	int lo = 0, hi = idx->count;
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if (idx->entries[mid].weight < w) lo = mid + 1;
+		else hi = mid;
+	}
+	return lo;
+}
+
+/**
+ hmmUpdate(HmmTracker *h, double weight)
+
+ one forward step with a tared weight in display units, returns the most probable state
+ (h->confidence is its posterior)
+*/
+int hmmUpdate(HmmTracker *h, double weight) {
+	const StateIndex *idx = h->idx;
+	int n = idx->count, bottles = idx->bottles;
+	double jump = (n > 1) ? HMM_JUMP_PROB / (n - 1) : 0;
+	double total = 0, best = -1, range;
+	int i, b, d, lo, hi, bestPos = 0;
+
+	// Predict: stay, move one bottle, or (rarely) jump anywhere
+	for (i = 0; i < n; i++) h->next[i] = 0;
+	for (i = 0; i < n; i++) {
+		int state = idx->entries[i].state;
+		int place = 1, neighbours = 0;
+		double share;
+
+		if (h->p[i] == 0) continue;
+
+		for (b = 0; b < bottles; b++, place *= 3) {
+			int digit = (state / place) % 3;
+			for (d = 0; d < 3; d++) {
+				if (d != digit && h->posOf[state + (d - digit) * place] >= 0) neighbours++;
+			}
+		}
+
+		share = neighbours ? h->p[i] * HMM_SWITCH_PROB / neighbours : 0;
+		h->next[i] += h->p[i] * (1 - (neighbours ? HMM_SWITCH_PROB : 0));
+
+		place = 1;
+		for (b = 0; b < bottles && share > 0; b++, place *= 3) {
+			int digit = (state / place) % 3;
+			for (d = 0; d < 3; d++) {
+				int pos;
+				if (d == digit) continue;
+				pos = h->posOf[state + (d - digit) * place];
+				if (pos >= 0) h->next[pos] += share;
+			}
+		}
+	}
+
+	// Update: Gaussian emission near the measurement, the outlier floor everywhere
+	range = HMM_EMISSION_RANGE * h->sigma * h->maxScale + h->reach;
+	lo = lowerBound(idx, weight - range);
+	hi = lowerBound(idx, weight + range);
+	for (i = 0; i < n; i++) {
+		double e = HMM_OUTLIER;
+		double prior = (1 - HMM_JUMP_PROB) * h->next[i] + jump * (1 - h->p[i]);  // p[i] is still the old posterior
+
+		if (i >= lo && i < hi) {
+			double base = h->baseSigma * h->scale[i];
+			double sigma = (h->scale[i] == 1) ? h->sigma : sqrt(base * base + h->noise * h->noise);
+			double z = (h->mean[i] - weight) / sigma;
+			e += h->sigma / sigma * exp(-0.5 * z * z);
+		}
+		h->p[i] = prior * e;
+		total += h->p[i];
+	}
+
+	for (i = 0; i < n; i++) {
+		h->p[i] /= total;
+		if (h->p[i] > best) {
+			best = h->p[i];
+			bestPos = i;
+		}
+	}
+
+	h->map = idx->entries[bestPos].state;
+	h->confidence = best;
+	return h->map;
+}
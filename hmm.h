@@ -0,0 +1,61 @@
+/**
+
+	State tracker for Music Bottles
+
+	Online forward filter (hidden Markov model) over the bottle/cap states of
+	a StateIndex. Between two conversions a visitor changes at most one
+	bottle, so each state keeps most of its probability, hands HMM_SWITCH_PROB
+	to the states one bottle away, and only HMM_JUMP_PROB to everything else.
+	Each conversion is scored with a Gaussian around every state's expected
+	weight, plus a small outlier floor so a transient (a hand on a cap, a
+	knock) is uninformative rather than decisive.
+
+	The posterior of the most probable state is the confidence: noise near a
+	margin edge never gathers enough of it, a clean step does within two
+	conversions.
+
+	hmmSetNoise() widens the emission by the standard error of each
+	measurement, so a value averaged over a short window (during a step) counts
+	for less than one averaged over a long window at rest. hmmSetState() moves
+	a state's emission to a learned mean and scales its sigma (see margins.h),
+	normalised so a tight state also scores higher on a close match.
+
+*/
+
+#ifndef HMM_H
+#define HMM_H
+
+#include "stateindex.h"
+
+#define HMM_SIGMA       8.0    // emission standard deviation, display units
+#define HMM_SWITCH_PROB 0.02   // per conversion, split over the single-bottle neighbours
+#define HMM_JUMP_PROB   1e-5   // per conversion, to any other state (two caps at once)
+#define HMM_OUTLIER     1e-3   // emission floor relative to a perfect match, one lone sample cannot reach HMM_CONFIDENCE
+#define HMM_CONFIDENCE  0.9    // posterior needed to act on a state
+
+// Emissions further than this many sigmas are left at the floor without evaluating exp()
+#define HMM_EMISSION_RANGE 6.0
+
+typedef struct {
+	const StateIndex *idx;
+	double baseSigma;                 // HMM_SIGMA or what hmmInit() was given
+	double sigma;                     // baseSigma widened by the measurement noise
+	double noise;
+	double mean[STATE_MAX_STATES];    // emission centre per entry position, display units
+	double scale[STATE_MAX_STATES];   // emission sigma per entry position, relative to baseSigma
+	double reach;                     // furthest any mean has moved from its entry weight
+	double maxScale;
+	int    posOf[STATE_MAX_STATES];   // state -> entry position, -1 if not modelled
+	double p[STATE_MAX_STATES];       // posterior per entry position
+	double next[STATE_MAX_STATES];
+	int    map;                       // most probable state
+	double confidence;                // its posterior
+} HmmTracker;
+
+void hmmInit(HmmTracker *h, const StateIndex *idx, double sigma);
+void hmmReset(HmmTracker *h, int state);
+void hmmSetNoise(HmmTracker *h, double noise);
+void hmmSetState(HmmTracker *h, int state, double mean, double scale);
+int  hmmUpdate(HmmTracker *h, double weight);
+
+#endif
@@ -1,4 +1,8 @@
 #include "hx711.h"
+#include "estimator.h"
+#include "tare.h"
+#include "source.h"
+#include "timing.h"
 #include <unistd.h>
 
 /**
@@ -21,13 +25,61 @@ void setHighPri (void)
 }
 
 
+// Data lines of all HX711s sharing CLOCK_PIN, channel 0 is the default DATA_PIN
+static int numChannels = 1;
+static int dataPins[HX711_MAX_CHANNELS] = { DATA_PIN };
+static unsigned dataMask = 1 << DATA_PIN;
+
 void setup_gpio()
 {
-	INP_GPIO(DATA_PIN);
+	int c;
+	for (c = 0; c < numChannels; c++) {
+		INP_GPIO(dataPins[c]);
+	}
 	INP_GPIO(CLOCK_PIN);  OUT_GPIO(CLOCK_PIN);
 	SCK_OFF;
 }
 
+/**
+ hx711SetDataPins(const int *pins, int n)
+
+ configure the data pin of each HX711 on the shared clock, call before initHX711().
+ Returns the number of channels configured, pins outside bank 0 (GPIO 0-31) are rejected
+*/
+int hx711SetDataPins(const int *pins, int n) {
+	int c;
+
+	if (n < 1 || n > HX711_MAX_CHANNELS) return -1;
+	for (c = 0; c < n; c++) {
+		if (pins[c] < 0 || pins[c] > 31 || pins[c] == CLOCK_PIN) return -1;
+	}
+
+	numChannels = n;
+	dataMask = 0;
+	for (c = 0; c < n; c++) {
+		dataPins[c] = pins[c];
+		dataMask |= 1 << pins[c];
+	}
+	return n;
+}
+
+// Parse a pin list such as "21,16,12" or "21+16+12", returns the count or -1
+int hx711ParsePins(const char *list, int *pins, int max) {
+	int n = 0;
+	char *end;
+
+	while (*list && n < max) {
+		pins[n++] = (int) strtol(list, &end, 10);
+		if (end == list) return -1;
+		list = (*end == ',' || *end == '+') ? end + 1 : end;
+	}
+	return (*list == 0) ? n : -1;
+}
+
+int hx711Channels() {
+	return numChannels;
+}
+
 void unpull_pins()
 {
    GPIO_PULL = 0;
@@ -38,98 +90,149 @@ void unpull_pins()
    GPIO_PULLCLK0 = 0;
 } // unpull_pins
 
-//hack for testing what works on the faster Pi3, see below - should probably be replaced with proper usleep
-void delay(int i) {
-	static clock_t timer;
-	timer = clock();
-	while (clock() - timer < i);  
-}
+static int gain = 0; //default Ch.a, Gain 128 (see set_gain())
+
+// Channel scheduling: the pulses after each conversion pick the input of the next one
+static int pendingGain = 0;  // gain code the conversion in progress was configured with
+static int lastGain = 0;     // gain code of the conversion most recently read
+static int interleaved = 0;  // alternate channel A (at gain) and channel B
+
+#define GAIN_CHANNEL(r) ((r) == HX711_GAIN_B ? HX711_CH_B : HX711_CH_A)
+
+static Hx711Stats stats;
+
+static int read_frame(long *values, int nextGain);
 
 void initHX711() {
 	setHighPri();
+	timingInit();
 	setup_io();
 	setup_gpio();
 	reset_converter();
 }
 
 /**
- getCleanSample(int numSamples, int spread)
+ getCleanSample(int numSamples)
 
- get a clean sample, by sampling numSamples times, and averaging while filtering out any samples outside the specified filter spread
+ get a clean sample, by sampling numSamples times through the streaming estimator (see estimator.h),
+ averaging while filtering out any samples outside a MAD-based band around the rolling median.
 
- will try a maximum of 10 times in a row to get a clean sample, fails with value of 0
+ returns 0 if the source delivers no samples
 */
-long getCleanSample(int numSamples, int spread) {
-
-	int i, j=0, k=0;
-	long tmp=0;
-	long tmp_avg=0;
-	long tmp_avg2;
-	long offset=0;
-	float filter_low, filter_high;
-	float spread_percent = spread / 100.0 /2.0;
-	int b;
-	long samples[numSamples];
-
-
-	while (j==0 && k<10) {
-		k++;
-	
-		tmp_avg =0;
-	
-		// get the dirty samples and average them
-		for(i=0;i<numSamples;i++) {
-			samples[i] = read_value();
-			tmp_avg += samples[i];
+long getCleanSample(int numSamples) {
+
+	int i, kept=0, result;
+	long long sum=0;
+	Estimator e;
+	Sample s;
+
+	estimatorInit(&e, numSamples, ESTIMATOR_K, ESTIMATOR_MIN_BAND);
+
+	for(i=0;i<numSamples;i++) {
+		// failed reads are retried (the source backs off and resets the converter), only the end stops
+		while ((result = sourceRead(&s)) == SOURCE_ERROR);
+		if (result != SOURCE_OK) break;
+		estimatorPush(&e, s.value);
+		if (!e.rejected) {
+			sum += s.value;
+			kept++;
 		}
+	}
 
-		//calculate dirty average
-		tmp_avg = tmp_avg / numSamples;
+	// a window holding every sample already has the answer, longer runs average what the window accepted
+	if (i <= e.size || kept == 0) {
+		return e.value;
+	}
+	return sum / kept;
+}
 
-		tmp_avg2 = 0;
-	
-		j=0;
+/**
+ getAdaptiveTare(double target, Tare *t)
 
-		filter_low =  (float) tmp_avg * (1.0 - spread_percent);
-		filter_high = (float) tmp_avg * (1.0 + spread_percent);
+ sample until the tare is known to within target counts (95% confidence), restarting whenever
+ the table is disturbed (see tare.h). Progress and restarts are left in t.
 
-		for(i=0;i<numSamples;i++) {
-			if ((samples[i] <= filter_high && samples[i] >= filter_low) || 
-			    (samples[i] >= filter_high && samples[i] <= filter_low) ) {
-				tmp_avg2 += samples[i];
-			    j++;
-			}
+ returns the tare, or the mean so far if the source ends first
+*/
+long getAdaptiveTare(double target, Tare *t) {
+	Sample s;
+	int result;
+
+	tareInit(t, target);
+	while ((result = sourceRead(&s)) != SOURCE_END) {
+		if (result != SOURCE_OK) continue;
+
+		result = tarePush(t, s.value);
+		if (result == TARE_DONE) return t->value;
+		if (result == TARE_RESTARTED) {
+			printf("\nScale disturbed, restarting tare... ");
+			fflush(stdout);
 		}
-
 	}
-
-	return tmp_avg2/j;
+	return lround(t->mean);
 }
 
 /**
- speedTest runs 100 samples, and returns 
+ speedTest runs 100 samples, and returns the achieved samples per second
 */
 float speedTest() {
 	int i;
-	clock_t t1, t2;
+	uint64_t t1, t2;
 
 	reset_converter();
 
-	t1 = clock();
+	t1 = timingNanos();
 	for(i=0;i<100;i++) {
 		read_value();
 	}
 
-	t2 = clock();
+	t2 = timingNanos();
 
-	float diff = ((float)(t2 - t1) / CLOCKS_PER_SEC ) *  1000;
+	float diff = (t2 - t1) / 1000000.0;
 	float sps = 1000/(diff/100);
 
-	//printf("%d samples took %f ms, %f sps\n",N_SAMPLES, diff, sps);
-
 	return sps;
 }
 
+/**
+ benchReadValue(int numSamples, Hx711Bench *bench)
+
+ time numSamples conversions, separating the bit-banged frame itself from the wait for data ready
+*/
+void benchReadValue(int numSamples, Hx711Bench *bench) {
+	int i;
+	uint64_t start, ready, done, frame;
+	uint64_t total = 0, frameTotal = 0, frameMax = 0;
+	long values[HX711_MAX_CHANNELS];
+
+	reset_converter();
+
+	for(i=0;i<numSamples;i++) {
+		start = timingNanos();
+		if (hx711WaitReady(HX711_READY_TIMEOUT_US) != HX711_OK) break;
+		ready = timingNanos();
+		read_frame(values, gain);
+		done = timingNanos();
+
+		frame = done - ready;
+		frameTotal += frame;
+		if (frame > frameMax) frameMax = frame;
+		total += done - start;
+	}
+
+	// a converter that stops answering ends the bench early
+	numSamples = (i > 0) ? i : 1;
+
+	bench->samples = i;
+	bench->channels = numChannels;
+	bench->bits = 24 + gain + 1;
+	bench->frameUs = frameTotal / 1000.0 / numSamples;
+	bench->frameMaxUs = frameMax / 1000.0;
+	bench->bitUs = bench->frameUs / bench->bits;
+	bench->sps = numSamples / (total / 1000000000.0);
+	bench->loopsPerUs = timingLoopsPerUs();
+}
+
 
 void uninit() {
   unpull_pins();
@@ -142,67 +245,313 @@ void reset_converter(void) {
 	usleep(60);
 	SCK_OFF;
 	usleep(60);
+
+	// power-up always starts on channel A, gain 128
+	pendingGain = HX711_GAIN_A128;
+}
+
+/**
+ hx711Recover()
+
+ bring the converters back after a timeout or corrupted read: re-assert the pin modes
+ (a brown-out or a hot-plugged cable can leave them wrong), power cycle through SCK and
+ restore the gain, which power-up resets to channel A at 128
+*/
+void hx711Recover(void) {
+	setup_gpio();
+	reset_converter();
+	lastGain = HX711_GAIN_A128;
+	stats.recoveries++;
+	if (gain != HX711_GAIN_A128 && !interleaved) set_gain(gain);
 }
 
-// r = 0 - Ch.A, Gain 128
-// r = 1 - Ch.B, Gain 64
-// r = 2 - Ch.A, Gain 32 <<<**** Different data sheets say different things about this configuration. Do not rely on this just working - test in your setup.
-static int gain = 0; //default Ch.a, Gain 128
-void set_gain(int r) {
+// r = 0 - Ch.A, Gain 128 (HX711_GAIN_A128)
+// r = 1 - Ch.B, Gain 64 (HX711_GAIN_B)
+// r = 2 - Ch.A, Gain 32 (HX711_GAIN_A_ALT) <<<**** Different data sheets say different things about this configuration. Do not rely on this just working - test in your setup.
+//
+// returns HX711_OK, or HX711_ERR_TIMEOUT if the converter never became ready (gain is applied from the next read)
+int set_gain(int r) {
 	int i;
 	gain = r;
 
-	//wait for data ready
-	while( DT_R ); 
+	//wait for data ready on every channel
+	if (hx711WaitReady(HX711_READY_TIMEOUT_US) != HX711_OK) return HX711_ERR_TIMEOUT;
 
 	//pull out a reading and configure appropriately for next reading
 	for (i=0;i<24+r+1;i++) {
 		SCK_ON;
+		timingDelayNs(HX711_PULSE_NS);
 		SCK_OFF;
+		timingDelayNs(HX711_PULSE_NS);
 	}
+	pendingGain = r;
+	return HX711_OK;
 }
 
+/**
+ hx711Interleave(int enable)
 
-unsigned long read_value() {
-	long count; //store the shifted-in data
-	int i; 		//iterator
+ alternate conversions between channel A (at the gain chosen with set_gain()) and channel B.
+ Each channel then converts at half the output data rate; use hx711LastChannel() after a read
+ to route the value to its channel's stream
+*/
+void hx711Interleave(int enable) {
+	interleaved = enable;
+}
+
+// Channel (HX711_CH_A/B) of the conversion the chip is producing now, i.e. the next one read
+int hx711NextChannel() {
+	return GAIN_CHANNEL(pendingGain);
+}
+
+// Channel (HX711_CH_A/B) of the conversion most recently read
+int hx711LastChannel() {
+	return GAIN_CHANNEL(lastGain);
+}
+
+void hx711StreamInit(Hx711Stream *stream, int window) {
+	estimatorInit(&stream->est, window, ESTIMATOR_K, ESTIMATOR_MIN_BAND);
+	stream->tare = 0;
+	stream->value = 0;
+	stream->count = 0;
+}
+
+/**
+ readStreams(Hx711Stream *streams)
+
+ read one conversion and push it into the stream of the channel it came from,
+ streams[HX711_CH_A] and streams[HX711_CH_B]. Returns that channel, or a read_multi() error
+*/
+int readStreams(Hx711Stream *streams) {
+	long values[HX711_MAX_CHANNELS];
+	long sum = 0;
+	int c, n = read_multi(values);
+	Hx711Stream *stream = &streams[hx711LastChannel()];
 
-	count = 0;
+	if (n < 0) return n;
 
-	//can be replaced with a proper usleep
-	const int DELAYLENGTH = 4;
+	for (c = 0; c < n; c++) {
+		sum += values[c];
+	}
+
+	stream->value = estimatorPush(&stream->est, sum) - stream->tare;
+	stream->count++;
+	return hx711LastChannel();
+}
+
+// Channel A gain code for interleaving, set_gain() values other than channel B
+static int channelAGain() {
+	return (gain == HX711_GAIN_B) ? HX711_GAIN_A128 : gain;
+}
+
+
+// Data ready: each HX711 pulls DOUT low once a conversion is available
+int hx711Ready() {
+	return (GPIO_IN0 & dataMask) == 0;
+}
+
+/**
+ hx711WaitReady(uint32_t timeoutUs)
+
+ wait for data ready on every channel, at most timeoutUs. Spins for HX711_SPIN_US since a
+ conversion is often nearly done, then sleeps with doubling intervals up to HX711_POLL_US so a
+ missing or dead converter cannot pin a core at real-time priority.
+
+ returns HX711_OK or HX711_ERR_TIMEOUT
+*/
+int hx711WaitReady(uint32_t timeoutUs) {
+	uint32_t start = timingMicros();
+	uint32_t waited;
+	unsigned sleepUs = 0;
+
+	while (!hx711Ready()) {
+		waited = timingMicros() - start;
+		if (waited >= timeoutUs) return HX711_ERR_TIMEOUT;
+		if (waited < HX711_SPIN_US) continue;
+
+		sleepUs = (sleepUs == 0) ? HX711_SLEEP_MIN_US : sleepUs * 2;
+		if (sleepUs > HX711_POLL_US) sleepUs = HX711_POLL_US;
+		usleep(sleepUs);
+	}
+	return HX711_OK;
+}
+
+// Histogram bin for a duration: bin 0 is under 1us, bin b covers [2^(b-1), 2^b) us, the last bin is open-ended
+static int histBin(uint64_t ns) {
+	uint64_t us = ns / 1000;
+	int b = 0;
+	while (us > 0 && b < HX711_HIST_BINS - 1) {
+		us >>= 1;
+		b++;
+	}
+	return b;
+}
+
+/**
+ recordFrame(const uint64_t *stamps, int pulses)
+
+ account a frame from the time stamp taken before each SCK pulse plus one after the last,
+ returns the longest pulse period in ns. A period bounds the SCK high time inside it, so
+ preemption while SCK is high shows up here
+*/
+static uint64_t recordFrame(const uint64_t *stamps, int pulses) {
+	uint64_t period, longest = 0, frame = stamps[pulses] - stamps[0];
+	int i;
+
+	for (i = 0; i < pulses; i++) {
+		period = stamps[i + 1] - stamps[i];
+		stats.bitHist[histBin(period)]++;
+		if (period > longest) longest = period;
+	}
+	stats.frameHist[histBin(frame)]++;
+	stats.frames++;
+
+	if (longest / 1000 > stats.maxBitUs) stats.maxBitUs = longest / 1000;
+	if (frame / 1000 > stats.maxFrameUs) stats.maxFrameUs = frame / 1000;
+	stats.lastStart = (uint32_t) (stamps[0] / 1000);
+	stats.lastEnd = (uint32_t) (stamps[pulses] / 1000);
+	return longest;
+}
+
+/**
+ read_frame(long *values, int nextGain)
+
+ clock one conversion out of every configured HX711, all DOUT lines must already be low,
+ then send the pulses that select nextGain (see set_gain()) for the following conversion.
+ The chips share SCK, so each bit costs one read of the bank 0 level register (the register
+ gpioReadBank1() returns) and the data lines are demultiplexed from it in software.
+
+ returns 0, or -1 if a pulse went over HX711_BIT_BUDGET_US and the values cannot be trusted
+*/
+static int read_frame(long *values, int nextGain) {
+	long count[HX711_MAX_CHANNELS]; //store the shifted-in data
+	uint64_t stamps[24 + HX711_GAIN_A_ALT + 2];
+	uint64_t longest;
+	unsigned bits;
+	int i, c, pulses = 24 + nextGain + 1;
+
+	for (c = 0; c < numChannels; c++) {
+		count[c] = 0;
+	}
 
-	//white for Data Ready
-	while( DT_R ); 
-	
-	delay(DELAYLENGTH);
+	timingDelayNs(HX711_PULSE_NS);
 
 	//read in the data
 	for(i=0;i<24; i++) {
+		stamps[i] = timingNanos();
 		SCK_ON;
-		delay(DELAYLENGTH);
-	    if (DT_R > 0 ) { count++; }
+		timingDelayNs(HX711_PULSE_NS);
+		bits = GPIO_IN0;
 	    SCK_OFF;
-		delay(DELAYLENGTH);
-	    count = count << 1;
+		for (c = 0; c < numChannels; c++) {
+			if (bits & (1 << dataPins[c])) { count[c]++; }
+			count[c] = count[c] << 1;
+		}
+		timingDelayNs(HX711_PULSE_NS);
 	}
 
 	//set gain for next reading
-	for (i=0; i<gain+1; i++) {
+	for (i=0; i<nextGain+1; i++) {
+		stamps[24 + i] = timingNanos();
 		SCK_ON;
-		delay(DELAYLENGTH);
+		timingDelayNs(HX711_PULSE_NS);
 
 		SCK_OFF;
-		delay(DELAYLENGTH);		
+		timingDelayNs(HX711_PULSE_NS);
 	}
+	stamps[pulses] = timingNanos();
 
 
 	//TODO: check correctness for negative values!
 	//  count = ~0x1800000 & count;
 	//  count = ~0x800000 & count;
-	if (count & 0x800000) {
-		count |= (long) ~0xffffff;
+	for (c = 0; c < numChannels; c++) {
+		if (count[c] & 0x800000) {
+			count[c] |= (long) ~0xffffff;
+		}
+		values[c] = count[c];
+	}
+
+	longest = recordFrame(stamps, pulses);
+	if (longest > HX711_BIT_BUDGET_US * 1000ULL) {
+		stats.corrupted++;
+		// SCK may have been high past the power-down limit, which also resets the channel to A/128
+		if (longest >= HX711_POWERDOWN_US * 1000ULL) {
+			pendingGain = HX711_GAIN_A128;
+		}
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ read_multi(long *values)
+
+ wait for every channel and read one conversion from each, returns the number of channels.
+ A frame whose bit timing went over budget is discarded and the next conversion read instead,
+ up to HX711_MAX_RETRIES times.
+
+ returns HX711_ERR_TIMEOUT if the converters are not ready within HX711_READY_TIMEOUT_US,
+ HX711_ERR_CORRUPT if every retry was over budget
+*/
+int read_multi(long *values) {
+	int attempt;
+
+	for (attempt = 0; ; attempt++) {
+		//wait for Data Ready on all channels
+		if (hx711WaitReady(HX711_READY_TIMEOUT_US) != HX711_OK) {
+			stats.timeouts++;
+			return HX711_ERR_TIMEOUT;
+		}
+
+		lastGain = pendingGain;
+		if (interleaved) {
+			pendingGain = (GAIN_CHANNEL(lastGain) == HX711_CH_A) ? HX711_GAIN_B : channelAGain();
+		} else {
+			pendingGain = gain;
+		}
+
+		if (read_frame(values, pendingGain) == 0) break;
+		if (attempt >= HX711_MAX_RETRIES) return HX711_ERR_CORRUPT;
+		stats.retries++;
 	}
+	return numChannels;
+}
+
+// Copy of the read timing statistics, safe to call from another thread (counters may be one frame apart)
+void hx711GetStats(Hx711Stats *out) {
+	*out = stats;
+}
+
+void hx711ResetStats() {
+	memset(&stats, 0, sizeof(stats));
+}
+
+/**
+ printHx711Stats(const Hx711Stats *st)
+
+ print the frame counters and the per-bit and per-frame duration histograms
+*/
+void printHx711Stats(const Hx711Stats *st) {
+	char label[16];
+	int b;
+
+	printf("HX711 frames: %lu, corrupted: %lu, retried: %lu, timeouts: %lu, recoveries: %lu, max bit %u us, max frame %u us\n",
+	       st->frames, st->corrupted, st->retries, st->timeouts, st->recoveries, st->maxBitUs, st->maxFrameUs);
+	printf("  %-12s %10s %10s\n", "duration", "bits", "frames");
+	for (b = 0; b < HX711_HIST_BINS; b++) {
+		if (st->bitHist[b] == 0 && st->frameHist[b] == 0) continue;
+		if (b == 0) snprintf(label, sizeof(label), "<1us");
+		else if (b == HX711_HIST_BINS - 1) snprintf(label, sizeof(label), ">=%uus", 1u << (b - 1));
+		else snprintf(label, sizeof(label), "%u-%uus", 1u << (b - 1), 1u << b);
+		printf("  %-12s %10lu %10lu\n", label, st->bitHist[b], st->frameHist[b]);
+	}
+}
+
+// Channel 0 of read_multi(), 0 if the read failed
+unsigned long read_value() {
+	long values[HX711_MAX_CHANNELS];
 
-	return count;
-}
\ No newline at end of file
+	if (read_multi(values) < 0) return 0;
+	return values[0];
+}
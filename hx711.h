@@ -5,20 +5,107 @@
 #include <stdlib.h>
 #include <time.h>
 #include <math.h>
+#include <stdint.h>
+#include "estimator.h"
+#include "tare.h"
 
 //Scale (HX711) connections
 #define CLOCK_PIN	20
 #define DATA_PIN	21
 
+// HX711s that can share CLOCK_PIN, each with its own data pin in GPIO bank 0
+#define HX711_MAX_CHANNELS 8
+
+// Input channels and set_gain() codes, see hx711.c for the data sheet caveats
+#define HX711_CH_A 0
+#define HX711_CH_B 1
+#define HX711_GAIN_A128   0
+#define HX711_GAIN_B      1
+#define HX711_GAIN_A_ALT  2
+
 //GPIO parameters
 #define SCK_ON  (GPIO_SET0 = (1 << CLOCK_PIN))
 #define SCK_OFF (GPIO_CLR0 = (1 << CLOCK_PIN))
 #define DT_R    (GPIO_IN0  & (1 << DATA_PIN))
 
+// Data-ready wait: spin briefly, then sleep with doubling intervals up to HX711_POLL_US.
+// At 10 SPS a conversion takes 100ms, a converter silent for HX711_READY_TIMEOUT_US is gone
+#define HX711_SPIN_US          100
+#define HX711_SLEEP_MIN_US     50
+#define HX711_POLL_US          500
+#define HX711_READY_TIMEOUT_US 500000
+
+// Read results, counts of channels read are positive
+#define HX711_OK           0
+#define HX711_ERR_TIMEOUT -1  // DOUT never went low: cable loose or converter dead
+#define HX711_ERR_CORRUPT -2  // every retry went over the timing budget
+
+// Minimum SCK high/low time is 0.2us (datasheet T3/T4), SCK high over 60us powers the chip down
+#define HX711_PULSE_NS 300
+
+// A pulse period over the budget marks the frame corrupt, SCK high past the power-down limit resets the chip
+#define HX711_BIT_BUDGET_US 50
+#define HX711_POWERDOWN_US  60
+#define HX711_MAX_RETRIES   3
+
+// Log2 duration bins, see printHx711Stats()
+#define HX711_HIST_BINS 12
+
+typedef struct {
+	unsigned long frames;     // frames clocked out, including discarded ones
+	unsigned long corrupted;  // frames with a pulse over HX711_BIT_BUDGET_US
+	unsigned long retries;    // corrupted frames replaced by the next conversion
+	unsigned long timeouts;   // data-ready waits that hit HX711_READY_TIMEOUT_US
+	unsigned long recoveries; // hx711Recover() calls
+	unsigned long bitHist[HX711_HIST_BINS];    // SCK pulse periods
+	unsigned long frameHist[HX711_HIST_BINS];  // whole frame durations
+	uint32_t      maxBitUs;
+	uint32_t      maxFrameUs;
+	uint32_t      lastStart;  // timingMicros() at the start and end of the latest frame
+	uint32_t      lastEnd;
+} Hx711Stats;
+
+typedef struct {
+	int   samples;     // conversions timed
+	int   channels;    // HX711s read per conversion
+	int   bits;        // SCK pulses per conversion (24 + gain select)
+	float frameUs;     // mean time to clock out one conversion
+	float frameMaxUs;  // worst conversion
+	float bitUs;       // mean time per SCK pulse
+	float sps;         // conversions per second including data-ready waits
+	float loopsPerUs;  // calibrated delay loop speed
+} Hx711Bench;
+
+// One input channel's conversions with their own tare and filtering (see readStreams())
+typedef struct {
+	Estimator est;
+	long      tare;
+	long      value;  // latest clean value minus tare
+	long      count;  // conversions received
+} Hx711Stream;
+
 void 		   initHX711();
 float		   speedTest();
-long 		   getCleanSample(int numSamples, int spread);
+void           benchReadValue(int numSamples, Hx711Bench *bench);
+long 		   getCleanSample(int numSamples);
+long           getAdaptiveTare(double target, Tare *t);
+int            hx711Ready();
+int            hx711WaitReady(uint32_t timeoutUs);
 void           reset_converter(void);
+void           hx711Recover(void);
 unsigned long  read_value();
-void           set_gain(int r);
-void           setHighPri (void);
\ No newline at end of file
+int            read_multi(long *values);
+int            hx711SetDataPins(const int *pins, int n);
+int            hx711ParsePins(const char *list, int *pins, int max);
+int            hx711Channels();
+void           hx711Interleave(int enable);
+int            hx711NextChannel();
+int            hx711LastChannel();
+void           hx711StreamInit(Hx711Stream *stream, int window);
+int            readStreams(Hx711Stream *streams);
+void           hx711GetStats(Hx711Stats *out);
+void           hx711ResetStats();
+void           printHx711Stats(const Hx711Stats *st);
+int            set_gain(int r);
+void           setHighPri (void);
+void           uninit();
\ No newline at end of file
@@ -0,0 +1,71 @@
+#include "kalman.h"
+
+/**
+
+	Adaptive weight filter for Music Bottles
+
+*/
+
+void kalmanInit(Kalman *k, double r) {
+	k->r = (r > KALMAN_R_MIN) ? r : KALMAN_R_MIN;
+	kalmanReset(k, 0);
+	k->primed = 0;  // the first measurement sets the level
+}
+
+// Continue from a known level (after a tare, a detected step or a warm start), keeping the learned noise
+void kalmanReset(Kalman *k, double level) {
+	k->x = level;
+	k->p = k->r;
+	k->q = KALMAN_Q_REST * k->r;
+	k->innovation = 0;
+	k->gain = 0;
+	k->moving = 0;
+	k->primed = 1;
+}
+
+/**
+ kalmanUpdate(Kalman *k, double z)
+
+ filter one measurement and return the new level estimate
+*/
+double kalmanUpdate(Kalman *k, double z) {
+	double rest, s, nu2;
+	int gated;
+
+	if (!k->primed) {
+		kalmanReset(k, z);
+		return k->x;
+	}
+
+	rest = KALMAN_Q_REST * k->r;
+	k->innovation = z - k->x;
+	nu2 = k->innovation * k->innovation;
+	s = k->p + k->q + k->r;
+	gated = (nu2 > KALMAN_GATE * KALMAN_GATE * s);
+
+	// Innovations at rest are measurement noise plus the estimate's own variance. A gated
+	// one counts clipped to the gate, enough to pull up an R that started too low but
+	// not enough for one real step to spoil the estimate
+	if (gated || !k->moving) {
+		double r = k->r + ((gated ? KALMAN_GATE * KALMAN_GATE * s : nu2) - s) / KALMAN_R_SMOOTHING;
+		k->r = (r > KALMAN_R_MIN) ? r : KALMAN_R_MIN;
+	}
+
+	if (gated) {
+		// The level moved: trust the measurement until the innovations are small again
+		k->q = nu2;
+		k->moving = 1;
+	} else {
+		k->q *= KALMAN_Q_DECAY;
+		if (k->q <= rest) {
+			k->q = rest;
+			k->moving = 0;
+		}
+	}
+
+	k->p += k->q;
+	k->gain = k->p / (k->p + k->r);
+	k->x += k->gain * k->innovation;
+	k->p *= 1 - k->gain;
+	return k->x;
+}
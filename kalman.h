@@ -0,0 +1,42 @@
+/**
+
+	Adaptive weight filter for Music Bottles
+
+	One-dimensional Kalman filter on a constant-level model. At rest the
+	process noise sits at a small fraction of the measurement noise, so the
+	gain is low and the readout quiet. An innovation beyond KALMAN_GATE
+	standard deviations means the level moved: the process noise jumps to the
+	innovation's size, the gain goes to almost 1 and the filter settles within
+	a few samples, then the process noise decays back to rest.
+
+	The measurement noise itself is learned from the innovations at rest, so
+	the same filter suits a quiet and a noisy load cell.
+
+*/
+
+#ifndef KALMAN_H
+#define KALMAN_H
+
+#define KALMAN_R_INIT        90000.0  // initial measurement variance, counts^2 (300 counts SD)
+#define KALMAN_R_MIN         100.0
+#define KALMAN_R_SMOOTHING   64       // samples, time constant of the noise estimate
+#define KALMAN_Q_REST        0.003    // process noise at rest, fraction of R (gain about 0.05)
+#define KALMAN_Q_DECAY       0.5      // per sample, back toward rest after a step
+#define KALMAN_GATE          4.0      // innovation in standard deviations that counts as a step
+
+typedef struct {
+	int    primed;
+	double x;           // level estimate
+	double p;           // its variance
+	double q;           // current process noise
+	double r;           // measurement noise, learned
+	double innovation;  // latest measurement minus prediction
+	double gain;        // latest Kalman gain
+	int    moving;      // 1 while the process noise is raised after a step
+} Kalman;
+
+void   kalmanInit(Kalman *k, double r);
+void   kalmanReset(Kalman *k, double level);
+double kalmanUpdate(Kalman *k, double z);
+
+#endif
@@ -0,0 +1,124 @@
+#include "latency.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+
+	Audio latency for Music Bottles
+
+	The callback hooks only compare two ticks and bump a counter; everything
+	that divides or prints runs in the main loop on snapshots, and the
+	counters are read as differences between snapshots so they may wrap.
+
+*/
+
+/**
+ latencyParse(LatencyConfig *c, const char *spec)
+
+ parse an output mode spec (see latency.h), returns -1 if it is malformed or a buffer size is
+ not a power of two from LATENCY_MIN_BUFFER to LATENCY_MAX_BUFFER
+*/
+int latencyParse(LatencyConfig *c, const char *spec) {
+	char buf[256];
+	char *opt, *save;
+
+	c->low = 0;
+	c->buffer = LATENCY_MAX_BUFFER;
+	c->budget = LATENCY_BUDGET;
+
+	snprintf(buf, sizeof(buf), "%s", spec ? spec : LATENCY_DEFAULT);
+	for (opt = strtok_r(buf, ",", &save); opt; opt = strtok_r(NULL, ",", &save)) {
+		char *value = strchr(opt, '='), *end;
+
+		if (strcmp(opt, "low") == 0) {
+			c->low = 1;
+			c->buffer = LATENCY_MIN_BUFFER;
+			continue;
+		}
+		if (value == NULL) return -1;
+		*value++ = 0;
+
+		if (strcmp(opt, "buffer") == 0) {
+			long frames = strtol(value, &end, 10);
+			if (*end || frames < LATENCY_MIN_BUFFER || frames > LATENCY_MAX_BUFFER || (frames & (frames - 1))) return -1;
+			c->buffer = frames;
+		} else if (strcmp(opt, "budget") == 0) {
+			c->budget = strtod(value, &end);
+			if (*end || c->budget <= 0 || c->budget > 1) return -1;
+		} else {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+// The buffer size to step up to, -1 if frames is already the largest
+int latencyNextBuffer(int frames) {
+	return (frames < LATENCY_MAX_BUFFER) ? frames * 2 : -1;
+}
+
+// Start monitoring a device that asks for frames at a time at rate frames per second
+void latencyInit(LatencyMonitor *m, int frames, int rate) {
+	memset(m, 0, sizeof(*m));
+	m->periodUs = (uint32_t) ((uint64_t) frames * 1000000 / rate);
+	m->lateUs = (uint32_t) (LATENCY_LATE_PERIODS * m->periodUs);
+	m->overrunUs = (uint32_t) (LATENCY_OVERRUN_FRACTION * m->periodUs);
+}
+
+// Audio thread, start of a callback
+void latencyBegin(LatencyMonitor *m, uint32_t tick) {
+	m->start = tick;
+	if (m->running && tick - m->lastStart > m->lateUs) {
+		__atomic_add_fetch(&m->stats.underruns, 1, __ATOMIC_RELAXED);
+	}
+	m->lastStart = tick;
+	m->running = 1;
+}
+
+// Audio thread, end of a callback
+void latencyEnd(LatencyMonitor *m, uint32_t tick) {
+	uint32_t busy = tick - m->start;
+
+	if (busy > m->overrunUs) __atomic_add_fetch(&m->stats.overruns, 1, __ATOMIC_RELAXED);
+	if (busy > __atomic_load_n(&m->stats.maxBusyUs, __ATOMIC_RELAXED)) {
+		__atomic_store_n(&m->stats.maxBusyUs, busy, __ATOMIC_RELAXED);
+	}
+	__atomic_add_fetch(&m->stats.busyUs, busy, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&m->stats.callbacks, 1, __ATOMIC_RELEASE);
+}
+
+// Audio thread, an underrun the device reported itself. The gap it leaves before the next callback is not counted again
+void latencyXrun(LatencyMonitor *m) {
+	__atomic_add_fetch(&m->stats.underruns, 1, __ATOMIC_RELAXED);
+	m->running = 0;
+}
+
+// Main loop: copy the counters and start a new maximum
+void latencySnapshot(LatencyMonitor *m, LatencyStats *s) {
+	s->callbacks = __atomic_load_n(&m->stats.callbacks, __ATOMIC_ACQUIRE);
+	s->underruns = __atomic_load_n(&m->stats.underruns, __ATOMIC_RELAXED);
+	s->overruns = __atomic_load_n(&m->stats.overruns, __ATOMIC_RELAXED);
+	s->busyUs = __atomic_load_n(&m->stats.busyUs, __ATOMIC_RELAXED);
+	s->maxBusyUs = __atomic_exchange_n(&m->stats.maxBusyUs, 0, __ATOMIC_RELAXED);
+}
+
+// What happened between two snapshots, the maximum is the later snapshot's
+void latencyDelta(const LatencyStats *now, const LatencyStats *then, LatencyStats *delta) {
+	delta->callbacks = now->callbacks - then->callbacks;
+	delta->underruns = now->underruns - then->underruns;
+	delta->overruns = now->overruns - then->overruns;
+	delta->busyUs = now->busyUs - then->busyUs;
+	delta->maxBusyUs = now->maxBusyUs;
+}
+
+// Share of the time the callback was busy over a delta
+double latencyLoad(const LatencyMonitor *m, const LatencyStats *delta) {
+	if (delta->callbacks == 0) return 0;
+	return (double) delta->busyUs / ((double) delta->callbacks * m->periodUs);
+}
+
+// 1 if a delta had callbacks, no xruns, and kept the callback within budget
+int latencyAcceptable(const LatencyMonitor *m, const LatencyStats *delta, double budget) {
+	return delta->callbacks > 0 && delta->underruns == 0 && delta->overruns == 0 && latencyLoad(m, delta) <= budget;
+}
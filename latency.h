@@ -0,0 +1,86 @@
+/**
+
+	Audio latency for Music Bottles
+
+	The mixer's buffer size is the output latency: 4096 frames at 22050 Hz
+	is 186 ms on top of detection. Smaller buffers mean the audio callback
+	has to run more often and on time, which an older Pi under HX711 load
+	may not manage. The output mode is chosen with a spec:
+
+	  buffer=N              a fixed buffer of N frames (default LATENCY_DEFAULT)
+	  low[,budget=F]        probe at startup for the smallest buffer that runs
+	                        without xruns and with the callback busy for at most
+	                        F of the time (default LATENCY_BUDGET)
+
+	Every callback is timed from its start (the music hook, which SDL_mixer
+	calls first) to its end (the post-mix hook), or with the ALSA output
+	every period rendered (see output.h):
+
+	  underrun   the callback started more than LATENCY_LATE_PERIODS periods
+	             after the previous one, the device has been starved, or
+	             the device reported one (latencyXrun())
+	  overrun    the callback took more than LATENCY_OVERRUN_FRACTION of a
+	             period, the next one is bound to be late
+
+	In low-latency mode LATENCY_STEP_XRUNS xruns within one
+	LATENCY_WINDOW_US window step the buffer up to the next size. The
+	counters here are written by the audio thread and read by the main loop
+	with atomics, so the monitor needs no lock either.
+
+*/
+
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stdint.h>
+
+#define LATENCY_DEFAULT "buffer=4096"
+
+#define LATENCY_MIN_BUFFER       256     // frames, smallest size probed
+#define LATENCY_MAX_BUFFER       4096    // frames, largest size stepped up to
+#define LATENCY_BUDGET           0.25    // default share of the time the callback may be busy
+#define LATENCY_LATE_PERIODS     1.5     // a callback later than this many periods counts as an underrun
+#define LATENCY_OVERRUN_FRACTION 0.75    // a callback busy for more than this share of a period counts as an overrun
+#define LATENCY_SETTLE_MS        300     // each probed size runs this long before it is measured
+#define LATENCY_PROBE_MS         1500    // and is then measured for this long
+#define LATENCY_WINDOW_US        10000000  // xruns are logged, and counted towards a step up, per window
+#define LATENCY_STEP_XRUNS       2
+
+typedef struct {
+	int    low;     // probe for the buffer size and step it up on xruns
+	int    buffer;  // frames, the fixed size or the one probed
+	double budget;
+} LatencyConfig;
+
+typedef struct {
+	uint32_t callbacks;
+	uint32_t underruns;
+	uint32_t overruns;
+	uint32_t busyUs;     // total time inside the callback, wraps
+	uint32_t maxBusyUs;  // longest callback since the previous snapshot
+} LatencyStats;
+
+typedef struct {
+	uint32_t periodUs;
+	uint32_t lateUs, overrunUs;
+	uint32_t start;      // tick the callback in progress started
+	uint32_t lastStart;
+	int      running;    // lastStart is valid
+
+	LatencyStats stats;  // written by the audio thread only, maxBusyUs also cleared by the reader
+} LatencyMonitor;
+
+int      latencyParse(LatencyConfig *c, const char *spec);
+int      latencyNextBuffer(int frames);
+
+void     latencyInit(LatencyMonitor *m, int frames, int rate);
+void     latencyBegin(LatencyMonitor *m, uint32_t tick);
+void     latencyEnd(LatencyMonitor *m, uint32_t tick);
+void     latencyXrun(LatencyMonitor *m);
+
+void     latencySnapshot(LatencyMonitor *m, LatencyStats *s);
+void     latencyDelta(const LatencyStats *now, const LatencyStats *then, LatencyStats *delta);
+double   latencyLoad(const LatencyMonitor *m, const LatencyStats *delta);
+int      latencyAcceptable(const LatencyMonitor *m, const LatencyStats *delta, double budget);
+
+#endif
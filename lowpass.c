@@ -1,5 +1,7 @@
 
 #include "hx711.h"
+#include "source.h"
+#include <unistd.h>
 
 void lowPassTest(const float alpha[],int n) {
   int i;
@@ -13,7 +15,7 @@ void lowPassTest(const float alpha[],int n) {
   static long* readingLastStable;
   static int* stableCount;
 
-  long value =  getCleanSample(2, 5);
+  long value =  getCleanSample(2);
    
   if (initSize!=n) {
     if (0==reading) {
@@ -62,8 +64,15 @@ void lowPassTest(const float alpha[],int n) {
 }
 
 int main(int argc, char **argv) {
+  const char *sourceSpec = SOURCE_DEFAULT;
+  int opt;
 
-  initHX711();
+  while ((opt = getopt(argc, argv, "s:")) != -1) {
+    if (opt == 's') sourceSpec = optarg;
+    else return -1;
+  }
+
+  if (sourceOpen(sourceSpec) < 0) return -1;
 
   while (1==1) {
      lowPassTest((const float[]){1, 0.50, 0.20 , 0.1},4);
@@ -0,0 +1,151 @@
+#include "margins.h"
+#include <math.h>
+
+/**
+
+	Per-state margins for Music Bottles
+
+	The statistics are kept by state number, so learning and lookups are O(1).
+	Matching walks the sorted index from a binary search: a learned mean stays
+	within the prior gate of the configured weight, so only the entries within
+	that plus the widest learned gate of the weight can qualify.
+
+*/
+
+// Keep the mean within the prior gate of the configured weight, so a drifting zero cannot walk a state into its neighbour
+static double clampMean(const Margins *m, int state, double mean) {
+	double expected = stateIndexWeight(m->idx, state);
+	double limit = MARGINS_GATE * m->priorSd;
+
+	if (mean < expected - limit) return expected - limit;
+	if (mean > expected + limit) return expected + limit;
+	return mean;
+}
+
+/**
+ marginsInit(Margins *m, const StateIndex *idx, double margin)
+
+ every state of the index at its configured weight, with the gate at +-margin
+*/
+void marginsInit(Margins *m, const StateIndex *idx, double margin) {
+	int i;
+
+	m->idx = idx;
+	m->priorSd = margin / MARGINS_GATE;
+	if (m->priorSd < MARGINS_MIN_SD) m->priorSd = MARGINS_MIN_SD;
+	m->maxSd = m->priorSd;
+
+	for (i = 0; i < idx->count; i++) {
+		StateMargin *s = &m->states[idx->entries[i].state];
+		s->count = MARGINS_PRIOR_COUNT;
+		s->mean = idx->entries[i].weight;
+		s->var = m->priorSd * m->priorSd;
+	}
+}
+
+/**
+ marginsAdd(Margins *m, int state, double weight)
+
+ one weight accepted as state, display units relative to the zero. Running mean and variance
+ with the oldest observations fading once MARGINS_MEMORY is reached
+*/
+void marginsAdd(Margins *m, int state, double weight) {
+	StateMargin *s = &m->states[state];
+	double d = weight - s->mean;
+
+	if (s->count < MARGINS_MEMORY) s->count++;
+	s->mean = clampMean(m, state, s->mean + d / s->count);
+	s->var += (d * (weight - s->mean) - s->var) / s->count;
+	if (marginsSd(m, state) > m->maxSd) m->maxSd = marginsSd(m, state);
+}
+
+// Restore a state's statistics (from the calibration file)
+void marginsSet(Margins *m, int state, double count, double mean, double var) {
+	StateMargin *s = &m->states[state];
+
+	s->count = (count < MARGINS_MEMORY) ? count : MARGINS_MEMORY;
+	s->mean = clampMean(m, state, mean);
+	s->var = (var > 0) ? var : 0;
+	if (marginsSd(m, state) > m->maxSd) m->maxSd = marginsSd(m, state);
+}
+
+double marginsSd(const Margins *m, int state) {
+	double sd = sqrt(m->states[state].var);
+	return (sd > MARGINS_MIN_SD) ? sd : MARGINS_MIN_SD;
+}
+
+// Mahalanobis distance of a weight from a state, in standard deviations
+double marginsDistance(const Margins *m, int state, double weight) {
+	return fabs(weight - m->states[state].mean) / marginsSd(m, state);
+}
+
+// 1 once a state has seen observations beyond its prior
+int marginsLearned(const Margins *m, int state) {
+	return m->states[state].count > MARGINS_PRIOR_COUNT;
+}
+
+// First entry position whose weight is >= w
+static int lowerBound(const StateIndex *idx, double w) {
+	int lo = 0, hi = idx->count;
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if (idx->entries[mid].weight < w) lo = mid + 1;
+		else hi = mid;
+	}
+	return lo;
+}
+
+/**
+ marginsMatch(const Margins *m, double weight, double *distance)
+
+ the state with the smallest Mahalanobis distance to weight, -1 if none is within MARGINS_GATE.
+ distance (may be NULL) receives the distance of the nearest state either way
+*/
+int marginsMatch(const Margins *m, double weight, double *distance) {
+	const StateIndex *idx = m->idx;
+	double reach = MARGINS_GATE * (m->maxSd + m->priorSd);
+	double best = HUGE_VAL;
+	int i, state = -1;
+
+	for (i = lowerBound(idx, weight - reach); i < idx->count && idx->entries[i].weight <= weight + reach; i++) {
+		double z = marginsDistance(m, idx->entries[i].state, weight);
+		if (z < best) {
+			best = z;
+			state = idx->entries[i].state;
+		}
+	}
+	if (distance) *distance = best;
+	return (best <= MARGINS_GATE) ? state : -1;
+}
+
+/**
+ marginsOverlap(const Margins *m, int *a, int *b)
+
+ the pair of states, at least one of them learned, whose gates come closest: the gap between
+ their means over the sum of their standard deviations. The gates overlap below MARGINS_GATE.
+ Returns -1 if no learned state is close enough to another for their gates to ever meet
+*/
+double marginsOverlap(const Margins *m, int *a, int *b) {
+	const StateIndex *idx = m->idx;
+	double reach = 2 * MARGINS_GATE * (m->maxSd + m->priorSd);
+	double best = -1;
+	int i, j;
+
+	for (i = 0; i < idx->count; i++) {
+		int x = idx->entries[i].state;
+
+		for (j = i + 1; j < idx->count && idx->entries[j].weight - idx->entries[i].weight <= reach; j++) {
+			int y = idx->entries[j].state;
+			double separation;
+
+			if (!marginsLearned(m, x) && !marginsLearned(m, y)) continue;
+			separation = fabs(m->states[y].mean - m->states[x].mean) / (marginsSd(m, x) + marginsSd(m, y));
+			if (best < 0 || separation < best) {
+				best = separation;
+				*a = x;
+				*b = y;
+			}
+		}
+	}
+	return best;
+}
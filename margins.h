@@ -0,0 +1,53 @@
+/**
+
+	Per-state margins for Music Bottles
+
+	WEIGHT_MARGIN is one compile-time +-20 for every state, but how much the
+	weight wanders at rest depends on the state: the mass on the platform
+	changes how it rings, and a configured cap weight may be a little off.
+	Each state keeps a running mean and variance of the weights accepted as
+	that state, and a weight matches the state whose mean is nearest in
+	standard deviations (Mahalanobis distance), within MARGINS_GATE of them.
+
+	Every state starts from the configured weight with a standard deviation of
+	margin / MARGINS_GATE, counted as MARGINS_PRIOR_COUNT observations, so
+	before anything is learned the gate is exactly +-margin. The running
+	statistics forget with an effective memory of MARGINS_MEMORY
+	observations, and the standard deviation never goes below MARGINS_MIN_SD,
+	so a quiet state tightens to a few units and a noisy one widens.
+
+*/
+
+#ifndef MARGINS_H
+#define MARGINS_H
+
+#include "stateindex.h"
+
+#define MARGINS_GATE        3.0     // standard deviations a match may be from the state's mean
+#define MARGINS_PRIOR_COUNT 50.0    // observations the configured weight and margin count as
+#define MARGINS_MEMORY      4000.0  // effective observations kept, about 50 s at rest at 80 SPS
+#define MARGINS_MIN_SD      2.0     // display units, slow creep between re-anchors stays inside
+
+typedef struct {
+	double count;  // observations, prior included, up to MARGINS_MEMORY
+	double mean;   // display units
+	double var;
+} StateMargin;
+
+typedef struct {
+	const StateIndex *idx;
+	double priorSd;
+	double maxSd;   // widest standard deviation any state has had, bounds the matching search
+	StateMargin states[STATE_MAX_STATES];  // by state, only those in the index are used
+} Margins;
+
+void   marginsInit(Margins *m, const StateIndex *idx, double margin);
+void   marginsAdd(Margins *m, int state, double weight);
+void   marginsSet(Margins *m, int state, double count, double mean, double var);
+double marginsSd(const Margins *m, int state);
+double marginsDistance(const Margins *m, int state, double weight);
+int    marginsMatch(const Margins *m, double weight, double *distance);
+double marginsOverlap(const Margins *m, int *a, int *b);
+int    marginsLearned(const Margins *m, int state);
+
+#endif
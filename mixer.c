@@ -0,0 +1,156 @@
+#include "mixer.h"
+#include <string.h>
+
+/**
+
+	Software mixer for Music Bottles
+
+	Per pass each audible voice is copied to the scratch buffer (wrapping
+	at the end of a looped sound to its loop start), faded in place and
+	added to a 32-bit sum, which is clipped to 16 bits once at the end. Four
+	full-scale voices cannot overflow the sum.
+
+*/
+
+void mixerInit(Mixer *m, FadeEngine *fader) {
+	memset(m, 0, sizeof(*m));
+	m->fader = fader;
+}
+
+// Control thread side of the queue: returns 1 if the command was queued, 0 if the queue was full
+static int pushCommand(MixerQueue *q, const MixerCommand *c) {
+	uint32_t head = q->head;
+	uint32_t tail = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+
+	if (head - tail >= MIXER_QUEUE_SIZE) {
+		__atomic_add_fetch(&q->dropped, 1, __ATOMIC_RELAXED);
+		return 0;
+	}
+
+	q->buf[head & (MIXER_QUEUE_SIZE - 1)] = *c;
+	__atomic_store_n(&q->head, head + 1, __ATOMIC_RELEASE);
+	return 1;
+}
+
+// Rendering thread side: returns 1 and fills c if a command was waiting
+static int popCommand(MixerQueue *q, MixerCommand *c) {
+	uint32_t tail = q->tail;
+	uint32_t head = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+
+	if (head == tail) return 0;
+
+	*c = q->buf[tail & (MIXER_QUEUE_SIZE - 1)];
+	__atomic_store_n(&q->tail, tail + 1, __ATOMIC_RELEASE);
+	return 1;
+}
+
+/**
+ mixerPlay(Mixer *m, int channel, const Pcm *pcm, int loop)
+
+ control thread: play pcm on a channel from the start, replacing whatever it played. Returns 0 if
+ the queue was full
+*/
+int mixerPlay(Mixer *m, int channel, const Pcm *pcm, int loop) {
+	MixerCommand c = {channel, pcm, loop};
+
+	if (channel < 0 || channel >= FADE_CHANNELS) return 0;
+	return pushCommand(&m->queue, &c);
+}
+
+// Control thread: stop a channel, -1 for every channel. Returns 0 if the queue was full
+int mixerHalt(Mixer *m, int channel) {
+	int i, queued = 1;
+
+	if (channel >= 0) return mixerPlay(m, channel, NULL, 0);
+	for (i = 0; i < FADE_CHANNELS; i++) queued &= mixerPlay(m, i, NULL, 0);
+	return queued;
+}
+
+// Control thread: commands the rendering thread has not taken yet. Once
+// none are left, no voice refers to a sound halted before
+int mixerPending(Mixer *m) {
+	return (int) (m->queue.head - __atomic_load_n(&m->queue.tail, __ATOMIC_ACQUIRE));
+}
+
+// Move a voice on by n frames: a looped sound carries on from its loop
+// start, any other ends, and so does a loop with no frames
+static void advance(MixerVoice *v, int n) {
+	const Pcm *pcm = v->pcm;
+
+	v->pos += n;
+	if (v->pos < pcm->frames) return;
+	if (v->loop && pcm->frames > pcm->loopStart) v->pos = pcm->loopStart + (v->pos - pcm->frames) % (pcm->frames - pcm->loopStart);
+	else v->pcm = NULL;
+}
+
+// The next n frames of a voice into the scratch buffer, silence past the end of a sound that is not looped
+static void fetch(Mixer *m, MixerVoice *v, int n) {
+	int16_t *dst = m->scratch;
+	uint32_t pos = v->pos;
+
+	while (n > 0) {
+		uint32_t run = v->pcm->frames - pos;
+		if (run > (uint32_t) n) run = n;
+		memcpy(dst, v->pcm->data + 2 * pos, run * 2 * sizeof(int16_t));
+		dst += 2 * run;
+		n -= run;
+		pos += run;
+		if (pos == v->pcm->frames) {
+			if (!v->loop || v->pcm->frames <= v->pcm->loopStart) break;
+			pos = v->pcm->loopStart;
+		}
+	}
+	if (n > 0) memset(dst, 0, (size_t) n * 2 * sizeof(int16_t));
+}
+
+static void mixPass(Mixer *m, int16_t *out, int n) {
+	int c, i;
+
+	memset(m->sum, 0, (size_t) n * 2 * sizeof(int32_t));
+	for (c = 0; c < FADE_CHANNELS; c++) {
+		MixerVoice *v = &m->voice[c];
+		const Envelope *e = &m->fader->env[c];
+
+		if (v->pcm == NULL) continue;
+		if (e->gain == 0 && e->pos >= e->frames) {
+			advance(v, n);
+			continue;
+		}
+
+		fetch(m, v, n);
+		fadeProcess(m->fader, c, m->scratch, n, 2);
+		for (i = 0; i < 2 * n; i++) m->sum[i] += m->scratch[i];
+		advance(v, n);
+	}
+
+	for (i = 0; i < 2 * n; i++) {
+		int32_t x = m->sum[i];
+		out[i] = (int16_t) ((x > INT16_MAX) ? INT16_MAX : (x < INT16_MIN) ? INT16_MIN : x);
+	}
+}
+
+/**
+ mixerRender(Mixer *m, int16_t *out, int frames)
+
+ rendering thread: take any queued commands, then mix frames of interleaved stereo into out
+*/
+void mixerRender(Mixer *m, int16_t *out, int frames) {
+	MixerCommand c;
+
+	while (popCommand(&m->queue, &c)) {
+		MixerVoice *v = &m->voice[c.channel];
+		v->pcm = (c.pcm && c.pcm->frames) ? c.pcm : NULL;
+		v->pos = 0;
+		v->loop = c.loop;
+	}
+
+	// Fade commands are taken even while every voice is idle
+	fadeProcess(m->fader, -1, NULL, 0, 2);
+
+	while (frames > 0) {
+		int n = (frames < MIXER_MAX_FRAMES) ? frames : MIXER_MAX_FRAMES;
+		mixPass(m, out, n);
+		out += 2 * n;
+		frames -= n;
+	}
+}
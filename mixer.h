@@ -0,0 +1,60 @@
+/**
+
+	Software mixer for Music Bottles
+
+	The ALSA output renders its period buffers with this: sounds (see wav.h)
+	play on FADE_CHANNELS voices, each through the fade engine, and are
+	summed with saturation into interleaved stereo. Play and halt commands
+	come from the control thread through a lock-free single-producer/
+	single-consumer queue, the same scheme as the fade engine's, so starting
+	a track never blocks the thread that renders.
+
+	A voice whose gain is at rest at 0 is not mixed at all, only its
+	position advances, so silent tracks stay in step for nothing.
+
+*/
+
+#ifndef MIXER_H
+#define MIXER_H
+
+#include <stdint.h>
+#include "fade.h"
+#include "wav.h"
+
+#define MIXER_QUEUE_SIZE 16    // commands, must be a power of two
+#define MIXER_MAX_FRAMES 1024  // frames mixed per pass, longer buffers take several
+
+typedef struct {
+	int        channel;
+	const Pcm *pcm;   // NULL halts the channel
+	int        loop;
+} MixerCommand;
+
+typedef struct {
+	MixerCommand buf[MIXER_QUEUE_SIZE];
+	uint32_t head;     // next slot to write, owned by the control thread
+	uint32_t tail;     // next slot to read, owned by the rendering thread
+	uint32_t dropped;
+} MixerQueue;
+
+typedef struct {
+	const Pcm *pcm;  // NULL while idle
+	uint32_t   pos;  // next frame
+	int        loop;
+} MixerVoice;
+
+typedef struct {
+	FadeEngine *fader;
+	MixerQueue  queue;
+	MixerVoice  voice[FADE_CHANNELS];
+	int32_t     sum[2 * MIXER_MAX_FRAMES];
+	int16_t     scratch[2 * MIXER_MAX_FRAMES];
+} Mixer;
+
+void mixerInit(Mixer *m, FadeEngine *fader);
+int  mixerPlay(Mixer *m, int channel, const Pcm *pcm, int loop);
+int  mixerHalt(Mixer *m, int channel);
+int  mixerPending(Mixer *m);
+void mixerRender(Mixer *m, int16_t *out, int frames);
+
+#endif
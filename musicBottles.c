@@ -5,15 +5,31 @@ Music Bottles v4 by Tal Achituv
 Based on code by Tomer Weller, Jasmin Rubinovitz, as well as the general idea of previous Music Bottles versions
 
 Simplified weight change detection system:
-- Auto tare on start
-- Detect cap removal by weight delta matching
-- Uses precomputed weight table for all 8 cap combinations
+- Auto tare on start, re-tare in the background with the GPIO 26 button
+- Detect cap and bottle removal by weight delta matching
+- Uses a sorted index of the expected weight of every state, up to 8 bottles (see stateindex.h)
+- Tracks the state with an HMM that favours one bottle changing at a time (see hmm.h)
+- Re-anchors on every stable plateau, so drift and foreign objects do not need a re-tare (see plateau.h),
+  and follows the zero continuously while all caps are on
+- Optionally tells caps of similar weight apart by the transient of the lift (see transient.h)
 - Plays classic tracks and birthday song (when all caps removed)
 
 */
 
 #include "audio.h"
 #include "hx711.h"
+#include "acquire.h"
+#include "timing.h"
+#include "estimator.h"
+#include "calib.h"
+#include "step.h"
+#include "stateindex.h"
+#include "hmm.h"
+#include "margins.h"
+#include "kalman.h"
+#include "plateau.h"
+#include "transient.h"
+#include "vibration.h"
 #include "minimal_gpio.c"
 #include <unistd.h>
 
@@ -25,34 +41,80 @@ Simplified weight change detection system:
 #define BOT3_PIN 23
 #define CAP3_PIN 24
 
-// Weight detection error margin (+-20)
+// Re-tare button, to ground, with the internal pull-up
+#define RETARE_PIN 26
+#define RETARE_DEBOUNCE_US 50000
+
+// Bottles with LEDs and an audio track, any further bottles only take part in detection
+#define LED_BOTTLES  3
+#define AUDIO_TRACKS 3
+
+// Weight detection error margin (+-20), each state's margin is learned from there (see margins.h)
 #define WEIGHT_MARGIN 20
 
+// Samples in the streaming estimator window: grows to the max at rest, cut to the min while the weight moves
+#define ESTIMATE_WINDOW     16
+#define ESTIMATE_MIN_WINDOW 2
+
+// Cap weights are in display units, 100 raw counts each
+#define COUNTS_PER_UNIT 100
+
+// Fades run in the mixer, the main loop checks this often for ones that have finished
+#define FADE_INTERVAL_US 50000
+
+// HX711 read timing (hx711 source only) and audio callback statistics are logged this often
+#define STATS_INTERVAL_US 600000000
+
 // Global state
 long tare = 0;
-int cap1, cap2, cap3;  // Cap weights from CLI args
 long smoothedWeight = 0;  // Smoothed weight reading (relative to tare)
+Kalman weightFilter;      // produces smoothedWeight, see kalman.h
+
+// Bottle and cap weights from the CLI, display units
+int numBottles = 0;
+long capWeights[STATE_MAX_BOTTLES];
+long bottleWeights[STATE_MAX_BOTTLES];  // 0 unless given with -b: only the cap can be removed
+
+// Expected weight delta of every state, sorted for matching
+StateIndex stateIndex;
+
+// Weight statistics learned per state, matching is by distance in standard deviations
+Margins margins;
+
+// Posterior over the states, a change is acted on once its state reaches HMM_CONFIDENCE
+HmmTracker tracker;
+
+// Plateau deltas re-anchor the zero, its offset holds drift and foreign weight since the tare
+PlateauTracker plateaus;
 
-// Precomputed weight table for all 8 states (indexed by cap state bitmask)
-// Index: bit0=cap1, bit1=cap2, bit2=cap3 (1=removed, 0=on)
-// Value: expected weight delta when those caps are removed
-long weightTable[8];
-
-// State names for debugging
-const char *stateNames[8] = {
-	"All caps on",      // 0b000: off, off, off
-	"Cap1 removed",     // 0b001: on, off, off -> track 1
-	"Cap2 removed",     // 0b010: off, on, off -> track 2
-	"Cap1+2 removed",   // 0b011: on, on, off -> track 1+2
-	"Cap3 removed",     // 0b100: off, off, on -> track 3
-	"Cap1+3 removed",   // 0b101: on, off, on -> track 1+3
-	"Cap2+3 removed",   // 0b110: off, on, on -> track 2+3
-	"BIRTHDAY MODE"     // 0b111: on, on, on -> birthday
-};
-
-// Current detected state (0-7)
+// Transient classifier, only with -k: raw conversions around each step, and the state the step left
+int transientEnabled = 0;
+TransientModel transientModel;
+TransientCapture capture;
+int transientFrom = 0;
+
+// Filter bank and impact detector on the raw conversions, state changes are held while the table shakes
+Vibration vibration;
+
+// Current detected state, one base-3 digit per bottle (0 = everything on the table)
 int currentState = 0;
 
+// LED outputs need /dev/mem, so they are only driven with the hardware sample source
+int gpioEnabled = 0;
+
+// Persisted calibration, NULL when warm start is off (see calib.h)
+const char *calibPath = NULL;
+Calibration calib;
+uint32_t lastCalibSave = 0;
+
+// Background re-tare, started by the button and fed from the main loop (see tare.h)
+double tareTarget = 0;  // confidence half-width, counts
+Tare retare;
+int retaring = 0;
+
+// Set while the scale is not answering, audio and LEDs are parked in the safe state
+int sensorLost = 0;
+
 void setupGPIO() {
 	if (gpioInitialise() < 0) exit(-1);
 	
@@ -63,64 +125,92 @@ void setupGPIO() {
 	gpioSetMode(CAP2_PIN, PI_OUTPUT);
 	gpioSetMode(BOT3_PIN, PI_OUTPUT);
 	gpioSetMode(CAP3_PIN, PI_OUTPUT);
+	
+	gpioSetMode(RETARE_PIN, PI_INPUT);
+	gpioSetPullUpDown(RETARE_PIN, PI_PUD_UP);
+	gpioEnabled = 1;
 }
 
 void setBottleLEDs(int state) {
-	// Signal Arduino based on which caps are removed
-	int cap1Removed = state & 0x01;
-	int cap2Removed = state & 0x02;
-	int cap3Removed = state & 0x04;
-	
-	gpioWrite(BOT1_PIN, 1);
-	gpioWrite(CAP1_PIN, cap1Removed ? 0 : 1);
-	gpioWrite(BOT2_PIN, 1);
-	gpioWrite(CAP2_PIN, cap2Removed ? 0 : 1);
-	gpioWrite(BOT3_PIN, 1);
-	gpioWrite(CAP3_PIN, cap3Removed ? 0 : 1);
-}
-
-// Initialize weight table for all 8 cap combinations
-void initWeightTable() {
-	// Weight delta is negative sum of removed cap weights
-	weightTable[0] = 0;                         // No caps removed
-	weightTable[1] = -cap1;                     // Cap1 removed
-	weightTable[2] = -cap2;                     // Cap2 removed
-	weightTable[3] = -cap1 - cap2;              // Cap1+2 removed
-	weightTable[4] = -cap3;                     // Cap3 removed
-	weightTable[5] = -cap1 - cap3;              // Cap1+3 removed
-	weightTable[6] = -cap2 - cap3;              // Cap2+3 removed
-	weightTable[7] = -cap1 - cap2 - cap3;       // All caps removed
-}
-
-// Find which state matches the current weight delta
+	// Signal Arduino based on which bottles and caps are on the table
+	const int botPins[LED_BOTTLES] = {BOT1_PIN, BOT2_PIN, BOT3_PIN};
+	const int capPins[LED_BOTTLES] = {CAP1_PIN, CAP2_PIN, CAP3_PIN};
+	
+	if (!gpioEnabled) return;
+	
+	for (int i = 0; i < LED_BOTTLES && i < numBottles; i++) {
+		int digit = stateDigit(state, i);
+		gpioWrite(botPins[i], digit != BOTTLE_REMOVED);
+		gpioWrite(capPins[i], digit == BOTTLE_COMPLETE);
+	}
+}
+
+// Readable state name, two rotating buffers so a printf can show an old and a new state
+const char *describeState(int state) {
+	static char names[2][128];
+	static int next = 0;
+	char *name = names[next];
+	
+	next = !next;
+	stateName(state, numBottles, name, sizeof(names[0]));
+	return name;
+}
+
+// Find the state nearest to the current weight delta in standard deviations, -1 if none is within its margin
 int matchState(long weightDelta) {
-	for (int i = 0; i < 8; i++) {
-		if (weightDelta >= weightTable[i] - WEIGHT_MARGIN &&
-		    weightDelta <= weightTable[i] + WEIGHT_MARGIN) {
-			return i;
-		}
+	return marginsMatch(&margins, weightDelta, NULL);
+}
+
+// A weight accepted as state at rest: update the state's margin and give the HMM the learned emission
+void learnMargin(int state, double weight) {
+	marginsAdd(&margins, state, weight);
+	hmmSetState(&tracker, state, margins.states[state].mean, marginsSd(&margins, state) / margins.priorSd);
+}
+
+/**
+ restoreMargins(const Calibration *saved)
+
+ margins learned in earlier runs. Warns when two states have grown into each other, the weights
+ then cannot tell them apart reliably
+*/
+void restoreMargins(const Calibration *saved) {
+	int restored = 0, a, b;
+	
+	for (int i = 0; i < saved->margins; i++) {
+		const CalibMargin *m = &saved->margin[i];
+		if (m->state >= STATE_MAX_STATES || tracker.posOf[m->state] < 0) continue;
+		marginsSet(&margins, m->state, m->count, m->mean, m->var);
+		hmmSetState(&tracker, m->state, margins.states[m->state].mean, marginsSd(&margins, m->state) / margins.priorSd);
+		restored++;
+	}
+	if (restored == 0) return;
+	printf("Learned margins: %d states\n", restored);
+	
+	double separation = marginsOverlap(&margins, &a, &b);
+	if (separation >= 0 && separation < MARGINS_GATE) {
+		printf("Warning: learned weights of '%s' (%.1f +/-%.1f) and '%s' (%.1f +/-%.1f) overlap\n",
+		       describeState(a), margins.states[a].mean, marginsSd(&margins, a),
+		       describeState(b), margins.states[b].mean, marginsSd(&margins, b));
 	}
-	return -1;  // Unknown state
 }
 
 // Apply audio based on cap state
 // Logic is decoupled: we determine target state for each of 4 tracks
-// based on 3 cap states, then apply appropriate transitions
+// based on the bottle states, then apply appropriate transitions
 void applyAudioState(int state) {
 	// Determine target state for each track
-	int birthdayMode = (state == 7);  // All 3 caps removed
-	
-	// Target state for each track (1 = should play, 0 = should stop)
-	int track1Target = !birthdayMode && (state & 0x01);  // Cap1 removed, not birthday
-	int track2Target = !birthdayMode && (state & 0x02);  // Cap2 removed, not birthday
-	int track3Target = !birthdayMode && (state & 0x04);  // Cap3 removed, not birthday
+	int birthdayMode = 1;  // All caps removed, every bottle still on the table
+	for (int i = 0; i < numBottles; i++) {
+		if (stateDigit(state, i) != BOTTLE_OPEN) birthdayMode = 0;
+	}
 	int birthdayTarget = birthdayMode;
 	
 	// Apply transitions for tracks 1-3
-	// Each track: if target is on -> volume up, if target is off -> fade out
-	track1Target ? volume(0, 105) : fadeOut(0);
-	track2Target ? volume(1, 105) : fadeOut(1);
-	track3Target ? volume(2, 105) : fadeOut(2);
+	// Each track plays while its bottle is open (cap removed, bottle present), not in birthday mode
+	for (int i = 0; i < AUDIO_TRACKS; i++) {
+		int target = !birthdayMode && i < numBottles && stateDigit(state, i) == BOTTLE_OPEN;
+		target ? volume(i, 105) : fadeOut(i);
+	}
 	
 	// Apply transition for birthday track
 	if (birthdayTarget) {
@@ -135,87 +225,510 @@ void applyAudioState(int state) {
 	}
 }
 
+// Plateau offset in raw counts, what the tare would be if it was taken now
+long anchorOffset() {
+	return lround(plateaus.offset * COUNTS_PER_UNIT);
+}
+
+// Write tare, smoothed weight and state through to the calibration file, with the re-anchored zero
+void saveCalibration() {
+	if (calibPath == NULL) return;
+	
+	calib.tare = tare + anchorOffset();
+	calib.weight = smoothedWeight - anchorOffset();
+	calib.state = currentState;
+	calib.margins = 0;
+	for (int i = 0; i < stateIndex.count && calib.margins < CALIB_MAX_MARGINS; i++) {
+		int state = stateIndex.entries[i].state;
+		const StateMargin *m = &margins.states[state];
+		if (marginsLearned(&margins, state)) calib.margin[calib.margins++] = (CalibMargin) {state, m->count, m->mean, m->var};
+	}
+	if (calibSave(calibPath, &calib) < 0) {
+		printf("\nWarning: could not write %s\n", calibPath);
+	}
+	lastCalibSave = timingMicros();
+}
+
+/**
+ warmStart(const Calibration *saved)
+
+ check a few conversions against the saved tare and resume without taring if they match a known state.
+ The state may differ from the saved one (caps moved while we were down), the tare still explains the weight.
+ Returns 1 if resumed, 0 if a full tare is needed
+*/
+int warmStart(const Calibration *saved) {
+	long weight = getCleanSample(CALIB_CHECK_SAMPLES) - saved->tare;
+	int state = matchState(weight / COUNTS_PER_UNIT);
+	
+	if (state < 0) {
+		printf("Saved tare does not match the scale (delta %ld), taring\n", weight / COUNTS_PER_UNIT);
+		return 0;
+	}
+	
+	tare = saved->tare;
+	smoothedWeight = weight;
+	currentState = state;
+	printf("Warm start: tare %ld, %s", tare, describeState(state));
+	if (state != saved->state) printf(" (was %s)", describeState(saved->state));
+	printf("\n\n");
+	
+	setBottleLEDs(currentState);
+	applyAudioState(currentState);
+	return 1;
+}
+
+// Scale disconnected or dead: fade everything out and show all caps on, rather than
+// keep playing whatever state the last valid weight happened to match
+void enterSafeState() {
+	printf("\n!!! Scale not responding, fading out until it recovers\n");
+	fadeOut(0);
+	fadeOut(1);
+	fadeOut(2);
+	if (isBirthdayPlaying()) fadeOutBirthday();
+	if (retaring) {
+		retaring = 0;
+		printf("!!! Re-tare abandoned, press again once the scale is back\n");
+	}
+	currentState = 0;
+	setBottleLEDs(currentState);
+}
+
+/**
+ applyStep(StepDetector *d, Estimator *e)
+
+ a step was detected in the raw conversions: jump straight to the new plateau rather than waiting
+ for the smoothing to get there. The estimator window still holds the old plateau, so it restarts
+*/
+void applyStep(StepDetector *d, Estimator *e) {
+	printf("\n>>> Step %+ld after %d samples\n", lround(d->step) / COUNTS_PER_UNIT, d->latency);
+	smoothedWeight = lround(d->level);
+	kalmanReset(&weightFilter, d->level);
+	estimatorReset(e);
+	vibrationSettle(&vibration, lround(d->level) + tare);
+	
+	if (transientEnabled) {
+		transientTrigger(&capture, d->latency);
+		transientFrom = currentState;
+	}
+}
+
+/**
+ applyTransient()
+
+ the capture around the last step is complete: if the classifier is sure which bottle it was and
+ the step size fits a move of that bottle, go to that state without waiting for the weight to decide
+*/
+void applyTransient() {
+	double features[TRANSIENT_FEATURES];
+	double step, posterior, bestError = -1;
+	unsigned allowed = 0;
+	int lift, bottle, place = 1, target = -1;
+	
+	transientFeatures(&capture, features);
+	step = features[TRANSIENT_STEP] / COUNTS_PER_UNIT;
+	lift = step < 0;
+	
+	// Bottles that can move in the step's direction from the state before it
+	for (int i = 0; i < numBottles; i++) {
+		int digit = stateDigit(transientFrom, i);
+		if (lift ? digit != BOTTLE_REMOVED : digit != BOTTLE_COMPLETE) allowed |= 1u << i;
+	}
+	
+	bottle = transientClassify(&transientModel, features, allowed, &posterior);
+	if (bottle < 0 || posterior < TRANSIENT_CONFIDENCE) return;
+	
+	// The move of that bottle whose expected step is nearest the measured one
+	for (int i = 0; i < bottle; i++) place *= 3;
+	int digit = stateDigit(transientFrom, bottle);
+	for (int d = BOTTLE_COMPLETE; d <= BOTTLE_REMOVED; d++) {
+		int next = transientFrom + (d - digit) * place;
+		double error;
+		if (d == digit || (lift != (d > digit)) || (bottleWeights[bottle] == 0 && d == BOTTLE_REMOVED)) continue;
+		error = fabs(step - (stateIndexWeight(&stateIndex, next) - stateIndexWeight(&stateIndex, transientFrom)));
+		if (bestError < 0 || error < bestError) {
+			bestError = error;
+			target = next;
+		}
+	}
+	if (target < 0 || bestError > WEIGHT_MARGIN) return;
+	
+	printf("\n>>> Transient: bottle %d (p %.2f), %s\n", bottle + 1, posterior, describeState(target));
+	plateauHint(&plateaus, transientFrom, target);
+	hmmReset(&tracker, target);
+}
+
+/**
+ updatePlateau(long raw, uint32_t tick)
+
+ feed the plateau tracker. A new plateau moves the zero, so the HMM restarts from the plateau's
+ state and sees the re-anchored weight from this conversion on
+*/
+void updatePlateau(long raw, uint32_t tick) {
+	int result = plateauPush(&plateaus, raw / (double) COUNTS_PER_UNIT, tick);
+	
+	// Follow creep between plateaus while the table is known to be empty of changes
+	if (currentState == 0 && tracker.confidence >= HMM_CONFIDENCE && !retaring) {
+		plateauTrackZero(&plateaus);
+	}
+	
+	if (result == PLATEAU_NONE || plateaus.state < 0) return;
+	
+	if (result == PLATEAU_UNEXPLAINED) {
+		printf("\n>>> Unexplained step %+.0f, re-anchored in %s\n", plateaus.delta, describeState(plateaus.state));
+		saveCalibration();
+	}
+	hmmReset(&tracker, plateaus.state);
+}
+
+/**
+ retareButtonPressed()
+
+ poll the re-tare button, 1 once per press after it has been held for RETARE_DEBOUNCE_US
+*/
+int retareButtonPressed() {
+	static int reported = 0;
+	static uint32_t downSince = 0;
+	static int down = 0;
+	
+	if (!gpioEnabled) return 0;
+	
+	if (gpioRead(RETARE_PIN)) {  // released, pulled up
+		down = 0;
+		reported = 0;
+		return 0;
+	}
+	if (!down) {
+		down = 1;
+		downSince = timingMicros();
+	}
+	if (reported || timingMicros() - downSince < RETARE_DEBOUNCE_US) return 0;
+	reported = 1;
+	return 1;
+}
+
+// Start a re-tare alongside normal operation, all caps should be on
+void startRetare() {
+	printf("\n>>> Re-tare requested, keep the table still\n");
+	tareInit(&retare, tareTarget);
+	retaring = 1;
+}
+
+/**
+ updateRetare(long value, StepDetector *d, Estimator *e)
+
+ feed a raw conversion to the running re-tare. Once it converges, everything measured relative
+ to the old tare restarts from zero with all caps on
+*/
+void updateRetare(long value, StepDetector *d, Estimator *e) {
+	int result = tarePush(&retare, value);
+	
+	if (result == TARE_RESTARTED) {
+		printf("\n>>> Table disturbed, restarting re-tare\n");
+		return;
+	}
+	if (result != TARE_DONE) return;
+	
+	printf("\n>>> Re-tare: %ld (was %ld, +/-%.0f counts, %d samples, %d restarts)\n", retare.value,
+	       tare + anchorOffset(), tareHalfWidth(&retare), retare.total, retare.restarts);
+	retaring = 0;
+	tare = retare.value;
+	smoothedWeight = e->value - tare;
+	kalmanReset(&weightFilter, smoothedWeight);
+	stepReset(d, smoothedWeight);
+	plateauReset(&plateaus, 0, 0);
+	hmmReset(&tracker, 0);
+	
+	if (currentState != 0) {
+		printf(">>> State change: %s -> %s\n", describeState(currentState), describeState(0));
+		currentState = 0;
+		setBottleLEDs(currentState);
+		applyAudioState(currentState);
+	}
+	saveCalibration();
+}
+
+/**
+ updateWeight(long raw, const Estimator *e, uint32_t tick)
+
+ smooth a new tared reading for display, track the state from the clean reading and apply any state
+ change. The estimator's window sets how much the state tracker trusts the reading
+*/
+void updateWeight(long raw, const Estimator *e, uint32_t tick) {
+	smoothedWeight = lround(kalmanUpdate(&weightFilter, raw));
+	updatePlateau(raw, tick);
+	
+	long displayWeight = (smoothedWeight - anchorOffset()) / COUNTS_PER_UNIT;
+	int held = vibration.disturbed;
+	long rawDisplay = (raw - anchorOffset()) / COUNTS_PER_UNIT;
+	double weight = raw / (double) COUNTS_PER_UNIT - plateaus.offset;
+	
+	// Most probable state given everything so far, only acted on when confident
+	hmmSetNoise(&tracker, estimatorStdErr(e) / COUNTS_PER_UNIT);
+	int mapState = hmmUpdate(&tracker, weight);
+	int newState = (tracker.confidence >= HMM_CONFIDENCE) ? mapState : -1;
+	
+	// Clear line and display current weight
+	printf("\r                                                              \r");
+	printf("Delta: %5ld | Raw: %5ld (%2d) | ", displayWeight, rawDisplay, e->count);
+	
+	if (held) {
+		printf("Disturbed (%s? p %.2f)", describeState(mapState), tracker.confidence);
+	} else if (newState >= 0) {
+		printf("%s (p %.2f)", describeState(newState), tracker.confidence);
+	} else {
+		printf("Uncertain (%s? p %.2f)", describeState(mapState), tracker.confidence);
+	}
+	fflush(stdout);
+	
+	// Handle state change, not while an impact shakes the table
+	if (newState >= 0 && newState != currentState && !held) {
+		printf("\n>>> State change: %s -> %s\n", 
+		       describeState(currentState), describeState(newState));
+		currentState = newState;
+		setBottleLEDs(currentState);
+		applyAudioState(currentState);
+		saveCalibration();
+	}
+	
+	// Learn the state's weight while it is confident and at rest, the estimator back at its full window
+	if (newState >= 0 && newState == currentState && e->count == ESTIMATE_WINDOW && !retaring && !held) {
+		learnMargin(currentState, weight);
+	}
+}
+
 int main(int argc, char **argv) {
+	const char *sourceSpec = SOURCE_DEFAULT;
+	const char *bottleList = NULL;
+	double tareFraction = TARE_CI_FRACTION;
+	int calibOption = 0;
+	int numBottleWeights = 0;
+	int opt;
+	
 	// Parse CLI arguments
-	if (argc != 4) {
-		printf("Usage: musicBottles cap1 cap2 cap3\n");
-		printf("  cap1, cap2, cap3: integer weights of the caps (e.g., 629 728 426)\n");
-		printf("  Weight detection margin: +/-%d\n", WEIGHT_MARGIN);
+	const char *modelPath = NULL;
+	const char *filterSpec = VIBRATION_DEFAULT;
+	const char *fadeSpec = FADE_DEFAULT;
+	const char *latencySpec = LATENCY_DEFAULT;
+	const char *outputSpec = OUTPUT_DEFAULT;
+	
+	while ((opt = getopt(argc, argv, "s:t:c:b:k:f:e:l:a:")) != -1) {
+		if (opt == 's') sourceSpec = optarg;
+		else if (opt == 't') tareFraction = atof(optarg);
+		else if (opt == 'c') { calibPath = optarg; calibOption = 1; }
+		else if (opt == 'b') bottleList = optarg;
+		else if (opt == 'k') modelPath = optarg;
+		else if (opt == 'f') filterSpec = optarg;
+		else if (opt == 'e') fadeSpec = optarg;
+		else if (opt == 'l') latencySpec = optarg;
+		else if (opt == 'a') outputSpec = optarg;
+		else argc = 0;
+	}
+	
+	numBottles = argc - optind;
+	if (bottleList) {
+		char *end = (char *) bottleList;
+		while (*end && numBottleWeights < STATE_MAX_BOTTLES) {
+			bottleWeights[numBottleWeights++] = strtol(end, &end, 10);
+			if (*end == ',') end++;
+			else if (*end) break;
+		}
+		if (*end) numBottleWeights = -1;
+	}
+	
+	if (numBottles < 1 || numBottles > STATE_MAX_BOTTLES || tareFraction <= 0 ||
+	    (bottleList && numBottleWeights != numBottles) || vibrationInit(&vibration, filterSpec) < 0 ||
+	    setFades(fadeSpec) < 0 || setLatency(latencySpec) < 0 ||
+	    setOutput(outputSpec) < 0) {
+		printf("Usage: musicBottles [-s source] [-t fraction] [-c file] [-b bot1,bot2,...] [-k model] [-f filters] [-e fades] [-l latency] [-a output] cap1 cap2 cap3 [cap4 ...]\n");
+		printf("  cap1, cap2, ...: integer weights of the caps (e.g., 629 728 426), up to %d bottles\n", STATE_MAX_BOTTLES);
+		printf("  bot1, bot2, ...: bottle weights without cap, one per cap; bottle removal is only detected with -b\n");
+		printf("  source: hx711 (default), trace:FILE[,speed=S] or synth[:options], see source.h\n");
+		printf("  fraction: tare until its 95%% confidence interval is below this fraction of the lightest cap (default %.2f)\n", TARE_CI_FRACTION);
+		printf("  file: calibration kept across restarts (default %s with the hx711 source, \"\" for none)\n", CALIB_PATH);
+		printf("  model: transient classifier from detectBench train, tells caps of similar weight apart\n");
+		printf("  filters: vibration filter bank, lowpass=HZ[/Q] and notch=HZ[/Q] sections or none (default %s)\n", VIBRATION_DEFAULT);
+		printf("  fades: in=MS,out=MS,curve=linear|cosine|exp (default %s)\n", FADE_DEFAULT);
+		printf("  latency: buffer=FRAMES, or low[,budget=F] to probe for the smallest buffer that keeps up (default %s)\n", LATENCY_DEFAULT);
+		printf("  output: sdl (default) or alsa[:device=NAME] with make ALSA=1, see output.h\n");
+		printf("  Weight detection margin: +/-%d until each state's margin is learned\n", WEIGHT_MARGIN);
 		return -1;
 	}
 	
-	cap1 = atoi(argv[1]);
-	cap2 = atoi(argv[2]);
-	cap3 = atoi(argv[3]);
+	for (int i = 0; i < numBottles; i++) {
+		capWeights[i] = atol(argv[optind + i]);
+	}
 	
 	printf("=== Music Bottles v4 ===\n");
 	printf("Sound set: Classic\n");
-	printf("Cap weights: Cap1=%d, Cap2=%d, Cap3=%d\n", cap1, cap2, cap3);
-	printf("Detection margin: +/-%d\n\n", WEIGHT_MARGIN);
+	printf("Sample source: %s\n", sourceSpec);
+	for (int i = 0; i < numBottles; i++) {
+		printf("Bottle %d: cap %ld, bottle %ld\n", i + 1, capWeights[i], bottleWeights[i]);
+	}
+	printf("Detection margin: +/-%d, learned per state\n\n", WEIGHT_MARGIN);
 	
-	// Initialize weight table
-	initWeightTable();
-	printf("Weight table initialized:\n");
-	for (int i = 0; i < 8; i++) {
-		printf("  State %d (%s): %ld\n", i, stateNames[i], weightTable[i]);
+	// Index the expected weight of every state
+	stateIndexInit(&stateIndex, capWeights, bottleWeights, numBottles);
+	hmmInit(&tracker, &stateIndex, HMM_SIGMA);
+	marginsInit(&margins, &stateIndex, WEIGHT_MARGIN);
+	plateauInit(&plateaus, &stateIndex, WEIGHT_MARGIN);
+	printf("Weight index initialized: %d states\n", stateIndex.count);
+	if (stateIndex.count <= 27) {
+		for (int i = 0; i < stateIndex.count; i++) {
+			printf("  %8ld  %s\n", stateIndex.entries[i].weight, describeState(stateIndex.entries[i].state));
+		}
+	}
+	int closeA, closeB;
+	long gap = stateIndexMinGap(&stateIndex, &closeA, &closeB);
+	if (gap >= 0 && gap <= 2 * WEIGHT_MARGIN) {
+		printf("Warning: '%s' and '%s' are only %ld apart, within twice the margin\n",
+		       describeState(closeA), describeState(closeB), gap);
+	}
+	if (modelPath) {
+		if (transientLoad(modelPath, &transientModel) < 0) {
+			printf("Could not load transient model %s\n", modelPath);
+			return -1;
+		}
+		transientEnabled = 1;
+		transientInit(&capture);
+		printf("Transient model: %s, %d classes\n", modelPath, transientModel.count);
 	}
 	printf("\n");
 	
 	// Initialize hardware
 	printf("Initializing scale...\n");
-	initHX711();
+	if (sourceOpen(sourceSpec) < 0) exit(-1);
 	
-	setupGPIO();
-	initSound();
+	if (sourceIsHardware()) setupGPIO();
+	if (initSound() < 0) {
+		printf("Error: audio could not be started, exiting\n");
+		exit(-1);
+	}
 	
-	// Play debug sound for 10 seconds if requested
-	playDebugSound();
+	long lightestCap = capWeights[0];
+	for (int i = 1; i < numBottles; i++) {
+		if (capWeights[i] < lightestCap) lightestCap = capWeights[i];
+	}
 	
-	// Auto tare on start
-	printf("Acquiring tare... ");
-	fflush(stdout);
-	tare = getCleanSample(150, 4);
-	printf("Tare: %ld\n\n", tare);
+	tareTarget = tareFraction * lightestCap * COUNTS_PER_UNIT;
+	
+	// Only the real scale warm-starts by default, replays and synthetic runs start clean
+	if (!calibOption && sourceIsHardware()) calibPath = CALIB_PATH;
+	if (calibPath && calibPath[0] == 0) calibPath = NULL;
+	
+	Calibration saved;
+	int warm = 0;
+	calibFingerprint(calib.fingerprint, sizeof(calib.fingerprint), sourceSpec, capWeights, bottleWeights, numBottles);
+	
+	if (calibPath && calibLoad(calibPath, &saved) == 0) {
+		if (strcmp(saved.fingerprint, calib.fingerprint) == 0) {
+			restoreMargins(&saved);
+			warm = warmStart(&saved);
+		} else {
+			printf("Calibration in %s is for a different setup (%s), taring\n", calibPath, saved.fingerprint);
+		}
+	}
+	
+	if (!warm) {
+		// Play debug sound for 10 seconds if requested
+		playDebugSound();
+		
+		// Auto tare on start, as long as it takes to pin the zero down to a fraction of the lightest cap
+		Tare tareState;
+		uint32_t tareStart = timingMicros();
+		printf("Acquiring tare... ");
+		fflush(stdout);
+		tare = getAdaptiveTare(tareTarget, &tareState);
+		printf("Tare: %ld (+/-%.0f counts, %d samples, %.1f s, %d restarts)\n\n", tare, tareHalfWidth(&tareState),
+		       tareState.n, (timingMicros() - tareStart) / 1000000.0, tareState.restarts);
+		smoothedWeight = 0;
+		currentState = 0;
+	}
+	saveCalibration();
 	
 	printf("Monitoring weight changes...\n");
 	printf("(Weight delta shown relative to tared zero)\n\n");
 	
-	// Main loop
-	while (1) {
-		long raw = getCleanSample(4, 4) - tare;
-		smoothedWeight = smoothedWeight * 0.85 + raw * 0.15;
-		
-		long displayWeight = smoothedWeight / 100;
-		long rawDisplay = raw / 100;
+	// Hand the scale over to the acquisition thread
+	if (startAcquisition(sourceIsHardware() ? ACQUIRE_PRIORITY : 0) < 0) exit(-1);
+	
+	Estimator estimator;
+	estimatorInit(&estimator, ESTIMATE_WINDOW, ESTIMATOR_K, ESTIMATOR_MIN_BAND);
+	estimatorAdapt(&estimator, ESTIMATE_MIN_WINDOW);
+	
+	// Steps as small as the lightest cap are caught from the raw conversions
+	StepDetector detector;
+	stepInit(&detector, lightestCap * COUNTS_PER_UNIT);
+	stepReset(&detector, smoothedWeight);
+	detector.primed = 1;
+	hmmReset(&tracker, currentState);
+	plateauReset(&plateaus, currentState, smoothedWeight / (double) COUNTS_PER_UNIT);
+	kalmanInit(&weightFilter, KALMAN_R_INIT);
+	kalmanReset(&weightFilter, smoothedWeight);
+	
+	uint32_t lastFade = timingMicros();
+	uint32_t lastStats = lastFade;
+	Sample sample;
+	
+	// Main loop, runs until a replayed source is exhausted
+	while (!acquireFinished()) {
+		// Park audio and LEDs while the scale is lost, start over from all caps on once it is back
+		int health = sourceHealth();
+		if (health == SENSOR_LOST && !sensorLost) {
+			sensorLost = 1;
+			enterSafeState();
+		} else if (health == SENSOR_OK && sensorLost) {
+			sensorLost = 0;
+			estimatorReset(&estimator);
+			vibrationReset(&vibration);
+			smoothedWeight = 0;
+			stepReset(&detector, smoothedWeight);
+			hmmReset(&tracker, -1);  // anything may have changed while it was down
+			plateauReset(&plateaus, -1, 0);  // keeps the offset, the next plateau is matched through it
+			kalmanReset(&weightFilter, smoothedWeight);
+			printf(">>> Scale recovered\n");
+		}
 		
-		// Find matching state
-		int newState = matchState(displayWeight);
+		// Drain every conversion the acquisition thread has queued, one clean value per conversion
+		while (acquireSample(&sample)) {
+			long filtered = vibrationPush(&vibration, sample.value, sample.tick);
+			if (stepPush(&detector, sample.value - tare) && !vibration.disturbed) applyStep(&detector, &estimator);
+			if (transientEnabled && transientPush(&capture, sample.value - tare)) applyTransient();
+			updateWeight(estimatorPush(&estimator, filtered) - tare, &estimator, sample.tick);
+			if (retaring) updateRetare(sample.value, &detector, &estimator);
+		}
 		
-		// Clear line and display current weight
-		printf("\r                                                              \r");
-		printf("Delta: %5ld | Raw: %5ld | ", displayWeight, rawDisplay);
+		if (retareButtonPressed() && !retaring && !sensorLost) startRetare();
 		
-		if (newState >= 0) {
-			printf("%s", stateNames[newState]);
-		} else {
-			printf("Unknown     ");
+		// Finish fades the mixer has completed
+		if (timingMicros() - lastFade >= FADE_INTERVAL_US) {
+			lastFade += FADE_INTERVAL_US;
+			handleFade();
+			handleLatency();
+			handleStreams();
 		}
-		fflush(stdout);
 		
-		// Handle state change
-		if (newState >= 0 && newState != currentState) {
-			printf("\n>>> State change: %s -> %s\n", 
-			       stateNames[currentState], stateNames[newState]);
-			currentState = newState;
-			setBottleLEDs(currentState);
-			applyAudioState(currentState);
+		// Keep the saved weight roughly current between state changes, without wearing out the SD card
+		if (calibPath && !sensorLost && timingMicros() - lastCalibSave >= CALIB_SAVE_INTERVAL_US &&
+		    labs(smoothedWeight - anchorOffset() - calib.weight) >= COUNTS_PER_UNIT) {
+			saveCalibration();
 		}
 		
-		// Handle audio fade
-		handleFade();
+		// Log read timing so preemption under audio load shows up as corrupted frames, and how the audio callback keeps up
+		if (timingMicros() - lastStats >= STATS_INTERVAL_US) {
+			Hx711Stats stats;
+			lastStats += STATS_INTERVAL_US;
+			printf("\n");
+			if (sourceIsHardware()) {
+				hx711GetStats(&stats);
+				printHx711Stats(&stats);
+			}
+			printAudioStats();
+		}
 		
-		usleep(50000);  // 50ms delay
+		usleep(5000);  // 5ms poll, well below one HX711 conversion
 	}
 	
+	printf("\nSample source finished\n");
+	sourceClose();
 	return 0;
 }
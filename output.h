@@ -0,0 +1,55 @@
+/**
+
+	Audio outputs for Music Bottles
+
+	audio.c plays the tracks through one output, selected at runtime with a
+	spec string:
+
+	  sdl                          SDL2_mixer on the default device (default)
+	  alsa[:device=NAME]           the ALSA PCM opened directly in mmap mode, our
+	                               own mixer rendering straight into its period
+	                               buffers (only with make ALSA=1)
+
+	Tracks already in the output format are streamed from their mapping
+	(see stream.h) and wrapped rather than loaded. An output plays sounds
+	on FADE_CHANNELS channels. Every channel goes
+	through the fade engine, and every period it renders is timed by the
+	latency monitor, so gains, fades and xrun counts behave the same on
+	either output.
+
+*/
+
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include "fade.h"
+#include "latency.h"
+#include "wav.h"
+
+#define OUTPUT_DEFAULT "sdl"
+#define OUTPUT_RATE    22050  // frames per second every output opens at
+
+typedef struct AudioOutput {
+	const char *name;
+	int   (*start)(struct AudioOutput *o, int frames);  // open the device with a buffer of frames, every channel silent
+	void  (*stop)(struct AudioOutput *o);
+	void *(*load)(struct AudioOutput *o, const char *path);  // a WAV file decoded to play at the output rate, NULL on error
+	void *(*wrap)(struct AudioOutput *o, const Pcm *pcm);    // samples already in the output format, played in place
+	void  (*unload)(struct AudioOutput *o, void *sound);     // either kind
+	int   (*play)(struct AudioOutput *o, int chan, void *sound, int loop);  // from the start, -1 on error
+	void  (*halt)(struct AudioOutput *o, int chan);     // -1 for every channel, the sound may be unloaded on return
+	long  (*delay)(struct AudioOutput *o);              // frames queued between the mixer and the DAC
+	uint32_t (*position)(struct AudioOutput *o, int chan);  // frame a playing channel mixes next, modulo its length
+	const char *(*error)(struct AudioOutput *o);
+
+	int   rate;     // frames per second, once started
+	int   frames;   // buffer size, once started
+	FadeEngine     *fader;
+	LatencyMonitor *monitor;
+	void *ctx;
+} AudioOutput;
+
+int sdlOutput(AudioOutput *o, char *opts);
+int alsaOutput(AudioOutput *o, char *opts);
+
+#endif
@@ -0,0 +1,301 @@
+#include "output.h"
+#include "mixer.h"
+#include "timing.h"
+#include <alsa/asoundlib.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/**
+
+	ALSA mmap output for Music Bottles
+
+	The PCM is opened directly with mmap interleaved access, no ALSA rate
+	plugin, and a ring of ALSA_PERIODS periods of the buffer size. A
+	SCHED_FIFO thread waits for a period of space, renders the mixer
+	straight into the mmap area and commits it, so there is no
+	resampler, no extra mixing thread and no intermediate buffer between the
+	stems and the DAC. Streamed tracks are mixed straight from their
+	mapping; anything else is converted to the output rate once when it is
+	loaded.
+
+	Underruns are reported by ALSA itself (-EPIPE) and counted before the
+	PCM is recovered.
+
+*/
+
+#define ALSA_DEFAULT_DEVICE "default"
+#define ALSA_PERIODS        2
+#define ALSA_PRIORITY       15    // above the main loop (10), below acquisition (20)
+#define ALSA_WAIT_MS        100
+#define ALSA_HALT_POLL_US   1000  // while halt waits for the thread to take the command
+
+typedef struct {
+	char       device[64];
+	snd_pcm_t *pcm;
+	snd_pcm_uframes_t period;
+	pthread_t  thread;
+	int        running;
+	long       delay;    // frames queued after the last commit, written by the thread
+	Mixer      mixer;
+	char       error[160];
+} AlsaCtx;
+
+// Recover from an xrun or a suspend, counting underruns
+static int recover(AudioOutput *o, AlsaCtx *a, int err) {
+	if (err == -EPIPE) latencyXrun(o->monitor);
+	err = snd_pcm_recover(a->pcm, err, 1);
+	if (err < 0) snprintf(a->error, sizeof(a->error), "%s", snd_strerror(err));
+	return err;
+}
+
+// One period rendered into the mmap area, in as many pieces as the ring wraps into
+static int renderPeriod(AudioOutput *o, AlsaCtx *a) {
+	snd_pcm_uframes_t left = a->period;
+
+	while (left > 0) {
+		const snd_pcm_channel_area_t *areas;
+		snd_pcm_uframes_t offset, frames = left;
+		snd_pcm_sframes_t committed;
+		int16_t *dst;
+		int err = snd_pcm_mmap_begin(a->pcm, &areas, &offset, &frames);
+
+		if (err < 0) return err;
+		dst = (int16_t *) ((char *) areas[0].addr + areas[0].first / 8 + offset * (areas[0].step / 8));
+		mixerRender(&a->mixer, dst, (int) frames);
+		committed = snd_pcm_mmap_commit(a->pcm, offset, frames);
+		if (committed < 0) return (int) committed;
+		if ((snd_pcm_uframes_t) committed != frames) return -EPIPE;
+		left -= frames;
+	}
+	return 0;
+}
+
+static void *alsaLoop(void *arg) {
+	AudioOutput *o = (AudioOutput *) arg;
+	AlsaCtx *a = (AlsaCtx *) o->ctx;
+
+	while (__atomic_load_n(&a->running, __ATOMIC_ACQUIRE)) {
+		snd_pcm_sframes_t avail = snd_pcm_avail_update(a->pcm);
+		snd_pcm_sframes_t delay;
+		int err;
+
+		if (avail < 0) {
+			if (recover(o, a, (int) avail) < 0) break;
+			continue;
+		}
+
+		// Start once the ring is full, otherwise wait for a period of space
+		if ((snd_pcm_uframes_t) avail < a->period) {
+			if (snd_pcm_state(a->pcm) == SND_PCM_STATE_PREPARED) {
+				err = snd_pcm_start(a->pcm);
+				if (err < 0 && recover(o, a, err) < 0) break;
+				continue;
+			}
+			err = snd_pcm_wait(a->pcm, ALSA_WAIT_MS);
+			if (err < 0 && recover(o, a, err) < 0) break;
+			continue;
+		}
+
+		latencyBegin(o->monitor, timingMicros());
+		err = renderPeriod(o, a);
+		latencyEnd(o->monitor, timingMicros());
+		if (err < 0 && recover(o, a, err) < 0) break;
+
+		if (snd_pcm_delay(a->pcm, &delay) == 0) __atomic_store_n(&a->delay, (long) delay, __ATOMIC_RELAXED);
+	}
+	__atomic_store_n(&a->running, 0, __ATOMIC_RELEASE);  // halt no longer waits for it
+	return NULL;
+}
+
+static int configure(AudioOutput *o, AlsaCtx *a, int frames) {
+	snd_pcm_hw_params_t *hw;
+	snd_pcm_sw_params_t *sw;
+	snd_pcm_uframes_t buffer = (snd_pcm_uframes_t) frames * ALSA_PERIODS;
+	unsigned int rate = OUTPUT_RATE;
+	int err;
+
+	a->period = frames;
+	snd_pcm_hw_params_alloca(&hw);
+	if ((err = snd_pcm_hw_params_any(a->pcm, hw)) < 0 ||
+	    (err = snd_pcm_hw_params_set_access(a->pcm, hw, SND_PCM_ACCESS_MMAP_INTERLEAVED)) < 0 ||
+	    (err = snd_pcm_hw_params_set_format(a->pcm, hw, SND_PCM_FORMAT_S16_LE)) < 0 ||
+	    (err = snd_pcm_hw_params_set_channels(a->pcm, hw, 2)) < 0 ||
+	    (err = snd_pcm_hw_params_set_rate_resample(a->pcm, hw, 0)) < 0 ||
+	    (err = snd_pcm_hw_params_set_rate_near(a->pcm, hw, &rate, NULL)) < 0 ||
+	    (err = snd_pcm_hw_params_set_period_size_near(a->pcm, hw, &a->period, NULL)) < 0 ||
+	    (err = snd_pcm_hw_params_set_buffer_size_near(a->pcm, hw, &buffer)) < 0 ||
+	    (err = snd_pcm_hw_params(a->pcm, hw)) < 0) {
+		return err;
+	}
+
+	// Woken per period, started by hand once the first ring is rendered
+	snd_pcm_sw_params_alloca(&sw);
+	if ((err = snd_pcm_sw_params_current(a->pcm, sw)) < 0 ||
+	    (err = snd_pcm_sw_params_set_avail_min(a->pcm, sw, a->period)) < 0 ||
+	    (err = snd_pcm_sw_params_set_start_threshold(a->pcm, sw, buffer * 2)) < 0 ||
+	    (err = snd_pcm_sw_params(a->pcm, sw)) < 0) {
+		return err;
+	}
+
+	o->rate = (int) rate;
+	o->frames = (int) a->period;
+	return 0;
+}
+
+/**
+ alsaStart(AudioOutput *o, int frames)
+
+ open the PCM for mmap playback in periods of about frames and start the rendering thread,
+ falling back to normal scheduling if real-time priority is not permitted
+*/
+static int alsaStart(AudioOutput *o, int frames) {
+	AlsaCtx *a = (AlsaCtx *) o->ctx;
+	pthread_attr_t attr;
+	struct sched_param sched;
+	int err;
+
+	if ((err = snd_pcm_open(&a->pcm, a->device, SND_PCM_STREAM_PLAYBACK, 0)) < 0) {
+		printf("Error opening ALSA device %s: %s\n", a->device, snd_strerror(err));
+		return -1;
+	}
+	if ((err = configure(o, a, frames)) < 0) {
+		printf("Error configuring ALSA device %s for mmap playback: %s\n", a->device, snd_strerror(err));
+		snd_pcm_close(a->pcm);
+		return -1;
+	}
+	if (o->rate != OUTPUT_RATE) {
+		printf("Warning: %s runs at %d Hz, sounds are converted to it\n", a->device, o->rate);
+	}
+
+	mixerInit(&a->mixer, o->fader);
+	a->delay = 0;
+	__atomic_store_n(&a->running, 1, __ATOMIC_RELEASE);
+
+	pthread_attr_init(&attr);
+	pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+	pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+	memset(&sched, 0, sizeof(sched));
+	sched.sched_priority = ALSA_PRIORITY;
+	pthread_attr_setschedparam(&attr, &sched);
+
+	if (pthread_create(&a->thread, &attr, alsaLoop, o) != 0) {
+		printf("Warning: Unable to start real-time audio thread, using normal priority\n");
+		if (pthread_create(&a->thread, NULL, alsaLoop, o) != 0) {
+			printf("Error starting audio thread\n");
+			pthread_attr_destroy(&attr);
+			snd_pcm_close(a->pcm);
+			return -1;
+		}
+	}
+	pthread_attr_destroy(&attr);
+	return 0;
+}
+
+static void alsaStop(AudioOutput *o) {
+	AlsaCtx *a = (AlsaCtx *) o->ctx;
+
+	__atomic_store_n(&a->running, 0, __ATOMIC_RELEASE);
+	pthread_join(a->thread, NULL);
+	snd_pcm_drop(a->pcm);
+	snd_pcm_close(a->pcm);
+}
+
+static void *alsaLoad(AudioOutput *o, const char *path) {
+	AlsaCtx *a = (AlsaCtx *) o->ctx;
+	Pcm *pcm = malloc(sizeof(Pcm));
+
+	if (pcm == NULL) return NULL;
+	if (wavLoad(path, o->rate, pcm) < 0) {
+		snprintf(a->error, sizeof(a->error), "%s", wavError());
+		free(pcm);
+		return NULL;
+	}
+	return pcm;
+}
+
+static void *alsaWrap(AudioOutput *o, const Pcm *pcm) {
+	Pcm *copy = malloc(sizeof(Pcm));
+
+	if (copy) *copy = *pcm;
+	return copy;
+}
+
+// Decoded samples are freed, mapped ones left to their stream
+static void alsaUnload(AudioOutput *o, void *sound) {
+	wavFree((Pcm *) sound);
+	free(sound);
+}
+
+static int alsaPlay(AudioOutput *o, int chan, void *sound, int loop) {
+	AlsaCtx *a = (AlsaCtx *) o->ctx;
+
+	if (sound == NULL) {
+		snprintf(a->error, sizeof(a->error), "nothing loaded to play on channel %d", chan);
+		return -1;
+	}
+	if (!mixerPlay(&a->mixer, chan, (const Pcm *) sound, loop)) {
+		snprintf(a->error, sizeof(a->error), "mixer queue full");
+		return -1;
+	}
+	return chan;
+}
+
+// The thread may be mixing the channel's sound right now, so return only once it has taken the halt
+// and the sound can be unloaded. A thread that has stopped reads nothing
+static void alsaHalt(AudioOutput *o, int chan) {
+	AlsaCtx *a = (AlsaCtx *) o->ctx;
+
+	while (!mixerHalt(&a->mixer, chan) && __atomic_load_n(&a->running, __ATOMIC_ACQUIRE)) usleep(ALSA_HALT_POLL_US);
+	while (mixerPending(&a->mixer) && __atomic_load_n(&a->running, __ATOMIC_ACQUIRE)) usleep(ALSA_HALT_POLL_US);
+}
+
+static long alsaDelay(AudioOutput *o) {
+	AlsaCtx *a = (AlsaCtx *) o->ctx;
+	return __atomic_load_n(&a->delay, __ATOMIC_RELAXED);
+}
+
+static uint32_t alsaPosition(AudioOutput *o, int chan) {
+	AlsaCtx *a = (AlsaCtx *) o->ctx;
+	return __atomic_load_n(&a->mixer.voice[chan].pos, __ATOMIC_RELAXED);
+}
+
+static const char *alsaError(AudioOutput *o) {
+	AlsaCtx *a = (AlsaCtx *) o->ctx;
+	return a->error;
+}
+
+// Options: device=NAME (default ALSA_DEFAULT_DEVICE, which follows asound.conf)
+int alsaOutput(AudioOutput *o, char *opts) {
+	AlsaCtx *a = calloc(1, sizeof(AlsaCtx));
+	char *opt, *save;
+
+	if (a == NULL) return -1;
+	snprintf(a->device, sizeof(a->device), "%s", ALSA_DEFAULT_DEVICE);
+	for (opt = opts ? strtok_r(opts, ",", &save) : NULL; opt; opt = strtok_r(NULL, ",", &save)) {
+		if (strncmp(opt, "device=", 7) == 0) {
+			snprintf(a->device, sizeof(a->device), "%s", opt + 7);
+		} else {
+			printf("Unknown alsa output option: %s\n", opt);
+			free(a);
+			return -1;
+		}
+	}
+
+	o->start = alsaStart;
+	o->stop = alsaStop;
+	o->load = alsaLoad;
+	o->wrap = alsaWrap;
+	o->unload = alsaUnload;
+	o->play = alsaPlay;
+	o->halt = alsaHalt;
+	o->delay = alsaDelay;
+	o->position = alsaPosition;
+	o->error = alsaError;
+	o->ctx = a;
+	return 0;
+}
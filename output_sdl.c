@@ -0,0 +1,148 @@
+#include "output.h"
+#include "timing.h"
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_mixer.h>
+#include <stdio.h>
+
+/**
+
+	SDL2_mixer output for Music Bottles
+
+	Each channel's gain is a Mix_RegisterEffect effect that runs the fade
+	engine; the Mix_Volume of every channel stays at full scale. Callbacks
+	are timed from the music hook, which SDL_mixer calls first, to the
+	post-mix hook, which it calls last.
+
+	SDL_mixer has a single mixer, so the output it drives is kept here.
+
+*/
+
+static AudioOutput *active;
+static int mixChannels = 2;
+
+// SDL_mixer does not say where a channel is, so the frames through its effect are counted
+static uint32_t played[FADE_CHANNELS];
+static uint32_t length[FADE_CHANNELS];
+
+// Mixer effect on every playing channel: per-frame gain from the fade engine
+static void fadeEffect(int chan, void *stream, int len, void *udata) {
+	int frames = len / (int) (sizeof(int16_t) * mixChannels);
+
+	fadeProcess(active->fader, chan, (int16_t *) stream, frames, mixChannels);
+	__atomic_add_fetch(&played[chan], (uint32_t) frames, __ATOMIC_RELAXED);
+}
+
+static void callbackStart(void *udata, Uint8 *stream, int len) {
+	latencyBegin(active->monitor, timingMicros());
+}
+
+static void callbackEnd(void *udata, Uint8 *stream, int len) {
+	latencyEnd(active->monitor, timingMicros());
+}
+
+/**
+ sdlStart(AudioOutput *o, int frames)
+
+ open the mixer with a buffer of frames, every channel at full volume and silent in the fade engine,
+ with the callback timed. Returns -1 if it could not be opened for signed 16-bit output
+*/
+static int sdlStart(AudioOutput *o, int frames) {
+	Uint16 format;
+
+	// Initialize SDL.
+	if (SDL_Init(SDL_INIT_AUDIO) < 0) {
+		printf("Error initializing SDL\n");
+		return -1;
+	}
+
+	if (Mix_OpenAudio(OUTPUT_RATE, MIX_DEFAULT_FORMAT, 2, frames) == -1) {
+		printf("Error initializing MIXER: %s\n", Mix_GetError());
+		return -1;
+	}
+	Mix_AllocateChannels(FADE_CHANNELS);  // 3 for music tracks + 1 for birthday
+
+	// Ramps are timed in output frames
+	if (Mix_QuerySpec(&o->rate, &format, &mixChannels) == 0 || format != AUDIO_S16SYS) {
+		printf("Error: mixer did not open with signed 16-bit output\n");
+		Mix_CloseAudio();
+		return -1;
+	}
+	o->frames = frames;
+
+	for (int i = 0; i < FADE_CHANNELS; i++) {
+		Mix_Volume(i, MIX_MAX_VOLUME);
+	}
+	Mix_HookMusic(callbackStart, NULL);
+	Mix_SetPostMix(callbackEnd, NULL);
+	return 0;
+}
+
+static void sdlStop(AudioOutput *o) {
+	Mix_CloseAudio();
+}
+
+static void *sdlLoad(AudioOutput *o, const char *path) {
+	return Mix_LoadWAV(path);
+}
+
+// The chunk points at the samples, SDL_mixer copies them before the effects run so they are never written.
+// SDL_mixer loops whole chunks, so a loop start is not honoured here
+static void *sdlWrap(AudioOutput *o, const Pcm *pcm) {
+	return Mix_QuickLoad_RAW((Uint8 *) pcm->data, pcm->frames * mixChannels * sizeof(int16_t));
+}
+
+static void sdlUnload(AudioOutput *o, void *sound) {
+	Mix_FreeChunk((Mix_Chunk *) sound);
+}
+
+// Halting a channel drops its effects, so the fade is registered again before every start, any earlier registration removed first
+static int sdlPlay(AudioOutput *o, int chan, void *sound, int loop) {
+	if (sound == NULL) {
+		Mix_SetError("nothing loaded to play on channel %d", chan);
+		return -1;
+	}
+	if (Mix_Playing(chan)) Mix_HaltChannel(chan);
+	__atomic_store_n(&played[chan], 0, __ATOMIC_RELAXED);
+	length[chan] = ((Mix_Chunk *) sound)->alen / (mixChannels * sizeof(int16_t));
+	Mix_UnregisterEffect(chan, fadeEffect);
+	if (Mix_RegisterEffect(chan, fadeEffect, NULL, NULL) == 0) {
+		printf("Error registering fade on channel %d: %s\n", chan, Mix_GetError());
+	}
+	return Mix_PlayChannel(chan, (Mix_Chunk *) sound, loop ? -1 : 0);
+}
+
+static void sdlHalt(AudioOutput *o, int chan) {
+	Mix_HaltChannel(chan);
+}
+
+// SDL does not say how much it has queued, one buffer in SDL's hands and one in the device's
+static long sdlDelay(AudioOutput *o) {
+	return 2L * o->frames;
+}
+
+static uint32_t sdlPosition(AudioOutput *o, int chan) {
+	return length[chan] ? __atomic_load_n(&played[chan], __ATOMIC_RELAXED) % length[chan] : 0;
+}
+
+static const char *sdlError(AudioOutput *o) {
+	return Mix_GetError();
+}
+
+int sdlOutput(AudioOutput *o, char *opts) {
+	if (opts && *opts) {
+		printf("Unknown sdl output option: %s\n", opts);
+		return -1;
+	}
+	o->start = sdlStart;
+	o->stop = sdlStop;
+	o->load = sdlLoad;
+	o->wrap = sdlWrap;
+	o->unload = sdlUnload;
+	o->play = sdlPlay;
+	o->halt = sdlHalt;
+	o->delay = sdlDelay;
+	o->position = sdlPosition;
+	o->error = sdlError;
+	active = o;
+	return 0;
+}
@@ -0,0 +1,183 @@
+#include "plateau.h"
+#include <math.h>
+
+/**
+
+	Plateau tracker for Music Bottles
+
+	A run is broken by the first value outside the band around its running
+	mean, so a step starts a new run straight away while slow drift breaks a
+	long run now and then and re-anchors through a PLATEAU_SETTLED plateau.
+	Candidate transitions are generated from the base-3 digits of the current
+	state, at most 2 per bottle.
+
+*/
+
+void plateauInit(PlateauTracker *p, const StateIndex *idx, double margin) {
+	p->idx = idx;
+	p->margin = margin;
+	p->band = margin * PLATEAU_BAND_FRACTION;
+	p->offset = 0;
+	p->transitions = p->settled = p->unexplained = 0;
+	plateauReset(p, -1, 0);
+}
+
+/**
+ plateauReset(PlateauTracker *p, int state, double level)
+
+ anchor at a known state and level (after a tare or a warm start). With state -1 the next
+ plateau is matched against the whole index through the current offset instead
+*/
+void plateauReset(PlateauTracker *p, int state, double level) {
+	p->runLength = 0;
+	p->reported = 0;
+	p->state = state;
+	p->from = state;
+	p->delta = 0;
+	p->hint = -1;
+	if (state >= 0) {
+		p->anchor = level;
+		p->offset = level - stateIndexWeight(p->idx, state);
+	}
+}
+
+// Best single-bottle move from the current state for the delta, or the state itself; sets *error
+static int nearestTransition(const PlateauTracker *p, double delta, double *error) {
+	const StateIndex *idx = p->idx;
+	long here = stateIndexWeight(idx, p->state);
+	int best = p->state, b, d, place = 1;
+
+	*error = fabs(delta);
+	for (b = 0; b < idx->bottles; b++, place *= 3) {
+		int digit = (p->state / place) % 3;
+		for (d = 0; d < 3; d++) {
+			int next;
+			double e;
+
+			if (d == digit) continue;
+			if (idx->bottle[b] == 0 && (d == BOTTLE_REMOVED || digit == BOTTLE_REMOVED)) continue;
+			next = p->state + (d - digit) * place;
+			e = fabs(delta - (stateIndexWeight(idx, next) - here));
+			if (e < *error) {
+				*error = e;
+				best = next;
+			}
+		}
+	}
+	return best;
+}
+
+// Step size from state to the hinted state
+static double hintDelta(const PlateauTracker *p, int state) {
+	return stateIndexWeight(p->idx, p->hint) - stateIndexWeight(p->idx, state);
+}
+
+// Classify a new plateau at level against the last one and re-anchor
+static int plateauEvaluate(PlateauTracker *p, double level) {
+	int result, next;
+	double error;
+
+	p->from = p->state;
+	p->delta = level - p->anchor;
+
+	if (p->state < 0) {
+		// No anchor to take a delta from, match through the offset like the absolute matchers
+		StateMatch m;
+		stateIndexMatch(p->idx, lround(level - p->offset), &m);
+		if (m.nearest < 0 || m.distance > p->margin) {
+			p->unexplained++;
+			return PLATEAU_UNEXPLAINED;
+		}
+		next = m.nearest;
+		result = PLATEAU_TRANSITION;
+	} else {
+		next = nearestTransition(p, p->delta, &error);
+		if (p->hint >= 0 && fabs(p->delta - hintDelta(p, p->state)) <= p->margin) {
+			next = p->hint;
+			error = 0;
+		}
+		if (error > p->margin) {
+			next = p->state;
+			result = PLATEAU_UNEXPLAINED;
+		} else {
+			result = (next == p->state) ? PLATEAU_SETTLED : PLATEAU_TRANSITION;
+		}
+	}
+
+	p->hint = -1;
+	if (result == PLATEAU_TRANSITION) p->transitions++;
+	else if (result == PLATEAU_SETTLED) p->settled++;
+	else p->unexplained++;
+
+	p->state = next;
+	p->anchor = level;
+	p->offset = level - stateIndexWeight(p->idx, next);
+	return result;
+}
+
+/**
+ plateauPush(PlateauTracker *p, double weight, uint32_t tick)
+
+ add a clean value (index units, relative to the tare) and its conversion tick. Returns
+ PLATEAU_NONE, or the classification once the current run has lasted PLATEAU_MIN_US
+*/
+int plateauPush(PlateauTracker *p, double weight, uint32_t tick) {
+	if (p->runLength > 0 && fabs(weight - p->runMean) > p->band) {
+		p->runLength = 0;
+	}
+
+	p->interval = (p->runLength > 0) ? tick - p->lastTick : 0;
+	p->lastTick = tick;
+	if (p->runLength == 0) {
+		p->runMean = weight;
+		p->runLength = 1;
+		p->runStart = tick;
+		p->reported = 0;
+	} else {
+		p->runLength++;
+		p->runMean += (weight - p->runMean) / p->runLength;
+	}
+
+	if (p->reported || (uint32_t) (tick - p->runStart) < PLATEAU_MIN_US) return PLATEAU_NONE;
+	p->reported = 1;
+	return plateauEvaluate(p, p->runMean);
+}
+
+/**
+ plateauTrackZero(PlateauTracker *p)
+
+ call after plateauPush() while the caller is confident the table is at state 0. Once the run
+ has been stable for PLATEAU_ZERO_WINDOW_US, moves the zero toward the run mean with time
+ constant PLATEAU_ZERO_TAU_US and returns 1
+*/
+int plateauTrackZero(PlateauTracker *p) {
+	double step = (double) p->interval / PLATEAU_ZERO_TAU_US;
+
+	if (p->state != 0 || (uint32_t) (p->lastTick - p->runStart) < PLATEAU_ZERO_WINDOW_US) return 0;
+
+	p->offset += (p->runMean - p->offset) * ((step < 1) ? step : 1);
+	p->anchor = p->offset;
+	return 1;
+}
+
+/**
+ plateauHint(PlateauTracker *p, int from, int to)
+
+ a classifier says the step that left state from went to state to. If the plateau after that
+ step is still forming, it is matched to to whenever the delta allows; if it was already
+ matched to another state within the margin, it is relabelled
+*/
+void plateauHint(PlateauTracker *p, int from, int to) {
+	if (p->state == from) {
+		p->hint = to;
+		return;
+	}
+	if (p->state < 0 || p->from != from || p->state == to) return;
+
+	p->hint = to;
+	if (fabs(p->delta - hintDelta(p, from)) <= p->margin) {
+		p->state = to;
+		p->offset = p->anchor - stateIndexWeight(p->idx, to);
+	}
+	p->hint = -1;
+}
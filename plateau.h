@@ -0,0 +1,79 @@
+/**
+
+	Plateau tracker for Music Bottles
+
+	Matching the weight against absolute offsets from a one-time tare stops
+	working once the load cell creeps or something foreign lands on the table.
+	The tracker instead splits the stream of clean values into plateaus (runs
+	that stay within PLATEAU_BAND_FRACTION of the margin of their own mean for
+	PLATEAU_MIN_US) and matches the delta between consecutive plateaus
+	against the single-cap and single-bottle step sizes from the current state.
+
+	Every plateau re-anchors: a matched delta moves to the new state, a delta
+	near zero keeps the state and absorbs the drift since the last plateau,
+	anything else (a phone set down, a hand resting on the table) keeps the
+	state and absorbs the foreign weight. offset is the accumulated difference
+	between the measured level and the state's expected weight; subtracting it
+	gives the weight the absolute matchers expect.
+
+	Between plateaus, while the table is confidently at state 0 and the run has
+	been stable for PLATEAU_ZERO_WINDOW_US, plateauTrackZero() pulls the offset
+	slowly toward the run, so creep is followed continuously rather than in
+	jumps of half a margin.
+
+	plateauHint() lets the transient classifier name the bottle behind a step,
+	which decides between transitions whose step sizes are both within the
+	margin (caps of similar weight).
+
+*/
+
+#ifndef PLATEAU_H
+#define PLATEAU_H
+
+#include "stateindex.h"
+#include <stdint.h>
+
+// Windows are in time, from the conversion ticks, so a hand press at 80 SPS is not a plateau
+#define PLATEAU_MIN_US        900000  // a level must hold this long, 10 conversions at 10 SPS
+#define PLATEAU_BAND_FRACTION 0.5  // run band, fraction of the matching margin
+
+// Zero tracking: how long the run must have held before it starts, and its time constant
+#define PLATEAU_ZERO_WINDOW_US 4900000
+#define PLATEAU_ZERO_TAU_US    10000000
+
+// plateauPush()
+#define PLATEAU_NONE        0  // no new plateau
+#define PLATEAU_TRANSITION  1  // a single bottle changed, state is the new one
+#define PLATEAU_SETTLED     2  // same state, drift absorbed
+#define PLATEAU_UNEXPLAINED 3  // delta fits no transition, foreign weight absorbed (or no state known yet)
+
+typedef struct {
+	const StateIndex *idx;
+	double margin;    // how far a delta may be from a step size, index units
+	double band;      // half-width of a run around its mean
+
+	// Current run
+	double   runMean;
+	int      runLength;
+	uint32_t runStart;  // tick of the run's first conversion
+	uint32_t lastTick;
+	uint32_t interval;  // between the last two conversions, microseconds
+	int    reported;  // this run was already evaluated as a plateau
+
+	// Last plateau
+	int    state;     // -1 until a plateau has been matched
+	double anchor;    // its level
+	double offset;    // anchor minus the state's expected weight
+	double delta;     // latest plateau minus the one before
+	int    from;      // state before the latest plateau
+	int    hint;      // state a classifier expects the next plateau to be, -1 for none
+	unsigned long transitions, settled, unexplained;
+} PlateauTracker;
+
+void plateauInit(PlateauTracker *p, const StateIndex *idx, double margin);
+void plateauReset(PlateauTracker *p, int state, double level);
+int  plateauPush(PlateauTracker *p, double weight, uint32_t tick);
+int  plateauTrackZero(PlateauTracker *p);
+void plateauHint(PlateauTracker *p, int from, int to);
+
+#endif
@@ -4,7 +4,7 @@
 # Detection margin: +/-30
 
 # Cap weights: 629, 728, 426
-make clean
+# Incremental: rebuilds only if a source changed, so a restart warm-starts in about a second
 make
 amixer set PCM 100%
 sudo ./musicBottles 619 724 415 
@@ -4,28 +4,172 @@ Music Bottles v4 by Tal Achituv
 
 Measuring tool, for scale calibration
 
+Usage: scaleTool [-s source] [-r trace]   live tare and weight readout
+       scaleTool bench                    time HX711 reads (per bit and per conversion)
+       scaleTool -s hx711:pins=21+16 channels   live readout of each HX711 on the shared clock
+       scaleTool ab                       live readout of channels A and B, interleaved, tared separately
+
+  -s source   sample source, hx711 (default), trace:FILE or synth[:options] (see source.h)
+  -r trace    record every raw sample to a trace file for later replay
+
 */
 
 #include "hx711.h"
+#include "source.h"
+#include "estimator.h"
+#include "kalman.h"
 #include <unistd.h>
 
+#define BENCH_SAMPLES   100
+#define TARE_SAMPLES    150
+#define ESTIMATE_WINDOW 8
+#define CHANNEL_TARE    10
+
+// Direct reads bypass the source, so they recover from a failed read themselves
+static int readFailed(int result) {
+	if (result >= 0) return 0;
+	printf("\rHX711 %s, resetting converter\n", result == HX711_ERR_TIMEOUT ? "not responding" : "frames corrupted");
+	usleep(SENSOR_BACKOFF_MIN_US);
+	hx711Recover();
+	return 1;
+}
+
+void runBench() {
+	Hx711Bench bench;
+
+	Hx711Stats stats;
+
+	printf("Timing %d conversions...\n", BENCH_SAMPLES);
+	hx711ResetStats();
+	benchReadValue(BENCH_SAMPLES, &bench);
+	hx711GetStats(&stats);
+
+	printf("Delay loop:      %.1f loops/us (pulse width %d ns)\n", bench.loopsPerUs, HX711_PULSE_NS);
+	printf("Per bit:         %.2f us\n", bench.bitUs);
+	printf("Per conversion:  %.1f us mean, %.1f us max (%d bits, %d channel%s)\n", bench.frameUs, bench.frameMaxUs,
+	       bench.bits, bench.channels, bench.channels > 1 ? "s" : "");
+	printf("Sample rate:     %.1f sps\n", bench.sps);
+	printf("\n");
+	printHx711Stats(&stats);
+}
+
+// Per-channel readout for several HX711s on one clock, each tared separately
+void runChannels() {
+	long values[HX711_MAX_CHANNELS];
+	long tare[HX711_MAX_CHANNELS];
+	int c, i, n = hx711Channels();
+
+	for (c = 0; c < n; c++) tare[c] = 0;
+	for (i = 0; i < CHANNEL_TARE; i++) {
+		if (readFailed(read_multi(values))) {
+			i--;
+			continue;
+		}
+		for (c = 0; c < n; c++) tare[c] += values[c] / CHANNEL_TARE;
+	}
+
+	while (1) {
+		if (readFailed(read_multi(values))) continue;
+		printf("\r                                                  \r");
+		for (c = 0; c < n; c++) {
+			printf("%d\t", (int) ((values[c] - tare[c]) / 100));
+		}
+		fflush(stdout);
+	}
+}
+
+// Interleaved channel A/B readout, two independent streams with their own tare and filtering
+void runAB() {
+	Hx711Stream streams[2];
+	int c, i;
+
+	hx711StreamInit(&streams[HX711_CH_A], ESTIMATE_WINDOW);
+	hx711StreamInit(&streams[HX711_CH_B], ESTIMATE_WINDOW);
+	hx711Interleave(1);
+
+	printf("Acquiring Tare A/B ... ");
+	fflush(stdout);
+	for (i = 0; i < 2 * CHANNEL_TARE; i++) {
+		if (readFailed(readStreams(streams))) i--;
+	}
+	for (c = HX711_CH_A; c <= HX711_CH_B; c++) {
+		streams[c].tare = streams[c].value;
+	}
+	printf("Tare: A (%ld) B (%ld)\n", streams[HX711_CH_A].tare, streams[HX711_CH_B].tare);
 
+	while (1) {
+		if (readFailed(readStreams(streams))) continue;
+		printf("\r                                        \r");
+		printf("A: %.1f\tB: %.1f\t", streams[HX711_CH_A].value / 100.0, streams[HX711_CH_B].value / 100.0);
+		fflush(stdout);
+	}
+}
 
 int main(int argc, char **argv) {
-	int i;
+	const char *sourceSpec = SOURCE_DEFAULT;
+	const char *recordPath = NULL;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "s:r:")) != -1) {
+		if (opt == 's') sourceSpec = optarg;
+		else if (opt == 'r') recordPath = optarg;
+		else return -1;
+	}
+
 	printf("Initializing Scale...\n");
 
 
-	initHX711();
+	if (sourceOpen(sourceSpec) < 0) return -1;
+
+	if (optind < argc && strcmp(argv[optind], "bench") == 0) {
+		if (!sourceIsHardware()) {
+			printf("bench needs the hx711 source\n");
+			return -1;
+		}
+		runBench();
+		return 0;
+	}
+
+	if (optind < argc && strcmp(argv[optind], "ab") == 0) {
+		if (!sourceIsHardware()) {
+			printf("ab needs the hx711 source\n");
+			return -1;
+		}
+		runAB();
+		return 0;
+	}
+
+	if (optind < argc && strcmp(argv[optind], "channels") == 0) {
+		if (!sourceIsHardware()) {
+			printf("channels needs the hx711 source\n");
+			return -1;
+		}
+		runChannels();
+		return 0;
+	}
+
+	if (recordPath && sourceRecord(recordPath) < 0) return -1;
 	printf("Acquiring Tare ... ");
 	fflush(stdout);
-	long tare = getCleanSample(150,4);
+	long tare = getCleanSample(TARE_SAMPLES);
 	printf("Tare: (%d)\n",tare);
 	
+	Estimator estimator;
+	estimatorInit(&estimator, ESTIMATE_WINDOW, ESTIMATOR_K, ESTIMATOR_MIN_BAND);
+	Kalman filter;
+	kalmanInit(&filter, KALMAN_R_INIT);
+	kalmanReset(&filter, 0);
+	Sample s;
 	long sample = 0;
-	while (1) {
-		long raw = getCleanSample(4,4) - tare;
-	    sample = sample * 0.85 +  raw * 0.15;
+	int result;
+	while ((result = sourceRead(&s)) != SOURCE_END) {
+		if (result != SOURCE_OK) {
+			printf("\r                       \r --.-\t(no signal)\t");
+			fflush(stdout);
+			continue;
+		}
+		long raw = estimatorPush(&estimator, s.value) - tare;
+		sample = lround(kalmanUpdate(&filter, raw));
 		if (sample>0) {
 			printf("\r                       \r ");
 		} else {
@@ -33,7 +177,8 @@ int main(int argc, char **argv) {
 		}
 		printf("%.1f\t%d\t",(sample)/100.0,raw/100);
 		fflush(stdout);
-		usleep(50000);
 	}
 
+	sourceClose();
+	return 0;
 }
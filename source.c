@@ -0,0 +1,463 @@
+#include "source.h"
+#include "hx711.h"
+#include "timing.h"
+#include <unistd.h>
+
+/**
+
+	Sample sources for Music Bottles
+
+	Backends: the real HX711, a trace replayer and a synthetic generator. Only
+	the HX711 backend touches /dev/mem, so everything else runs on a dev box.
+
+*/
+
+#define SYNTH_MAX_STEPS 64
+
+// Step transients: the hand rests on the cap this long before the step, then the platform rings down
+#define SYNTH_PRESS_S  0.25
+#define SYNTH_RING_TAU 0.15
+#define SYNTH_BUMP_TAU 0.3   // decay of a bump's oscillation, seconds
+
+static SampleSource active;
+static FILE *recordFile = NULL;
+
+// Paces virtual sources at speed x real time, speed 0 means no pacing
+typedef struct {
+	double   speed;
+	int      started;
+	uint64_t startNs;
+	uint64_t elapsedUs;  // virtual time since the first sample
+	uint32_t lastTick;
+} Pacer;
+
+static void pace(Pacer *p, uint32_t tick) {
+	if (!p->started) {
+		p->started = 1;
+		p->startNs = timingNanos();
+		p->elapsedUs = 0;
+		p->lastTick = tick;
+		return;
+	}
+
+	p->elapsedUs += (uint32_t) (tick - p->lastTick);
+	p->lastTick = tick;
+	if (p->speed <= 0) return;
+
+	uint64_t due = p->startNs + (uint64_t) (p->elapsedUs * 1000.0 / p->speed);
+	uint64_t now = timingNanos();
+	if (due > now) usleep((due - now) / 1000);
+}
+
+// Split "key=value" in place, value is NULL for a bare flag
+static char *splitOption(char *opt, char **value) {
+	char *eq = strchr(opt, '=');
+	*value = NULL;
+	if (eq) {
+		*eq = 0;
+		*value = eq + 1;
+	}
+	return opt;
+}
+
+
+/* ==================== HX711 ==================== */
+
+// Channel B gain is a quarter of channel A at 128 according to the data sheet
+#define HX711_B_SCALE 4.0
+
+typedef struct {
+	int    interleaved;
+	double bScale;     // channel B counts to channel A counts
+	long   hold[2];    // latest reading of each channel
+	int    have[2];
+	int    failures;   // consecutive failed reads
+	unsigned backoffUs;
+} Hx711Ctx;
+
+/**
+ hx711Failed(src, h, error)
+
+ reset the converter after a failed read and wait out an exponential backoff, so an unplugged
+ scale costs a few wakeups per second instead of a spinning real-time thread
+*/
+static int hx711Failed(SampleSource *src, Hx711Ctx *h, int error) {
+	h->failures++;
+	if (h->failures == 1 || h->failures == SENSOR_LOST_AFTER) {
+		printf("HX711 %s, resetting converter (failure %d)\n",
+		       error == HX711_ERR_TIMEOUT ? "not responding" : "frames corrupted", h->failures);
+	}
+
+	// written by the acquisition thread, read by the main loop
+	__atomic_store_n(&src->health, (h->failures >= SENSOR_LOST_AFTER) ? SENSOR_LOST : SENSOR_RECOVERING, __ATOMIC_RELAXED);
+	h->have[HX711_CH_A] = h->have[HX711_CH_B] = 0;
+
+	usleep(h->backoffUs);
+	h->backoffUs *= 2;
+	if (h->backoffUs > SENSOR_BACKOFF_MAX_US) h->backoffUs = SENSOR_BACKOFF_MAX_US;
+
+	hx711Recover();
+	return SOURCE_ERROR;
+}
+
+static int hx711SourceRead(SampleSource *src, Sample *s) {
+	Hx711Ctx *h = (Hx711Ctx *) src->ctx;
+	long values[HX711_MAX_CHANNELS];
+	long sum;
+	int c, n;
+
+	do {
+		// Bounded wait for DOUT low: spins briefly, then sleeps (see hx711WaitReady())
+		n = read_multi(values);
+		if (n < 0) return hx711Failed(src, h, n);
+		s->tick = timingMicros();
+
+		// Several load cells under one platform add up to one weight
+		sum = 0;
+		for (c = 0; c < n; c++) {
+			sum += values[c];
+		}
+
+		c = hx711LastChannel();
+		h->hold[c] = sum;
+		h->have[c] = 1;
+	} while (h->interleaved && !(h->have[HX711_CH_A] && h->have[HX711_CH_B]));
+
+	if (h->failures > 0) {
+		printf("HX711 recovered after %d failed reads\n", h->failures);
+	}
+	h->failures = 0;
+	h->backoffUs = SENSOR_BACKOFF_MIN_US;
+	__atomic_store_n(&src->health, SENSOR_OK, __ATOMIC_RELAXED);
+
+	// Interleaved cells on A and B add up to one weight, each conversion refreshes one of them.
+	// Downstream sees only the sum, per-channel tare and filtering is scaleTool's readStreams()
+	s->value = h->interleaved ? h->hold[HX711_CH_A] + lround(h->bScale * h->hold[HX711_CH_B]) : sum;
+	return SOURCE_OK;
+}
+
+static void hx711SourceClose(SampleSource *src) {
+	uninit();
+	free(src->ctx);
+}
+
+static int openHX711(SampleSource *src, char *opts) {
+	Hx711Ctx *h = calloc(1, sizeof(Hx711Ctx));
+	int pins[HX711_MAX_CHANNELS];
+	int numPins;
+	char *opt, *value, *save;
+
+	h->bScale = HX711_B_SCALE;
+	h->backoffUs = SENSOR_BACKOFF_MIN_US;
+
+	for (opt = opts ? strtok_r(opts, ",", &save) : NULL; opt; opt = strtok_r(NULL, ",", &save)) {
+		splitOption(opt, &value);
+		if (value == NULL && strcmp(opt, "ab") == 0) h->interleaved = 1;
+		else if (value && strcmp(opt, "bscale") == 0) h->bScale = atof(value);
+		else if (value && strcmp(opt, "pins") == 0) {
+			numPins = hx711ParsePins(value, pins, HX711_MAX_CHANNELS);
+			if (hx711SetDataPins(pins, numPins) < 0) {
+				printf("Error: bad HX711 data pin list '%s'\n", value);
+				free(h);
+				return -1;
+			}
+		}
+		else printf("Warning: unknown hx711 option '%s'\n", opt);
+	}
+
+	initHX711();
+	hx711Interleave(h->interleaved);
+	src->read = hx711SourceRead;
+	src->close = hx711SourceClose;
+	src->hardware = 1;
+	src->paced = 1;
+	src->ctx = h;
+	return 0;
+}
+
+
+/* ==================== Trace replay ==================== */
+
+typedef struct {
+	FILE    *file;
+	int      loop;
+	Pacer    pacer;
+	int      haveTick;
+	uint32_t rawTick;   // last tick read from the file
+	uint32_t outTick;   // last tick handed out, continuous across loops
+	uint32_t interval;  // last tick delta, used to bridge a loop
+} TraceCtx;
+
+static int traceSourceRead(SampleSource *src, Sample *s) {
+	TraceCtx *t = (TraceCtx *) src->ctx;
+	char line[128];
+	unsigned long tick;
+	long value;
+
+	while (1) {
+		if (fgets(line, sizeof(line), t->file) == NULL) {
+			if (!t->loop || !t->haveTick) return SOURCE_END;
+			rewind(t->file);
+			t->haveTick = 0;
+			continue;
+		}
+		if (line[0] == '#' || sscanf(line, "%lu %ld", &tick, &value) != 2) continue;
+
+		if (t->haveTick) {
+			t->interval = (uint32_t) tick - t->rawTick;
+		}
+		t->outTick = (t->pacer.started ? t->outTick + t->interval : (uint32_t) tick);
+		t->rawTick = (uint32_t) tick;
+		t->haveTick = 1;
+
+		s->tick = t->outTick;
+		s->value = value;
+		pace(&t->pacer, s->tick);
+		return SOURCE_OK;
+	}
+}
+
+static void traceSourceClose(SampleSource *src) {
+	TraceCtx *t = (TraceCtx *) src->ctx;
+	fclose(t->file);
+	free(t);
+}
+
+static int openTrace(SampleSource *src, char *opts) {
+	TraceCtx *t = calloc(1, sizeof(TraceCtx));
+	char *path = NULL, *opt, *value, *save;
+
+	t->pacer.speed = 1;
+	for (opt = opts ? strtok_r(opts, ",", &save) : NULL; opt; opt = strtok_r(NULL, ",", &save)) {
+		splitOption(opt, &value);
+		if (value == NULL && strcmp(opt, "loop") == 0) t->loop = 1;
+		else if (value == NULL) path = opt;
+		else if (strcmp(opt, "file") == 0) path = value;
+		else if (strcmp(opt, "speed") == 0) t->pacer.speed = atof(value);
+		else printf("Warning: unknown trace option '%s'\n", opt);
+	}
+
+	if (path == NULL || (t->file = fopen(path, "r")) == NULL) {
+		printf("Error opening trace '%s'\n", path ? path : "");
+		free(t);
+		return -1;
+	}
+
+	src->read = traceSourceRead;
+	src->close = traceSourceClose;
+	src->paced = t->pacer.speed > 0;
+	src->ctx = t;
+	return 0;
+}
+
+
+/* ==================== Synthetic ==================== */
+
+typedef struct {
+	double   rate;   // samples per second
+	double   base;   // counts at t=0
+	double   noise;  // gaussian noise, standard deviation in counts
+	double   drift;  // counts per second
+	double   duration;  // seconds until SOURCE_END, 0 runs forever
+	int      numSteps;
+	double   stepTime[SYNTH_MAX_STEPS];
+	double   stepDelta[SYNTH_MAX_STEPS];
+	double   stepPress[SYNTH_MAX_STEPS];  // counts, 0 for a clean step
+	double   stepRing[SYNTH_MAX_STEPS];   // Hz
+	int      numBumps;
+	double   bumpTime[SYNTH_MAX_STEPS];
+	double   bumpAmp[SYNTH_MAX_STEPS];    // counts, first swing
+	double   bumpHz[SYNTH_MAX_STEPS];
+	uint32_t rng;
+	uint64_t n;      // samples generated
+	Pacer    pacer;
+} SynthCtx;
+
+static double synthUniform(SynthCtx *c) {
+	// xorshift32, deterministic for a given seed
+	c->rng ^= c->rng << 13;
+	c->rng ^= c->rng >> 17;
+	c->rng ^= c->rng << 5;
+	return (c->rng + 1.0) / 4294967297.0;
+}
+
+static double synthGauss(SynthCtx *c) {
+	return sqrt(-2.0 * log(synthUniform(c))) * cos(2.0 * M_PI * synthUniform(c));
+}
+
+static int synthSourceRead(SampleSource *src, Sample *s) {
+	SynthCtx *c = (SynthCtx *) src->ctx;
+	double t = c->n / c->rate;
+	double value = c->base + c->drift * t;
+	int i;
+
+	if (c->duration > 0 && t >= c->duration) return SOURCE_END;
+
+	for (i = 0; i < c->numSteps; i++) {
+		double since = t - c->stepTime[i];
+		if (since >= 0) value += c->stepDelta[i];
+		if (since >= -SYNTH_PRESS_S && since < 0) value += c->stepPress[i];
+		if (since >= 0 && c->stepPress[i] != 0) {
+			value += 0.5 * c->stepPress[i] * exp(-since / SYNTH_RING_TAU) * sin(2.0 * M_PI * c->stepRing[i] * since);
+		}
+	}
+	for (i = 0; i < c->numBumps; i++) {
+		double since = t - c->bumpTime[i];
+		if (since >= 0) value += c->bumpAmp[i] * exp(-since / SYNTH_BUMP_TAU) * sin(2.0 * M_PI * c->bumpHz[i] * since);
+	}
+	value += c->noise * synthGauss(c);
+
+	s->tick = (uint32_t) (uint64_t) (t * 1000000.0);
+	s->value = lround(value);
+	c->n++;
+
+	pace(&c->pacer, s->tick);
+	return SOURCE_OK;
+}
+
+static void synthSourceClose(SampleSource *src) {
+	free(src->ctx);
+}
+
+static int openSynth(SampleSource *src, char *opts) {
+	SynthCtx *c = calloc(1, sizeof(SynthCtx));
+	char *opt, *value, *save;
+
+	c->rate = 10;
+	c->base = 100000;
+	c->noise = 300;
+	c->rng = 1;
+	c->pacer.speed = 1;
+
+	for (opt = opts ? strtok_r(opts, ",", &save) : NULL; opt; opt = strtok_r(NULL, ",", &save)) {
+		splitOption(opt, &value);
+		if (value == NULL) { printf("Warning: synth option '%s' needs a value\n", opt); continue; }
+
+		if (strcmp(opt, "rate") == 0) c->rate = atof(value);
+		else if (strcmp(opt, "base") == 0) c->base = atof(value);
+		else if (strcmp(opt, "noise") == 0) c->noise = atof(value);
+		else if (strcmp(opt, "drift") == 0) c->drift = atof(value);
+		else if (strcmp(opt, "duration") == 0) c->duration = atof(value);
+		else if (strcmp(opt, "seed") == 0) c->rng = strtoul(value, NULL, 0);
+		else if (strcmp(opt, "speed") == 0) c->pacer.speed = atof(value);
+		else if (strcmp(opt, "step") == 0 && c->numSteps < SYNTH_MAX_STEPS && strchr(value, '@')) {
+			char *end;
+			c->stepTime[c->numSteps] = atof(value);
+			c->stepDelta[c->numSteps] = strtod(strchr(value, '@') + 1, &end);
+			if (*end == '/') c->stepPress[c->numSteps] = strtod(end + 1, &end);
+			if (*end == '/') c->stepRing[c->numSteps] = strtod(end + 1, &end);
+			c->numSteps++;
+		}
+		else if (strcmp(opt, "bump") == 0 && c->numBumps < SYNTH_MAX_STEPS && strchr(value, '@')) {
+			char *end;
+			c->bumpTime[c->numBumps] = atof(value);
+			c->bumpAmp[c->numBumps] = strtod(strchr(value, '@') + 1, &end);
+			c->bumpHz[c->numBumps] = (*end == '/') ? atof(end + 1) : 10;
+			c->numBumps++;
+		}
+		else printf("Warning: unknown synth option '%s'\n", opt);
+	}
+
+	if (c->rate <= 0) c->rate = 10;
+	if (c->rng == 0) c->rng = 1;
+
+	src->read = synthSourceRead;
+	src->close = synthSourceClose;
+	src->paced = c->pacer.speed > 0;
+	src->ctx = c;
+	return 0;
+}
+
+
+/* ==================== Active source ==================== */
+
+/**
+ sourceOpen(const char *spec)
+
+ select and initialise the active source, spec is "name[:options]" (see source.h).
+ Returns 0 on success, -1 on an unknown or unusable spec
+*/
+int sourceOpen(const char *spec) {
+	char buf[4096];  // room for a long list of synthetic steps
+	char *opts;
+	int result;
+
+	if (spec == NULL) spec = SOURCE_DEFAULT;
+	snprintf(buf, sizeof(buf), "%s", spec);
+
+	opts = strchr(buf, ':');
+	if (opts) *opts++ = 0;
+
+	memset(&active, 0, sizeof(active));
+
+	if (strcmp(buf, "hx711") == 0) {
+		active.name = "hx711";
+		result = openHX711(&active, opts);
+	} else if (strcmp(buf, "trace") == 0) {
+		active.name = "trace";
+		result = openTrace(&active, opts);
+	} else if (strcmp(buf, "synth") == 0) {
+		active.name = "synth";
+		result = openSynth(&active, opts);
+	} else {
+		printf("Unknown sample source '%s' (expected hx711, trace or synth)\n", buf);
+		result = -1;
+	}
+
+	if (result < 0) active.read = NULL;
+	return result;
+}
+
+// Blocking read of the next conversion from the active source
+int sourceRead(Sample *s) {
+	int result = active.read(&active, s);
+
+	if (result == SOURCE_OK && recordFile) {
+		fprintf(recordFile, "%u %ld\n", s->tick, s->value);
+	}
+	return result;
+}
+
+void sourceClose(void) {
+	if (active.close) active.close(&active);
+	active.read = NULL;
+	active.close = NULL;
+
+	if (recordFile) {
+		fclose(recordFile);
+		recordFile = NULL;
+	}
+}
+
+const char *sourceName(void) {
+	return active.name;
+}
+
+int sourceIsHardware(void) {
+	return active.hardware;
+}
+
+int sourceIsPaced(void) {
+	return active.paced;
+}
+
+// SENSOR_OK, SENSOR_RECOVERING or SENSOR_LOST, only hardware sources ever fail
+int sourceHealth(void) {
+	return __atomic_load_n(&active.health, __ATOMIC_RELAXED);
+}
+
+/**
+ sourceRecord(const char *path)
+
+ tee every sample read from now on into a trace file that the trace source can replay
+*/
+int sourceRecord(const char *path) {
+	recordFile = fopen(path, "w");
+	if (recordFile == NULL) {
+		printf("Error opening %s for recording\n", path);
+		return -1;
+	}
+	setvbuf(recordFile, NULL, _IOLBF, 0);
+	fprintf(recordFile, "# music bottles trace, source %s\n", active.name ? active.name : "?");
+	return 0;
+}
@@ -0,0 +1,78 @@
+/**
+
+	Sample sources for Music Bottles
+
+	Everything downstream of the scale reads conversions through one active
+	source, selected at runtime with a spec string:
+
+	  hx711[:pins=P1+P2+...][,ab[,bscale=X]]
+	                                      bit-banged HX711 on /dev/mem (default),
+	                                      several data pins on one SCK are summed,
+	                                      ab alternates channels A and B and reports
+	                                      A + X*B as one sample, not two streams
+	  trace:FILE[,speed=S][,loop]         replay a recorded trace
+	  synth[:key=value,...]               synthetic load cell, keys:
+	      rate=SPS base=COUNTS noise=SD drift=COUNTS_PER_S seed=N speed=S
+	      duration=SECONDS                end of data (default: never)
+	      step=T@DELTA[/PRESS/HZ]         add DELTA counts at T seconds (repeatable), optionally
+	                                      with a hand pressing PRESS counts just before and
+	                                      ringing at HZ after, for the transient classifier
+	      bump=T@AMP[/HZ]                 a knock or footstep at T seconds: oscillation of AMP
+	                                      counts at HZ (default 10) decaying to nothing
+
+	speed is a multiple of real time, 0 runs as fast as the consumer drains.
+	A hardware read that times out or stays corrupted returns SOURCE_ERROR after
+	resetting the converter; reads keep backing off until it answers again, and
+	sourceHealth() tells the main loop whether the weight can be trusted.
+	Traces are text, one "tick value" pair per line (tick in microseconds),
+	lines starting with # are ignored.
+
+*/
+
+#ifndef SOURCE_H
+#define SOURCE_H
+
+#include <stdint.h>
+
+#define SOURCE_OK     0
+#define SOURCE_END   -1  // trace or synthetic duration exhausted
+#define SOURCE_ERROR -2  // no valid conversion this time, try again
+
+// sourceHealth()
+#define SENSOR_OK         0
+#define SENSOR_RECOVERING 1  // recent reads failed, converter being reset
+#define SENSOR_LOST       2  // SENSOR_LOST_AFTER failures in a row, weight is meaningless
+
+#define SENSOR_LOST_AFTER 3
+
+// Delay before retrying after a failed read, doubling per failure up to the max
+#define SENSOR_BACKOFF_MIN_US 100000
+#define SENSOR_BACKOFF_MAX_US 5000000
+
+#define SOURCE_DEFAULT "hx711"
+
+typedef struct {
+	long     value;  // raw HX711 counts
+	uint32_t tick;   // microseconds, monotonic, wraps like gpioTick()
+} Sample;
+
+typedef struct SampleSource {
+	const char *name;
+	int  (*read)(struct SampleSource *src, Sample *s);  // blocks until the next conversion or an error
+	void (*close)(struct SampleSource *src);
+	int  hardware;  // needs /dev/mem, implies real-time pacing
+	int  paced;     // delivers samples at (a multiple of) real time
+	int  health;    // SENSOR_OK/RECOVERING/LOST
+	void *ctx;
+} SampleSource;
+
+int         sourceOpen(const char *spec);
+int         sourceRead(Sample *s);
+void        sourceClose(void);
+const char *sourceName(void);
+int         sourceIsHardware(void);
+int         sourceIsPaced(void);
+int         sourceHealth(void);
+int         sourceRecord(const char *path);
+
+#endif
@@ -0,0 +1,164 @@
+#include "stateindex.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+/**
+
+	State index for Music Bottles
+
+	6561 entries for 8 bottles is about 100 KB and 13 comparisons per
+	match, small enough that meet-in-the-middle is not worth it yet.
+
+*/
+
+// Digit (BOTTLE_COMPLETE/OPEN/REMOVED) of one bottle in a state
+int stateDigit(int state, int bottle) {
+	while (bottle-- > 0) state /= 3;
+	return state % 3;
+}
+
+// Expected delta from tare for a state, whether or not the index contains it
+long stateIndexWeight(const StateIndex *idx, int state) {
+	long weight = 0;
+	int i;
+
+	for (i = 0; i < idx->bottles; i++, state /= 3) {
+		if (state % 3 == BOTTLE_OPEN) weight -= idx->cap[i];
+		else if (state % 3 == BOTTLE_REMOVED) weight -= idx->cap[i] + idx->bottle[i];
+	}
+	return weight;
+}
+
+static int compareEntries(const void *a, const void *b) {
+	const StateEntry *x = (const StateEntry *) a, *y = (const StateEntry *) b;
+	if (x->weight != y->weight) return (x->weight > y->weight) - (x->weight < y->weight);
+	return x->state - y->state;
+}
+
+/**
+ stateIndexInit(idx, cap, bottle, bottles)
+
+ build the sorted index for up to STATE_MAX_BOTTLES bottles, bottle may be NULL (caps only).
+ Returns the number of states, -1 if bottles is out of range
+*/
+int stateIndexInit(StateIndex *idx, const long *cap, const long *bottle, int bottles) {
+	int total = 1, state, i;
+
+	if (bottles < 1 || bottles > STATE_MAX_BOTTLES) return -1;
+
+	idx->bottles = bottles;
+	for (i = 0; i < bottles; i++) {
+		idx->cap[i] = cap[i];
+		idx->bottle[i] = bottle ? bottle[i] : 0;
+		total *= 3;
+	}
+
+	idx->count = 0;
+	for (state = 0; state < total; state++) {
+		int removable = 1;
+		for (i = 0; i < bottles; i++) {
+			if (stateDigit(state, i) == BOTTLE_REMOVED && idx->bottle[i] == 0) removable = 0;
+		}
+		if (!removable) continue;
+
+		idx->entries[idx->count].state = state;
+		idx->entries[idx->count].weight = stateIndexWeight(idx, state);
+		idx->count++;
+	}
+
+	qsort(idx->entries, idx->count, sizeof(StateEntry), compareEntries);
+	return idx->count;
+}
+
+/**
+ stateIndexMatch(idx, weight, m)
+
+ nearest and second-nearest states to a measured delta. In a sorted list both are among
+ the two entries either side of the insertion point, so only those four are compared
+*/
+void stateIndexMatch(const StateIndex *idx, long weight, StateMatch *m) {
+	int lo = 0, hi = idx->count, i;
+
+	m->nearest = m->second = -1;
+	m->distance = m->secondDistance = m->margin = 0;
+
+	// First entry with weight >= the measurement
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if (idx->entries[mid].weight < weight) lo = mid + 1;
+		else hi = mid;
+	}
+
+	for (i = lo - 2; i <= lo + 1; i++) {
+		long d;
+		if (i < 0 || i >= idx->count) continue;
+
+		d = labs(idx->entries[i].weight - weight);
+		if (m->nearest < 0 || d < m->distance) {
+			m->second = m->nearest;
+			m->secondDistance = m->distance;
+			m->nearest = idx->entries[i].state;
+			m->distance = d;
+		} else if (m->second < 0 || d < m->secondDistance) {
+			m->second = idx->entries[i].state;
+			m->secondDistance = d;
+		}
+	}
+	if (m->second >= 0) m->margin = m->secondDistance - m->distance;
+}
+
+/**
+ stateIndexMinGap(idx, a, b)
+
+ smallest weight difference between two states, the pair is returned in a and b (may be NULL).
+ A gap under twice the detection margin means those states cannot be told apart reliably
+*/
+long stateIndexMinGap(const StateIndex *idx, int *a, int *b) {
+	long best = -1;
+	int i;
+
+	for (i = 1; i < idx->count; i++) {
+		long gap = idx->entries[i].weight - idx->entries[i - 1].weight;
+		if (best < 0 || gap < best) {
+			best = gap;
+			if (a) *a = idx->entries[i - 1].state;
+			if (b) *b = idx->entries[i].state;
+		}
+	}
+	return best;
+}
+
+/**
+ stateName(state, bottles, buf, len)
+
+ readable state such as "Cap1+3 removed, Bottle2 removed"; every cap off and every bottle
+ present is the birthday state. Returns the length written
+*/
+int stateName(int state, int bottles, char *buf, int len) {
+	int i, used = 0, open = 0, removed = 0, first;
+	int digit;
+
+	for (i = 0; i < bottles; i++) {
+		digit = stateDigit(state, i);
+		if (digit == BOTTLE_OPEN) open++;
+		if (digit == BOTTLE_REMOVED) removed++;
+	}
+
+	if (open == 0 && removed == 0) return snprintf(buf, len, "All caps on");
+	if (open == bottles) return snprintf(buf, len, "BIRTHDAY MODE");
+
+	for (digit = BOTTLE_OPEN; digit <= BOTTLE_REMOVED; digit++) {
+		if ((digit == BOTTLE_OPEN ? open : removed) == 0) continue;
+
+		if (used > 0 && used < len) used += snprintf(buf + used, len - used, ", ");
+		first = 1;
+		for (i = 0; i < bottles && used < len; i++) {
+			if (stateDigit(state, i) != digit) continue;
+			if (first) used += snprintf(buf + used, len - used, "%s%d", digit == BOTTLE_OPEN ? "Cap" : "Bottle", i + 1);
+			else used += snprintf(buf + used, len - used, "+%d", i + 1);
+			first = 0;
+		}
+		if (used < len) used += snprintf(buf + used, len - used, " removed");
+	}
+	return used;
+}
@@ -0,0 +1,56 @@
+/**
+
+	State index for Music Bottles
+
+	Each bottle is in one of three states: complete, cap removed, or bottle
+	(with its cap) removed. A table state is one base-3 digit per bottle,
+	bottle 0 least significant, the encoding tests/test_bottle_state.c uses:
+	state = d0 + 3*d1 + 9*d2 + ...
+
+	All 3^N expected weight deltas are computed once and sorted, so matching a
+	weight is a binary search plus a look at the neighbours: O(log 3^N), no
+	allocation. A bottle with weight 0 cannot be removed, only its cap, which
+	leaves the 2^N cap-only model of the original installation.
+
+*/
+
+#ifndef STATEINDEX_H
+#define STATEINDEX_H
+
+#define STATE_MAX_BOTTLES 8
+#define STATE_MAX_STATES  6561  // 3^STATE_MAX_BOTTLES
+
+// Per-bottle digit
+#define BOTTLE_COMPLETE 0
+#define BOTTLE_OPEN     1  // cap removed
+#define BOTTLE_REMOVED  2  // bottle and cap removed
+
+typedef struct {
+	long weight;  // expected delta from tare (negative: things removed)
+	int  state;
+} StateEntry;
+
+typedef struct {
+	int        bottles;
+	int        count;  // states in the index
+	long       cap[STATE_MAX_BOTTLES];
+	long       bottle[STATE_MAX_BOTTLES];
+	StateEntry entries[STATE_MAX_STATES];  // ascending weight
+} StateIndex;
+
+typedef struct {
+	int  nearest;         // state, -1 if the index is empty
+	int  second;          // runner-up state, -1 if there is only one
+	long distance;        // |weight - expected| of the nearest
+	long secondDistance;
+	long margin;          // secondDistance - distance, how clear-cut the match is
+} StateMatch;
+
+int  stateIndexInit(StateIndex *idx, const long *cap, const long *bottle, int bottles);
+void stateIndexMatch(const StateIndex *idx, long weight, StateMatch *m);
+long stateIndexWeight(const StateIndex *idx, int state);
+long stateIndexMinGap(const StateIndex *idx, int *a, int *b);
+int  stateDigit(int state, int bottle);
+int  stateName(int state, int bottles, char *buf, int len);
+
+#endif
@@ -0,0 +1,88 @@
+#include "step.h"
+
+/**
+
+	Step-change detector for Music Bottles
+
+	Constant work per sample: two sums, two running means and the
+	reference, no history buffer.
+
+*/
+
+void stepInit(StepDetector *d, double minStep) {
+	d->minStep = minStep;
+	d->k = STEP_DRIFT_FRACTION * minStep;
+	d->h = STEP_THRESHOLD_FRACTION * minStep;
+	d->clip = STEP_CLIP_FRACTION * minStep;
+	d->alarms = 0;
+	d->step = 0;
+	d->latency = 0;
+	d->primed = 0;
+	stepReset(d, 0);
+}
+
+// Restart both sums from a known plateau (after an alarm, a re-tare or a lost sensor)
+void stepReset(StepDetector *d, double level) {
+	d->ref = level;
+	d->level = level;
+	d->sPos = d->sNeg = 0;
+	d->sumPos = d->sumNeg = 0;
+	d->nPos = d->nNeg = 0;
+}
+
+/**
+ stepPush(StepDetector *d, long x)
+
+ add a tared conversion, returns 1 if it completed a step (d->step, d->level and d->latency are set)
+*/
+int stepPush(StepDetector *d, long x) {
+	double z;
+
+	// The first sample defines the plateau
+	if (!d->primed) {
+		d->primed = 1;
+		stepReset(d, x);
+		return 0;
+	}
+
+	z = x - d->ref;
+	if (z > d->clip) z = d->clip;
+	if (z < -d->clip) z = -d->clip;
+
+	d->sPos += z - d->k;
+	if (d->sPos <= 0) {
+		d->sPos = 0;
+		d->sumPos = 0;
+		d->nPos = 0;
+	} else {
+		d->sumPos += x;
+		d->nPos++;
+	}
+
+	d->sNeg += -z - d->k;
+	if (d->sNeg <= 0) {
+		d->sNeg = 0;
+		d->sumNeg = 0;
+		d->nNeg = 0;
+	} else {
+		d->sumNeg += x;
+		d->nNeg++;
+	}
+
+	if (d->sPos > d->h || d->sNeg > d->h) {
+		int up = d->sPos > d->h;
+		double level = up ? d->sumPos / d->nPos : d->sumNeg / d->nNeg;
+
+		d->latency = up ? d->nPos : d->nNeg;
+		d->step = level - d->ref;
+		d->alarms++;
+		stepReset(d, level);
+		return 1;
+	}
+
+	// No step in progress: let the plateau follow slow drift
+	if (z > -d->k && z < d->k) {
+		d->ref += z / STEP_REF_SMOOTHING;
+	}
+	return 0;
+}
@@ -0,0 +1,48 @@
+/**
+
+	Step-change detector for Music Bottles
+
+	Two-sided CUSUM on tared raw conversions. Each sample adds its distance
+	from the reference level, less a drift allowance of half the smallest
+	step of interest, to an upper and a lower sum; a sum over the threshold
+	is a step. The step size is the mean of the samples since that sum last
+	left zero, minus the reference, so it is known a few conversions after
+	the lift instead of once a smoothed value has settled.
+
+	Increments are clipped, so a single spike cannot reach the threshold on
+	its own. Between steps the reference slowly follows drift.
+
+*/
+
+#ifndef STEP_H
+#define STEP_H
+
+// Tuning, as fractions of the smallest step of interest (the lightest cap)
+#define STEP_DRIFT_FRACTION     0.5   // CUSUM allowance k
+#define STEP_THRESHOLD_FRACTION 1.6   // alarm threshold h, above one clipped sample
+#define STEP_CLIP_FRACTION      2.0   // largest increment one sample can add
+
+// Reference level tracks in-band samples with this time constant (samples)
+#define STEP_REF_SMOOTHING 16
+
+typedef struct {
+	double minStep;    // smallest step to detect, counts
+	double k, h, clip;
+	int    primed;     // reference level set
+	double ref;        // current plateau
+	double sPos, sNeg; // upper and lower CUSUM
+	double sumPos, sumNeg;  // samples since each sum last left zero
+	int    nPos, nNeg;
+
+	// Result of the latest alarm
+	double step;       // estimated step, counts
+	double level;      // new plateau, ref + step
+	int    latency;    // samples from the estimated change point to the alarm
+	unsigned long alarms;
+} StepDetector;
+
+void stepInit(StepDetector *d, double minStep);
+void stepReset(StepDetector *d, double level);
+int  stepPush(StepDetector *d, long x);
+
+#endif
@@ -0,0 +1,169 @@
+#include "stream.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+
+	Streamed tracks for Music Bottles
+
+	Only the header is parsed when a track is opened. The mapping is
+	read-only and shared, so dropping pages with MADV_DONTNEED loses nothing:
+	they are read back from the file if the track comes round to them again.
+
+*/
+
+static size_t pageSize;
+
+// Advise on the frames [first, first + n) of a stream: read ahead whole pages around them, drop only pages wholly inside
+static void advise(Stream *s, uint32_t first, uint32_t n, int advice) {
+	size_t start = (size_t) ((uint8_t *) (s->pcm.data + 2 * (size_t) first) - s->map);
+	size_t end = start + (size_t) n * 2 * sizeof(int16_t);
+
+	if (advice == MADV_DONTNEED) {
+		start = (start + pageSize - 1) & ~(pageSize - 1);
+		end &= ~(pageSize - 1);
+	} else {
+		start &= ~(pageSize - 1);
+	}
+	if (end > s->size) end = s->size;
+	if (end > start) madvise(s->map + start, end - start, advice);
+}
+
+/**
+ streamOpen(Stream *s, const char *path, int rate)
+
+ map a WAV file to play from. Returns 0 if it streams, 1 if it is not 16-bit stereo at rate and has
+ to be decoded instead, -1 on error (wavError() says why)
+*/
+int streamOpen(Stream *s, const char *path, int rate) {
+	struct stat st;
+	WavInfo info;
+	Pcm pcm;
+	int fd;
+
+	memset(s, 0, sizeof(*s));
+	memset(&pcm, 0, sizeof(pcm));
+	fd = open(path, O_RDONLY);
+	if (fd < 0) return wavFail("cannot open %s: %s", path, strerror(errno));
+	if (fstat(fd, &st) < 0 || st.st_size == 0) {
+		close(fd);
+		return wavFail("cannot read %s", path);
+	}
+
+	// The mapping keeps the file open
+	s->size = (size_t) st.st_size;
+	s->map = mmap(NULL, s->size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (s->map == MAP_FAILED) {
+		s->map = NULL;
+		return wavFail("cannot map %s: %s", path, strerror(errno));
+	}
+	if (wavParse(path, s->map, s->size, &info) < 0) {
+		streamClose(s);
+		return -1;
+	}
+
+	// Played in place only if the mixer can take the samples as they are
+	if (info.channels != 2 || info.rate != rate || info.offset % sizeof(int16_t) != 0 ||
+	    __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__) {
+		streamClose(s);
+		return 1;
+	}
+
+	pcm.data = (int16_t *) (s->map + info.offset);
+	pcm.frames = info.loopEnd ? info.loopEnd : info.frames;
+	pcm.rate = rate;
+	pcm.loopStart = info.loopStart;
+	streamView(s, s->map, s->size, &pcm);
+	s->view = 0;
+	return 0;
+}
+
+/**
+ streamView(Stream *s, uint8_t *map, size_t size, const Pcm *pcm)
+
+ stream samples inside a mapping made elsewhere (see assets.h), which streamClose() leaves mapped
+*/
+void streamView(Stream *s, uint8_t *map, size_t size, const Pcm *pcm) {
+	if (pageSize == 0) pageSize = (size_t) sysconf(_SC_PAGESIZE);
+
+	s->map = map;
+	s->size = size;
+	s->view = 1;
+	s->pcm = *pcm;
+	s->pcm.mapped = 1;
+	s->aheadFrames = (uint32_t) ((uint64_t) pcm->rate * STREAM_AHEAD_MS / 1000);
+	s->behindFrames = (uint32_t) ((uint64_t) pcm->rate * STREAM_BEHIND_MS / 1000);
+	s->stepFrames = (uint32_t) ((uint64_t) pcm->rate * STREAM_STEP_MS / 1000);
+	s->window = ~0u;
+
+	// Nothing has been read yet, the first window is read ahead for the first play
+	streamPrefetch(s, 0);
+}
+
+/**
+ streamPrefetch(Stream *s, uint32_t position)
+
+ main loop: read ahead of the frame a channel plays from, wrapping to the loop start, and drop
+ everything else but what was just played. Does nothing until the position moves into another
+ STREAM_STEP_MS step
+*/
+void streamPrefetch(Stream *s, uint32_t position) {
+	uint32_t frames = s->pcm.frames, loop = s->pcm.loopStart, window;
+	uint32_t keep[3][2];  // frame ranges to keep, in order once sorted
+	uint32_t end = 0;
+	int n = 0, i, j;
+
+	if (s->map == NULL || frames == 0) return;
+	position %= frames;
+	window = position / s->stepFrames;
+	if (window == s->window) return;
+	s->window = window;
+	position = window * s->stepFrames;
+
+	// Ahead, wrapping to the loop start; behind, wrapping back to the end of the loop
+	keep[n][0] = (position > s->behindFrames) ? position - s->behindFrames : 0;
+	keep[n][1] = (frames - position > s->aheadFrames) ? position + s->aheadFrames : frames;
+	advise(s, position, keep[n][1] - position, MADV_WILLNEED);
+	n++;
+	if (position + s->aheadFrames > frames) {
+		uint32_t over = position + s->aheadFrames - frames;
+		keep[n][0] = loop;
+		keep[n][1] = (over < frames - loop) ? loop + over : frames;
+		advise(s, keep[n][0], keep[n][1] - keep[n][0], MADV_WILLNEED);
+		n++;
+	}
+	if (position < s->behindFrames && position >= loop) {
+		uint32_t under = s->behindFrames - position;
+		keep[n][0] = (under < frames - loop) ? frames - under : loop;
+		keep[n][1] = frames;
+		n++;
+	}
+
+	// Drop the gaps between the ranges kept
+	for (i = 1; i < n; i++) {
+		for (j = i; j > 0 && keep[j][0] < keep[j - 1][0]; j--) {
+			uint32_t a = keep[j][0], b = keep[j][1];
+			keep[j][0] = keep[j - 1][0];
+			keep[j][1] = keep[j - 1][1];
+			keep[j - 1][0] = a;
+			keep[j - 1][1] = b;
+		}
+	}
+	for (i = 0; i < n; i++) {
+		if (keep[i][0] > end) advise(s, end, keep[i][0] - end, MADV_DONTNEED);
+		if (keep[i][1] > end) end = keep[i][1];
+	}
+	if (end < frames) advise(s, end, frames - end, MADV_DONTNEED);
+}
+
+// Unmap a stream, nothing to do for one that is zeroed or did not open
+void streamClose(Stream *s) {
+	if (s->map && !s->view) munmap(s->map, s->size);
+	s->map = NULL;
+	memset(&s->pcm, 0, sizeof(s->pcm));
+}
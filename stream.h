@@ -0,0 +1,48 @@
+/**
+
+	Streamed tracks for Music Bottles
+
+	A WAV file that is already in the output format (16-bit stereo at the
+	output rate) is memory-mapped and played from the mapping: nothing is
+	decoded at startup and no copy of the samples is made, the mixer reads
+	the file's pages as the kernel brings them in. Those pages are clean and
+	backed by the file, so however long a track is, only the part around the
+	play position stays resident.
+
+	The main loop calls streamPrefetch() with every playing channel's
+	position: the next STREAM_AHEAD_MS are read ahead (wrapping to the loop
+	start of a looped track) so the audio thread does not wait on the SD card, and
+	everything but the last STREAM_BEHIND_MS is dropped from memory.
+
+	Convert a track to stream it, e.g. for a 22050 Hz output:
+
+	  sox in.wav -r 22050 -c 2 -b 16 out.wav
+
+*/
+
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "wav.h"
+
+#define STREAM_AHEAD_MS  2000  // read ahead of the play position
+#define STREAM_BEHIND_MS 1000  // kept behind it, dropped further back
+#define STREAM_STEP_MS   500   // the window moves in steps of this, not on every call
+
+typedef struct {
+	uint8_t *map;         // NULL while closed
+	size_t   size;
+	int      view;        // map belongs to someone else
+	Pcm      pcm;         // samples inside the map
+	uint32_t aheadFrames, behindFrames, stepFrames;
+	uint32_t window;      // step the last prefetch was for, ~0 before the first
+} Stream;
+
+int  streamOpen(Stream *s, const char *path, int rate);
+void streamView(Stream *s, uint8_t *map, size_t size, const Pcm *pcm);
+void streamPrefetch(Stream *s, uint32_t position);
+void streamClose(Stream *s);
+
+#endif
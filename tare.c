@@ -0,0 +1,82 @@
+#include "tare.h"
+#include <math.h>
+
+/**
+
+	Adaptive tare for Music Bottles
+
+	Welford's update keeps the mean and variance exact in one pass without
+	holding the samples, so the tare length is bounded only by TARE_MAX_SAMPLES.
+
+*/
+
+void tareInit(Tare *t, double target) {
+	t->target = target;
+	t->n = 0;
+	t->total = 0;
+	t->mean = 0;
+	t->m2 = 0;
+	t->outliers = 0;
+	t->restarts = 0;
+	t->spikes = 0;
+	t->value = 0;
+}
+
+static void addSample(Tare *t, long x) {
+	double delta = x - t->mean;
+
+	t->n++;
+	t->mean += delta / t->n;
+	t->m2 += delta * (x - t->mean);
+}
+
+double tareStdDev(const Tare *t) {
+	return (t->n > 1) ? sqrt(t->m2 / (t->n - 1)) : 0;
+}
+
+// Half-width of the confidence interval of the mean, infinite until there is a variance
+double tareHalfWidth(const Tare *t) {
+	return (t->n > 1) ? TARE_Z * tareStdDev(t) / sqrt(t->n) : INFINITY;
+}
+
+/**
+ tarePush(Tare *t, long x)
+
+ add a conversion, returns TARE_DONE once the mean is known well enough (t->value is the tare),
+ TARE_RESTARTED if the table moved and the run started over, TARE_CONVERGING otherwise
+*/
+int tarePush(Tare *t, long x) {
+	double band = TARE_MOTION_K * tareStdDev(t);
+	int i;
+
+	t->total++;
+	if (band < TARE_MOTION_MIN) band = TARE_MOTION_MIN;
+
+	if (t->n >= 3 && fabs(x - t->mean) > band) {
+		t->pending[t->outliers++] = x;
+		if (t->outliers < TARE_MOTION_RUN) return TARE_CONVERGING;
+
+		// Sustained: start over from the new level
+		t->n = 0;
+		t->mean = 0;
+		t->m2 = 0;
+		for (i = 0; i < t->outliers; i++) {
+			addSample(t, t->pending[i]);
+		}
+		t->outliers = 0;
+		t->restarts++;
+		return TARE_RESTARTED;
+	}
+
+	if (t->outliers > 0) {
+		t->spikes += t->outliers;
+		t->outliers = 0;
+	}
+	addSample(t, x);
+
+	if ((t->n >= TARE_MIN_SAMPLES && tareHalfWidth(t) <= t->target) || t->total >= TARE_MAX_SAMPLES) {
+		t->value = lround(t->mean);
+		return TARE_DONE;
+	}
+	return TARE_CONVERGING;
+}
@@ -0,0 +1,53 @@
+/**
+
+	Adaptive tare for Music Bottles
+
+	Keeps a running mean and variance (Welford) of the empty-scale conversions
+	and stops as soon as the confidence interval of the mean is narrower than a
+	target, typically a small fraction of the lightest cap. A quiet scale
+	converges in a second or two; a noisy one keeps sampling. Two conversions in
+	a row far outside the spread so far mean the table is being touched, and the
+	tare starts over from the new level. A single one is a spike and is dropped.
+
+*/
+
+#ifndef TARE_H
+#define TARE_H
+
+// Stop when the 95% confidence half-width is below this fraction of the smallest cap weight
+#define TARE_CI_FRACTION 0.02
+#define TARE_Z           1.96
+
+#define TARE_MIN_SAMPLES 12   // enough to trust the variance
+#define TARE_MAX_SAMPLES 600  // a minute at 10 SPS: settle for the current mean, disturbed or not
+
+// Motion: a conversion further than TARE_MOTION_K standard deviations and TARE_MOTION_MIN counts
+// from the mean, TARE_MOTION_RUN times in a row
+#define TARE_MOTION_K   4.0
+#define TARE_MOTION_MIN 1000
+#define TARE_MOTION_RUN 2
+
+// tarePush() results
+#define TARE_CONVERGING 0
+#define TARE_DONE       1
+#define TARE_RESTARTED  2
+
+typedef struct {
+	double target;    // confidence half-width to reach, counts
+	int    n;         // samples in the current run
+	int    total;     // samples since tareInit(), across restarts
+	double mean;
+	double m2;        // sum of squared deviations from the mean
+	int    outliers;  // consecutive samples outside the motion band
+	long   pending[TARE_MOTION_RUN];
+	int    restarts;
+	int    spikes;    // lone outliers dropped
+	long   value;     // tare, valid once tarePush() returned TARE_DONE
+} Tare;
+
+void   tareInit(Tare *t, double target);
+int    tarePush(Tare *t, long x);
+double tareStdDev(const Tare *t);
+double tareHalfWidth(const Tare *t);
+
+#endif
@@ -0,0 +1,144 @@
+/**
+ * Unit tests for the acquisition ring and thread
+ *
+ * These tests verify the single-producer/single-consumer sample ring:
+ * order, wrap-around of the free-running indices, and dropping (and
+ * counting) samples when it is full. The thread is run against a stub
+ * source to check that an unpaced source waits for the consumer instead of
+ * dropping, and that the end of the source is reported once drained.
+ */
+
+#define _DEFAULT_SOURCE
+#include "test_framework.h"
+#include "../acquire.c"
+
+/* Stub source: STUB_SAMPLES conversions counting up, an error every 7th read, then the end */
+#define STUB_SAMPLES 2000
+
+static int stubPaced = 0;
+static int stubReads = 0;
+static long stubNext = 0;
+
+int sourceRead(Sample *s) {
+    if (stubNext == STUB_SAMPLES) return SOURCE_END;
+    if (++stubReads % 7 == 0) return SOURCE_ERROR;
+    s->value = stubNext++;
+    s->tick = (uint32_t) s->value * 12500;
+    return SOURCE_OK;
+}
+
+int sourceIsPaced(void) {
+    return stubPaced;
+}
+
+/* ==================== Test Cases ==================== */
+
+void test_ring_order() {
+    SampleRing r;
+    Sample s;
+    ringInit(&r);
+    ASSERT_EQUAL(0, ringPop(&r, &s));
+    for (long i = 0; i < 10; i++) ASSERT_EQUAL(1, ringPush(&r, &(Sample) {i, 0}));
+    for (long i = 0; i < 10; i++) {
+        ASSERT_EQUAL(1, ringPop(&r, &s));
+        ASSERT_EQUAL(i, s.value);
+    }
+    ASSERT_EQUAL(0, ringPop(&r, &s));
+}
+
+void test_ring_wraps() {
+    SampleRing r;
+    Sample s;
+    long expected = 0;
+    ringInit(&r);
+
+    // Twice round the ring, three in and two out at a time, never more than 200 queued
+    for (long i = 0; i < 3 * 200; i += 3) {
+        for (long j = i; j < i + 3; j++) ringPush(&r, &(Sample) {j, 0});
+        for (int k = 0; k < 2; k++) {
+            ASSERT_EQUAL(1, ringPop(&r, &s));
+            ASSERT_EQUAL(expected, s.value);
+            expected++;
+        }
+    }
+    while (ringPop(&r, &s)) {
+        ASSERT_EQUAL(expected, s.value);
+        expected++;
+    }
+    ASSERT_EQUAL(3 * 200, expected);
+    ASSERT_EQUAL(0, (int) r.dropped);
+}
+
+void test_ring_indices_overflow() {
+    SampleRing r;
+    Sample s;
+    ringInit(&r);
+    r.head = r.tail = UINT32_MAX - 2;
+    for (long i = 0; i < 6; i++) ASSERT_EQUAL(1, ringPush(&r, &(Sample) {i, 0}));
+    ASSERT_EQUAL(6, (int) (r.head - r.tail));
+    for (long i = 0; i < 6; i++) {
+        ASSERT_EQUAL(1, ringPop(&r, &s));
+        ASSERT_EQUAL(i, s.value);
+    }
+}
+
+void test_full_ring_drops() {
+    SampleRing r;
+    Sample s;
+    ringInit(&r);
+    for (long i = 0; i < SAMPLE_RING_SIZE; i++) ringPush(&r, &(Sample) {i, 0});
+    ASSERT_TRUE(ringFull(&r));
+    ASSERT_EQUAL(0, ringPush(&r, &(Sample) {-1, 0}));
+    ASSERT_EQUAL(0, ringPush(&r, &(Sample) {-2, 0}));
+    ASSERT_EQUAL(2, (int) r.dropped);
+
+    // The oldest are kept, the new ones lost
+    ASSERT_EQUAL(1, ringPop(&r, &s));
+    ASSERT_EQUAL(0, s.value);
+    ASSERT_TRUE(!ringFull(&r));
+    ASSERT_EQUAL(1, ringPush(&r, &(Sample) {SAMPLE_RING_SIZE, 0}));
+    for (long i = 1; i <= SAMPLE_RING_SIZE; i++) {
+        ASSERT_EQUAL(1, ringPop(&r, &s));
+        ASSERT_EQUAL(i, s.value);
+    }
+}
+
+void test_unpaced_source_waits_for_consumer() {
+    Sample s;
+    long expected = 0;
+    stubPaced = 0;
+    ASSERT_EQUAL(0, startAcquisition(0));
+
+    // Slower than the source, so the ring fills up and the thread has to wait
+    usleep(20000);
+    while (!acquireFinished()) {
+        if (!acquireSample(&s)) {
+            usleep(100);
+            continue;
+        }
+        if (s.value != expected) break;
+        expected++;
+    }
+    pthread_join(acquireThread, NULL);
+    ASSERT_EQUAL(STUB_SAMPLES, expected);
+    ASSERT_EQUAL(0, (int) acquireDropped());
+    ASSERT_EQUAL(0, acquireSample(&s));
+}
+
+int main(void) {
+    TEST_SUITE_START("Acquisition Tests");
+
+    printf("\n-- Sample Ring --\n");
+    RUN_TEST(test_ring_order);
+    RUN_TEST(test_ring_wraps);
+    RUN_TEST(test_ring_indices_overflow);
+    RUN_TEST(test_full_ring_drops);
+
+    printf("\n-- Acquisition Thread --\n");
+    RUN_TEST(test_unpaced_source_waits_for_consumer);
+
+    TEST_SUITE_END();
+    PRINT_TEST_SUMMARY();
+
+    return TEST_EXIT_CODE();
+}
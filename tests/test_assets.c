@@ -0,0 +1,226 @@
+/**
+ * Unit tests for the asset cache
+ *
+ * These tests build a cache from WAV files written to the test binary
+ * directory and verify that it maps back to the same samples the decoder
+ * gives, with loop points, peak and RMS, and that it is found stale when a
+ * source changes, is added or removed, or the output rate differs, that a
+ * touched source is accepted once its hash matches, and that it is refused
+ * when it is corrupt.
+ */
+
+#define _GNU_SOURCE
+#include "test_framework.h"
+#include "../wav.c"
+#include "../assets.c"
+
+#define DIR   "bin/assets"
+#define CACHE "bin/assets.cache"
+#define RATE  22050
+
+static void put16(FILE *f, uint32_t v) {
+    fputc(v & 0xff, f);
+    fputc((v >> 8) & 0xff, f);
+}
+
+static void put32(FILE *f, uint32_t v) {
+    put16(f, v & 0xffff);
+    put16(f, v >> 16);
+}
+
+/* A WAV file of a constant level, with a smpl loop when loopEnd is not 0 */
+static void writeWav(const char *name, int channels, int rate, int frames, int16_t level, int loopStart, int loopEnd) {
+    char path[256];
+    FILE *f;
+    uint32_t dataSize = frames * channels * 2, smplSize = loopEnd ? 60 : 0;
+
+    snprintf(path, sizeof(path), "%s/%s", DIR, name);
+    f = fopen(path, "wb");
+    fwrite("RIFF", 1, 4, f);
+    put32(f, 36 + (smplSize ? 8 + smplSize : 0) + dataSize);
+    fwrite("WAVEfmt ", 1, 8, f);
+    put32(f, 16);
+    put16(f, 1);
+    put16(f, channels);
+    put32(f, rate);
+    put32(f, rate * channels * 2);
+    put16(f, channels * 2);
+    put16(f, 16);
+    if (smplSize) {
+        fwrite("smpl", 1, 4, f);
+        put32(f, smplSize);
+        for (int i = 0; i < 7; i++) put32(f, 0);
+        put32(f, 1);                 // one loop
+        put32(f, 0);
+        put32(f, 0);                 // cue point id
+        put32(f, 0);                 // type
+        put32(f, loopStart);
+        put32(f, loopEnd - 1);       // inclusive
+        put32(f, 0);
+        put32(f, 0);
+    }
+    fwrite("data", 1, 4, f);
+    put32(f, dataSize);
+    for (int i = 0; i < frames * channels; i++) put16(f, (uint16_t) (i % 2 ? -level : level));
+    fclose(f);
+}
+
+static void setup(void) {
+    mkdir("bin", 0755);
+    mkdir(DIR, 0755);
+    remove(DIR "/a.wav");
+    remove(DIR "/b.wav");
+    remove(DIR "/c.wav");
+    remove(DIR "/bad.wav");
+    remove(CACHE);
+    writeWav("a.wav", 2, RATE, 3000, 1000, 0, 0);
+    writeWav("b.wav", 2, 44100, 8000, 2000, 1000, 6000);
+}
+
+/* ==================== Test Cases ==================== */
+
+void test_build_and_open() {
+    Assets a;
+    Pcm pcm, decoded;
+    setup();
+    ASSERT_EQUAL(0, assetsBuild(DIR, CACHE, RATE));
+    ASSERT_EQUAL(0, assetsOpen(&a, DIR, CACHE, RATE));
+    ASSERT_EQUAL(2, a.header->count);
+    ASSERT_EQUAL(RATE, (int) a.header->rate);
+
+    ASSERT_EQUAL(0, assetsFind(&a, "a.wav", &pcm));
+    ASSERT_EQUAL(3000, (int) pcm.frames);
+    ASSERT_TRUE(pcm.mapped);
+    ASSERT_EQUAL(0, (int) ((uint8_t *) pcm.data - a.map) % ASSETS_ALIGN);
+    ASSERT_EQUAL(0, wavLoad(DIR "/a.wav", RATE, &decoded));
+    ASSERT_EQUAL(0, memcmp(decoded.data, pcm.data, decoded.frames * 4));
+    wavFree(&decoded);
+
+    ASSERT_EQUAL(-1, assetsFind(&a, "c.wav", &pcm));
+    assetsClose(&a);
+    ASSERT_TRUE(a.map == NULL);
+}
+
+void test_loop_and_levels() {
+    Assets a;
+    Pcm pcm;
+    setup();
+    ASSERT_EQUAL(0, assetsBuild(DIR, CACHE, RATE));
+    ASSERT_EQUAL(0, assetsOpen(&a, DIR, CACHE, RATE));
+
+    // Converted to 22050 Hz and ended at the loop end
+    ASSERT_EQUAL(1, assetsFind(&a, "b.wav", &pcm));
+    ASSERT_EQUAL(3000, (int) pcm.frames);
+    ASSERT_EQUAL(500, (int) pcm.loopStart);
+    ASSERT_EQUAL(2000, (int) a.entry[1].peak);
+    ASSERT_TRUE(fabs(a.entry[1].rms - 2000 / 32768.0) < 1e-4);
+    ASSERT_EQUAL(1000, (int) a.entry[0].peak);
+    assetsClose(&a);
+}
+
+void test_stale_sources() {
+    Assets a;
+    struct stat st;
+    struct timespec times[2];
+    setup();
+    ASSERT_EQUAL(0, assetsBuild(DIR, CACHE, RATE));
+
+    ASSERT_EQUAL(-1, assetsOpen(&a, DIR, CACHE, 44100));
+    ASSERT_TRUE(strstr(assetsError(), "44100") == NULL && strstr(assetsError(), "22050") != NULL);
+
+    writeWav("c.wav", 2, RATE, 100, 0, 0, 0);
+    ASSERT_EQUAL(-1, assetsOpen(&a, DIR, CACHE, RATE));
+    remove(DIR "/c.wav");
+    ASSERT_EQUAL(0, assetsOpen(&a, DIR, CACHE, RATE));
+    assetsClose(&a);
+
+    // Touched, same content
+    stat(DIR "/a.wav", &st);
+    times[0].tv_sec = times[1].tv_sec = st.st_mtime + 1;
+    times[0].tv_nsec = times[1].tv_nsec = 0;
+    utimensat(AT_FDCWD, DIR "/a.wav", times, 0);
+    ASSERT_EQUAL(0, assetsOpen(&a, DIR, CACHE, RATE));
+    assetsClose(&a);
+
+    // Same size, new content, a second later
+    writeWav("a.wav", 2, RATE, 3000, 1001, 0, 0);
+    times[0].tv_sec = times[1].tv_sec = st.st_mtime + 2;
+    utimensat(AT_FDCWD, DIR "/a.wav", times, 0);
+    ASSERT_EQUAL(-1, assetsOpen(&a, DIR, CACHE, RATE));
+    ASSERT_TRUE(strstr(assetsError(), "a.wav changed") != NULL);
+    ASSERT_TRUE(a.map == NULL);
+
+    // Same size, new content and the time it was built with: only a full check finds it
+    times[0].tv_sec = times[1].tv_sec = st.st_mtime;
+    utimensat(AT_FDCWD, DIR "/a.wav", times, 0);
+    ASSERT_EQUAL(0, assetsOpen(&a, DIR, CACHE, RATE));
+    ASSERT_EQUAL(-1, assetsVerify(&a, DIR));
+    ASSERT_TRUE(strstr(assetsError(), "a.wav changed") != NULL);
+    assetsClose(&a);
+
+    remove(DIR "/b.wav");
+    ASSERT_EQUAL(-1, assetsOpen(&a, DIR, CACHE, RATE));
+}
+
+void test_unconvertible_source_listed() {
+    Assets a;
+    Pcm pcm;
+    FILE *f;
+    setup();
+    f = fopen(DIR "/bad.wav", "wb");
+    fputs("RIFF....WAVEjunk", f);
+    fclose(f);
+    ASSERT_EQUAL(0, assetsBuild(DIR, CACHE, RATE));
+    ASSERT_EQUAL(0, assetsOpen(&a, DIR, CACHE, RATE));
+    ASSERT_EQUAL(3, a.header->count);
+    ASSERT_EQUAL(-1, assetsFind(&a, "bad.wav", &pcm));
+    assetsClose(&a);
+}
+
+void test_corrupt_cache_refused() {
+    Assets a;
+    FILE *f;
+    setup();
+    ASSERT_EQUAL(-1, assetsOpen(&a, DIR, CACHE, RATE));
+    ASSERT_TRUE(strstr(assetsError(), "no cache") != NULL);
+
+    ASSERT_EQUAL(0, assetsBuild(DIR, CACHE, RATE));
+    f = fopen(CACHE, "r+b");
+    fseek(f, sizeof(AssetHeader) + 4, SEEK_SET);
+    fputc('x', f);
+    fclose(f);
+    ASSERT_EQUAL(-1, assetsOpen(&a, DIR, CACHE, RATE));
+    ASSERT_TRUE(a.map == NULL);
+
+    // The build hash no longer matches the stems' hashes
+    ASSERT_EQUAL(0, assetsBuild(DIR, CACHE, RATE));
+    f = fopen(CACHE, "r+b");
+    fseek(f, offsetof(AssetHeader, hash), SEEK_SET);
+    fputc('x', f);
+    fclose(f);
+    ASSERT_EQUAL(-1, assetsOpen(&a, DIR, CACHE, RATE));
+
+    f = fopen(CACHE, "wb");
+    fputs("MB", f);
+    fclose(f);
+    ASSERT_EQUAL(-1, assetsOpen(&a, DIR, CACHE, RATE));
+}
+
+int main(void) {
+    TEST_SUITE_START("Asset Cache Tests");
+
+    printf("\n-- Building --\n");
+    RUN_TEST(test_build_and_open);
+    RUN_TEST(test_loop_and_levels);
+    RUN_TEST(test_unconvertible_source_listed);
+
+    printf("\n-- Validation --\n");
+    RUN_TEST(test_stale_sources);
+    RUN_TEST(test_corrupt_cache_refused);
+
+    remove(CACHE);
+    TEST_SUITE_END();
+    PRINT_TEST_SUMMARY();
+
+    return TEST_EXIT_CODE();
+}
@@ -0,0 +1,116 @@
+/**
+ * Unit tests for the fixed-point biquad filters
+ *
+ * These tests verify unity gain at DC, that the low-pass and notch sections
+ * take out the frequencies they are designed for, that cut-offs at or above
+ * the Nyquist frequency are refused, and how a cascade chains its sections.
+ */
+
+#define _DEFAULT_SOURCE
+#include "test_framework.h"
+#include "../biquad.c"
+
+#define RATE 80.0
+
+/* Largest |output| over the second half of n conversions of a tone of amp around level */
+static long tone_peak(Biquad *q, double hz, double amp, long level, int n) {
+    long peak = 0;
+    biquadReset(q, (int32_t) level);
+    for (int i = 0; i < n; i++) {
+        long y = biquadPush(q, (int32_t) lround(level + amp * sin(2 * M_PI * hz * i / RATE))) - level;
+        if (i >= n / 2 && labs(y) > peak) peak = labs(y);
+    }
+    return peak;
+}
+
+/* ==================== Test Cases ==================== */
+
+void test_reset_holds_level() {
+    Biquad q;
+    ASSERT_EQUAL(0, biquadLowPass(&q, RATE, 1.0, BIQUAD_BUTTERWORTH_Q));
+    biquadReset(&q, 123457);
+    for (int i = 0; i < 1000; i++) {
+        int32_t y = biquadPush(&q, 123457);
+        ASSERT_EQUAL(123457, y);
+    }
+}
+
+void test_lowpass_settles_exactly() {
+    Biquad q;
+    int32_t y = 0;
+    biquadLowPass(&q, RATE, 0.5, BIQUAD_BUTTERWORTH_Q);
+    biquadReset(&q, 0);
+    /* A low cut-off with plain truncation would stop a few counts short */
+    for (int i = 0; i < 2000; i++) y = biquadPush(&q, 62900);
+    ASSERT_EQUAL(62900, y);
+    for (int i = 0; i < 2000; i++) y = biquadPush(&q, -7);
+    ASSERT_EQUAL(-7, y);
+}
+
+void test_lowpass_attenuates_above_cutoff() {
+    Biquad q;
+    biquadLowPass(&q, RATE, 4.0, BIQUAD_BUTTERWORTH_Q);
+    ASSERT_TRUE(tone_peak(&q, 0.5, 10000, 50000, 800) > 9500);
+    ASSERT_TRUE(tone_peak(&q, 20.0, 10000, 50000, 800) < 1000);
+}
+
+void test_notch_removes_its_frequency() {
+    Biquad q;
+    ASSERT_EQUAL(0, biquadNotch(&q, RATE, 12.0, 2));
+    ASSERT_TRUE(tone_peak(&q, 12.0, 10000, -30000, 1600) < 100);
+    ASSERT_TRUE(tone_peak(&q, 2.0, 10000, -30000, 1600) > 9000);
+}
+
+void test_refuses_cutoff_above_nyquist() {
+    Biquad q;
+    ASSERT_EQUAL(-1, biquadLowPass(&q, RATE, 40.0, BIQUAD_BUTTERWORTH_Q));
+    ASSERT_EQUAL(-1, biquadNotch(&q, RATE, 50.0, 2));
+    ASSERT_EQUAL(-1, biquadLowPass(&q, RATE, 0, BIQUAD_BUTTERWORTH_Q));
+    ASSERT_EQUAL(-1, biquadLowPass(&q, 0, 4.0, BIQUAD_BUTTERWORTH_Q));
+}
+
+void test_empty_cascade_passes_through() {
+    BiquadCascade c;
+    cascadeInit(&c);
+    cascadeReset(&c, 100);
+    ASSERT_EQUAL(-4242, cascadePush(&c, -4242));
+}
+
+void test_cascade_chains_and_fills() {
+    BiquadCascade c;
+    Biquad q;
+    int32_t y = 0;
+    cascadeInit(&c);
+    biquadLowPass(&q, RATE, 8.0, BIQUAD_BUTTERWORTH_Q);
+    for (int i = 0; i < BIQUAD_MAX_SECTIONS; i++) ASSERT_EQUAL(0, cascadeAdd(&c, &q));
+    ASSERT_EQUAL(-1, cascadeAdd(&c, &q));
+    ASSERT_EQUAL(BIQUAD_MAX_SECTIONS, c.sections);
+
+    cascadeReset(&c, 1000);
+    for (int i = 0; i < 500; i++) y = cascadePush(&c, 1000);
+    ASSERT_EQUAL(1000, y);
+}
+
+/* ==================== Main ==================== */
+
+int main(void) {
+    TEST_SUITE_START("Biquad Filter Tests");
+
+    printf("\n-- DC --\n");
+    RUN_TEST(test_reset_holds_level);
+    RUN_TEST(test_lowpass_settles_exactly);
+
+    printf("\n-- Response --\n");
+    RUN_TEST(test_lowpass_attenuates_above_cutoff);
+    RUN_TEST(test_notch_removes_its_frequency);
+    RUN_TEST(test_refuses_cutoff_above_nyquist);
+
+    printf("\n-- Cascade --\n");
+    RUN_TEST(test_empty_cascade_passes_through);
+    RUN_TEST(test_cascade_chains_and_fills);
+
+    TEST_SUITE_END();
+    PRINT_TEST_SUMMARY();
+
+    return TEST_EXIT_CODE();
+}
@@ -0,0 +1,142 @@
+/**
+ * Unit tests for the persisted calibration file
+ *
+ * These tests verify the round trip, the atomic replacement and the
+ * rejection of incomplete or foreign files used by the warm start.
+ */
+
+#define _DEFAULT_SOURCE
+#include "test_framework.h"
+#include "../calib.c"
+
+#define TEST_PATH "bin/test.calib"
+
+static void write_file(const char *text) {
+    FILE *f = fopen(TEST_PATH, "w");
+    fputs(text, f);
+    fclose(f);
+}
+
+/* ==================== Test Cases ==================== */
+
+/* Fingerprints run to CALIB_FINGERPRINT_LEN, longer than ASSERT_STR_EQUAL's message holds */
+#define ASSERT_FINGERPRINT(expected, actual) ASSERT_TRUE(strcmp((expected), (actual)) == 0)
+
+void test_fingerprint() {
+    char buf[CALIB_FINGERPRINT_LEN];
+    long caps[] = {619, 724, 415};
+    long none[] = {0, 0, 0};
+    long bottles[] = {1890, 1685, 1561};
+    calibFingerprint(buf, sizeof(buf), "hx711:pins=21+16", caps, NULL, 3);
+    ASSERT_FINGERPRINT("hx711:pins=21+16 caps=619,724,415", buf);
+    calibFingerprint(buf, sizeof(buf), "hx711", caps, none, 3);
+    ASSERT_FINGERPRINT("hx711 caps=619,724,415", buf);
+    calibFingerprint(buf, sizeof(buf), "hx711", caps, bottles, 3);
+    ASSERT_FINGERPRINT("hx711 caps=619,724,415 bottles=1890,1685,1561", buf);
+}
+
+void test_round_trip() {
+    Calibration out, in;
+    long caps[] = {619, 724, 415};
+    calibFingerprint(out.fingerprint, sizeof(out.fingerprint), "hx711", caps, NULL, 3);
+    out.tare = -8123456;
+    out.weight = -61900;
+    out.state = 5;
+    out.margins = 0;
+
+    ASSERT_EQUAL(0, calibSave(TEST_PATH, &out));
+    ASSERT_EQUAL(0, calibLoad(TEST_PATH, &in));
+    ASSERT_FINGERPRINT(out.fingerprint, in.fingerprint);
+    ASSERT_EQUAL(out.tare, in.tare);
+    ASSERT_EQUAL(out.weight, in.weight);
+    ASSERT_EQUAL(out.state, in.state);
+}
+
+void test_margins_round_trip() {
+    Calibration out = {.fingerprint = "hx711 caps=1,2,3", .tare = 1, .weight = 2, .state = 3};
+    Calibration in;
+    out.margins = 2;
+    out.margin[0] = (CalibMargin) {0, 4000, 0.412, 1.2345};
+    out.margin[1] = (CalibMargin) {5, 812, -1147.5, 9.75};
+
+    ASSERT_EQUAL(0, calibSave(TEST_PATH, &out));
+    ASSERT_EQUAL(0, calibLoad(TEST_PATH, &in));
+    ASSERT_EQUAL(2, in.margins);
+    ASSERT_EQUAL(5, in.margin[1].state);
+    /* Values chosen to survive the fixed decimals of the file exactly */
+    ASSERT_TRUE(in.margin[1].count == 812);
+    ASSERT_TRUE(in.margin[1].mean == -1147.5);
+    ASSERT_TRUE(in.margin[0].var == 1.2345);
+}
+
+void test_file_without_margins_accepted() {
+    Calibration c;
+    write_file("version 1\nfingerprint a\ntare 7\nweight -8\nstate 2\nmargin 1 garbage\n");
+    ASSERT_EQUAL(0, calibLoad(TEST_PATH, &c));
+    ASSERT_EQUAL(0, c.margins);
+}
+
+void test_no_temporary_left_behind() {
+    Calibration c = {.fingerprint = "hx711 caps=1,2,3", .tare = 1, .weight = 2, .state = 3};
+    ASSERT_EQUAL(0, calibSave(TEST_PATH, &c));
+    ASSERT_TRUE(access(TEST_PATH ".tmp", F_OK) != 0);
+}
+
+void test_missing_file() {
+    Calibration c;
+    unlink(TEST_PATH);
+    ASSERT_EQUAL(-1, calibLoad(TEST_PATH, &c));
+}
+
+void test_incomplete_file_rejected() {
+    Calibration c;
+    write_file("version 1\nfingerprint hx711 caps=1,2,3\ntare 100\n");
+    ASSERT_EQUAL(-1, calibLoad(TEST_PATH, &c));
+}
+
+void test_other_version_rejected() {
+    Calibration c;
+    write_file("version 99\nfingerprint x\ntare 1\nweight 2\nstate 3\n");
+    ASSERT_EQUAL(-1, calibLoad(TEST_PATH, &c));
+}
+
+void test_unknown_keys_and_comments_skipped() {
+    Calibration c;
+    write_file("# comment\nversion 1\nnoise 250\nfingerprint a b\ntare 7\nweight -8\nstate 2\n");
+    ASSERT_EQUAL(0, calibLoad(TEST_PATH, &c));
+    ASSERT_FINGERPRINT("a b", c.fingerprint);
+    ASSERT_EQUAL(7, c.tare);
+    ASSERT_EQUAL(-8, c.weight);
+}
+
+void test_unwritable_path_fails_cleanly() {
+    Calibration c = {.fingerprint = "x", .tare = 1, .weight = 2, .state = 3};
+    ASSERT_EQUAL(-1, calibSave("bin/no/such/dir/test.calib", &c));
+}
+
+/* ==================== Main ==================== */
+
+int main(void) {
+    TEST_SUITE_START("Calibration File Tests");
+
+    printf("\n-- Round Trip --\n");
+    RUN_TEST(test_fingerprint);
+    RUN_TEST(test_round_trip);
+    RUN_TEST(test_margins_round_trip);
+    RUN_TEST(test_no_temporary_left_behind);
+
+    printf("\n-- Rejection --\n");
+    RUN_TEST(test_missing_file);
+    RUN_TEST(test_incomplete_file_rejected);
+    RUN_TEST(test_other_version_rejected);
+    RUN_TEST(test_unknown_keys_and_comments_skipped);
+    RUN_TEST(test_file_without_margins_accepted);
+    RUN_TEST(test_unwritable_path_fails_cleanly);
+
+    unlink(TEST_PATH);
+
+    TEST_SUITE_END();
+    PRINT_TEST_SUMMARY();
+
+    return TEST_EXIT_CODE();
+}
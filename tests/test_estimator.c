@@ -0,0 +1,211 @@
+/**
+ * Unit tests for the streaming robust estimator
+ *
+ * These tests verify the rolling median, MAD and band-limited mean that
+ * replace the batch averaging in getCleanSample().
+ */
+
+#include "test_framework.h"
+#include "../estimator.c"
+
+/* Brute-force reference: median and MAD of an unsorted window */
+static int cmp_long(const void *a, const void *b) {
+    long x = *(const long *)a, y = *(const long *)b;
+    return (x > y) - (x < y);
+}
+
+static long reference_median(const long *v, int n) {
+    long tmp[ESTIMATOR_MAX_WINDOW];
+    memcpy(tmp, v, n * sizeof(long));
+    qsort(tmp, n, sizeof(long), cmp_long);
+    return (n % 2) ? tmp[n / 2] : (tmp[n / 2 - 1] + tmp[n / 2]) / 2;
+}
+
+static long reference_mad(const long *v, int n, long med) {
+    long dev[ESTIMATOR_MAX_WINDOW];
+    for (int i = 0; i < n; i++) dev[i] = labs(v[i] - med);
+    qsort(dev, n, sizeof(long), cmp_long);
+    return dev[(n - 1) / 2];
+}
+
+/* ==================== Test Cases ==================== */
+
+void test_single_sample() {
+    Estimator e;
+    estimatorInit(&e, 8, ESTIMATOR_K, ESTIMATOR_MIN_BAND);
+    ASSERT_EQUAL(1234, estimatorPush(&e, 1234));
+    ASSERT_EQUAL(1234, e.median);
+    ASSERT_EQUAL(0, e.mad);
+}
+
+void test_constant_signal() {
+    Estimator e;
+    estimatorInit(&e, 8, ESTIMATOR_K, ESTIMATOR_MIN_BAND);
+    for (int i = 0; i < 20; i++) estimatorPush(&e, -5000);
+    ASSERT_EQUAL(-5000, e.value);
+    ASSERT_EQUAL(8, e.count);
+}
+
+void test_outlier_rejected() {
+    Estimator e;
+    long samples[] = {1000, 1010, 990, 1005, 995, 90000, 1000, 1002};
+    estimatorInit(&e, 8, ESTIMATOR_K, ESTIMATOR_MIN_BAND);
+    for (int i = 0; i < 8; i++) estimatorPush(&e, samples[i]);
+    /* Spike must not pull the value more than a few counts */
+    ASSERT_TRUE(labs(e.value - 1000) < 10);
+    ASSERT_EQUAL(7, e.kept);
+}
+
+void test_latest_outlier_flagged() {
+    Estimator e;
+    estimatorInit(&e, 8, ESTIMATOR_K, ESTIMATOR_MIN_BAND);
+    for (int i = 0; i < 7; i++) estimatorPush(&e, 1000 + i);
+    ASSERT_FALSE(e.rejected);
+    estimatorPush(&e, -80000);
+    ASSERT_TRUE(e.rejected);
+}
+
+void test_band_does_not_collapse_at_zero() {
+    /* The old percentage band was empty around 0 after tare */
+    Estimator e;
+    long samples[] = {-30, 20, 5, -10, 40, 0, -25, 15};
+    estimatorInit(&e, 8, ESTIMATOR_K, ESTIMATOR_MIN_BAND);
+    for (int i = 0; i < 8; i++) estimatorPush(&e, samples[i]);
+    ASSERT_EQUAL(8, e.kept);
+    ASSERT_TRUE(e.band >= ESTIMATOR_MIN_BAND);
+    ASSERT_EQUAL(1, e.value);  /* 15 / 8, integer mean */
+}
+
+void test_window_slides() {
+    Estimator e;
+    estimatorInit(&e, 4, ESTIMATOR_K, ESTIMATOR_MIN_BAND);
+    for (int i = 0; i < 4; i++) estimatorPush(&e, 0);
+    for (int i = 0; i < 4; i++) estimatorPush(&e, 100000);
+    /* Old plateau fully retired after one window length */
+    ASSERT_EQUAL(100000, e.value);
+    ASSERT_EQUAL(100000, e.median);
+}
+
+void test_median_and_mad_match_reference() {
+    Estimator e;
+    long window[16];
+    unsigned seed = 12345;
+    estimatorInit(&e, 16, ESTIMATOR_K, ESTIMATOR_MIN_BAND);
+
+    for (int i = 0; i < 500; i++) {
+        seed = seed * 1103515245 + 12345;
+        long x = (long)((seed >> 8) % 4000) - 2000;
+        if (i % 37 == 0) x *= 50;  /* occasional spike */
+        window[i % 16] = x;
+        estimatorPush(&e, x);
+
+        int n = (i < 16) ? i + 1 : 16;
+        long med = reference_median(window, n);
+        ASSERT_EQUAL(med, e.median);
+        ASSERT_EQUAL(reference_mad(window, n, med), e.mad);
+    }
+}
+
+void test_window_size_clamped() {
+    Estimator e;
+    estimatorInit(&e, 1000, ESTIMATOR_K, ESTIMATOR_MIN_BAND);
+    ASSERT_EQUAL(ESTIMATOR_MAX_WINDOW, e.size);
+    estimatorInit(&e, 0, ESTIMATOR_K, ESTIMATOR_MIN_BAND);
+    ASSERT_EQUAL(1, e.size);
+}
+
+void test_adaptive_starts_short_and_grows() {
+    Estimator e;
+    estimatorInit(&e, 16, ESTIMATOR_K, ESTIMATOR_MIN_BAND);
+    estimatorAdapt(&e, 2);
+    ASSERT_EQUAL(2, e.size);
+    for (int i = 0; i < 30; i++) estimatorPush(&e, 1000 + (i % 3) * 10);
+    ASSERT_EQUAL(16, e.size);
+    ASSERT_EQUAL(16, e.count);
+}
+
+void test_adaptive_shrinks_on_step() {
+    Estimator e;
+    estimatorInit(&e, 16, ESTIMATOR_K, ESTIMATOR_MIN_BAND);
+    estimatorAdapt(&e, 2);
+    for (int i = 0; i < 30; i++) estimatorPush(&e, 0);
+    estimatorPush(&e, 50000);
+    estimatorPush(&e, 50000);
+    ASSERT_EQUAL(16, e.count);  /* two samples out of band could still be noise */
+    estimatorPush(&e, 50000);
+    /* Third one on the same side: the window drops to the new plateau */
+    ASSERT_EQUAL(2, e.count);
+    ASSERT_EQUAL(50000, e.value);
+    ASSERT_EQUAL(1, (int) e.shrinks);
+}
+
+void test_adaptive_ignores_alternating_spikes() {
+    Estimator e;
+    estimatorInit(&e, 16, ESTIMATOR_K, ESTIMATOR_MIN_BAND);
+    estimatorAdapt(&e, 2);
+    for (int i = 0; i < 30; i++) estimatorPush(&e, 0);
+    estimatorPush(&e, 50000);
+    estimatorPush(&e, -50000);
+    ASSERT_EQUAL(16, e.count);
+    ASSERT_EQUAL(0, (int) e.shrinks);
+    ASSERT_TRUE(labs(e.value) < 10);
+}
+
+void test_adaptive_matches_reference_after_shrink() {
+    /* The fifo must stay in order across shrinking and growing */
+    Estimator e;
+    long history[200];
+    estimatorInit(&e, 16, ESTIMATOR_K, ESTIMATOR_MIN_BAND);
+    estimatorAdapt(&e, 2);
+    for (int i = 0; i < 200; i++) {
+        history[i] = ((i / 50) % 2) ? 40000 + (i % 7) * 20 : (i % 5) * 30;
+        estimatorPush(&e, history[i]);
+        long med = reference_median(&history[i + 1 - e.count], e.count);
+        ASSERT_EQUAL(med, e.median);
+    }
+    ASSERT_EQUAL(16, e.count);
+}
+
+void test_stderr_falls_with_window() {
+    Estimator e;
+    estimatorInit(&e, 16, ESTIMATOR_K, ESTIMATOR_MIN_BAND);
+    estimatorAdapt(&e, 2);
+    estimatorPush(&e, 0);
+    estimatorPush(&e, 10);
+    double shortWindow = estimatorStdErr(&e);
+    for (int i = 0; i < 30; i++) estimatorPush(&e, (i % 2) * 10);
+    ASSERT_TRUE(estimatorStdErr(&e) < shortWindow / 2);
+    ASSERT_TRUE(estimatorStdErr(&e) > 0);
+}
+
+/* ==================== Main ==================== */
+
+int main(void) {
+    TEST_SUITE_START("Streaming Estimator Tests");
+
+    printf("\n-- Basic Behaviour --\n");
+    RUN_TEST(test_single_sample);
+    RUN_TEST(test_constant_signal);
+    RUN_TEST(test_window_slides);
+    RUN_TEST(test_window_size_clamped);
+
+    printf("\n-- Outlier Rejection --\n");
+    RUN_TEST(test_outlier_rejected);
+    RUN_TEST(test_latest_outlier_flagged);
+    RUN_TEST(test_band_does_not_collapse_at_zero);
+
+    printf("\n-- Adaptive Window --\n");
+    RUN_TEST(test_adaptive_starts_short_and_grows);
+    RUN_TEST(test_adaptive_shrinks_on_step);
+    RUN_TEST(test_adaptive_ignores_alternating_spikes);
+    RUN_TEST(test_adaptive_matches_reference_after_shrink);
+    RUN_TEST(test_stderr_falls_with_window);
+
+    printf("\n-- Reference Comparison --\n");
+    RUN_TEST(test_median_and_mad_match_reference);
+
+    TEST_SUITE_END();
+    PRINT_TEST_SUMMARY();
+
+    return TEST_EXIT_CODE();
+}
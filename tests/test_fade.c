@@ -0,0 +1,206 @@
+/**
+ * Unit tests for the fade engine
+ *
+ * These tests verify parsing of the fade spec, that a ramp lasts exactly
+ * the configured number of frames and lands exactly on its target, that no
+ * frame steps the gain by more than a smooth ramp would, that a fade in is
+ * the mirror image of a fade out, and the command queue between threads.
+ */
+
+#define _DEFAULT_SOURCE
+#include "test_framework.h"
+#include "../fade.c"
+
+#define RATE   22050
+#define FULL   (105 * FADE_UNITY / 128)
+#define BUFFER 512
+
+static FadeEngine engine;
+
+static void setup(const char *spec) {
+    ASSERT_EQUAL(0, fadeInit(&engine, spec));
+    fadeSetRate(&engine, RATE);
+}
+
+/* Run n frames of a constant stereo signal through a channel, in mixer-sized buffers, or one frame at a time recording the gain of every frame */
+static void run(int channel, int n, int32_t *gains) {
+    int16_t buf[2 * BUFFER];
+    for (int done = 0; done < n; ) {
+        int frames = gains ? 1 : (n - done < BUFFER) ? n - done : BUFFER;
+        for (int i = 0; i < 2 * frames; i++) buf[i] = 16384;
+        fadeProcess(&engine, channel, buf, frames, 2);
+        for (int i = 0; i < frames; i++) ASSERT_EQUAL(buf[2 * i], buf[2 * i + 1]);
+        if (gains) gains[done] = engine.env[channel].gain;
+        done += frames;
+    }
+}
+
+/* ==================== Test Cases ==================== */
+
+void test_parse_spec() {
+    setup("in=50,out=1200,curve=cosine");
+    ASSERT_EQUAL(50, engine.inMs);
+    ASSERT_EQUAL(1200, engine.outMs);
+    ASSERT_EQUAL(FADE_COSINE, engine.curve);
+
+    setup(FADE_DEFAULT);
+    ASSERT_EQUAL(FADE_IN_MS, engine.inMs);
+    ASSERT_EQUAL(FADE_EXPONENTIAL, engine.curve);
+    ASSERT_EQUAL(0, engine.table[0]);
+    ASSERT_EQUAL(FADE_UNITY, engine.table[FADE_TABLE_SIZE]);
+}
+
+void test_parse_malformed() {
+    ASSERT_EQUAL(-1, fadeInit(&engine, "in"));
+    ASSERT_EQUAL(-1, fadeInit(&engine, "in=fast"));
+    ASSERT_EQUAL(-1, fadeInit(&engine, "out=-5"));
+    ASSERT_EQUAL(-1, fadeInit(&engine, "out=600000"));
+    ASSERT_EQUAL(-1, fadeInit(&engine, "curve=log"));
+    ASSERT_EQUAL(-1, fadeInit(&engine, "hold=3"));
+}
+
+void test_starts_silent() {
+    int16_t buf[4] = {1000, -1000, 2000, -2000};
+    setup(NULL);
+    fadeProcess(&engine, 0, buf, 2, 2);
+    ASSERT_EQUAL(0, buf[0]);
+    ASSERT_EQUAL(0, buf[3]);
+}
+
+void test_ramp_length_exact() {
+    static int32_t gains[RATE];
+    int frames = 300 * RATE / 1000;
+    setup("in=300,out=3000,curve=linear");
+    fadeTo(&engine, 1, FULL);
+    run(1, frames + 10, gains);
+    ASSERT_TRUE(gains[frames - 2] < FULL);
+    ASSERT_EQUAL(FULL, gains[frames - 1]);
+    ASSERT_EQUAL(FULL, gains[frames + 9]);
+}
+
+void test_fade_out_lands_on_silence() {
+    static int32_t gains[4 * RATE];
+    int frames = 3000 * RATE / 1000;
+    setup(NULL);
+    fadeSet(&engine, 2, FULL);
+    run(2, 1, NULL);
+    fadeTo(&engine, 2, 0);
+    run(2, frames, gains);
+    ASSERT_TRUE(gains[frames - frames / 20] > 0);
+    ASSERT_EQUAL(0, gains[frames - 1]);
+    ASSERT_EQUAL(1, (int) fadeSilenced(&engine, 2));
+}
+
+void test_no_frame_steps() {
+    static int32_t gains[RATE];
+    int frames = 300 * RATE / 1000;
+    const char *specs[] = {"in=300,curve=linear", "in=300,curve=cosine", "in=300,curve=exp"};
+    for (int c = 0; c < 3; c++) {
+        int32_t prev = 0, worst = 0;
+        setup(specs[c]);
+        fadeTo(&engine, 0, FADE_UNITY);
+        run(0, frames, gains);
+        for (int i = 0; i < frames; i++) {
+            if (gains[i] - prev > worst) worst = gains[i] - prev;
+            ASSERT_TRUE(gains[i] >= prev);
+            prev = gains[i];
+        }
+        /* No frame moves more than a few times the average step */
+        ASSERT_TRUE(worst < 8 * FADE_UNITY / frames);
+    }
+}
+
+void test_exp_fade_in_mirrors_fade_out() {
+    static int32_t in[RATE], out[RATE];
+    int frames = 500 * RATE / 1000;
+    setup("in=500,out=500,curve=exp");
+    fadeTo(&engine, 3, FADE_UNITY);
+    run(3, frames, in);
+    fadeTo(&engine, 3, 0);
+    run(3, frames, out);
+    for (int i = 0; i < frames - 1; i += 97) {
+        ASSERT_TRUE(abs(in[i] - out[frames - 2 - i]) <= 2);
+    }
+    /* Rises slowly at first, falls fast at first */
+    ASSERT_TRUE(in[frames / 2] < FADE_UNITY / 4);
+    ASSERT_TRUE(out[frames / 2] < FADE_UNITY / 4);
+}
+
+void test_same_target_carries_on() {
+    static int32_t gains[RATE];
+    int frames = 300 * RATE / 1000, half = frames / 2;
+    setup("in=300,curve=linear");
+    fadeTo(&engine, 0, FULL);
+    run(0, half, NULL);
+    fadeTo(&engine, 0, FULL);
+    run(0, frames, gains);
+    ASSERT_EQUAL(FULL, gains[frames - half - 1]);
+    ASSERT_TRUE(gains[frames - half - 2] < FULL);
+}
+
+void test_reversal_starts_from_current_gain() {
+    static int32_t gains[RATE];
+    int frames = 300 * RATE / 1000;
+    int32_t reached;
+    setup("in=300,out=300,curve=cosine");
+    fadeTo(&engine, 0, FADE_UNITY);
+    run(0, frames / 2, NULL);
+    reached = fadeGain(&engine, 0);
+    fadeTo(&engine, 0, 0);
+    run(0, 1, gains);
+    ASSERT_TRUE(abs(gains[0] - reached) < 8 * FADE_UNITY / frames);
+}
+
+void test_channels_independent() {
+    int16_t buf[2] = {10000, 10000};
+    setup(NULL);
+    fadeSet(&engine, 1, FADE_UNITY);
+    fadeSet(&engine, 2, FADE_UNITY / 2);
+    fadeProcess(&engine, 0, buf, 1, 2);
+    ASSERT_EQUAL(0, buf[0]);
+    buf[0] = buf[1] = 10000;
+    fadeProcess(&engine, 1, buf, 1, 2);
+    ASSERT_EQUAL(10000, buf[0]);
+    buf[0] = buf[1] = 10000;
+    fadeProcess(&engine, 2, buf, 1, 2);
+    ASSERT_EQUAL(5000, buf[0]);
+}
+
+void test_queue_full() {
+    setup(NULL);
+    for (int i = 0; i < FADE_QUEUE_SIZE; i++) ASSERT_EQUAL(1, fadeSet(&engine, 0, i));
+    ASSERT_EQUAL(0, fadeSet(&engine, 0, FADE_UNITY));
+    ASSERT_EQUAL(1, (int) fadeDropped(&engine));
+    /* The mixer drains every command in order */
+    run(1, 1, NULL);
+    ASSERT_EQUAL(FADE_QUEUE_SIZE - 1, fadeGain(&engine, 0));
+    ASSERT_EQUAL(1, fadeSet(&engine, 0, FADE_UNITY));
+}
+
+/* ==================== Main ==================== */
+
+int main(void) {
+    TEST_SUITE_START("Fade Engine Tests");
+
+    printf("\n-- Configuration --\n");
+    RUN_TEST(test_parse_spec);
+    RUN_TEST(test_parse_malformed);
+    RUN_TEST(test_starts_silent);
+
+    printf("\n-- Ramps --\n");
+    RUN_TEST(test_ramp_length_exact);
+    RUN_TEST(test_fade_out_lands_on_silence);
+    RUN_TEST(test_no_frame_steps);
+    RUN_TEST(test_exp_fade_in_mirrors_fade_out);
+    RUN_TEST(test_same_target_carries_on);
+    RUN_TEST(test_reversal_starts_from_current_gain);
+
+    printf("\n-- Mixing --\n");
+    RUN_TEST(test_channels_independent);
+    RUN_TEST(test_queue_full);
+
+    TEST_SUITE_END();
+    PRINT_TEST_SUMMARY();
+
+    return TEST_EXIT_CODE();
+}
@@ -0,0 +1,146 @@
+/**
+ * Unit tests for the HMM state tracker
+ *
+ * These tests verify that clean steps are followed within a few samples,
+ * that noise near a margin edge and lone outliers do not flip the state,
+ * and that the tracker scales to the 8-bottle lattice.
+ */
+
+#include "test_framework.h"
+#include "../stateindex.c"
+#include "../hmm.c"
+
+static const long CAPS[] = {619, 724, 415};
+
+static StateIndex idx;
+static HmmTracker tracker;
+
+/* Deterministic noise, roughly uniform in [-amp, amp] */
+static unsigned seed = 3;
+static double noise(double amp) {
+    seed = seed * 1103515245 + 12345;
+    return ((double)((seed >> 8) % 20001) / 10000.0 - 1.0) * amp;
+}
+
+/* Feed n samples around weight, returns the sample (1-based) where state became confident, 0 if never */
+static int feed(double weight, double amp, int n, int state) {
+    for (int i = 1; i <= n; i++) {
+        hmmUpdate(&tracker, weight + noise(amp));
+        if (tracker.map == state && tracker.confidence >= HMM_CONFIDENCE) return i;
+    }
+    return 0;
+}
+
+static void setup(void) {
+    stateIndexInit(&idx, CAPS, NULL, 3);
+    hmmInit(&tracker, &idx, HMM_SIGMA);
+    hmmReset(&tracker, 0);
+}
+
+/* ==================== Test Cases ==================== */
+
+void test_posterior_normalised() {
+    double sum = 0;
+    setup();
+    for (int i = 0; i < 50; i++) hmmUpdate(&tracker, -300 + noise(400));
+    for (int i = 0; i < idx.count; i++) sum += tracker.p[i];
+    ASSERT_TRUE(fabs(sum - 1.0) < 1e-9);
+}
+
+void test_single_cap_step_followed_quickly() {
+    setup();
+    ASSERT_EQUAL(1, feed(0, 3, 1, 0));
+    ASSERT_TRUE(feed(-619, 3, 5, 1) <= 2);
+    ASSERT_EQUAL(1, tracker.map);
+}
+
+void test_two_caps_at_once_followed() {
+    setup();
+    int at = feed(-619 - 724, 3, 20, 1 + 3);
+    ASSERT_TRUE(at > 0 && at <= 5);
+}
+
+void test_edge_noise_does_not_swap_caps() {
+    /* Cap1 (-619) and Cap2 (-724): sit at Cap1 with noise pushing toward Cap2 */
+    setup();
+    feed(-619, 3, 10, 1);
+    for (int i = 0; i < 200; i++) {
+        int map = hmmUpdate(&tracker, -619 - 20 + noise(25));
+        if (tracker.confidence >= HMM_CONFIDENCE) ASSERT_EQUAL(1, map);  /* never Cap2 (3) */
+    }
+}
+
+void test_lone_outlier_ignored() {
+    setup();
+    feed(0, 3, 10, 0);
+    hmmUpdate(&tracker, -724);
+    ASSERT_FALSE(tracker.map == 3 && tracker.confidence >= HMM_CONFIDENCE);
+    ASSERT_EQUAL(1, feed(0, 3, 1, 0));
+}
+
+void test_uniform_reset_finds_state() {
+    setup();
+    hmmReset(&tracker, -1);
+    ASSERT_TRUE(tracker.confidence < HMM_CONFIDENCE);
+    ASSERT_TRUE(feed(-415 - 724, 3, 5, 3 + 9) > 0);
+}
+
+void test_eight_bottles() {
+    long caps[8] = {619, 724, 415, 512, 689, 377, 801, 455};
+    long bottles[8] = {1890, 1685, 1561, 1702, 1933, 1488, 2010, 1599};
+    int state = 2 + 1 * 27;  /* bottle 1 removed, cap 4 removed */
+    stateIndexInit(&idx, caps, bottles, 8);
+    hmmInit(&tracker, &idx, HMM_SIGMA);
+    hmmReset(&tracker, 2);
+    ASSERT_EQUAL(1, feed(stateIndexWeight(&idx, 2), 3, 1, 2));
+    ASSERT_TRUE(feed(stateIndexWeight(&idx, state), 3, 5, state) > 0);
+}
+
+void test_learned_mean_followed() {
+    /* Cap 1 really weighs 640, learned: a tight emission there still wins */
+    setup();
+    hmmSetState(&tracker, 1, -640, 0.3);
+    ASSERT_TRUE(feed(-640, 1, 10, 1) > 0);
+    ASSERT_TRUE(tracker.reach > 20);
+}
+
+void test_tight_state_rejects_far_weight() {
+    /* 12 units off is within the default sigma, but 5 sigmas of a learned tight state */
+    setup();
+    hmmReset(&tracker, 1);
+    feed(-619 - 12, 0, 5, 1);
+    ASSERT_EQUAL(1, tracker.map);
+    double loose = tracker.confidence;
+
+    setup();
+    hmmSetState(&tracker, 1, -619, 0.3);
+    hmmReset(&tracker, 1);
+    for (int i = 0; i < 5; i++) hmmUpdate(&tracker, -619 - 12);
+    ASSERT_TRUE(tracker.confidence < loose);
+}
+
+/* ==================== Main ==================== */
+
+int main(void) {
+    TEST_SUITE_START("HMM Tracker Tests");
+
+    printf("\n-- Following Changes --\n");
+    RUN_TEST(test_posterior_normalised);
+    RUN_TEST(test_single_cap_step_followed_quickly);
+    RUN_TEST(test_two_caps_at_once_followed);
+    RUN_TEST(test_uniform_reset_finds_state);
+    RUN_TEST(test_eight_bottles);
+
+    printf("\n-- Rejecting Noise --\n");
+    RUN_TEST(test_edge_noise_does_not_swap_caps);
+    RUN_TEST(test_lone_outlier_ignored);
+
+    printf("\n-- Learned States --\n");
+    RUN_TEST(test_learned_mean_followed);
+    RUN_TEST(test_tight_state_rejects_far_weight);
+
+    TEST_SUITE_END();
+    PRINT_TEST_SUMMARY();
+
+    return TEST_EXIT_CODE();
+}
@@ -0,0 +1,122 @@
+/**
+ * Unit tests for the adaptive Kalman weight filter
+ *
+ * These tests verify that the filter is quieter than its input at rest,
+ * follows a cap-sized step within a few samples and learns the
+ * measurement noise of the load cell.
+ */
+
+#include "test_framework.h"
+#include "../kalman.c"
+#include <math.h>
+
+/* Deterministic noise, roughly uniform in [-amp, amp] */
+static unsigned seed = 11;
+static double noise(double amp) {
+    seed = seed * 1103515245 + 12345;
+    return ((double)((seed >> 8) % 20001) / 10000.0 - 1.0) * amp;
+}
+
+/* Standard deviation of the filter output around level over n noisy samples */
+static double output_sd(Kalman *k, double level, double amp, int n) {
+    double sum2 = 0;
+    for (int i = 0; i < n; i++) {
+        double d = kalmanUpdate(k, level + noise(amp)) - level;
+        sum2 += d * d;
+    }
+    return sqrt(sum2 / n);
+}
+
+/* ==================== Test Cases ==================== */
+
+void test_first_sample_primes() {
+    Kalman k;
+    kalmanInit(&k, KALMAN_R_INIT);
+    long x = lround(kalmanUpdate(&k, 5000));
+    ASSERT_EQUAL(5000, x);
+    ASSERT_FALSE(k.moving);
+}
+
+void test_reset_keeps_learned_noise() {
+    Kalman k;
+    kalmanInit(&k, KALMAN_R_INIT);
+    kalmanReset(&k, 0);
+    output_sd(&k, 0, 300, 500);
+    double r = k.r;
+    kalmanReset(&k, -41500);
+    ASSERT_TRUE(k.r == r);
+    ASSERT_EQUAL(-41500, lround(k.x));
+}
+
+void test_quieter_than_input_at_rest() {
+    Kalman k;
+    kalmanInit(&k, KALMAN_R_INIT);
+    kalmanReset(&k, 0);
+    output_sd(&k, 0, 520, 200);  /* let the gain come down */
+    /* Input SD is 520 / sqrt(3) = 300 */
+    double sd = output_sd(&k, 0, 520, 2000);
+    ASSERT_TRUE(sd < 100);
+}
+
+void test_learns_measurement_noise() {
+    Kalman k;
+    kalmanInit(&k, KALMAN_R_MIN);
+    kalmanReset(&k, 0);
+    output_sd(&k, 0, 1732, 3000);  /* SD 1000 */
+    ASSERT_TRUE(sqrt(k.r) > 800 && sqrt(k.r) < 1200);
+}
+
+void test_follows_step_quickly() {
+    Kalman k;
+    int i;
+    kalmanInit(&k, KALMAN_R_INIT);
+    kalmanReset(&k, 0);
+    output_sd(&k, 0, 520, 500);
+
+    for (i = 1; i <= 50; i++) {
+        if (fabs(kalmanUpdate(&k, -41500 + noise(520)) + 41500) < 2000) break;
+    }
+    ASSERT_TRUE(i <= 3);
+    ASSERT_TRUE(k.moving);
+
+    /* Back to rest after the step, quiet again */
+    output_sd(&k, -41500, 520, 200);
+    ASSERT_FALSE(k.moving);
+    ASSERT_TRUE(output_sd(&k, -41500, 520, 2000) < 100);
+}
+
+void test_noise_does_not_open_gate() {
+    Kalman k;
+    int moving = 0;
+    kalmanInit(&k, KALMAN_R_INIT);
+    kalmanReset(&k, 0);
+    output_sd(&k, 0, 520, 500);
+    for (int i = 0; i < 5000; i++) {
+        kalmanUpdate(&k, noise(520));
+        moving += k.moving;
+    }
+    ASSERT_EQUAL(0, moving);
+}
+
+/* ==================== Main ==================== */
+
+int main(void) {
+    TEST_SUITE_START("Kalman Filter Tests");
+
+    printf("\n-- Basic Behaviour --\n");
+    RUN_TEST(test_first_sample_primes);
+    RUN_TEST(test_reset_keeps_learned_noise);
+
+    printf("\n-- Noise --\n");
+    RUN_TEST(test_quieter_than_input_at_rest);
+    RUN_TEST(test_learns_measurement_noise);
+    RUN_TEST(test_noise_does_not_open_gate);
+
+    printf("\n-- Steps --\n");
+    RUN_TEST(test_follows_step_quickly);
+
+    TEST_SUITE_END();
+    PRINT_TEST_SUMMARY();
+
+    return TEST_EXIT_CODE();
+}
@@ -0,0 +1,163 @@
+/**
+ * Unit tests for the audio latency monitor
+ *
+ * These tests verify parsing of the output mode, the buffer size steps,
+ * that late callbacks count as underruns and long ones as overruns, that
+ * an underrun the device reports is not counted twice, and
+ * the load and acceptance figures the probe decides on, across counter
+ * wrap-around.
+ */
+
+#define _DEFAULT_SOURCE
+#include "test_framework.h"
+#include <math.h>
+#include "../latency.c"
+
+#define RATE 22050
+
+static LatencyMonitor monitor;
+
+/* n callbacks of busy us each, period us apart, from tick */
+static uint32_t callbacks(uint32_t tick, int n, uint32_t period, uint32_t busy) {
+    for (int i = 0; i < n; i++) {
+        latencyBegin(&monitor, tick);
+        latencyEnd(&monitor, tick + busy);
+        tick += period;
+    }
+    return tick;
+}
+
+/* ==================== Test Cases ==================== */
+
+void test_parse_modes() {
+    LatencyConfig c;
+    ASSERT_EQUAL(0, latencyParse(&c, LATENCY_DEFAULT));
+    ASSERT_FALSE(c.low);
+    ASSERT_EQUAL(4096, c.buffer);
+
+    ASSERT_EQUAL(0, latencyParse(&c, "buffer=512"));
+    ASSERT_EQUAL(512, c.buffer);
+
+    ASSERT_EQUAL(0, latencyParse(&c, "low,budget=0.4"));
+    ASSERT_TRUE(c.low);
+    ASSERT_EQUAL(LATENCY_MIN_BUFFER, c.buffer);
+    ASSERT_TRUE(fabs(c.budget - 0.4) < 1e-9);
+}
+
+void test_parse_malformed() {
+    LatencyConfig c;
+    ASSERT_EQUAL(-1, latencyParse(&c, "buffer=1000"));
+    ASSERT_EQUAL(-1, latencyParse(&c, "buffer=128"));
+    ASSERT_EQUAL(-1, latencyParse(&c, "buffer=8192"));
+    ASSERT_EQUAL(-1, latencyParse(&c, "low,budget=0"));
+    ASSERT_EQUAL(-1, latencyParse(&c, "fast"));
+}
+
+void test_buffer_steps() {
+    ASSERT_EQUAL(512, latencyNextBuffer(256));
+    ASSERT_EQUAL(4096, latencyNextBuffer(2048));
+    ASSERT_EQUAL(-1, latencyNextBuffer(4096));
+}
+
+void test_on_time_callbacks_clean() {
+    LatencyStats s;
+    latencyInit(&monitor, 512, RATE);
+    ASSERT_EQUAL(23219, (int) monitor.periodUs);
+    callbacks(1000, 100, monitor.periodUs + 2000, 3000);
+    latencySnapshot(&monitor, &s);
+    ASSERT_EQUAL(100, (int) s.callbacks);
+    ASSERT_EQUAL(0, (int) s.underruns);
+    ASSERT_EQUAL(0, (int) s.overruns);
+    ASSERT_EQUAL(3000, (int) s.maxBusyUs);
+}
+
+void test_late_callback_is_underrun() {
+    LatencyStats s;
+    uint32_t tick;
+    latencyInit(&monitor, 512, RATE);
+    tick = callbacks(0, 10, monitor.periodUs, 1000);
+    tick = callbacks(tick + monitor.periodUs, 1, monitor.periodUs, 1000);
+    callbacks(tick, 10, monitor.periodUs, 1000);
+    latencySnapshot(&monitor, &s);
+    ASSERT_EQUAL(1, (int) s.underruns);
+}
+
+void test_reported_xrun_counted_once() {
+    LatencyStats s;
+    uint32_t tick;
+    latencyInit(&monitor, 512, RATE);
+    tick = callbacks(0, 10, monitor.periodUs, 1000);
+    latencyXrun(&monitor);
+    callbacks(tick + 3 * monitor.periodUs, 10, monitor.periodUs, 1000);
+    latencySnapshot(&monitor, &s);
+    ASSERT_EQUAL(1, (int) s.underruns);
+}
+
+void test_long_callback_is_overrun() {
+    LatencyStats s;
+    latencyInit(&monitor, 256, RATE);
+    callbacks(0, 3, monitor.periodUs, monitor.periodUs * 9 / 10);
+    latencySnapshot(&monitor, &s);
+    ASSERT_EQUAL(3, (int) s.overruns);
+}
+
+void test_delta_and_load_across_wrap() {
+    LatencyStats before, after, delta;
+    uint32_t tick = 0xffffffffu - 100000;
+    latencyInit(&monitor, 1024, RATE);
+    tick = callbacks(tick, 5, monitor.periodUs, 500);
+    latencySnapshot(&monitor, &before);
+    callbacks(tick, 20, monitor.periodUs, monitor.periodUs / 10);
+    latencySnapshot(&monitor, &after);
+    latencyDelta(&after, &before, &delta);
+
+    ASSERT_EQUAL(20, (int) delta.callbacks);
+    ASSERT_EQUAL(0, (int) delta.underruns);
+    ASSERT_TRUE(fabs(latencyLoad(&monitor, &delta) - 0.1) < 0.001);
+    ASSERT_TRUE(latencyAcceptable(&monitor, &delta, 0.25));
+    ASSERT_FALSE(latencyAcceptable(&monitor, &delta, 0.05));
+}
+
+void test_no_callbacks_not_acceptable() {
+    LatencyStats s;
+    latencyInit(&monitor, 256, RATE);
+    latencySnapshot(&monitor, &s);
+    ASSERT_FALSE(latencyAcceptable(&monitor, &s, 1));
+}
+
+void test_snapshot_restarts_maximum() {
+    LatencyStats s;
+    latencyInit(&monitor, 1024, RATE);
+    callbacks(0, 2, monitor.periodUs, 7000);
+    latencySnapshot(&monitor, &s);
+    ASSERT_EQUAL(7000, (int) s.maxBusyUs);
+    latencySnapshot(&monitor, &s);
+    ASSERT_EQUAL(0, (int) s.maxBusyUs);
+}
+
+/* ==================== Main ==================== */
+
+int main(void) {
+    TEST_SUITE_START("Audio Latency Tests");
+
+    printf("\n-- Configuration --\n");
+    RUN_TEST(test_parse_modes);
+    RUN_TEST(test_parse_malformed);
+    RUN_TEST(test_buffer_steps);
+
+    printf("\n-- Callback timing --\n");
+    RUN_TEST(test_on_time_callbacks_clean);
+    RUN_TEST(test_late_callback_is_underrun);
+    RUN_TEST(test_reported_xrun_counted_once);
+    RUN_TEST(test_long_callback_is_overrun);
+
+    printf("\n-- Probe figures --\n");
+    RUN_TEST(test_delta_and_load_across_wrap);
+    RUN_TEST(test_no_callbacks_not_acceptable);
+    RUN_TEST(test_snapshot_restarts_maximum);
+
+    TEST_SUITE_END();
+    PRINT_TEST_SUMMARY();
+
+    return TEST_EXIT_CODE();
+}
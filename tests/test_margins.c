@@ -0,0 +1,148 @@
+/**
+ * Unit tests for the per-state margins
+ *
+ * These tests verify that the prior reproduces the fixed margin, that the
+ * running statistics tighten or widen a state's gate, that matching uses
+ * the Mahalanobis distance, and that overlapping learned states are found.
+ */
+
+#include "test_framework.h"
+#include "../stateindex.c"
+#include "../margins.c"
+
+static const long CAPS[] = {619, 724, 415};
+
+static StateIndex idx;
+static Margins margins;
+
+/* Deterministic noise, roughly uniform in [-amp, amp] */
+static unsigned seed = 7;
+static double noise(double amp) {
+    seed = seed * 1103515245 + 12345;
+    return ((double)((seed >> 8) % 20001) / 10000.0 - 1.0) * amp;
+}
+
+static void setup(void) {
+    stateIndexInit(&idx, CAPS, NULL, 3);
+    marginsInit(&margins, &idx, 20);
+}
+
+static void learn(int state, double weight, double amp, int n) {
+    for (int i = 0; i < n; i++) marginsAdd(&margins, state, weight + noise(amp));
+}
+
+/* ==================== Test Cases ==================== */
+
+void test_prior_is_the_fixed_margin() {
+    setup();
+    ASSERT_EQUAL(0, marginsMatch(&margins, 19.5, NULL));
+    ASSERT_EQUAL(-1, marginsMatch(&margins, 20.5, NULL));
+    ASSERT_EQUAL(1, marginsMatch(&margins, -619 - 19.5, NULL));
+    ASSERT_FALSE(marginsLearned(&margins, 1));
+}
+
+void test_quiet_state_tightens() {
+    setup();
+    learn(0, 0, 1, 2000);
+    ASSERT_TRUE(marginsLearned(&margins, 0));
+    ASSERT_TRUE(marginsSd(&margins, 0) < 3);
+    /* 15 units off used to match, a quiet state no longer accepts it */
+    ASSERT_EQUAL(-1, marginsMatch(&margins, 15, NULL));
+    ASSERT_EQUAL(0, marginsMatch(&margins, 4, NULL));
+}
+
+void test_sd_floor() {
+    setup();
+    learn(0, 0, 0, 5000);
+    ASSERT_TRUE(marginsSd(&margins, 0) == MARGINS_MIN_SD);
+}
+
+void test_noisy_state_widens() {
+    setup();
+    learn(1, -619, 30, 3000);
+    ASSERT_TRUE(marginsSd(&margins, 1) > 10);
+    ASSERT_EQUAL(1, marginsMatch(&margins, -619 + 25, NULL));
+}
+
+void test_mean_follows_real_weight() {
+    /* Cap 1 configured as 619 but weighs 629 */
+    setup();
+    learn(1, -629, 1, 3000);
+    ASSERT_TRUE(fabs(margins.states[1].mean + 629) < 0.5);
+    ASSERT_EQUAL(1, marginsMatch(&margins, -629, NULL));
+}
+
+void test_mean_clamped_to_prior_gate() {
+    setup();
+    learn(0, 60, 0, 5000);
+    ASSERT_TRUE(margins.states[0].mean <= 20 + 1e-9);
+}
+
+void test_forgets_old_observations() {
+    setup();
+    learn(0, -5, 0.5, 4000);
+    learn(0, 5, 0.5, 4000 * 5);
+    ASSERT_TRUE(fabs(margins.states[0].mean - 5) < 0.5);
+}
+
+void test_distance_in_standard_deviations() {
+    double d;
+    setup();
+    marginsSet(&margins, 3, 1000, -724, 16);
+    ASSERT_TRUE(fabs(marginsDistance(&margins, 3, -716) - 2) < 1e-9);
+    ASSERT_EQUAL(3, marginsMatch(&margins, -716, &d));
+    ASSERT_TRUE(fabs(d - 2) < 1e-9);
+}
+
+void test_overlap_only_with_learned_states() {
+    int a, b;
+    setup();
+    ASSERT_TRUE(marginsOverlap(&margins, &a, &b) < 0);
+
+    /* Cap 1 (-619) is over 100 units from any other state */
+    learn(1, -619, 3, 2000);
+    ASSERT_TRUE(marginsOverlap(&margins, &a, &b) < 0);
+
+    /* Cap 2 + cap 3 (-1139) and cap 1 + cap 2 (-1343) neither */
+    learn(12, -1139, 3, 2000);
+    ASSERT_TRUE(marginsOverlap(&margins, &a, &b) < 0);
+}
+
+void test_overlap_found() {
+    /* Caps of 619 and 622: learned spreads of 2+ units overlap */
+    static const long close[] = {619, 622, 415};
+    int a, b;
+    stateIndexInit(&idx, close, NULL, 3);
+    marginsInit(&margins, &idx, 20);
+    learn(1, -619, 3, 2000);
+    learn(3, -622, 3, 2000);
+    ASSERT_TRUE(marginsOverlap(&margins, &a, &b) < MARGINS_GATE);
+    ASSERT_TRUE((a == 1 && b == 3) || (a == 3 && b == 1));
+}
+
+/* ==================== Main ==================== */
+
+int main(void) {
+    TEST_SUITE_START("Per-State Margin Tests");
+
+    printf("\n-- Prior --\n");
+    RUN_TEST(test_prior_is_the_fixed_margin);
+
+    printf("\n-- Learning --\n");
+    RUN_TEST(test_quiet_state_tightens);
+    RUN_TEST(test_sd_floor);
+    RUN_TEST(test_noisy_state_widens);
+    RUN_TEST(test_mean_follows_real_weight);
+    RUN_TEST(test_mean_clamped_to_prior_gate);
+    RUN_TEST(test_forgets_old_observations);
+
+    printf("\n-- Matching --\n");
+    RUN_TEST(test_distance_in_standard_deviations);
+    RUN_TEST(test_overlap_only_with_learned_states);
+    RUN_TEST(test_overlap_found);
+
+    TEST_SUITE_END();
+    PRINT_TEST_SUMMARY();
+
+    return TEST_EXIT_CODE();
+}
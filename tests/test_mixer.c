@@ -0,0 +1,202 @@
+/**
+ * Unit tests for the software mixer
+ *
+ * These tests verify that looped sounds wrap, to their loop start when
+ * they have one, and others end in silence,
+ * that voices are summed with saturation and through the fade engine, that
+ * a silent voice keeps its place without being mixed, and the play and halt
+ * commands between threads.
+ */
+
+#define _DEFAULT_SOURCE
+#include "test_framework.h"
+#include "../fade.c"
+#include "../mixer.c"
+
+#define RATE 22050
+
+static FadeEngine engine;
+static Mixer mixer;
+static int16_t out[2 * 4096];
+
+/* A stereo sound of frames frames counting up from first, the right channel negated */
+static int16_t ramp[2 * 4096];
+static Pcm makeRamp(int frames, int first) {
+    Pcm pcm = {.data = ramp, .frames = (uint32_t) frames, .rate = RATE};
+    for (int i = 0; i < frames; i++) {
+        ramp[2 * i] = (int16_t) (first + i);
+        ramp[2 * i + 1] = (int16_t) -(first + i);
+    }
+    return pcm;
+}
+
+static void setup(void) {
+    fadeInit(&engine, "in=0,out=0,curve=linear");
+    fadeSetRate(&engine, RATE);
+    mixerInit(&mixer, &engine);
+}
+
+/* ==================== Test Cases ==================== */
+
+void test_loop_wraps() {
+    Pcm pcm = makeRamp(100, 1);
+    setup();
+    fadeSet(&engine, 0, FADE_UNITY - 1);
+    mixerPlay(&mixer, 0, &pcm, 1);
+    mixerRender(&mixer, out, 150);
+    ASSERT_TRUE(abs(out[2 * 99] - 100) <= 1);
+    ASSERT_TRUE(abs(out[2 * 100] - 1) <= 1);
+    ASSERT_TRUE(abs(out[2 * 149 + 1] + 50) <= 1);
+    ASSERT_EQUAL(50, (int) mixer.voice[0].pos);
+}
+
+void test_loop_wraps_to_loop_start() {
+    Pcm pcm = makeRamp(100, 1);
+    pcm.loopStart = 40;
+    setup();
+    fadeSet(&engine, 0, FADE_UNITY - 1);
+    mixerPlay(&mixer, 0, &pcm, 1);
+    mixerRender(&mixer, out, 150);
+    ASSERT_TRUE(abs(out[2 * 99] - 100) <= 1);
+    ASSERT_TRUE(abs(out[2 * 100] - 41) <= 1);
+    ASSERT_EQUAL(90, (int) mixer.voice[0].pos);
+
+    // Silent, it still wraps to the loop start
+    fadeSet(&engine, 0, 0);
+    mixerRender(&mixer, out, 50);
+    ASSERT_EQUAL(80, (int) mixer.voice[0].pos);
+}
+
+void test_empty_loop_ends() {
+    Pcm pcm = makeRamp(100, 1);
+    pcm.loopStart = 100;
+    setup();
+    fadeSet(&engine, 0, FADE_UNITY - 1);
+    mixerPlay(&mixer, 0, &pcm, 1);
+    mixerRender(&mixer, out, 150);
+    ASSERT_TRUE(abs(out[2 * 99] - 100) <= 1);
+    ASSERT_EQUAL(0, out[2 * 100]);
+    ASSERT_TRUE(mixer.voice[0].pcm == NULL);
+}
+
+void test_one_shot_ends_in_silence() {
+    Pcm pcm = makeRamp(100, 1000);
+    setup();
+    fadeSet(&engine, 1, FADE_UNITY - 1);
+    mixerPlay(&mixer, 1, &pcm, 0);
+    mixerRender(&mixer, out, 150);
+    ASSERT_TRUE(out[2 * 99] != 0);
+    ASSERT_EQUAL(0, out[2 * 100]);
+    ASSERT_EQUAL(0, out[2 * 149]);
+    ASSERT_TRUE(mixer.voice[1].pcm == NULL);
+}
+
+void test_sum_saturates() {
+    Pcm pcm = makeRamp(10, 30000);
+    setup();
+    for (int c = 0; c < 3; c++) {
+        fadeSet(&engine, c, FADE_UNITY - 1);
+        mixerPlay(&mixer, c, &pcm, 1);
+    }
+    mixerRender(&mixer, out, 10);
+    ASSERT_EQUAL(INT16_MAX, out[0]);
+    ASSERT_EQUAL(INT16_MIN, out[1]);
+}
+
+void test_gain_applied() {
+    Pcm pcm = makeRamp(10, 10000);
+    setup();
+    fadeSet(&engine, 2, FADE_UNITY / 2);
+    mixerPlay(&mixer, 2, &pcm, 1);
+    mixerRender(&mixer, out, 10);
+    ASSERT_TRUE(abs(out[0] - 5000) <= 1);
+}
+
+void test_silent_voice_keeps_place() {
+    Pcm pcm = makeRamp(1000, 1);
+    setup();
+    mixerPlay(&mixer, 0, &pcm, 1);
+    mixerRender(&mixer, out, 2500);
+    ASSERT_EQUAL(0, out[0]);
+    ASSERT_EQUAL(0, out[2 * 2499]);
+    ASSERT_EQUAL(500, (int) mixer.voice[0].pos);
+
+    // Fading in picks up where the track would have been
+    fadeTo(&engine, 0, FADE_UNITY - 1);
+    mixerRender(&mixer, out, 1);
+    ASSERT_TRUE(abs(out[0] - 501) <= 1);
+}
+
+void test_long_buffer_in_passes() {
+    static int16_t sound[2 * 3000];
+    Pcm pcm = {.data = sound, .frames = 3000, .rate = RATE};
+    for (int i = 0; i < 6000; i++) sound[i] = 1000;
+    setup();
+    fadeSet(&engine, 0, FADE_UNITY - 1);
+    mixerPlay(&mixer, 0, &pcm, 1);
+    mixerRender(&mixer, out, 4096);
+    ASSERT_TRUE(abs(out[2 * 4095] - 1000) <= 1);
+    ASSERT_EQUAL(1096, (int) mixer.voice[0].pos);
+}
+
+void test_halt_every_channel() {
+    Pcm pcm = makeRamp(100, 1);
+    setup();
+    for (int c = 0; c < FADE_CHANNELS; c++) mixerPlay(&mixer, c, &pcm, 1);
+    mixerRender(&mixer, out, 1);
+    ASSERT_EQUAL(1, mixerHalt(&mixer, -1));
+    mixerRender(&mixer, out, 1);
+    for (int c = 0; c < FADE_CHANNELS; c++) ASSERT_TRUE(mixer.voice[c].pcm == NULL);
+    ASSERT_EQUAL(0, mixerPlay(&mixer, FADE_CHANNELS, &pcm, 1));
+}
+
+void test_pending_until_taken() {
+    Pcm pcm = makeRamp(100, 1);
+    setup();
+    mixerPlay(&mixer, 0, &pcm, 1);
+    mixerRender(&mixer, out, 10);
+    ASSERT_EQUAL(0, mixerPending(&mixer));
+    mixerHalt(&mixer, 0);
+    ASSERT_EQUAL(1, mixerPending(&mixer));
+    ASSERT_TRUE(mixer.voice[0].pcm == &pcm);
+    mixerRender(&mixer, out, 10);
+    ASSERT_EQUAL(0, mixerPending(&mixer));
+    ASSERT_TRUE(mixer.voice[0].pcm == NULL);
+}
+
+void test_queue_full() {
+    Pcm pcm = makeRamp(100, 1);
+    int queued = 0;
+    setup();
+    for (int i = 0; i < MIXER_QUEUE_SIZE + 3; i++) queued += mixerPlay(&mixer, 0, &pcm, 1);
+    ASSERT_EQUAL(MIXER_QUEUE_SIZE, queued);
+    ASSERT_EQUAL(3, (int) mixer.queue.dropped);
+    mixerRender(&mixer, out, 1);
+    ASSERT_EQUAL(1, mixerPlay(&mixer, 0, &pcm, 1));
+}
+
+int main(void) {
+    TEST_SUITE_START("Software Mixer Tests");
+
+    printf("\n-- Voices --\n");
+    RUN_TEST(test_loop_wraps);
+    RUN_TEST(test_loop_wraps_to_loop_start);
+    RUN_TEST(test_empty_loop_ends);
+    RUN_TEST(test_one_shot_ends_in_silence);
+    RUN_TEST(test_long_buffer_in_passes);
+
+    printf("\n-- Mixing --\n");
+    RUN_TEST(test_sum_saturates);
+    RUN_TEST(test_gain_applied);
+    RUN_TEST(test_silent_voice_keeps_place);
+
+    printf("\n-- Commands --\n");
+    RUN_TEST(test_halt_every_channel);
+    RUN_TEST(test_pending_until_taken);
+    RUN_TEST(test_queue_full);
+
+    TEST_SUITE_END();
+    PRINT_TEST_SUMMARY();
+
+    return TEST_EXIT_CODE();
+}
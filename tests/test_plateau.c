@@ -0,0 +1,197 @@
+/**
+ * Unit tests for the plateau tracker
+ *
+ * These tests verify that deltas between plateaus are matched against
+ * single-cap and single-bottle steps, and that drift and foreign weight
+ * are absorbed by re-anchoring instead of leaving the state unknown,
+ * and that the zero follows slow creep while all caps are on.
+ */
+
+#include "test_framework.h"
+#include "../stateindex.c"
+#include "../plateau.c"
+
+static const long CAPS[] = {619, 724, 415};
+static const long BOTTLES[] = {3100, 2800, 0};
+
+static StateIndex idx;
+static PlateauTracker tracker;
+
+/* Deterministic noise, roughly uniform in [-amp, amp] */
+static unsigned seed = 5;
+static double noise(double amp) {
+    seed = seed * 1103515245 + 12345;
+    return ((double)((seed >> 8) % 20001) / 10000.0 - 1.0) * amp;
+}
+
+/* Conversions arrive at 10 SPS */
+static uint32_t now = 0;
+static int push(double weight) {
+    now += 100000;
+    return plateauPush(&tracker, weight, now);
+}
+
+/* Feed n samples around weight, returns the last non-NONE result, PLATEAU_NONE if none */
+static int hold(double weight, int n) {
+    int last = PLATEAU_NONE;
+    for (int i = 0; i < n; i++) {
+        int r = push(weight + noise(2));
+        if (r != PLATEAU_NONE) last = r;
+    }
+    return last;
+}
+
+static void setup(const long *bottles) {
+    stateIndexInit(&idx, CAPS, bottles, 3);
+    plateauInit(&tracker, &idx, 20);
+    plateauReset(&tracker, 0, 0);
+}
+
+/* ==================== Test Cases ==================== */
+
+void test_cap_lift_and_return() {
+    setup(NULL);
+    ASSERT_EQUAL(PLATEAU_SETTLED, hold(0, 20));
+    ASSERT_EQUAL(PLATEAU_TRANSITION, hold(-724, 20));
+    ASSERT_EQUAL(3, tracker.state);  /* Cap2 */
+    ASSERT_EQUAL(PLATEAU_TRANSITION, hold(0, 20));
+    ASSERT_EQUAL(0, tracker.state);
+}
+
+void test_needs_min_samples() {
+    setup(NULL);
+    ASSERT_EQUAL(PLATEAU_NONE, hold(-619, 9));  /* 0.8 s */
+    ASSERT_EQUAL(0, tracker.state);
+    ASSERT_EQUAL(PLATEAU_TRANSITION, hold(-619, 1));
+    ASSERT_EQUAL(1, tracker.state);
+}
+
+void test_one_report_per_plateau() {
+    setup(NULL);
+    hold(-415, 10);
+    ASSERT_EQUAL(PLATEAU_NONE, hold(-415, 100));
+    ASSERT_EQUAL(1, (long) tracker.transitions);
+}
+
+void test_bottle_removal() {
+    setup(BOTTLES);
+    hold(-619, 20);
+    ASSERT_EQUAL(1, tracker.state);
+    hold(-619 - 3100, 20);  /* the rest of bottle 1 */
+    ASSERT_EQUAL(2, tracker.state);
+}
+
+void test_drift_absorbed() {
+    /* 300 units of creep, far beyond the margin from the tare, in small plateaus */
+    setup(NULL);
+    for (int i = 0; i <= 30; i++) hold(i * 10, 20);
+    ASSERT_EQUAL(0, tracker.state);
+    ASSERT_TRUE(fabs(tracker.offset - 300) < 5);
+
+    /* A cap lift still matches relative to the drifted level */
+    ASSERT_EQUAL(PLATEAU_TRANSITION, hold(300 - 619, 20));
+    ASSERT_EQUAL(1, tracker.state);
+}
+
+void test_foreign_object_absorbed() {
+    setup(NULL);
+    hold(0, 20);
+    ASSERT_EQUAL(PLATEAU_UNEXPLAINED, hold(180, 20));  /* phone set down */
+    ASSERT_EQUAL(0, tracker.state);
+    ASSERT_TRUE(fabs(tracker.offset - 180) < 5);
+
+    ASSERT_EQUAL(PLATEAU_TRANSITION, hold(180 - 415, 20));
+    ASSERT_EQUAL(9, tracker.state);  /* Cap3 */
+    ASSERT_EQUAL(PLATEAU_UNEXPLAINED, hold(-415, 20));  /* phone picked up */
+    ASSERT_EQUAL(9, tracker.state);
+}
+
+void test_two_caps_at_once_not_matched() {
+    /* Only single-bottle steps re-anchor to a new state */
+    setup(NULL);
+    ASSERT_EQUAL(PLATEAU_UNEXPLAINED, hold(-619 - 724, 20));
+    ASSERT_EQUAL(0, tracker.state);
+}
+
+void test_unknown_state_matched_through_offset() {
+    setup(NULL);
+    hold(50, 20);  /* drift since the tare, absorbed */
+    plateauReset(&tracker, -1, 0);
+    ASSERT_EQUAL(PLATEAU_TRANSITION, hold(50 - 619 - 415, 20));
+    ASSERT_EQUAL(10, tracker.state);  /* Cap1+3 */
+}
+
+void test_unknown_state_stays_unknown() {
+    setup(NULL);
+    plateauReset(&tracker, -1, 0);
+    ASSERT_EQUAL(PLATEAU_UNEXPLAINED, hold(-300, 20));
+    ASSERT_EQUAL(-1, tracker.state);
+}
+
+/* Feed n samples around weight, tracking the zero after each */
+static int hold_tracking(double weight, int n) {
+    int moved = 0;
+    for (int i = 0; i < n; i++) {
+        push(weight + noise(2));
+        moved += plateauTrackZero(&tracker);
+    }
+    return moved;
+}
+
+void test_zero_tracking_follows_creep() {
+    setup(NULL);
+    /* Creep smaller than the run band never breaks the run */
+    ASSERT_EQUAL(0, hold_tracking(0, 49));  /* 4.8 s */
+    hold_tracking(0, 1);
+    hold_tracking(6, 2000);
+    ASSERT_TRUE(tracker.offset > 4 && tracker.offset < 6.5);
+    ASSERT_EQUAL(0, tracker.state);
+}
+
+void test_short_press_is_not_a_plateau() {
+    /* At 80 SPS a quarter second hand press is 20 conversions, still no plateau */
+    setup(NULL);
+    hold(0, 20);
+    for (int i = 0; i < 20; i++) {
+        now += 12500;
+        ASSERT_EQUAL(PLATEAU_NONE, plateauPush(&tracker, 80, now));
+    }
+    ASSERT_EQUAL(PLATEAU_TRANSITION, hold(-619, 20));
+    ASSERT_EQUAL(1, tracker.state);
+}
+
+void test_zero_tracking_only_at_state_zero() {
+    setup(NULL);
+    hold(-619, 20);
+    ASSERT_EQUAL(0, hold_tracking(-619 + 6, 500));
+    ASSERT_TRUE(fabs(tracker.offset) < 1);
+}
+
+/* ==================== Main ==================== */
+
+int main(void) {
+    TEST_SUITE_START("Plateau Tracker Tests");
+
+    printf("\n-- Transitions --\n");
+    RUN_TEST(test_cap_lift_and_return);
+    RUN_TEST(test_needs_min_samples);
+    RUN_TEST(test_one_report_per_plateau);
+    RUN_TEST(test_bottle_removal);
+    RUN_TEST(test_two_caps_at_once_not_matched);
+    RUN_TEST(test_short_press_is_not_a_plateau);
+
+    printf("\n-- Re-anchoring --\n");
+    RUN_TEST(test_drift_absorbed);
+    RUN_TEST(test_foreign_object_absorbed);
+    RUN_TEST(test_unknown_state_matched_through_offset);
+    RUN_TEST(test_unknown_state_stays_unknown);
+
+    printf("\n-- Zero Tracking --\n");
+    RUN_TEST(test_zero_tracking_follows_creep);
+    RUN_TEST(test_zero_tracking_only_at_state_zero);
+
+    TEST_SUITE_END();
+    PRINT_TEST_SUMMARY();
+
+    return TEST_EXIT_CODE();
+}
@@ -0,0 +1,276 @@
+/**
+ * Unit tests for the sample sources
+ *
+ * These tests verify the sources that every bench result is based on:
+ * trace replay (comments and malformed lines skipped, file and speed
+ * options, looping with continuous ticks, the end of the file), the
+ * synthetic load cell's options (rate, base, noise, drift, steps, bumps,
+ * seed, duration), recording a trace and replaying it, the pacer, and how
+ * the hx711 source folds channel B into channel A. The HX711 driver is
+ * stubbed with a script of conversions.
+ */
+
+#define _DEFAULT_SOURCE
+#include "test_framework.h"
+#include "../timing.c"
+#include "../source.c"
+
+#define TRACE_PATH  "bin/test.trace"
+#define RECORD_PATH "bin/record.trace"
+
+/* HX711 driver stubs, conversions come from a script of (channel, value) pairs */
+static const long (*script)[2];
+static int scriptLength;
+static int scriptPos;
+static int lastChannel;
+
+void initHX711() {}
+void uninit() {}
+void hx711Recover(void) {}
+void hx711Interleave(int enable) { (void) enable; }
+int  hx711LastChannel() { return lastChannel; }
+
+int read_multi(long *values) {
+    if (scriptPos >= scriptLength) return HX711_ERR_TIMEOUT;
+    lastChannel = (int) script[scriptPos][0];
+    values[0] = script[scriptPos++][1];
+    return 1;
+}
+
+int  hx711SetDataPins(const int *pins, int n) { (void) pins; (void) n; return 0; }
+int  hx711ParsePins(const char *list, int *pins, int max) { (void) list; (void) pins; (void) max; return 0; }
+
+static void writeTrace(const char *text) {
+    FILE *f = fopen(TRACE_PATH, "w");
+    fputs(text, f);
+    fclose(f);
+}
+
+/* Reads until the source ends or max samples, returns how many */
+static int readAll(Sample *out, int max) {
+    int n = 0, result;
+    Sample s;
+    while (n < max && (result = sourceRead(&s)) != SOURCE_END) {
+        if (result == SOURCE_OK) out[n++] = s;
+    }
+    return n;
+}
+
+/* ==================== Test Cases ==================== */
+
+void test_trace_parsing() {
+    Sample s[8];
+    writeTrace("# music bottles trace\n1000 -5\n\ngarbage\n2000\n 3000 70000\n4000 12 extra\n#5000 9\n");
+    ASSERT_EQUAL(0, sourceOpen("trace:" TRACE_PATH ",speed=0"));
+    ASSERT_STR_EQUAL("trace", sourceName());
+    ASSERT_EQUAL(0, sourceIsHardware());
+    ASSERT_EQUAL(3, readAll(s, 8));
+    ASSERT_EQUAL(1000, (int) s[0].tick);
+    ASSERT_EQUAL(-5, s[0].value);
+    ASSERT_EQUAL(3000, (int) s[1].tick);
+    ASSERT_EQUAL(70000, s[1].value);
+    ASSERT_EQUAL(12, s[2].value);
+
+    // Exhausted for good
+    ASSERT_EQUAL(SOURCE_END, sourceRead(&s[0]));
+    ASSERT_EQUAL(SOURCE_END, sourceRead(&s[0]));
+    sourceClose();
+}
+
+void test_trace_options() {
+    Sample s[4];
+    writeTrace("100 1\n200 2\n");
+
+    ASSERT_EQUAL(0, sourceOpen("trace:file=" TRACE_PATH ",speed=0"));
+    ASSERT_EQUAL(0, sourceIsPaced());
+    ASSERT_EQUAL(2, readAll(s, 4));
+    sourceClose();
+
+    // Real time unless told otherwise
+    ASSERT_EQUAL(0, sourceOpen("trace:" TRACE_PATH));
+    ASSERT_EQUAL(1, sourceIsPaced());
+    sourceClose();
+    ASSERT_EQUAL(0, sourceOpen("trace:" TRACE_PATH ",speed=4"));
+    ASSERT_EQUAL(1, sourceIsPaced());
+    sourceClose();
+
+    ASSERT_EQUAL(-1, sourceOpen("trace:bin/no-such.trace"));
+    ASSERT_EQUAL(-1, sourceOpen("trace"));
+    ASSERT_EQUAL(-1, sourceOpen("trace:speed=0"));
+}
+
+void test_trace_loop_keeps_ticks_going() {
+    Sample s[7];
+    writeTrace("1000 1\n1100 2\n1200 3\n");
+    ASSERT_EQUAL(0, sourceOpen("trace:" TRACE_PATH ",speed=0,loop"));
+    ASSERT_EQUAL(7, readAll(s, 7));
+    for (int i = 0; i < 7; i++) {
+        ASSERT_EQUAL(1 + i % 3, s[i].value);
+        ASSERT_EQUAL(1000 + 100 * i, (int) s[i].tick);
+    }
+    sourceClose();
+
+    // A looped trace with no samples still ends
+    writeTrace("# nothing\n");
+    ASSERT_EQUAL(0, sourceOpen("trace:" TRACE_PATH ",speed=0,loop"));
+    ASSERT_EQUAL(SOURCE_END, sourceRead(&s[0]));
+    sourceClose();
+}
+
+void test_synth_options() {
+    Sample s[40];
+    ASSERT_EQUAL(0, sourceOpen("synth:speed=0,rate=20,base=5000,noise=0,drift=100,duration=2"));
+    ASSERT_STR_EQUAL("synth", sourceName());
+    ASSERT_EQUAL(0, sourceIsPaced());
+    ASSERT_EQUAL(40, readAll(s, 40));
+    ASSERT_EQUAL(SOURCE_END, sourceRead(&s[0]));
+    ASSERT_EQUAL(0, (int) s[0].tick);
+    ASSERT_EQUAL(50000, (int) s[1].tick);
+    ASSERT_EQUAL(5000, s[0].value);
+    ASSERT_EQUAL(5000 + 100, s[20].value);
+    sourceClose();
+
+    // Unknown and valueless options are skipped, a bad rate falls back to the default
+    ASSERT_EQUAL(0, sourceOpen("synth:speed=0,noise=0,rate=-3,bogus=1,drift,duration=1"));
+    ASSERT_EQUAL(10, readAll(s, 40));
+    sourceClose();
+
+    ASSERT_EQUAL(-1, sourceOpen("nonsense"));
+}
+
+void test_synth_steps_and_bumps() {
+    Sample s[40];
+    ASSERT_EQUAL(0, sourceOpen("synth:speed=0,rate=10,base=0,noise=0,duration=4,step=1@-41500,step=2.5@20000/3000/8,bump=3.5@5000"));
+    ASSERT_EQUAL(40, readAll(s, 40));
+    ASSERT_EQUAL(0, s[9].value);
+    ASSERT_EQUAL(-41500, s[10].value);
+    ASSERT_EQUAL(-41500, s[20].value);
+
+    // The hand presses before the second step, then the platform rings
+    ASSERT_EQUAL(-41500 + 3000, s[23].value);
+    ASSERT_EQUAL(-41500 + 20000, s[25].value);
+    ASSERT_TRUE(s[26].value != -21500);
+
+    // A bump starts from zero and swings
+    ASSERT_EQUAL(-21500, s[35].value);
+    ASSERT_TRUE(s[36].value != -21500);
+    sourceClose();
+}
+
+void test_synth_seed() {
+    Sample a[20], b[20], c[20];
+    ASSERT_EQUAL(0, sourceOpen("synth:speed=0,duration=2,seed=7"));
+    readAll(a, 20);
+    sourceClose();
+    ASSERT_EQUAL(0, sourceOpen("synth:speed=0,duration=2,seed=7"));
+    readAll(b, 20);
+    sourceClose();
+    ASSERT_EQUAL(0, sourceOpen("synth:speed=0,duration=2,seed=8"));
+    readAll(c, 20);
+    sourceClose();
+
+    int same = 1, differ = 0;
+    for (int i = 0; i < 20; i++) {
+        same &= (a[i].value == b[i].value);
+        differ |= (a[i].value != c[i].value);
+    }
+    ASSERT_TRUE(same);
+    ASSERT_TRUE(differ);
+}
+
+void test_record_and_replay() {
+    Sample in[30], out[30];
+    ASSERT_EQUAL(0, sourceOpen("synth:speed=0,rate=80,duration=0.375,step=0.1@-41500"));
+    ASSERT_EQUAL(0, sourceRecord(RECORD_PATH));
+    ASSERT_EQUAL(30, readAll(in, 30));
+    sourceClose();
+
+    ASSERT_EQUAL(0, sourceOpen("trace:" RECORD_PATH ",speed=0"));
+    ASSERT_EQUAL(30, readAll(out, 30));
+    for (int i = 0; i < 30; i++) {
+        ASSERT_EQUAL(in[i].value, out[i].value);
+        ASSERT_EQUAL(in[i].tick, out[i].tick);
+    }
+    sourceClose();
+}
+
+void test_pacer_holds_real_time() {
+    Sample s[5];
+    uint64_t start;
+
+    // 5 samples 40 ms apart at twice real time take 80 ms
+    ASSERT_EQUAL(0, sourceOpen("synth:speed=2,rate=25,noise=0,duration=0.2"));
+    start = timingNanos();
+    ASSERT_EQUAL(5, readAll(s, 5));
+    ASSERT_TRUE(timingNanos() - start >= 75000000ULL);
+    ASSERT_TRUE(timingNanos() - start < 500000000ULL);
+    sourceClose();
+
+    // Unpaced replays run as fast as they are read
+    ASSERT_EQUAL(0, sourceOpen("synth:speed=0,rate=25,noise=0,duration=0.2"));
+    start = timingNanos();
+    ASSERT_EQUAL(5, readAll(s, 5));
+    ASSERT_TRUE(timingNanos() - start < 20000000ULL);
+    sourceClose();
+}
+
+void test_hx711_ab_reports_one_summed_sample() {
+    static const long conversions[][2] = {
+        {HX711_CH_A, 1000}, {HX711_CH_B, 50}, {HX711_CH_A, 1010}, {HX711_CH_B, 60}
+    };
+    Sample s;
+    script = conversions;
+    scriptLength = 4;
+    scriptPos = 0;
+
+    // Nothing comes out until both channels have converted once
+    ASSERT_EQUAL(0, sourceOpen("hx711:ab,bscale=2"));
+    ASSERT_EQUAL(SOURCE_OK, sourceRead(&s));
+    ASSERT_EQUAL(2, scriptPos);
+    ASSERT_EQUAL(1000 + 2 * 50, s.value);
+
+    // Then every conversion refreshes its channel and the sum goes out again
+    ASSERT_EQUAL(SOURCE_OK, sourceRead(&s));
+    ASSERT_EQUAL(1010 + 2 * 50, s.value);
+    ASSERT_EQUAL(SOURCE_OK, sourceRead(&s));
+    ASSERT_EQUAL(1010 + 2 * 60, s.value);
+    sourceClose();
+
+    // Without ab each conversion is its own sample
+    scriptPos = 0;
+    ASSERT_EQUAL(0, sourceOpen("hx711"));
+    ASSERT_EQUAL(SOURCE_OK, sourceRead(&s));
+    ASSERT_EQUAL(1000, s.value);
+    ASSERT_EQUAL(SOURCE_OK, sourceRead(&s));
+    ASSERT_EQUAL(50, s.value);
+    sourceClose();
+}
+
+int main(void) {
+    TEST_SUITE_START("Sample Source Tests");
+
+    printf("\n-- Trace Replay --\n");
+    RUN_TEST(test_trace_parsing);
+    RUN_TEST(test_trace_options);
+    RUN_TEST(test_trace_loop_keeps_ticks_going);
+
+    printf("\n-- Synthetic --\n");
+    RUN_TEST(test_synth_options);
+    RUN_TEST(test_synth_steps_and_bumps);
+    RUN_TEST(test_synth_seed);
+
+    printf("\n-- Recording and Pacing --\n");
+    RUN_TEST(test_record_and_replay);
+    RUN_TEST(test_pacer_holds_real_time);
+
+    printf("\n-- HX711 Channels --\n");
+    RUN_TEST(test_hx711_ab_reports_one_summed_sample);
+
+    remove(TRACE_PATH);
+    remove(RECORD_PATH);
+
+    TEST_SUITE_END();
+    PRINT_TEST_SUMMARY();
+
+    return TEST_EXIT_CODE();
+}
@@ -0,0 +1,160 @@
+/**
+ * Unit tests for the sorted state index
+ *
+ * These tests verify the base-3 bottle/cap model, the nearest and
+ * second-nearest lookup against a linear scan, and the 8-bottle limit.
+ */
+
+#include "test_framework.h"
+#include "../stateindex.c"
+
+/* Weights from runBottlesSquare.sh, divided by 100 */
+static const long CAPS[]    = {629, 728, 426};
+static const long BOTTLES[] = {1890, 1685, 1561};
+
+/* Reference: linear scan over every entry */
+static void linear_match(const StateIndex *idx, long weight, long *best, long *second) {
+    *best = *second = -1;
+    for (int i = 0; i < idx->count; i++) {
+        long d = labs(idx->entries[i].weight - weight);
+        if (*best < 0 || d < *best) {
+            *second = *best;
+            *best = d;
+        } else if (*second < 0 || d < *second) {
+            *second = d;
+        }
+    }
+}
+
+/* ==================== Test Cases ==================== */
+
+void test_full_model_has_27_states() {
+    static StateIndex idx;
+    ASSERT_EQUAL(27, stateIndexInit(&idx, CAPS, BOTTLES, 3));
+    for (int i = 1; i < idx.count; i++) {
+        ASSERT_TRUE(idx.entries[i - 1].weight <= idx.entries[i].weight);
+    }
+}
+
+void test_caps_only_model_has_8_states() {
+    static StateIndex idx;
+    ASSERT_EQUAL(8, stateIndexInit(&idx, CAPS, NULL, 3));
+    for (int i = 0; i < idx.count; i++) {
+        for (int b = 0; b < 3; b++) {
+            ASSERT_TRUE(stateDigit(idx.entries[i].state, b) != BOTTLE_REMOVED);
+        }
+    }
+}
+
+void test_state_weights() {
+    static StateIndex idx;
+    stateIndexInit(&idx, CAPS, BOTTLES, 3);
+    /* Same encoding as test_bottle_state.c: a + 3b + 9c */
+    ASSERT_EQUAL(0, stateIndexWeight(&idx, 0));
+    ASSERT_EQUAL(-629, stateIndexWeight(&idx, 1));
+    ASSERT_EQUAL(-(1890 + 629), stateIndexWeight(&idx, 2));
+    ASSERT_EQUAL(-728 - (1561 + 426), stateIndexWeight(&idx, 0 + 1 * 3 + 2 * 9));
+}
+
+void test_exact_and_noisy_match() {
+    static StateIndex idx;
+    StateMatch m;
+    stateIndexInit(&idx, CAPS, BOTTLES, 3);
+
+    stateIndexMatch(&idx, -629, &m);
+    ASSERT_EQUAL(1, m.nearest);
+    ASSERT_EQUAL(0, m.distance);
+
+    stateIndexMatch(&idx, -629 - 728 - 426 + 7, &m);
+    ASSERT_EQUAL(1 + 3 + 9, m.nearest);
+    ASSERT_EQUAL(7, m.distance);
+    ASSERT_TRUE(m.second >= 0);
+    ASSERT_EQUAL(m.secondDistance - m.distance, m.margin);
+}
+
+void test_out_of_range_weights() {
+    static StateIndex idx;
+    StateMatch m;
+    stateIndexInit(&idx, CAPS, BOTTLES, 3);
+
+    stateIndexMatch(&idx, 5000, &m);
+    ASSERT_EQUAL(0, m.nearest);
+    ASSERT_EQUAL(5000, m.distance);
+
+    stateIndexMatch(&idx, -100000, &m);
+    ASSERT_EQUAL(2 + 2 * 3 + 2 * 9, m.nearest);
+}
+
+void test_matches_linear_scan_for_8_bottles() {
+    static StateIndex idx;
+    long caps[8] = {629, 728, 426, 512, 689, 377, 801, 455};
+    long bottles[8] = {1890, 1685, 1561, 1702, 1933, 1488, 2010, 1599};
+    StateMatch m;
+    unsigned seed = 99;
+
+    ASSERT_EQUAL(STATE_MAX_STATES, stateIndexInit(&idx, caps, bottles, 8));
+
+    for (int i = 0; i < 2000; i++) {
+        long best, second;
+        seed = seed * 1103515245 + 12345;
+        long w = -(long)((seed >> 8) % 25000) + 100;
+        stateIndexMatch(&idx, w, &m);
+        linear_match(&idx, w, &best, &second);
+        ASSERT_EQUAL(best, m.distance);
+        ASSERT_EQUAL(second, m.secondDistance);
+        ASSERT_EQUAL(best, labs(stateIndexWeight(&idx, m.nearest) - w));
+    }
+}
+
+void test_bottle_count_limits() {
+    static StateIndex idx;
+    long caps[9] = {1, 2, 3, 4, 5, 6, 7, 8, 9};
+    ASSERT_EQUAL(-1, stateIndexInit(&idx, caps, NULL, 0));
+    ASSERT_EQUAL(-1, stateIndexInit(&idx, caps, NULL, 9));
+    ASSERT_EQUAL(2, stateIndexInit(&idx, caps, NULL, 1));
+}
+
+void test_min_gap() {
+    static StateIndex idx;
+    long caps[] = {400, 410, 900};
+    int a, b;
+    stateIndexInit(&idx, caps, NULL, 3);
+    ASSERT_EQUAL(10, stateIndexMinGap(&idx, &a, &b));
+    ASSERT_EQUAL(10, labs(stateIndexWeight(&idx, a) - stateIndexWeight(&idx, b)));
+}
+
+void test_state_names() {
+    char buf[128];
+    stateName(0, 3, buf, sizeof(buf));
+    ASSERT_STR_EQUAL("All caps on", buf);
+    stateName(1 + 9, 3, buf, sizeof(buf));
+    ASSERT_STR_EQUAL("Cap1+3 removed", buf);
+    stateName(1 + 3 + 9, 3, buf, sizeof(buf));
+    ASSERT_STR_EQUAL("BIRTHDAY MODE", buf);
+    stateName(1 + 2 * 3, 3, buf, sizeof(buf));
+    ASSERT_STR_EQUAL("Cap1 removed, Bottle2 removed", buf);
+}
+
+/* ==================== Main ==================== */
+
+int main(void) {
+    TEST_SUITE_START("State Index Tests");
+
+    printf("\n-- Model --\n");
+    RUN_TEST(test_full_model_has_27_states);
+    RUN_TEST(test_caps_only_model_has_8_states);
+    RUN_TEST(test_state_weights);
+    RUN_TEST(test_bottle_count_limits);
+    RUN_TEST(test_state_names);
+
+    printf("\n-- Matching --\n");
+    RUN_TEST(test_exact_and_noisy_match);
+    RUN_TEST(test_out_of_range_weights);
+    RUN_TEST(test_matches_linear_scan_for_8_bottles);
+    RUN_TEST(test_min_gap);
+
+    TEST_SUITE_END();
+    PRINT_TEST_SUMMARY();
+
+    return TEST_EXIT_CODE();
+}
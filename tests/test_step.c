@@ -0,0 +1,116 @@
+/**
+ * Unit tests for the CUSUM step detector
+ *
+ * These tests verify that cap-sized steps are caught within a few samples
+ * with their size, and that noise, spikes and drift do not trigger it.
+ */
+
+#include "test_framework.h"
+#include "../step.c"
+#include <math.h>
+
+#define MIN_STEP 41500
+
+/* Deterministic noise, roughly uniform in [-amp, amp] */
+static unsigned seed = 7;
+static long noise(long amp) {
+    seed = seed * 1103515245 + 12345;
+    return (long)((seed >> 8) % (2 * amp + 1)) - amp;
+}
+
+/* Push n samples at level, returns the sample index (1-based) of the first alarm, 0 if none */
+static int push_level(StepDetector *d, long level, int n) {
+    for (int i = 1; i <= n; i++) {
+        if (stepPush(d, level + noise(300))) return i;
+    }
+    return 0;
+}
+
+/* ==================== Test Cases ==================== */
+
+void test_quiet_plateau_never_alarms() {
+    StepDetector d;
+    stepInit(&d, MIN_STEP);
+    ASSERT_EQUAL(0, push_level(&d, 0, 5000));
+    ASSERT_EQUAL(0, (int) d.alarms);
+}
+
+void test_cap_lift_detected_quickly() {
+    StepDetector d;
+    stepInit(&d, MIN_STEP);
+    push_level(&d, 0, 50);
+    int at = push_level(&d, -61900, 50);
+    ASSERT_TRUE(at > 0 && at <= 3);
+    ASSERT_TRUE(fabs(d.step + 61900) < 500);
+    ASSERT_EQUAL(at, d.latency);
+}
+
+void test_smallest_step_detected() {
+    StepDetector d;
+    stepInit(&d, MIN_STEP);
+    push_level(&d, 100000, 50);
+    int at = push_level(&d, 100000 + MIN_STEP, 50);
+    ASSERT_TRUE(at > 0 && at <= 5);
+    ASSERT_TRUE(fabs(d.step - MIN_STEP) < 500);
+}
+
+void test_consecutive_steps() {
+    StepDetector d;
+    stepInit(&d, MIN_STEP);
+    push_level(&d, 0, 30);
+    ASSERT_TRUE(push_level(&d, -61900, 30) > 0);
+    ASSERT_EQUAL(0, push_level(&d, -61900, 30));
+    ASSERT_TRUE(push_level(&d, -61900 - 41500, 30) > 0);
+    ASSERT_TRUE(fabs(d.level + 61900 + 41500) < 500);
+    ASSERT_EQUAL(2, (int) d.alarms);
+}
+
+void test_single_spike_ignored() {
+    StepDetector d;
+    stepInit(&d, MIN_STEP);
+    push_level(&d, 0, 30);
+    ASSERT_EQUAL(0, stepPush(&d, 900000));
+    ASSERT_EQUAL(0, push_level(&d, 0, 30));
+}
+
+void test_slow_drift_followed() {
+    StepDetector d;
+    stepInit(&d, MIN_STEP);
+    /* 100 counts per sample: 60000 counts over 600 samples, never a step */
+    for (int i = 0; i < 600; i++) {
+        ASSERT_EQUAL(0, stepPush(&d, i * 100 + noise(300)));
+    }
+    ASSERT_TRUE(fabs(d.ref - 60000) < MIN_STEP * STEP_DRIFT_FRACTION);
+}
+
+void test_reset_sets_plateau() {
+    StepDetector d;
+    stepInit(&d, MIN_STEP);
+    stepReset(&d, -50000);
+    d.primed = 1;
+    ASSERT_EQUAL(0, push_level(&d, -50000, 30));
+    ASSERT_TRUE(push_level(&d, 0, 30) > 0);
+    ASSERT_TRUE(fabs(d.step - 50000) < 500);
+}
+
+/* ==================== Main ==================== */
+
+int main(void) {
+    TEST_SUITE_START("Step Detector Tests");
+
+    printf("\n-- Detection --\n");
+    RUN_TEST(test_cap_lift_detected_quickly);
+    RUN_TEST(test_smallest_step_detected);
+    RUN_TEST(test_consecutive_steps);
+    RUN_TEST(test_reset_sets_plateau);
+
+    printf("\n-- False Triggers --\n");
+    RUN_TEST(test_quiet_plateau_never_alarms);
+    RUN_TEST(test_single_spike_ignored);
+    RUN_TEST(test_slow_drift_followed);
+
+    TEST_SUITE_END();
+    PRINT_TEST_SUMMARY();
+
+    return TEST_EXIT_CODE();
+}
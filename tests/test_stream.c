@@ -0,0 +1,142 @@
+/**
+ * Unit tests for streamed tracks
+ *
+ * These tests write small WAV files to the test binary directory and
+ * verify that a file in the output format is played in place from its
+ * mapping, that any other format is left to be decoded, that errors are
+ * reported, that the read-ahead window moves in steps and wraps round a
+ * looped track, and that pages it drops read back from the file.
+ */
+
+#define _DEFAULT_SOURCE
+#include "test_framework.h"
+#include "../wav.c"
+#include "../stream.c"
+
+#define PATH "bin/stream.wav"
+#define RATE 22050
+
+static void put16(FILE *f, uint32_t v) {
+    fputc(v & 0xff, f);
+    fputc((v >> 8) & 0xff, f);
+}
+
+static void put32(FILE *f, uint32_t v) {
+    put16(f, v & 0xffff);
+    put16(f, v >> 16);
+}
+
+/* A WAV file of frames frames, sample i of the data being i */
+static void writeWav(int channels, int rate, int frames) {
+    FILE *f = fopen(PATH, "wb");
+    uint32_t dataSize = frames * channels * 2;
+    fwrite("RIFF", 1, 4, f);
+    put32(f, 36 + dataSize);
+    fwrite("WAVEfmt ", 1, 8, f);
+    put32(f, 16);
+    put16(f, 1);
+    put16(f, channels);
+    put32(f, rate);
+    put32(f, rate * channels * 2);
+    put16(f, channels * 2);
+    put16(f, 16);
+    fwrite("data", 1, 4, f);
+    put32(f, dataSize);
+    for (int i = 0; i < frames * channels; i++) put16(f, (uint16_t) i);
+    fclose(f);
+}
+
+/* ==================== Test Cases ==================== */
+
+void test_output_format_streams() {
+    Stream s;
+    writeWav(2, RATE, 1000);
+    ASSERT_EQUAL(0, streamOpen(&s, PATH, RATE));
+    ASSERT_EQUAL(1000, (int) s.pcm.frames);
+    ASSERT_EQUAL(RATE, s.pcm.rate);
+    ASSERT_TRUE(s.pcm.mapped);
+    ASSERT_TRUE((uint8_t *) s.pcm.data == s.map + 44);
+    for (int i = 0; i < 2000; i++) ASSERT_EQUAL((int16_t) i, s.pcm.data[i]);
+
+    // Freeing it as a Pcm leaves the mapping alone
+    Pcm copy = s.pcm;
+    wavFree(&copy);
+    ASSERT_EQUAL(1999, s.pcm.data[1999]);
+    streamClose(&s);
+    ASSERT_TRUE(s.map == NULL);
+}
+
+void test_other_formats_left_to_decode() {
+    Stream s;
+    writeWav(2, 44100, 100);
+    ASSERT_EQUAL(1, streamOpen(&s, PATH, RATE));
+    ASSERT_TRUE(s.map == NULL);
+    writeWav(1, RATE, 100);
+    ASSERT_EQUAL(1, streamOpen(&s, PATH, RATE));
+    ASSERT_TRUE(s.map == NULL);
+}
+
+void test_errors() {
+    Stream s;
+    FILE *f = fopen(PATH, "wb");
+    fputs("RIFF....AVI LIST", f);
+    fclose(f);
+    ASSERT_EQUAL(-1, streamOpen(&s, PATH, RATE));
+    ASSERT_TRUE(s.map == NULL);
+    ASSERT_EQUAL(-1, streamOpen(&s, "bin/missing.wav", RATE));
+    ASSERT_TRUE(strstr(wavError(), "bin/missing.wav") != NULL);
+
+    // Closing a stream that never opened is harmless
+    memset(&s, 0, sizeof(s));
+    streamClose(&s);
+}
+
+void test_window_moves_in_steps() {
+    Stream s;
+    writeWav(2, RATE, 10 * RATE);
+    ASSERT_EQUAL(0, streamOpen(&s, PATH, RATE));
+    ASSERT_EQUAL(0, (int) s.window);
+    ASSERT_EQUAL(RATE * STREAM_STEP_MS / 1000, (int) s.stepFrames);
+
+    streamPrefetch(&s, s.stepFrames - 1);
+    ASSERT_EQUAL(0, (int) s.window);
+    streamPrefetch(&s, s.stepFrames);
+    ASSERT_EQUAL(1, (int) s.window);
+    streamPrefetch(&s, 9 * RATE);
+    ASSERT_EQUAL(9 * RATE / (int) s.stepFrames, (int) s.window);
+
+    // Past the end of a loop is back at its start
+    streamPrefetch(&s, 10 * RATE + 1);
+    ASSERT_EQUAL(0, (int) s.window);
+    streamClose(&s);
+}
+
+void test_dropped_pages_read_back() {
+    Stream s;
+    int ok = 1;
+    writeWav(2, RATE, 10 * RATE);
+    ASSERT_EQUAL(0, streamOpen(&s, PATH, RATE));
+    for (uint32_t pos = 0; pos < 20 * RATE; pos += s.stepFrames) streamPrefetch(&s, pos);
+    for (int i = 0; i < 20 * RATE; i++) ok &= (s.pcm.data[i] == (int16_t) i);
+    ASSERT_TRUE(ok);
+    streamClose(&s);
+}
+
+int main(void) {
+    TEST_SUITE_START("Streamed Track Tests");
+
+    printf("\n-- Opening --\n");
+    RUN_TEST(test_output_format_streams);
+    RUN_TEST(test_other_formats_left_to_decode);
+    RUN_TEST(test_errors);
+
+    printf("\n-- Read-ahead --\n");
+    RUN_TEST(test_window_moves_in_steps);
+    RUN_TEST(test_dropped_pages_read_back);
+
+    remove(PATH);
+    TEST_SUITE_END();
+    PRINT_TEST_SUMMARY();
+
+    return TEST_EXIT_CODE();
+}
@@ -0,0 +1,109 @@
+/**
+ * Unit tests for the adaptive tare
+ *
+ * These tests verify the running mean/variance, the confidence-based
+ * stopping rule and the motion restart that replace the fixed-length tare.
+ */
+
+#include "test_framework.h"
+#include "../tare.c"
+
+/* Deterministic noise, roughly uniform in [-amp, amp] */
+static unsigned seed = 1;
+static long noise(long amp) {
+    seed = seed * 1103515245 + 12345;
+    return (long)((seed >> 8) % (2 * amp + 1)) - amp;
+}
+
+/* Push samples around base until done, returns the number pushed */
+static int run_until_done(Tare *t, long base, long amp, int limit) {
+    for (int i = 1; i <= limit; i++) {
+        if (tarePush(t, base + noise(amp)) == TARE_DONE) return i;
+    }
+    return -1;
+}
+
+/* ==================== Test Cases ==================== */
+
+void test_mean_and_variance() {
+    Tare t;
+    long samples[] = {2, 4, 4, 4, 5, 5, 7, 9};
+    tareInit(&t, 0);
+    for (int i = 0; i < 8; i++) tarePush(&t, 1000 + samples[i]);
+    ASSERT_TRUE(fabs(t.mean - 1005) < 1e-9);
+    /* sample variance 32 / 7 */
+    ASSERT_TRUE(fabs(tareStdDev(&t) - sqrt(32.0 / 7)) < 1e-9);
+}
+
+void test_quiet_scale_stops_at_minimum() {
+    Tare t;
+    tareInit(&t, 800);
+    ASSERT_EQUAL(TARE_MIN_SAMPLES, run_until_done(&t, 100000, 300, 1000));
+    ASSERT_TRUE(labs(t.value - 100000) < 300);
+    ASSERT_EQUAL(0, t.restarts);
+}
+
+void test_noisier_scale_takes_longer() {
+    Tare quiet, noisy;
+    tareInit(&quiet, 200);
+    tareInit(&noisy, 200);
+    int nQuiet = run_until_done(&quiet, 0, 300, 1000);
+    int nNoisy = run_until_done(&noisy, 0, 3000, 1000);
+    ASSERT_TRUE(nQuiet > 0);
+    ASSERT_TRUE(nNoisy > nQuiet);
+    ASSERT_TRUE(tareHalfWidth(&noisy) <= 200);
+}
+
+void test_never_converging_gives_up() {
+    Tare t;
+    tareInit(&t, 0.001);
+    ASSERT_EQUAL(TARE_MAX_SAMPLES, run_until_done(&t, 5000, 300, 10000));
+    ASSERT_TRUE(labs(t.value - 5000) < 100);
+}
+
+void test_spike_is_dropped() {
+    Tare t;
+    tareInit(&t, 0);
+    for (int i = 0; i < 5; i++) tarePush(&t, 1000 + i);
+    ASSERT_EQUAL(TARE_CONVERGING, tarePush(&t, 90000));
+    ASSERT_EQUAL(TARE_CONVERGING, tarePush(&t, 1002));
+    ASSERT_EQUAL(0, t.restarts);
+    ASSERT_EQUAL(1, t.spikes);
+    ASSERT_EQUAL(6, t.n);
+}
+
+void test_motion_restarts_at_new_level() {
+    Tare t;
+    tareInit(&t, 800);
+    for (int i = 0; i < 6; i++) tarePush(&t, 100000 + noise(300));
+    ASSERT_EQUAL(TARE_CONVERGING, tarePush(&t, 70000));
+    ASSERT_EQUAL(TARE_RESTARTED, tarePush(&t, 70100));
+    ASSERT_EQUAL(1, t.restarts);
+    ASSERT_EQUAL(2, t.n);
+
+    ASSERT_TRUE(run_until_done(&t, 70000, 300, 1000) > 0);
+    ASSERT_TRUE(labs(t.value - 70000) < 300);
+}
+
+/* ==================== Main ==================== */
+
+int main(void) {
+    TEST_SUITE_START("Adaptive Tare Tests");
+
+    printf("\n-- Statistics --\n");
+    RUN_TEST(test_mean_and_variance);
+
+    printf("\n-- Stopping Rule --\n");
+    RUN_TEST(test_quiet_scale_stops_at_minimum);
+    RUN_TEST(test_noisier_scale_takes_longer);
+    RUN_TEST(test_never_converging_gives_up);
+
+    printf("\n-- Motion --\n");
+    RUN_TEST(test_spike_is_dropped);
+    RUN_TEST(test_motion_restarts_at_new_level);
+
+    TEST_SUITE_END();
+    PRINT_TEST_SUMMARY();
+
+    return TEST_EXIT_CODE();
+}
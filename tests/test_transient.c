@@ -0,0 +1,197 @@
+/**
+ * Unit tests for the transient classifier
+ *
+ * These tests verify the features of synthetic lifts (press, ringing
+ * frequency), the capture timing around a step detector alarm, and that
+ * a trained model tells apart caps of the same weight by their transient.
+ */
+
+#define _DEFAULT_SOURCE
+#include "test_framework.h"
+#include "../transient.c"
+
+#define TEST_PATH "bin/test.model"
+
+/* Deterministic noise, roughly uniform in [-amp, amp] */
+static unsigned seed = 9;
+static double noise(double amp) {
+    seed = seed * 1103515245 + 12345;
+    return ((double)((seed >> 8) % 20001) / 10000.0 - 1.0) * amp;
+}
+
+/* A step of delta at TRANSIENT_PRE, pressed for 20 conversions before it, ringing at cycles per sample after */
+static void make_lift(long *w, double delta, double press, double ring, double amp) {
+    for (int i = 0; i < TRANSIENT_LEN; i++) {
+        int since = i - TRANSIENT_PRE;
+        double x = 100000 + noise(amp);
+        if (since >= 0) x += delta + 0.5 * press * exp(-since / 12.0) * sin(2 * M_PI * ring * since);
+        if (since < 0 && since >= -20) x += press;
+        w[i] = lround(x);
+    }
+}
+
+static void features_of(double delta, double press, double ring, double *f) {
+    long w[TRANSIENT_LEN];
+    make_lift(w, delta, press, ring, 300);
+    transientExtract(w, f);
+}
+
+/* ==================== Test Cases ==================== */
+
+void test_clean_step_features() {
+    long w[TRANSIENT_LEN];
+    double f[TRANSIENT_FEATURES];
+    make_lift(w, -61900, 0, 0, 0);
+    transientExtract(w, f);
+    ASSERT_EQUAL(-61900, lround(f[TRANSIENT_STEP]));
+    ASSERT_EQUAL(0, lround(f[TRANSIENT_PRESS]));
+    ASSERT_EQUAL(0, lround(f[TRANSIENT_ENERGY]));
+}
+
+void test_press_and_ring_frequency() {
+    double f[TRANSIENT_FEATURES];
+    features_of(-61900, 8000, 0.15, f);
+    ASSERT_TRUE(fabs(f[TRANSIENT_STEP] + 61900) < 500);
+    ASSERT_TRUE(f[TRANSIENT_PRESS] > 7000);
+    ASSERT_TRUE(fabs(f[TRANSIENT_RING] - 0.15) < 0.03);
+
+    features_of(-61900, 8000, 0.25, f);
+    ASSERT_TRUE(fabs(f[TRANSIENT_RING] - 0.25) < 0.03);
+}
+
+void test_capture_waits_for_post_window() {
+    TransientCapture c;
+    int i;
+    transientInit(&c);
+    for (i = 0; i < 100; i++) ASSERT_FALSE(transientPush(&c, i));
+
+    /* Alarm 3 conversions after the change point */
+    transientTrigger(&c, 3);
+    for (i = 0; i < TRANSIENT_POST - 4; i++) ASSERT_FALSE(transientPush(&c, 0));
+    ASSERT_TRUE(transientPush(&c, 0));
+    ASSERT_FALSE(transientPush(&c, 0));  /* one window per trigger */
+}
+
+void test_capture_window_order() {
+    TransientCapture c;
+    double f[TRANSIENT_FEATURES];
+    transientInit(&c);
+    for (int i = 0; i < 200; i++) transientPush(&c, 100000);
+    transientTrigger(&c, 0);
+    for (int i = 0; i < TRANSIENT_POST; i++) transientPush(&c, 100000 - 41500);
+    transientFeatures(&c, f);
+    ASSERT_EQUAL(-41500, lround(f[TRANSIENT_STEP]));
+}
+
+void test_capture_needs_full_history() {
+    TransientCapture c;
+    transientInit(&c);
+    transientTrigger(&c, TRANSIENT_POST);
+    ASSERT_FALSE(transientPush(&c, 0));
+}
+
+void test_same_weight_told_apart() {
+    TransientModel m;
+    double f[TRANSIENT_FEATURES], p;
+    int correct = 0;
+
+    /* Three caps of equal weight, different press and platform ringing */
+    const double press[] = {8000, 6000, 9000};
+    const double ring[] = {0.15, 0.25, 0.09};
+
+    transientModelInit(&m);
+    for (int k = 0; k < 10; k++) {
+        for (int b = 0; b < 3; b++) {
+            features_of(-62000, press[b] * (0.9 + 0.02 * k), ring[b], f);
+            ASSERT_EQUAL(0, transientTrainAdd(&m, b, TRANSIENT_LIFT, f));
+        }
+    }
+    transientTrainFinish(&m);
+    ASSERT_EQUAL(3, m.count);
+
+    for (int k = 0; k < 10; k++) {
+        for (int b = 0; b < 3; b++) {
+            features_of(-62000, press[b], ring[b], f);
+            if (transientClassify(&m, f, 7, &p) == b) correct++;
+        }
+    }
+    ASSERT_TRUE(correct >= 27);
+}
+
+void test_allowed_mask_and_direction() {
+    TransientModel m;
+    double f[TRANSIENT_FEATURES], p;
+
+    transientModelInit(&m);
+    features_of(-62000, 8000, 0.15, f);
+    transientTrainAdd(&m, 0, TRANSIENT_LIFT, f);
+    features_of(-62000, 6000, 0.25, f);
+    transientTrainAdd(&m, 1, TRANSIENT_LIFT, f);
+    transientTrainFinish(&m);
+
+    features_of(-62000, 8000, 0.15, f);
+    ASSERT_EQUAL(0, transientClassify(&m, f, 3, &p));
+    ASSERT_EQUAL(1, transientClassify(&m, f, 2, &p));  /* bottle 1 already open */
+    ASSERT_TRUE(p > 0.99);
+
+    features_of(62000, 8000, 0.15, f);  /* a return, no return classes */
+    ASSERT_EQUAL(-1, transientClassify(&m, f, 3, &p));
+}
+
+void test_save_load_round_trip() {
+    TransientModel m, loaded;
+    double f[TRANSIENT_FEATURES], p1, p2;
+
+    transientModelInit(&m);
+    for (int k = 0; k < 5; k++) {
+        features_of(-62000, 8000, 0.15, f);
+        transientTrainAdd(&m, 0, TRANSIENT_LIFT, f);
+        features_of(62000, 6000, 0.25, f);
+        transientTrainAdd(&m, 2, TRANSIENT_RETURN, f);
+    }
+    transientTrainFinish(&m);
+    ASSERT_EQUAL(0, transientSave(TEST_PATH, &m));
+    ASSERT_EQUAL(0, transientLoad(TEST_PATH, &loaded));
+    ASSERT_EQUAL(2, loaded.count);
+    ASSERT_EQUAL(2, loaded.classes[1].bottle);
+    ASSERT_EQUAL(TRANSIENT_RETURN, loaded.classes[1].direction);
+
+    features_of(62000, 6000, 0.25, f);
+    ASSERT_EQUAL(transientClassify(&m, f, 7, &p1), transientClassify(&loaded, f, 7, &p2));
+    ASSERT_TRUE(fabs(p1 - p2) < 1e-3);
+}
+
+void test_load_rejects_other_version() {
+    TransientModel m;
+    FILE *f = fopen(TEST_PATH, "w");
+    fputs("version 99\nclass 0 0 1 1 1 1 1 1 1 1 1 1 1\n", f);
+    fclose(f);
+    ASSERT_EQUAL(-1, transientLoad(TEST_PATH, &m));
+    ASSERT_EQUAL(-1, transientLoad("bin/no-such.model", &m));
+}
+
+/* ==================== Main ==================== */
+
+int main(void) {
+    TEST_SUITE_START("Transient Classifier Tests");
+
+    printf("\n-- Features --\n");
+    RUN_TEST(test_clean_step_features);
+    RUN_TEST(test_press_and_ring_frequency);
+
+    printf("\n-- Capture --\n");
+    RUN_TEST(test_capture_waits_for_post_window);
+    RUN_TEST(test_capture_window_order);
+    RUN_TEST(test_capture_needs_full_history);
+
+    printf("\n-- Classifier --\n");
+    RUN_TEST(test_same_weight_told_apart);
+    RUN_TEST(test_allowed_mask_and_direction);
+    RUN_TEST(test_save_load_round_trip);
+    RUN_TEST(test_load_rejects_other_version);
+
+    TEST_SUITE_END();
+    PRINT_TEST_SUMMARY();
+
+    return TEST_EXIT_CODE();
+}
@@ -0,0 +1,158 @@
+/**
+ * Unit tests for vibration and impact rejection
+ *
+ * These tests verify parsing of the filter bank spec, that the conversion
+ * rate is measured before the sections are designed, that a knock on the
+ * table marks the conversions as disturbed until it has died away, and
+ * that a real lift, pressed or not, does not.
+ */
+
+#define _DEFAULT_SOURCE
+#include "test_framework.h"
+#include "../biquad.c"
+#include "../vibration.c"
+
+#define PERIOD 12500  /* us, 80 SPS */
+
+static Vibration v;
+static uint32_t tick;
+
+/* Deterministic noise, roughly uniform in [-amp, amp] */
+static unsigned seed = 11;
+static double noise(double amp) {
+    seed = seed * 1103515245 + 12345;
+    return ((double)((seed >> 8) % 20001) / 10000.0 - 1.0) * amp;
+}
+
+static long push(double x) {
+    tick += PERIOD;
+    return vibrationPush(&v, lround(x + noise(300)), tick);
+}
+
+/* Rest at level for n conversions, returns how many were disturbed */
+static int rest(double level, int n) {
+    int disturbed = 0;
+    for (int i = 0; i < n; i++) {
+        push(level);
+        disturbed += v.disturbed;
+    }
+    return disturbed;
+}
+
+static void setup(const char *spec) {
+    ASSERT_EQUAL(0, vibrationInit(&v, spec));
+    tick = 0;
+    rest(100000, 400);
+}
+
+/* ==================== Test Cases ==================== */
+
+void test_parse_spec() {
+    ASSERT_EQUAL(0, vibrationInit(&v, "lowpass=4,notch=12/3"));
+    ASSERT_EQUAL(2, v.sections);
+    ASSERT_EQUAL(VIBRATION_LOWPASS, v.spec[0].type);
+    ASSERT_TRUE(fabs(v.spec[0].q - BIQUAD_BUTTERWORTH_Q) < 1e-9);
+    ASSERT_EQUAL(VIBRATION_NOTCH, v.spec[1].type);
+    ASSERT_TRUE(fabs(v.spec[1].hz - 12) < 1e-9 && fabs(v.spec[1].q - 3) < 1e-9);
+
+    ASSERT_EQUAL(0, vibrationInit(&v, "none"));
+    ASSERT_EQUAL(0, v.sections);
+    ASSERT_EQUAL(0, vibrationInit(&v, VIBRATION_DEFAULT));
+    ASSERT_EQUAL(1, v.sections);
+}
+
+void test_parse_malformed() {
+    ASSERT_EQUAL(-1, vibrationInit(&v, "lowpass"));
+    ASSERT_EQUAL(-1, vibrationInit(&v, "highpass=3"));
+    ASSERT_EQUAL(-1, vibrationInit(&v, "lowpass=x"));
+    ASSERT_EQUAL(-1, vibrationInit(&v, "notch=12/0"));
+    ASSERT_EQUAL(-1, vibrationInit(&v, "lowpass=1,lowpass=2,lowpass=3,lowpass=4,lowpass=5"));
+}
+
+void test_rate_measured_first() {
+    ASSERT_EQUAL(0, vibrationInit(&v, "lowpass=8"));
+    tick = 0;
+    for (int i = 0; i < VIBRATION_RATE_SAMPLES - 1; i++) {
+        long y;
+        tick += PERIOD;
+        y = vibrationPush(&v, 1000 * i, tick);
+        ASSERT_EQUAL(1000 * i, y);
+    }
+    ASSERT_TRUE(v.rate == 0);
+    push(0);
+    ASSERT_TRUE(fabs(v.rate - 80) < 1e-6);
+    ASSERT_EQUAL(1, v.bank.sections);
+}
+
+void test_section_above_nyquist_left_out() {
+    setup("lowpass=8,notch=50");
+    ASSERT_EQUAL(2, v.sections);
+    ASSERT_EQUAL(1, v.bank.sections);
+}
+
+void test_rest_not_disturbed() {
+    setup(VIBRATION_DEFAULT);
+    ASSERT_EQUAL(0, rest(100000, 8000));
+    ASSERT_EQUAL(VIBRATION_MIN_THRESHOLD, vibrationThreshold(&v));
+}
+
+void test_knock_disturbs_then_clears() {
+    int disturbed = 0, i;
+    setup(VIBRATION_DEFAULT);
+    for (i = 0; i < 80; i++) {
+        double t = i / 80.0;
+        push(100000 + 100000 * exp(-t / 0.3) * sin(2 * M_PI * 3 * t));
+        disturbed += v.disturbed;
+    }
+    ASSERT_TRUE(disturbed > 20);
+    ASSERT_EQUAL(1, (int) v.impacts);
+    rest(100000, 40);
+    ASSERT_FALSE(v.disturbed);
+}
+
+void test_lift_not_disturbed() {
+    setup(VIBRATION_DEFAULT);
+    ASSERT_EQUAL(0, rest(100000 - 62900, 400));
+    ASSERT_EQUAL(0, (int) v.impacts);
+}
+
+void test_pressed_lift_not_disturbed() {
+    setup(VIBRATION_DEFAULT);
+    ASSERT_EQUAL(0, rest(100000 + 15000, 9));
+    ASSERT_EQUAL(0, rest(100000 - 62900, 400));
+    ASSERT_EQUAL(0, (int) v.impacts);
+}
+
+void test_settle_jumps_the_bank() {
+    long y = 0;
+    setup(VIBRATION_DEFAULT);
+    vibrationSettle(&v, 40000);
+    for (int i = 0; i < 3; i++) y = push(40000);
+    ASSERT_TRUE(labs(y - 40000) < 600);
+}
+
+/* ==================== Main ==================== */
+
+int main(void) {
+    TEST_SUITE_START("Vibration Rejection Tests");
+
+    printf("\n-- Configuration --\n");
+    RUN_TEST(test_parse_spec);
+    RUN_TEST(test_parse_malformed);
+    RUN_TEST(test_rate_measured_first);
+    RUN_TEST(test_section_above_nyquist_left_out);
+
+    printf("\n-- Impacts --\n");
+    RUN_TEST(test_rest_not_disturbed);
+    RUN_TEST(test_knock_disturbs_then_clears);
+    RUN_TEST(test_lift_not_disturbed);
+    RUN_TEST(test_pressed_lift_not_disturbed);
+
+    printf("\n-- Filter bank --\n");
+    RUN_TEST(test_settle_jumps_the_bank);
+
+    TEST_SUITE_END();
+    PRINT_TEST_SUMMARY();
+
+    return TEST_EXIT_CODE();
+}
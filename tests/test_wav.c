@@ -0,0 +1,183 @@
+/**
+ * Unit tests for WAV loading
+ *
+ * These tests write small WAV files to the test binary directory and
+ * verify that mono and stereo 16-bit PCM decode to interleaved stereo,
+ * that rate conversion gives the right length and interpolates between
+ * source frames, that unknown chunks are skipped, that smpl loops are
+ * kept through rate conversion, and that files the ALSA output cannot play
+ * are refused.
+ */
+
+#include "test_framework.h"
+#include "../wav.c"
+
+#define PATH "bin/test.wav"
+
+static void put16(FILE *f, uint32_t v) {
+    fputc(v & 0xff, f);
+    fputc((v >> 8) & 0xff, f);
+}
+
+static void put32(FILE *f, uint32_t v) {
+    put16(f, v & 0xffff);
+    put16(f, v >> 16);
+}
+
+/* A WAV file of frames frames, optionally with a LIST chunk of odd length and a smpl loop before the data */
+static void writeLoopedWav(int channels, int rate, int bits, const int16_t *samples, int frames, int extra,
+                           int loopStart, int loopEnd) {
+    FILE *f = fopen(PATH, "wb");
+    uint32_t dataSize = frames * channels * 2;
+    fwrite("RIFF", 1, 4, f);
+    put32(f, 4 + 24 + (extra ? 8 + 4 : 0) + (loopEnd ? 8 + 60 : 0) + 8 + dataSize);
+    fwrite("WAVEfmt ", 1, 8, f);
+    put32(f, 16);
+    put16(f, 1);
+    put16(f, channels);
+    put32(f, rate);
+    put32(f, rate * channels * 2);
+    put16(f, channels * 2);
+    put16(f, bits);
+    if (extra) {
+        fwrite("LIST", 1, 4, f);
+        put32(f, 3);
+        fwrite("abc\0", 1, 4, f);
+    }
+    if (loopEnd) {
+        fwrite("smpl", 1, 4, f);
+        put32(f, 60);
+        for (int i = 0; i < 7; i++) put32(f, 0);
+        put32(f, 1);              // one loop
+        put32(f, 0);
+        put32(f, 0);              // cue point id
+        put32(f, 0);              // type
+        put32(f, loopStart);
+        put32(f, loopEnd - 1);    // inclusive
+        put32(f, 0);
+        put32(f, 0);
+    }
+    fwrite("data", 1, 4, f);
+    put32(f, dataSize);
+    for (int i = 0; i < frames * channels; i++) put16(f, (uint16_t) samples[i]);
+    fclose(f);
+}
+
+static void writeWav(int channels, int rate, int bits, const int16_t *samples, int frames, int extra) {
+    writeLoopedWav(channels, rate, bits, samples, frames, extra, 0, 0);
+}
+
+/* ==================== Test Cases ==================== */
+
+void test_stereo_same_rate() {
+    int16_t s[] = {100, -100, 200, -200, 300, -300, 32767, -32768};
+    Pcm pcm;
+    writeWav(2, 22050, 16, s, 4, 0);
+    ASSERT_EQUAL(0, wavLoad(PATH, 22050, &pcm));
+    ASSERT_EQUAL(4, (int) pcm.frames);
+    for (int i = 0; i < 8; i++) ASSERT_EQUAL(s[i], pcm.data[i]);
+    wavFree(&pcm);
+}
+
+void test_mono_to_stereo() {
+    int16_t s[] = {1000, 2000, 3000};
+    Pcm pcm;
+    writeWav(1, 22050, 16, s, 3, 1);
+    ASSERT_EQUAL(0, wavLoad(PATH, 22050, &pcm));
+    ASSERT_EQUAL(3, (int) pcm.frames);
+    for (int i = 0; i < 3; i++) {
+        ASSERT_EQUAL(s[i], pcm.data[2 * i]);
+        ASSERT_EQUAL(s[i], pcm.data[2 * i + 1]);
+    }
+    wavFree(&pcm);
+}
+
+void test_downsample_length() {
+    static int16_t s[44100];
+    Pcm pcm;
+    writeWav(1, 44100, 16, s, 44100, 0);
+    ASSERT_EQUAL(0, wavLoad(PATH, 22050, &pcm));
+    ASSERT_EQUAL(22050, (int) pcm.frames);
+    ASSERT_EQUAL(22050, pcm.rate);
+    wavFree(&pcm);
+}
+
+void test_upsample_interpolates() {
+    int16_t s[] = {0, 1000, 2000, 3000};
+    Pcm pcm;
+    writeWav(1, 11025, 16, s, 4, 0);
+    ASSERT_EQUAL(0, wavLoad(PATH, 22050, &pcm));
+    ASSERT_EQUAL(8, (int) pcm.frames);
+    ASSERT_EQUAL(0, pcm.data[0]);
+    ASSERT_EQUAL(500, pcm.data[2]);
+    ASSERT_EQUAL(1000, pcm.data[4]);
+    ASSERT_EQUAL(3000, pcm.data[14]);
+    wavFree(&pcm);
+}
+
+void test_loop_scaled() {
+    int16_t s[20] = {0};
+    Pcm pcm;
+    writeLoopedWav(2, 44100, 16, s, 10, 0, 4, 10);
+    ASSERT_EQUAL(0, wavLoad(PATH, 22050, &pcm));
+    ASSERT_EQUAL(5, (int) pcm.frames);
+    ASSERT_EQUAL(2, (int) pcm.loopStart);
+    wavFree(&pcm);
+
+    // Ends at the loop end
+    writeLoopedWav(2, 44100, 16, s, 10, 1, 2, 8);
+    ASSERT_EQUAL(0, wavLoad(PATH, 22050, &pcm));
+    ASSERT_EQUAL(4, (int) pcm.frames);
+    ASSERT_EQUAL(1, (int) pcm.loopStart);
+    wavFree(&pcm);
+}
+
+void test_collapsed_loop_dropped() {
+    int16_t s[20] = {0};
+    Pcm pcm;
+    writeLoopedWav(2, 44100, 16, s, 10, 0, 4, 5);
+    ASSERT_EQUAL(0, wavLoad(PATH, 22050, &pcm));
+    ASSERT_EQUAL(2, (int) pcm.frames);
+    ASSERT_EQUAL(0, (int) pcm.loopStart);
+    wavFree(&pcm);
+}
+
+void test_refuses_other_formats() {
+    int16_t s[] = {0, 0, 0, 0};
+    Pcm pcm;
+    FILE *f;
+
+    writeWav(1, 22050, 8, s, 2, 0);
+    ASSERT_EQUAL(-1, wavLoad(PATH, 22050, &pcm));
+    ASSERT_TRUE(strstr(wavError(), "16-bit") != NULL);
+
+    f = fopen(PATH, "wb");
+    fputs("RIFF....AVI LIST", f);
+    fclose(f);
+    ASSERT_EQUAL(-1, wavLoad(PATH, 22050, &pcm));
+    ASSERT_EQUAL(-1, wavLoad("bin/missing.wav", 22050, &pcm));
+    ASSERT_TRUE(pcm.data == NULL);
+}
+
+int main(void) {
+    TEST_SUITE_START("WAV Loading Tests");
+
+    printf("\n-- Decoding --\n");
+    RUN_TEST(test_stereo_same_rate);
+    RUN_TEST(test_mono_to_stereo);
+
+    printf("\n-- Rate conversion --\n");
+    RUN_TEST(test_downsample_length);
+    RUN_TEST(test_upsample_interpolates);
+    RUN_TEST(test_loop_scaled);
+    RUN_TEST(test_collapsed_loop_dropped);
+
+    printf("\n-- Errors --\n");
+    RUN_TEST(test_refuses_other_formats);
+
+    remove(PATH);
+    TEST_SUITE_END();
+    PRINT_TEST_SUMMARY();
+
+    return TEST_EXIT_CODE();
+}
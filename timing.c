@@ -0,0 +1,69 @@
+#include "timing.h"
+#include <time.h>
+
+/**
+
+	Timing layer for Music Bottles
+
+	The calibration runs the delay loop for a known iteration count and times it
+	with CLOCK_MONOTONIC_RAW, keeping the fastest of several runs so a preemption
+	during calibration cannot make later delays too short.
+
+*/
+
+#define CALIBRATE_RUNS     5
+#define CALIBRATE_LOOPS    200000
+#define CALIBRATE_WARMUP_NS 50000000ULL  // let the cpufreq governor ramp up first
+
+static double loopsPerNs = 0;
+
+static void spin(unsigned long loops) {
+	volatile unsigned long i;
+	for (i = 0; i < loops; i++);
+}
+
+uint64_t timingNanos(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Microseconds, wraps like gpioTick()
+uint32_t timingMicros(void) {
+	return (uint32_t) (timingNanos() / 1000);
+}
+
+/**
+ timingInit()
+
+ calibrate the delay loop, call once at startup before timingDelayNs()
+*/
+void timingInit(void) {
+	int i;
+	uint64_t t0, t1, best = 0;
+
+	t0 = timingNanos();
+	while (timingNanos() - t0 < CALIBRATE_WARMUP_NS) {
+		spin(1000);
+	}
+
+	for (i = 0; i < CALIBRATE_RUNS; i++) {
+		t0 = timingNanos();
+		spin(CALIBRATE_LOOPS);
+		t1 = timingNanos();
+		if (best == 0 || t1 - t0 < best) best = t1 - t0;
+	}
+
+	if (best == 0) best = 1;
+	loopsPerNs = (double) CALIBRATE_LOOPS / best;
+}
+
+// Busy-wait for at least ns nanoseconds
+void timingDelayNs(unsigned ns) {
+	if (loopsPerNs == 0) timingInit();
+	spin((unsigned long) (ns * loopsPerNs) + 1);
+}
+
+double timingLoopsPerUs(void) {
+	return loopsPerNs * 1000.0;
+}
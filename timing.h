@@ -0,0 +1,22 @@
+/**
+
+	Timing layer for Music Bottles
+
+	Time stamps come from CLOCK_MONOTONIC_RAW. Short delays (HX711 clock pulses)
+	use a busy loop calibrated against that clock at startup, since a clock read
+	alone costs more than the pulse widths we need on older Pis.
+
+*/
+
+#ifndef TIMING_H
+#define TIMING_H
+
+#include <stdint.h>
+
+void     timingInit(void);
+uint64_t timingNanos(void);
+uint32_t timingMicros(void);
+void     timingDelayNs(unsigned ns);
+double   timingLoopsPerUs(void);
+
+#endif
@@ -0,0 +1,270 @@
+#include "transient.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/**
+
+	Transient classifier for Music Bottles
+
+	Feature extraction works on a plain window of TRANSIENT_LEN conversions,
+	change point at TRANSIENT_PRE, so the training tool can run it on a trace
+	in memory and musicBottles on the capture ring. The model file has one
+	"class" line per bottle and direction: bottle, direction, count, then the
+	mean and variance of every feature.
+
+*/
+
+void transientInit(TransientCapture *c) {
+	c->next = 0;
+	c->count = 0;
+	c->waiting = -1;
+}
+
+/**
+ transientTrigger(TransientCapture *c, int latency)
+
+ the change point was latency conversions ago (the step detector's estimate), the window
+ completes TRANSIENT_POST conversions after it. A new trigger replaces a pending one
+*/
+void transientTrigger(TransientCapture *c, int latency) {
+	if (latency < 0) latency = 0;
+	c->waiting = (latency < TRANSIENT_POST) ? TRANSIENT_POST - latency : 0;
+}
+
+/**
+ transientPush(TransientCapture *c, long x)
+
+ add a raw conversion, returns 1 when a triggered window is complete and transientFeatures() can be read
+*/
+int transientPush(TransientCapture *c, long x) {
+	c->buf[c->next] = x;
+	c->next = (c->next + 1) % TRANSIENT_LEN;
+	if (c->count < TRANSIENT_LEN) c->count++;
+
+	if (c->waiting < 0) return 0;
+	if (c->waiting > 0) c->waiting--;
+	if (c->waiting > 0) return 0;
+
+	c->waiting = -1;
+	return c->count == TRANSIENT_LEN;
+}
+
+static int compareLong(const void *a, const void *b) {
+	long x = *(const long *) a, y = *(const long *) b;
+	return (x > y) - (x < y);
+}
+
+static double median(const long *v, int n) {
+	long tmp[TRANSIENT_LEN];
+
+	memcpy(tmp, v, n * sizeof(long));
+	qsort(tmp, n, sizeof(long), compareLong);
+	return (n % 2) ? tmp[n / 2] : (tmp[n / 2 - 1] + tmp[n / 2]) / 2.0;
+}
+
+/**
+ transientExtract(const long *window, double *features)
+
+ features of TRANSIENT_LEN conversions with the change point at TRANSIENT_PRE
+*/
+void transientExtract(const long *window, double *features) {
+	double pre = median(window, TRANSIENT_ENDS);
+	double post = median(window + TRANSIENT_LEN - TRANSIENT_ENDS, TRANSIENT_ENDS);
+	double high = (pre > post) ? pre : post;
+	double low = (pre < post) ? pre : post;
+	double press = 0, release = 0, energy = 0, best = 0;
+	double residual[TRANSIENT_POST];
+	int i, lag, bestLag = 0, n = TRANSIENT_POST - TRANSIENT_SKIP;
+
+	for (i = 0; i < TRANSIENT_LEN; i++) {
+		if (window[i] - high > press) press = window[i] - high;
+		if (low - window[i] > release) release = low - window[i];
+	}
+
+	for (i = 0; i < n; i++) {
+		residual[i] = window[TRANSIENT_PRE + TRANSIENT_SKIP + i] - post;
+		energy += residual[i] * residual[i];
+	}
+
+	// Dominant period: the lag with the highest normalised autocorrelation, a full cycle at least 2 samples
+	for (lag = 2; lag <= n / 2 && energy > 0; lag++) {
+		double r = 0;
+		for (i = 0; i + lag < n; i++) r += residual[i] * residual[i + lag];
+		r /= energy * (n - lag) / n;
+		if (r > best) {
+			best = r;
+			bestLag = lag;
+		}
+	}
+
+	features[TRANSIENT_STEP] = post - pre;
+	features[TRANSIENT_PRESS] = press;
+	features[TRANSIENT_RELEASE] = release;
+	features[TRANSIENT_RING] = bestLag ? 1.0 / bestLag : 0;
+	features[TRANSIENT_ENERGY] = sqrt(energy / n);
+}
+
+// Features of the last completed capture, oldest conversion first
+void transientFeatures(const TransientCapture *c, double *features) {
+	long window[TRANSIENT_LEN];
+	int i;
+
+	for (i = 0; i < TRANSIENT_LEN; i++) window[i] = c->buf[(c->next + i) % TRANSIENT_LEN];
+	transientExtract(window, features);
+}
+
+void transientModelInit(TransientModel *m) {
+	memset(m, 0, sizeof(*m));
+}
+
+static TransientClass *findClass(TransientModel *m, int bottle, int direction) {
+	int i;
+
+	for (i = 0; i < m->count; i++) {
+		if (m->classes[i].bottle == bottle && m->classes[i].direction == direction) return &m->classes[i];
+	}
+	if (m->count == TRANSIENT_MAX_CLASSES) return NULL;
+
+	memset(&m->classes[m->count], 0, sizeof(TransientClass));
+	m->classes[m->count].bottle = bottle;
+	m->classes[m->count].direction = direction;
+	return &m->classes[m->count++];
+}
+
+// Add a labelled training step (Welford per feature), returns -1 if the model is full
+int transientTrainAdd(TransientModel *m, int bottle, int direction, const double *features) {
+	TransientClass *c = findClass(m, bottle, direction);
+	int f;
+
+	if (c == NULL) return -1;
+	c->count++;
+	for (f = 0; f < TRANSIENT_FEATURES; f++) {
+		double d = features[f] - c->mean[f];
+		c->mean[f] += d / c->count;
+		c->m2[f] += d * (features[f] - c->mean[f]);
+	}
+	return 0;
+}
+
+// Turn the accumulated sums into variances, with the floor applied
+void transientTrainFinish(TransientModel *m) {
+	int i, f;
+
+	for (i = 0; i < m->count; i++) {
+		TransientClass *c = &m->classes[i];
+		for (f = 0; f < TRANSIENT_FEATURES; f++) {
+			double sd = TRANSIENT_MIN_SD_FRACTION * fabs(c->mean[f]) + TRANSIENT_MIN_SD;
+			c->var[f] = (c->count > 1) ? c->m2[f] / (c->count - 1) : 0;
+			if (c->var[f] < sd * sd) c->var[f] = sd * sd;
+		}
+	}
+}
+
+/**
+ transientClassify(m, features, allowed, posterior)
+
+ most probable bottle among the classes whose direction matches the step and whose bit is
+ set in allowed (bit i = bottle i), with equal priors. Returns -1 if no class qualifies
+*/
+int transientClassify(const TransientModel *m, const double *features, unsigned allowed, double *posterior) {
+	int direction = (features[TRANSIENT_STEP] < 0) ? TRANSIENT_LIFT : TRANSIENT_RETURN;
+	double logLik[TRANSIENT_MAX_CLASSES];
+	double bestLog = -HUGE_VAL, total = 0;
+	int i, f, best = -1;
+
+	for (i = 0; i < m->count; i++) {
+		const TransientClass *c = &m->classes[i];
+
+		logLik[i] = -HUGE_VAL;
+		if (c->direction != direction || !(allowed & (1u << c->bottle))) continue;
+
+		logLik[i] = 0;
+		for (f = 0; f < TRANSIENT_FEATURES; f++) {
+			double d = features[f] - c->mean[f];
+			logLik[i] -= 0.5 * (d * d / c->var[f] + log(c->var[f]));
+		}
+		if (logLik[i] > bestLog) {
+			bestLog = logLik[i];
+			best = i;
+		}
+	}
+	if (best < 0) return -1;
+
+	for (i = 0; i < m->count; i++) {
+		if (logLik[i] > -HUGE_VAL) total += exp(logLik[i] - bestLog);
+	}
+	*posterior = 1.0 / total;
+	return m->classes[best].bottle;
+}
+
+/**
+ transientLoad(const char *path, TransientModel *m)
+
+ returns 0 if the file has the current version and at least one class, -1 otherwise
+*/
+int transientLoad(const char *path, TransientModel *m) {
+	char line[512];
+	int version = 0;
+	FILE *f = fopen(path, "r");
+
+	if (f == NULL) return -1;
+
+	transientModelInit(m);
+	while (fgets(line, sizeof(line), f)) {
+		TransientClass c;
+		char *p;
+		int j;
+
+		if (line[0] == '#') continue;
+		if (sscanf(line, "version %d", &version) == 1) continue;
+		if (strncmp(line, "class ", 6) != 0 || m->count == TRANSIENT_MAX_CLASSES) continue;
+
+		memset(&c, 0, sizeof(c));
+		p = line + 6;
+		c.bottle = strtol(p, &p, 10);
+		c.direction = strtol(p, &p, 10);
+		c.count = strtol(p, &p, 10);
+		for (j = 0; j < TRANSIENT_FEATURES; j++) {
+			c.mean[j] = strtod(p, &p);
+			c.var[j] = strtod(p, &p);
+		}
+		if (c.bottle < 0 || c.bottle >= TRANSIENT_MAX_CLASSES / 2 || c.var[TRANSIENT_FEATURES - 1] <= 0) continue;
+		m->classes[m->count++] = c;
+	}
+	fclose(f);
+
+	return (version == TRANSIENT_MODEL_VERSION && m->count > 0) ? 0 : -1;
+}
+
+// Write the model atomically like the calibration, returns 0 on success, -1 on any error
+int transientSave(const char *path, const TransientModel *m) {
+	char tmp[512];
+	FILE *f;
+	int i, j, ok;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	f = fopen(tmp, "w");
+	if (f == NULL) return -1;
+
+	fprintf(f, "# music bottles transient model: class bottle direction count, then mean variance per feature\n");
+	fprintf(f, "# features: step press release ring energy\n");
+	fprintf(f, "version %d\n", TRANSIENT_MODEL_VERSION);
+	for (i = 0; i < m->count; i++) {
+		const TransientClass *c = &m->classes[i];
+		fprintf(f, "class %d %d %d", c->bottle, c->direction, c->count);
+		for (j = 0; j < TRANSIENT_FEATURES; j++) fprintf(f, " %.6g %.6g", c->mean[j], c->var[j]);
+		fprintf(f, "\n");
+	}
+
+	ok = fflush(f) == 0 && fsync(fileno(f)) == 0;
+	ok = (fclose(f) == 0) && ok;
+
+	if (!ok || rename(tmp, path) != 0) {
+		unlink(tmp);
+		return -1;
+	}
+	return 0;
+}
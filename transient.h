@@ -0,0 +1,94 @@
+/**
+
+	Transient classifier for Music Bottles
+
+	Caps of similar weight cannot be told apart by the step alone, but the
+	lift itself leaves a signature in the raw conversions: the hand pressing on
+	the cap before it comes off, the spike as the hand lets go, and ringing of
+	the platform at a frequency that depends on where the bottle stands.
+
+	A capture keeps the last TRANSIENT_PRE + TRANSIENT_POST raw conversions.
+	When the step detector fires it marks the change point, and once
+	TRANSIENT_POST conversions have followed it yields a feature vector:
+
+	  step     post level minus pre level (medians of the window ends)
+	  press    largest excursion above both levels
+	  release  largest excursion below both levels
+	  ring     dominant frequency of the residual after the step, cycles per sample
+	  energy   RMS of that residual
+
+	The classifier is Gaussian naive Bayes with one class per bottle and
+	direction (lift or return), trained offline from labelled traces
+	(detectBench train) and stored as text. The window is sized for the
+	HX711's 80 SPS mode, where it spans 0.4 s before the step and 0.3 s after.
+
+*/
+
+#ifndef TRANSIENT_H
+#define TRANSIENT_H
+
+#include <stdint.h>
+
+#define TRANSIENT_PRE   32  // conversions kept before the change point, longer than a hand press
+#define TRANSIENT_POST  24  // conversions needed after it
+#define TRANSIENT_LEN   (TRANSIENT_PRE + TRANSIENT_POST)
+#define TRANSIENT_ENDS  6   // conversions at either end whose median is the level
+#define TRANSIENT_SKIP  2   // conversions after the change point left out of the ringing
+
+#define TRANSIENT_FEATURES 5
+#define TRANSIENT_STEP     0
+#define TRANSIENT_PRESS    1
+#define TRANSIENT_RELEASE  2
+#define TRANSIENT_RING     3
+#define TRANSIENT_ENERGY   4
+
+#define TRANSIENT_LIFT   0  // step < 0, something came off
+#define TRANSIENT_RETURN 1
+
+#define TRANSIENT_MAX_CLASSES 16  // 8 bottles, two directions
+
+// A class's standard deviation is at least this fraction of its mean, so two
+// training steps that happen to agree do not make a feature infinitely sharp
+#define TRANSIENT_MIN_SD_FRACTION 0.05
+#define TRANSIENT_MIN_SD          1e-3
+
+#define TRANSIENT_CONFIDENCE 0.9  // posterior needed to act on a classification
+
+#define TRANSIENT_MODEL_PATH    "transient.model"
+#define TRANSIENT_MODEL_VERSION 1
+
+typedef struct {
+	long buf[TRANSIENT_LEN];  // ring of raw conversions
+	int  next;                // ring index of the next conversion
+	int  count;               // conversions held, up to TRANSIENT_LEN
+	int  waiting;             // conversions still needed after a trigger, -1 when idle
+} TransientCapture;
+
+typedef struct {
+	int    bottle;     // 0-based
+	int    direction;  // TRANSIENT_LIFT or TRANSIENT_RETURN
+	int    count;      // training steps
+	double mean[TRANSIENT_FEATURES];
+	double m2[TRANSIENT_FEATURES];  // sum of squared deviations while training
+	double var[TRANSIENT_FEATURES];
+} TransientClass;
+
+typedef struct {
+	int            count;
+	TransientClass classes[TRANSIENT_MAX_CLASSES];
+} TransientModel;
+
+void   transientInit(TransientCapture *c);
+void   transientTrigger(TransientCapture *c, int latency);
+int    transientPush(TransientCapture *c, long x);
+void   transientExtract(const long *window, double *features);
+void   transientFeatures(const TransientCapture *c, double *features);
+
+void   transientModelInit(TransientModel *m);
+int    transientTrainAdd(TransientModel *m, int bottle, int direction, const double *features);
+void   transientTrainFinish(TransientModel *m);
+int    transientClassify(const TransientModel *m, const double *features, unsigned allowed, double *posterior);
+int    transientLoad(const char *path, TransientModel *m);
+int    transientSave(const char *path, const TransientModel *m);
+
+#endif
@@ -0,0 +1,164 @@
+#include "vibration.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+
+	Vibration and impact rejection for Music Bottles
+
+	Everything per conversion is integer arithmetic: the biquads, the
+	residual, the lobe bookkeeping and the running scale (kept in 1/16
+	counts so the exponential average does not stall on small residuals).
+
+	A lobe is judged once it has peaked, not when it ends: the residual of a
+	lift jumps to the full step within a conversion or two and then decays,
+	so a hand press of a fifth of the step before it never pairs up with it,
+	while the swings of a knock are within a factor of two of each other.
+
+*/
+
+#define SCALE_ONE 16  // scale fixed point, 1 count
+
+/**
+ vibrationInit(Vibration *v, const char *spec)
+
+ parse a filter bank spec (see vibration.h), returns -1 if it is malformed or has more than
+ BIQUAD_MAX_SECTIONS sections
+*/
+int vibrationInit(Vibration *v, const char *spec) {
+	char buf[256];
+	char *opt, *save;
+
+	memset(v, 0, sizeof(*v));
+	cascadeInit(&v->bank);
+	v->scale = VIBRATION_MIN_THRESHOLD * SCALE_ONE / VIBRATION_K;
+	if (spec == NULL || strcmp(spec, "none") == 0) return 0;
+
+	snprintf(buf, sizeof(buf), "%s", spec);
+	for (opt = strtok_r(buf, ",", &save); opt; opt = strtok_r(NULL, ",", &save)) {
+		VibrationSection *s = &v->spec[v->sections];
+		char *value = strchr(opt, '='), *end;
+
+		if (value == NULL || v->sections == BIQUAD_MAX_SECTIONS) return -1;
+		*value++ = 0;
+
+		if (strcmp(opt, "lowpass") == 0) {
+			s->type = VIBRATION_LOWPASS;
+			s->q = BIQUAD_BUTTERWORTH_Q;
+		} else if (strcmp(opt, "notch") == 0) {
+			s->type = VIBRATION_NOTCH;
+			s->q = 2;
+		} else {
+			return -1;
+		}
+
+		s->hz = strtod(value, &end);
+		if (*end == '/') s->q = strtod(end + 1, &end);
+		if (*end || s->hz <= 0 || s->q <= 0) return -1;
+		v->sections++;
+	}
+	return 0;
+}
+
+// Restart the filters at the next conversion, after a gap in the data
+void vibrationReset(Vibration *v) {
+	v->primed = 0;
+	v->lobe = 0;
+	v->lastLobe = 0;
+	v->disturbed = 0;
+}
+
+// Jump the filter bank to a new level (a detected step) instead of letting it ramp through the states in between
+void vibrationSettle(Vibration *v, long level) {
+	if (v->primed) cascadeReset(&v->bank, (int32_t) level);
+}
+
+// Design every section that fits under the Nyquist frequency of the measured rate
+static void designBank(Vibration *v) {
+	int i;
+
+	for (i = 0; i < v->sections; i++) {
+		const VibrationSection *s = &v->spec[i];
+		Biquad q;
+		int result = (s->type == VIBRATION_LOWPASS) ? biquadLowPass(&q, v->rate, s->hz, s->q)
+		                                            : biquadNotch(&q, v->rate, s->hz, s->q);
+		if (result < 0) {
+			printf("Warning: %s at %.1f Hz is above the Nyquist frequency at %.1f SPS, left out\n",
+			       (s->type == VIBRATION_LOWPASS) ? "lowpass" : "notch", s->hz, v->rate);
+			continue;
+		}
+		cascadeAdd(&v->bank, &q);
+	}
+	biquadLowPass(&v->level, v->rate, VIBRATION_LEVEL_HZ, BIQUAD_BUTTERWORTH_Q);
+}
+
+// Current impact threshold in counts
+int32_t vibrationThreshold(const Vibration *v) {
+	int32_t threshold = VIBRATION_K * v->scale / SCALE_ONE;
+	return (threshold > VIBRATION_MIN_THRESHOLD) ? threshold : VIBRATION_MIN_THRESHOLD;
+}
+
+// Track lobes of the residual and flag an impact on two opposite lobes of similar size
+static void detectImpact(Vibration *v, int32_t residual, uint32_t tick) {
+	int32_t size = abs(residual);
+	int32_t threshold = vibrationThreshold(v);
+	int sign = (residual > threshold) - (residual < -threshold);
+
+	if (sign != v->lobe) {
+		if (v->lobe != 0) {
+			v->lastLobe = v->lobe;
+			v->lastPeak = v->peak;
+			v->lastLobeEnd = tick;
+		}
+		v->lobe = sign;
+		v->peak = 0;
+	}
+
+	if (sign != 0) {
+		v->lastLoud = tick;
+		if (size > v->peak) {
+			v->peak = size;
+		} else if (!v->disturbed && v->lastLobe == -sign && tick - v->lastLobeEnd <= VIBRATION_PAIR_US) {
+			int32_t small = (v->peak < v->lastPeak) ? v->peak : v->lastPeak;
+			int32_t large = (v->peak < v->lastPeak) ? v->lastPeak : v->peak;
+			if (small >= VIBRATION_LOBE_RATIO * large) {
+				v->disturbed = 1;
+				v->impacts++;
+			}
+		}
+	} else if (!v->disturbed) {
+		v->scale += (size * SCALE_ONE - v->scale) >> VIBRATION_SCALE_SHIFT;
+	}
+
+	if (v->disturbed && tick - v->lastLoud > VIBRATION_QUIET_US) v->disturbed = 0;
+}
+
+/**
+ vibrationPush(Vibration *v, long x, uint32_t tick)
+
+ one raw conversion, returns it through the filter bank. v->disturbed tells whether it is
+ part of an impact
+*/
+long vibrationPush(Vibration *v, long x, uint32_t tick) {
+	if (v->rate == 0) {
+		if (v->timed++ == 0) v->firstTick = tick;
+		if (v->timed < VIBRATION_RATE_SAMPLES) return x;
+		if (tick == v->firstTick) {
+			v->timed = 0;
+			return x;
+		}
+		v->rate = (VIBRATION_RATE_SAMPLES - 1) * 1000000.0 / (uint32_t) (tick - v->firstTick);
+		designBank(v);
+	}
+
+	if (!v->primed) {
+		cascadeReset(&v->bank, (int32_t) x);
+		biquadReset(&v->level, (int32_t) x);
+		v->lastLoud = tick;
+		v->primed = 1;
+	}
+
+	detectImpact(v, (int32_t) x - biquadPush(&v->level, (int32_t) x), tick);
+	return cascadePush(&v->bank, (int32_t) x);
+}
@@ -0,0 +1,87 @@
+/**
+
+	Vibration and impact rejection for Music Bottles
+
+	Two stages between the raw conversions and the matcher:
+
+	  filter bank   a configurable cascade of fixed-point biquads (biquad.h)
+	                that takes platform ringing and hum out of the weight:
+	                  lowpass=HZ[/Q],notch=HZ[/Q],...   or none
+	  impacts       footsteps and bumps on the table shake the platform for a
+	                few hundred milliseconds without changing the weight. The
+	                raw conversions minus a VIBRATION_LEVEL_HZ low-pass leave
+	                the fast part of the signal; a lift shows there as one
+	                lobe that decays as the level catches up, an impact as
+	                lobes of alternating sign and similar size. The second such
+	                lobe marks the conversions as disturbed until the residual
+	                has stayed inside the threshold for VIBRATION_QUIET_US.
+
+	The threshold is VIBRATION_K times the mean absolute residual at rest,
+	learned as it runs, and at least VIBRATION_MIN_THRESHOLD counts.
+
+	The stages run on raw counts, before the tare, so a re-tare does not
+	disturb them. Cut-offs are in Hz, so the sections are designed once the
+	conversion rate is known: the first VIBRATION_RATE_SAMPLES conversions
+	pass through unfiltered while their ticks are timed. Sections at or above
+	the Nyquist frequency of the measured rate are left out, with a warning.
+
+*/
+
+#ifndef VIBRATION_H
+#define VIBRATION_H
+
+#include <stdint.h>
+#include "biquad.h"
+
+#define VIBRATION_DEFAULT "lowpass=8"
+
+#define VIBRATION_RATE_SAMPLES 16
+
+#define VIBRATION_LEVEL_HZ       1.0     // low-pass the impact residual is taken against
+#define VIBRATION_K              6       // threshold in mean absolute residuals at rest
+#define VIBRATION_MIN_THRESHOLD  1000    // counts, half the default detection margin
+#define VIBRATION_LOBE_RATIO     0.5     // the smaller of two opposite lobes against the larger, for an impact
+#define VIBRATION_PAIR_US        300000  // longest gap between two opposite lobes of one impact
+#define VIBRATION_QUIET_US       250000  // disturbed until the residual has been quiet this long
+#define VIBRATION_SCALE_SHIFT    6       // residual scale follows |residual| at rest with weight 1/64
+
+#define VIBRATION_LOWPASS 0
+#define VIBRATION_NOTCH   1
+
+typedef struct {
+	int    type;  // VIBRATION_LOWPASS or VIBRATION_NOTCH
+	double hz;
+	double q;
+} VibrationSection;
+
+typedef struct {
+	// Configuration, designed into the filters once the rate is known
+	int              sections;
+	VibrationSection spec[BIQUAD_MAX_SECTIONS];
+	double           rate;       // conversions per second, 0 until measured
+	int              timed;      // conversions timed so far
+	int              primed;     // filters settled at a conversion since the last reset
+	uint32_t         firstTick;
+
+	BiquadCascade    bank;
+	Biquad           level;      // slow level the impact residual is taken against
+
+	// Impact detector
+	int32_t  scale;        // mean |residual| at rest, counts << 4
+	int      lobe;         // sign of the lobe in progress, 0 inside the threshold
+	int32_t  peak;         // its largest |residual|
+	int      lastLobe;     // sign of the previous lobe
+	int32_t  lastPeak;
+	uint32_t lastLobeEnd;  // tick
+	uint32_t lastLoud;     // tick of the latest conversion outside the threshold
+	int      disturbed;
+	unsigned long impacts;
+} Vibration;
+
+int     vibrationInit(Vibration *v, const char *spec);
+void    vibrationReset(Vibration *v);
+void    vibrationSettle(Vibration *v, long level);
+long    vibrationPush(Vibration *v, long x, uint32_t tick);
+int32_t vibrationThreshold(const Vibration *v);
+
+#endif
@@ -0,0 +1,182 @@
+#include "wav.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+
+	WAV loading for Music Bottles
+
+	The file is read (or mapped, see stream.h), then its chunks are walked:
+	"fmt " must describe 16-bit PCM (plain or WAVE_FORMAT_EXTENSIBLE), "data"
+	holds the samples, and anything else is skipped. Fields are little-endian
+	whatever the host.
+
+*/
+
+#define WAVE_FORMAT_PCM        1
+#define WAVE_FORMAT_EXTENSIBLE 0xFFFE
+
+static __thread char message[160];  // per thread, the asset cache is rebuilt in the background
+
+// Record why loading failed for wavError(), returns -1
+int wavFail(const char *format, ...) {
+	va_list args;
+	va_start(args, format);
+	vsnprintf(message, sizeof(message), format, args);
+	va_end(args);
+	return -1;
+}
+
+// Why the last wavLoad() failed
+const char *wavError(void) {
+	return message;
+}
+
+static uint32_t le16(const uint8_t *p) {
+	return p[0] | (p[1] << 8);
+}
+
+static uint32_t le32(const uint8_t *p) {
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+// Frame i of the source, channel c, as stereo
+static int32_t sampleAt(const uint8_t *data, int channels, uint32_t i, int c) {
+	return (int16_t) le16(data + 2 * ((size_t) i * channels + (channels == 2 ? c : 0)));
+}
+
+/**
+ wavParse(const char *path, const uint8_t *file, size_t size, WavInfo *info)
+
+ find the format and the samples of a WAV file in memory. Returns -1 unless it is 16-bit mono or
+ stereo PCM, wavError() says why
+*/
+int wavParse(const char *path, const uint8_t *file, size_t size, WavInfo *info) {
+	const uint8_t *p, *end = file + size, *data = NULL;
+	uint32_t dataSize = 0;
+	int format = 0;
+
+	memset(info, 0, sizeof(*info));
+	if (size < 12 || memcmp(file, "RIFF", 4) != 0 || memcmp(file + 8, "WAVE", 4) != 0) {
+		return wavFail("%s is not a WAV file", path);
+	}
+
+	// Chunks are padded to an even size
+	for (p = file + 12; p + 8 <= end; p += 8 + ((le32(p + 4) + 1) & ~1u)) {
+		uint32_t length = le32(p + 4);
+		if (length > (uint32_t) (end - p - 8)) length = end - p - 8;
+
+		if (memcmp(p, "fmt ", 4) == 0 && length >= 16) {
+			format = le16(p + 8);
+			info->channels = le16(p + 10);
+			info->rate = le32(p + 12);
+			info->bits = le16(p + 22);
+		} else if (memcmp(p, "data", 4) == 0) {
+			data = p + 8;
+			dataSize = length;
+		} else if (memcmp(p, "smpl", 4) == 0 && length >= 60 && le32(p + 8 + 28) > 0) {
+			// The first sample loop, its end frame inclusive
+			info->loopStart = le32(p + 8 + 36 + 8);
+			info->loopEnd = le32(p + 8 + 36 + 12) + 1;
+		}
+		if ((size_t) (end - p) < 8 + ((le32(p + 4) + 1) & ~1u)) break;
+	}
+
+	if ((format != WAVE_FORMAT_PCM && format != WAVE_FORMAT_EXTENSIBLE) || info->bits != 16 ||
+	    info->channels < 1 || info->channels > 2 || info->rate <= 0) {
+		return wavFail("%s is not 16-bit mono or stereo PCM", path);
+	}
+	if (data == NULL) return wavFail("%s has no data", path);
+
+	info->offset = (uint32_t) (data - file);
+	info->frames = dataSize / (2 * info->channels);
+	if (info->loopEnd > info->frames || info->loopStart >= info->loopEnd) {
+		info->loopStart = 0;
+		info->loopEnd = 0;
+	}
+	return 0;
+}
+
+/**
+ wavDecode(const char *path, const uint8_t *file, size_t size, int rate, Pcm *pcm)
+
+ decode a 16-bit PCM WAV file in memory to interleaved stereo at rate, ending at its loop end if it
+ has one. Returns -1 on error, wavError() says why
+*/
+int wavDecode(const char *path, const uint8_t *file, size_t size, int rate, Pcm *pcm) {
+	const uint8_t *data;
+	WavInfo info;
+	uint32_t i, inFrames;
+
+	memset(pcm, 0, sizeof(*pcm));
+	if (wavParse(path, file, size, &info) < 0) return -1;
+	data = file + info.offset;
+	inFrames = info.loopEnd ? info.loopEnd : info.frames;
+
+	pcm->rate = rate;
+	pcm->frames = (uint32_t) ((uint64_t) inFrames * rate / info.rate);
+	pcm->loopStart = (uint32_t) ((uint64_t) info.loopStart * rate / info.rate);
+	if (pcm->loopStart >= pcm->frames) pcm->loopStart = 0;  // a loop shorter than an output frame is dropped
+	pcm->data = malloc((size_t) pcm->frames * 2 * sizeof(int16_t) + 1);
+	if (pcm->data == NULL) return wavFail("out of memory for %s", path);
+
+	// Source position of every output frame in 1/65536 frames, interpolated between neighbours
+	for (i = 0; i < pcm->frames; i++) {
+		uint64_t position = ((uint64_t) i * info.rate << 16) / rate;
+		uint32_t at = (uint32_t) (position >> 16), next = (at + 1 < info.frames) ? at + 1 : at;
+		int32_t frac = (int32_t) (position & 0xffff);
+
+		for (int c = 0; c < 2; c++) {
+			int32_t a = sampleAt(data, info.channels, at, c), b = sampleAt(data, info.channels, next, c);
+			pcm->data[2 * i + c] = (int16_t) (a + (((int64_t) (b - a) * frac) >> 16));
+		}
+	}
+	return 0;
+}
+
+// Read a whole file into memory, NULL on error
+uint8_t *wavRead(const char *path, size_t *size) {
+	FILE *f = fopen(path, "rb");
+	uint8_t *file;
+	long length;
+
+	if (f == NULL) {
+		wavFail("cannot open %s", path);
+		return NULL;
+	}
+	fseek(f, 0, SEEK_END);
+	length = ftell(f);
+	rewind(f);
+	file = malloc(length > 0 ? length : 1);
+	if (file == NULL || length < 0 || fread(file, 1, length, f) != (size_t) length) {
+		fclose(f);
+		free(file);
+		wavFail("cannot read %s", path);
+		return NULL;
+	}
+	fclose(f);
+	*size = (size_t) length;
+	return file;
+}
+
+// Read and decode a WAV file, see wavDecode()
+int wavLoad(const char *path, int rate, Pcm *pcm) {
+	size_t size;
+	uint8_t *file = wavRead(path, &size);
+	int result;
+
+	memset(pcm, 0, sizeof(*pcm));
+	if (file == NULL) return -1;
+	result = wavDecode(path, file, size, rate, pcm);
+	free(file);
+	return result;
+}
+
+// Free what wavLoad() decoded, samples mapped from a file (see stream.h) are left alone
+void wavFree(Pcm *pcm) {
+	if (!pcm->mapped) free(pcm->data);
+	pcm->data = NULL;
+	pcm->frames = 0;
+}
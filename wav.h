@@ -0,0 +1,45 @@
+/**
+
+	WAV loading for Music Bottles
+
+	Files already in the output format are played from their mapping (see
+	stream.h). Anything else the ALSA output plays is decoded here once:
+	16-bit PCM, mono or stereo, at any rate, converted to interleaved stereo
+	at the output rate. The rate conversion is linear interpolation, done at
+	load time, never per period.
+
+	A loop in a smpl chunk (the first one) is kept: the sound ends at the
+	loop end and a looped sound plays on from the loop start.
+
+*/
+
+#ifndef WAV_H
+#define WAV_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+	int16_t *data;    // interleaved stereo
+	uint32_t frames;
+	int      rate;
+	uint32_t loopStart;  // a looped sound plays on from here after its last frame
+	int      mapped;     // data points into a mapped file rather than memory of its own
+} Pcm;
+
+typedef struct {
+	int      channels, rate, bits;
+	uint32_t offset;  // of the first sample from the start of the file
+	uint32_t frames;
+	uint32_t loopStart, loopEnd;  // from a smpl chunk, loopEnd exclusive, both 0 for none
+} WavInfo;
+
+int         wavParse(const char *path, const uint8_t *file, size_t size, WavInfo *info);
+int         wavDecode(const char *path, const uint8_t *file, size_t size, int rate, Pcm *pcm);
+uint8_t    *wavRead(const char *path, size_t *size);
+int         wavLoad(const char *path, int rate, Pcm *pcm);
+void        wavFree(Pcm *pcm);
+const char *wavError(void);
+int         wavFail(const char *format, ...);
+
+#endif